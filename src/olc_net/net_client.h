@@ -56,6 +56,7 @@
 
 #pragma once
 #include "net_common.h"
+#include "net_transport.h"
 
 namespace olc
 {
@@ -75,17 +76,17 @@ namespace olc
 			}
 
 		public:
-			// Connect to server with hostname/ip-address and port
+			// Connect to server with hostname/ip-address and port, or with
+			// "unix:/path" to a server on this host listening on that Unix socket
 			bool Connect(const std::string& host, const uint16_t port)
 			{
 				try
 				{
 					// Resolve hostname/ip-address into tangiable physical address
-					boost::asio::ip::tcp::resolver resolver(m_context);
-					boost::asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(host, std::to_string(port));
+					std::vector<stream_protocol::endpoint> endpoints = ResolveEndpoints(m_context, host, port);
 
 					// Create connection
-					m_connection = std::make_unique<connection<T>>(connection<T>::owner::client, m_context, boost::asio::ip::tcp::socket(m_context), m_qMessagesIn);
+					m_connection = std::make_unique<connection<T>>(connection<T>::owner::client, m_context, stream_protocol::socket(m_context), m_qMessagesIn);
 					
 					// Tell the connection object to connect to server
 					m_connection->ConnectToServer(endpoints);
@@ -138,6 +139,20 @@ namespace olc
 					 m_connection->Send(msg);
 			}
 
+			// Send a message the caller is done with to server, without copying it
+			void Send(message<T>&& msg)
+			{
+				if (IsConnected())
+					 m_connection->Send(std::move(msg));
+			}
+
+			// Send a shared message to server, without copying it
+			void Send(shared_message<T> msg)
+			{
+				if (IsConnected())
+					 m_connection->Send(std::move(msg));
+			}
+
 			// Retrieve queue of messages from server
 			tsqueue<owned_message<T>>& Incoming()
 			{ 
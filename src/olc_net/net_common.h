@@ -56,6 +56,7 @@
 
 #pragma once
 
+#include <any>
 #include <memory>
 #include <thread>
 #include <mutex>
@@ -59,6 +59,8 @@
 #include "net_common.h"
 #include "net_tsqueue.h"
 #include "net_message.h"
+#include "net_trace.h"
+#include "net_transport.h"
 
 
 namespace olc
@@ -80,7 +82,7 @@ namespace olc
 		public:
 			// Constructor: Specify Owner, connect to context, transfer the socket
 			//				Provide reference to incoming message queue
-			connection(owner parent, boost::asio::io_context& asioContext, boost::asio::ip::tcp::socket socket, tsqueue<owned_message<T>>& qIn)
+			connection(owner parent, boost::asio::io_context& asioContext, stream_protocol::socket socket, tsqueue<owned_message<T>>& qIn)
 				: m_asioContext(asioContext), m_socket(std::move(socket)), m_qMessagesIn(qIn)
 			{
 				m_nOwnerType = parent;
@@ -96,6 +98,23 @@ namespace olc
 				return id;
 			}
 
+			// A slot for whatever the owning server or client keeps about this
+			// connection, such as which party it is. The connection never looks at
+			// it, and it is only for the thread that handles the messages (the one
+			// calling Update()).
+			template<typename U>
+			void SetUserData(U data)
+			{
+				m_userData = std::move(data);
+			}
+
+			// The user data, or nullptr if none of type U has been set
+			template<typename U>
+			U* GetUserData()
+			{
+				return std::any_cast<U>(&m_userData);
+			}
+
 		public:
 			void ConnectToClient(uint32_t uid = 0)
 			{
@@ -109,14 +128,14 @@ namespace olc
 				}
 			}
 
-			void ConnectToServer(const boost::asio::ip::tcp::resolver::results_type& endpoints)
+			void ConnectToServer(const std::vector<stream_protocol::endpoint>& endpoints)
 			{
 				// Only clients can connect to servers
 				if (m_nOwnerType == owner::client)
 				{
 					// Request asio attempts to connect to an endpoint
 					boost::asio::async_connect(m_socket, endpoints,
-						[this](std::error_code ec, boost::asio::ip::tcp::endpoint endpoint)
+						[this](std::error_code ec, const stream_protocol::endpoint& endpoint)
 						{
 							if (!ec)
 							{
@@ -146,11 +165,49 @@ namespace olc
 
 		public:
 			// ASYNC - Send a message, connections are one-to-one so no need to specifiy
-			// the target, for a client, the target is the server and vice versa
+			// the target, for a client, the target is the server and vice versa.
+			// The message is copied once, pass it with std::move to avoid even that.
 			void Send(const message<T>& msg)
+			{
+				Send(std::make_shared<const message<T>>(msg));
+			}
+
+			// ASYNC - Send a message the caller is done with, its body is moved
+			void Send(message<T>&& msg)
+			{
+				Send(std::make_shared<const message<T>>(std::move(msg)));
+			}
+
+			// ASYNC - Send a message that may be shared with other connections, it
+			// is not copied, the body is written straight from it
+			void Send(shared_message<T> msg)
+			{
+				// Only the header is per connection
+				outgoing out{ msg->header, std::move(msg) };
+
+				// Stamp the trace context here, on the sending thread, so the
+				// message is parented to the span that is sending it
+				if (tracer::Get().IsEnabled())
+					tracer::Get().StampSend(out.header);
+
+				Post(std::move(out));
+			}
+
+
+
+		private:
+			// A message on its way out: its own header, and the body it shares
+			struct outgoing
+			{
+				message_header<T> header;
+				shared_message<T> msg;
+			};
+
+			// ASYNC - Queue a message on the asio thread
+			void Post(outgoing&& out)
 			{
 				boost::asio::post(m_asioContext,
-					[this, msg]()
+					[this, out = std::move(out)]() mutable
 					{
 						// If the queue has a message in it, then we must 
 						// assume that it is in the process of asynchronously being written.
@@ -158,7 +215,7 @@ namespace olc
 						// were available to be written, then start the process of writing the
 						// message at the front of the queue.
 						bool bWritingMessage = !m_qMessagesOut.empty();
-						m_qMessagesOut.push_back(msg);
+						m_qMessagesOut.push_back(std::move(out));
 						if (!bWritingMessage)
 						{
 							WriteHeader();
@@ -166,16 +223,20 @@ namespace olc
 					});
 			}
 
-
-
-		private:
 			// ASYNC - Prime context to write a message header
 			void WriteHeader()
 			{
+				// The header goes out from its own buffer so it can be stamped with
+				// the time the message actually hits the wire. The receiver uses this
+				// to separate queueing from transfer time.
+				m_headerOut = m_qMessagesOut.front().header;
+				if (m_headerOut.span_id != 0)
+					m_headerOut.send_ts = tracer::NowMicros();
+
 				// If this function is called, we know the outgoing message queue must have 
 				// at least one message to send. So allocate a transmission buffer to hold
 				// the message, and issue the work - asio, send these bytes
-				boost::asio::async_write(m_socket, boost::asio::buffer(&m_qMessagesOut.front().header, sizeof(message_header<T>)),
+				boost::asio::async_write(m_socket, boost::asio::buffer(&m_headerOut, sizeof(message_header<T>)),
 					[this](std::error_code ec, std::size_t length)
 					{
 						// asio has now sent the bytes - if there was a problem
@@ -184,7 +245,7 @@ namespace olc
 						{
 							// ... no error, so check if the message header just sent also
 							// has a message body...
-							if (m_qMessagesOut.front().body.size() > 0)
+							if (m_qMessagesOut.front().msg->body.size() > 0)
 							{
 								// ...it does, so issue the task to write the body bytes
 								WriteBody();
@@ -221,7 +282,8 @@ namespace olc
 				// If this function is called, a header has just been sent, and that header
 				// indicated a body existed for this message. Fill a transmission buffer
 				// with the body data, and send it!
-				boost::asio::async_write(m_socket, boost::asio::buffer(m_qMessagesOut.front().body.data(), m_qMessagesOut.front().body.size()),
+				const std::vector<uint8_t>& body = m_qMessagesOut.front().msg->body;
+				boost::asio::async_write(m_socket, boost::asio::buffer(body.data(), body.size()),
 					[this](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
@@ -312,12 +374,17 @@ namespace olc
 			// Once a full message is received, add it to the incoming queue
 			void AddToIncomingMessageQueue()
 			{				
+				if (tracer::Get().IsEnabled())
+					tracer::Get().RecordReceive(m_msgTemporaryIn.header);
+
 				// Shove it in queue, converting it to an "owned message", by initialising
-				// with the a shared pointer from this connection object
+				// with the a shared pointer from this connection object. The body is
+				// moved, ReadHeader() starts the next message afresh.
 				if(m_nOwnerType == owner::server)
-					m_qMessagesIn.push_back({ this->shared_from_this(), m_msgTemporaryIn });
+					m_qMessagesIn.push_back({ this->shared_from_this(), std::move(m_msgTemporaryIn) });
 				else
-					m_qMessagesIn.push_back({ nullptr, m_msgTemporaryIn });
+					m_qMessagesIn.push_back({ nullptr, std::move(m_msgTemporaryIn) });
+				m_msgTemporaryIn.body.clear();
 
 				// We must now prime the asio context to receive the next message. It 
 				// wil just sit and wait for bytes to arrive, and the message construction
@@ -329,16 +396,20 @@ namespace olc
 			// This context is shared with the whole asio instance
 			boost::asio::io_context& m_asioContext;
 
-			// Each connection has a unique socket to a remote 
-			boost::asio::ip::tcp::socket m_socket;
+			// Each connection has a unique socket to a remote, TCP or Unix
+			// (see net_transport.h)
+			stream_protocol::socket m_socket;
 
 			// This queue holds all messages to be sent to the remote side
 			// of this connection
-			tsqueue<message<T>> m_qMessagesOut;
+			tsqueue<outgoing> m_qMessagesOut;
 
 			// This references the incoming queue of the parent object
 			tsqueue<owned_message<T>>& m_qMessagesIn;
 
+			// Header of the message currently being written
+			message_header<T> m_headerOut;
+
 			// Incoming messages are constructed asynchronously, so we will
 			// store the part assembled message here, until it is ready
 			message<T> m_msgTemporaryIn;
@@ -348,6 +419,9 @@ namespace olc
 
 			uint32_t id = 0;
 
+			// See SetUserData()
+			std::any m_userData;
+
 		};
 	}
 }
@@ -71,6 +71,13 @@ namespace olc
 			T id{};
 			unsigned int SubType_ID = 0; //sequence number of the ciphertext for exchanging multiple ciphertexts
 			uint32_t size = 0;
+
+			// Trace context (see net_trace.h), all zero when tracing is off.
+			// trace_id identifies the whole multi-party run, span_id this message
+			// and send_ts is the sender's wall clock (usec) when it hit the wire.
+			uint64_t trace_id = 0;
+			uint64_t span_id = 0;
+			uint64_t send_ts = 0;
 		};
 
 		// Message Body contains a header and a std::vector, containing raw bytes
@@ -171,6 +178,12 @@ namespace olc
 
 		};
 
+		// A message that can no longer change, shared by everything sending it.
+		// A broadcast makes one of these and every connection sends from it, so
+		// the body is allocated once whatever the number of clients.
+		template <typename T>
+		using shared_message = std::shared_ptr<const message<T>>;
+
 
 		// An "owned" message is identical to a regular message, but it is associated with
 		// a connection. On a server, the owner would be the client that sent the message, 
@@ -60,6 +60,9 @@
 #include "net_tsqueue.h"
 #include "net_message.h"
 #include "net_connection.h"
+#include "net_transport.h"
+
+#include <unordered_map>
 
 namespace olc
 {
@@ -71,15 +74,28 @@ namespace olc
 		public:
 			// Create a server, ready to listen on specified port
 			server_interface(uint16_t port)
-				: m_asioAcceptor(m_asioContext, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port))
+				: server_interface("", port)
 			{
 
 			}
 
+			// Create a server, ready to listen on a Unix socket if address is
+			// "unix:/path", otherwise on the specified port (see net_transport.h)
+			server_interface(const std::string& address, uint16_t port = 0)
+				: m_asioAcceptor(m_asioContext, ListenEndpoint(address, port))
+			{
+				if (IsUnixAddress(address))
+					m_sUnixPath = UnixPath(address);
+			}
+
 			virtual ~server_interface()
 			{
 				// May as well try and tidy up
 				Stop();
+
+				// A Unix socket leaves its file behind
+				if (!m_sUnixPath.empty())
+					std::remove(m_sUnixPath.c_str());
 			}
 
 			// Starts the server!
@@ -128,13 +144,13 @@ namespace olc
 				// is the purpose of an "acceptor" object. It will provide a unique socket
 				// for each incoming connection attempt
 				m_asioAcceptor.async_accept(
-					[this](std::error_code ec, boost::asio::ip::tcp::socket socket)
+					[this](std::error_code ec, stream_protocol::socket socket)
 					{
 						// Triggered by incoming connection request
 						if (!ec)
 						{
 							// Display some useful(?) information
-							std::cout << "[SERVER]: New Connection: " << socket.remote_endpoint() << "\n";
+							std::cout << "[SERVER]: New Connection: " << DescribeEndpoint(socket.remote_endpoint()) << "\n";
 
 							// Create a new connection to handle this client 
 							std::shared_ptr<connection<T>> newconn = 
@@ -146,14 +162,18 @@ namespace olc
 							// Give the user server a chance to deny connection
 							if (OnClientConnect(newconn))
 							{								
-								// Connection allowed, so add to container of new connections
-								m_deqConnections.push_back(std::move(newconn));
+								// Connection allowed, so add to the registry of connections
+								uint32_t nID = nIDCounter++;
+								{
+									std::scoped_lock lock(m_muxConnections);
+									m_mapConnections.emplace(nID, newconn);
+								}
 
 								// And very important! Issue a task to the connection's
 								// asio context to sit and wait for bytes to arrive!
-								m_deqConnections.back()->ConnectToClient(nIDCounter++);
+								newconn->ConnectToClient(nID);
 
-								std::cout << "[" << m_deqConnections.back()->GetID() << "]: Connection Approved\n";
+								std::cout << "[" << nID << "]: Connection Approved\n";
 							}
 							else
 							{
@@ -177,6 +197,19 @@ namespace olc
 
 			// Send a message to a specific client
 			void MessageClient(std::shared_ptr<connection<T>> client, const message<T>& msg)
+			{
+				MessageClient(client, std::make_shared<const message<T>>(msg));
+			}
+
+			// Send a message the caller is done with to a specific client, without
+			// copying it
+			void MessageClient(std::shared_ptr<connection<T>> client, message<T>&& msg)
+			{
+				MessageClient(client, std::make_shared<const message<T>>(std::move(msg)));
+			}
+
+			// Send a shared message to a specific client
+			void MessageClient(std::shared_ptr<connection<T>> client, shared_message<T> msg)
 			{
 				// Check client is legitimate...
 				if (client && client->IsConnected())
@@ -189,27 +222,39 @@ namespace olc
 					// If we cant communicate with client then we may as 
 					// well remove the client - let the server know, it may
 					// be tracking it somehow
-					OnClientDisconnect(client);
-
-					// Off you go now, bye bye!
-					client.reset();
+					if (client)
+					{
+						OnClientDisconnect(client);
 
-					// Then physically remove it from the container
-					m_deqConnections.erase(
-						std::remove(m_deqConnections.begin(), m_deqConnections.end(), client), m_deqConnections.end());
+						// Off you go now, bye bye!
+						RemoveClient(client->GetID());
+					}
 				}
 			}
 			
-			// Send message to all clients
+			// Send message to all clients. The message is copied once into a
+			// shared_message that every client sends from, whatever their number.
 			void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
 			{
-				bool bInvalidClientExists = false;
+				MessageAllClients(std::make_shared<const message<T>>(msg), pIgnoreClient);
+			}
 
-				// Iterate through all clients in container
-				for (auto& client : m_deqConnections)
+			// Send a message the caller is done with to all clients, without copying
+			// it at all
+			void MessageAllClients(message<T>&& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
+			{
+				MessageAllClients(std::make_shared<const message<T>>(std::move(msg)), pIgnoreClient);
+			}
+
+			// Send a shared message to all clients
+			void MessageAllClients(shared_message<T> msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
+			{
+				// Iterate through a snapshot of the clients, so connections that arrive
+				// or are removed meanwhile do not disturb the loop
+				for (auto& client : Clients())
 				{
 					// Check client is connected...
-					if (client && client->IsConnected())
+					if (client->IsConnected())
 					{
 						// ..it is!
 						if(client != pIgnoreClient)
@@ -220,18 +265,44 @@ namespace olc
 						// The client couldnt be contacted, so assume it has
 						// disconnected.
 						OnClientDisconnect(client);
-						client.reset();
-
-						// Set this flag to then remove dead clients from container
-						bInvalidClientExists = true;
+						RemoveClient(client->GetID());
 					}
 				}
+			}
+
+			// The connection with ID nID, or nullptr if there is none
+			std::shared_ptr<connection<T>> FindClient(uint32_t nID)
+			{
+				std::scoped_lock lock(m_muxConnections);
+				auto it = m_mapConnections.find(nID);
+				return it == m_mapConnections.end() ? nullptr : it->second;
+			}
 
-				// Remove dead clients, all in one go - this way, we dont invalidate the
-				// container as we iterated through it.
-				if (bInvalidClientExists)
-					m_deqConnections.erase(
-						std::remove(m_deqConnections.begin(), m_deqConnections.end(), nullptr), m_deqConnections.end());
+			// A snapshot of all connections, safe to iterate while clients come
+			// and go
+			std::vector<std::shared_ptr<connection<T>>> Clients()
+			{
+				std::scoped_lock lock(m_muxConnections);
+				std::vector<std::shared_ptr<connection<T>>> clients;
+				clients.reserve(m_mapConnections.size());
+				for (auto& entry : m_mapConnections)
+					clients.push_back(entry.second);
+				return clients;
+			}
+
+			// Number of connections in the registry
+			size_t ClientCount()
+			{
+				std::scoped_lock lock(m_muxConnections);
+				return m_mapConnections.size();
+			}
+
+			// Drop the connection with ID nID from the registry, it is destroyed
+			// once nobody else holds it
+			void RemoveClient(uint32_t nID)
+			{
+				std::scoped_lock lock(m_muxConnections);
+				m_mapConnections.erase(nID);
 			}
 
 			// Force server to respond to incoming messages
@@ -281,15 +352,21 @@ namespace olc
 			// Thread Safe Queue for incoming message packets
 			tsqueue<owned_message<T>> m_qMessagesIn;
 
-			// Container of active validated connections
-			std::deque<std::shared_ptr<connection<T>>> m_deqConnections;
+			// Registry of active validated connections by ID. Connections are added
+			// on the asio thread and looked up and removed on the Update() thread,
+			// so it is guarded by a mutex.
+			std::unordered_map<uint32_t, std::shared_ptr<connection<T>>> m_mapConnections;
+			std::mutex m_muxConnections;
 
 			// Order of declaration is important - it is also the order of initialisation
 			boost::asio::io_context m_asioContext;
 			std::thread m_threadContext;
 
 			// These things need an asio context
-			boost::asio::ip::tcp::acceptor m_asioAcceptor; // Handles new incoming connection attempts...
+			stream_acceptor m_asioAcceptor; // Handles new incoming connection attempts...
+
+			// Path of the socket file when listening on a Unix socket
+			std::string m_sUnixPath;
 
 			// Clients will be identified in the "wider system" via an ID
 			uint32_t nIDCounter = 10000;
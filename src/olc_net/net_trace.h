@@ -0,0 +1,267 @@
+/*
+	Cross-process tracing for olc::net
+
+	Every message carries a trace context in its header (trace ID, span ID and
+	the time it was put on the wire). Each process that opens a tracer appends
+	one JSON object per line to its own trace file:
+
+		span begin / end     ("ev":"B" / "ev":"E")
+		message send         ("ev":"send")   recorded when Send() is called
+		message receive      ("ev":"recv")   recorded when the body has arrived
+
+	The per-process files are stitched together into a single Chrome/Perfetto
+	trace by the trace_merge tool (src/trace_merge), which also aligns the
+	clocks of the parties and reports critical-path and idle time.
+
+	Tracing is off until tracer::Get().Open() is called, in which case the only
+	cost on the message path is a single test of IsEnabled().
+*/
+
+#pragma once
+
+#include "net_common.h"
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+
+namespace olc
+{
+	namespace net
+	{
+		class tracer
+		{
+		public:
+			// One tracer per process, shared by every connection in it
+			static tracer& Get()
+			{
+				static tracer instance;
+				return instance;
+			}
+
+			// Start recording to filename under the given party name. The process
+			// that starts the ceremony (normally the server) passes bRoot = true and
+			// mints the trace ID, everybody else adopts it from the first message
+			// they receive.
+			bool Open(const std::string& party, const std::string& filename, bool bRoot = false)
+			{
+				std::scoped_lock lock(m_muxFile);
+				m_file.open(filename, std::ios::out | std::ios::trunc);
+				if (!m_file.is_open())
+				{
+					std::cerr << "[TRACE] cannot open trace file " << filename << "\n";
+					return false;
+				}
+				m_party = party;
+				if (bRoot)
+					m_nTraceID = NewID();
+				m_bEnabled = true;
+				return true;
+			}
+
+			void Close()
+			{
+				std::scoped_lock lock(m_muxFile);
+				m_bEnabled = false;
+				if (m_file.is_open())
+					m_file.close();
+			}
+
+			bool IsEnabled() const
+			{
+				return m_bEnabled;
+			}
+
+			// Names used for message ids in the trace, e.g. ThreshMsgNames
+			void SetMessageNamer(std::function<std::string(uint32_t)> namer)
+			{
+				m_fnNamer = std::move(namer);
+			}
+
+			std::string MessageName(uint32_t id) const
+			{
+				if (m_fnNamer)
+					return m_fnNamer(id);
+				return "msg " + std::to_string(id);
+			}
+
+			uint64_t TraceID() const
+			{
+				return m_nTraceID;
+			}
+
+			// Clients learn the trace ID of the ceremony from the server
+			void AdoptTraceID(uint64_t nTraceID)
+			{
+				uint64_t nNone = 0;
+				if (nTraceID != 0)
+					m_nTraceID.compare_exchange_strong(nNone, nTraceID);
+			}
+
+			// Random 64 bit identifier, never zero
+			uint64_t NewID()
+			{
+				std::scoped_lock lock(m_muxRandom);
+				uint64_t nID = 0;
+				while (nID == 0)
+					nID = m_rng();
+				return nID;
+			}
+
+			// Wall clock time in microseconds. Wall clock (not steady) so that
+			// separate processes can be lined up by the merge tool.
+			static uint64_t NowMicros()
+			{
+				return std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::system_clock::now().time_since_epoch()).count();
+			}
+
+			// The innermost span open on the calling thread, 0 if there is none
+			uint64_t CurrentSpan() const
+			{
+				auto& stack = SpanStack();
+				return stack.empty() ? 0 : stack.back();
+			}
+
+			// Open a span on this thread. The parent defaults to the enclosing span,
+			// a message handler passes the span ID of the message it is handling so
+			// the merge tool can follow the work from one process to the next.
+			uint64_t BeginSpan(const std::string& name, uint64_t nParent = 0)
+			{
+				if (!m_bEnabled) return 0;
+				uint64_t nSpan = NewID();
+				if (nParent == 0) nParent = CurrentSpan();
+				SpanStack().push_back(nSpan);
+
+				std::ostringstream os;
+				os << "{\"ev\":\"B\"" << Common(NowMicros()) << ",\"name\":\"" << name
+					<< "\",\"span\":\"" << Hex(nSpan) << "\",\"parent\":\"" << Hex(nParent) << "\"}";
+				Write(os.str());
+				return nSpan;
+			}
+
+			void EndSpan(uint64_t nSpan)
+			{
+				if (!m_bEnabled || nSpan == 0) return;
+				auto& stack = SpanStack();
+				if (!stack.empty() && stack.back() == nSpan)
+					stack.pop_back();
+
+				std::ostringstream os;
+				os << "{\"ev\":\"E\"" << Common(NowMicros()) << ",\"span\":\"" << Hex(nSpan) << "\"}";
+				Write(os.str());
+			}
+
+			// Called by connection::Send() on the sending thread, so that the message
+			// is parented to whatever span is doing the sending.
+			template <typename HeaderType>
+			void StampSend(HeaderType& header)
+			{
+				header.trace_id = m_nTraceID;
+				header.span_id = NewID();
+
+				std::ostringstream os;
+				os << "{\"ev\":\"send\"" << Common(NowMicros()) << ",\"name\":\""
+					<< MessageName(static_cast<uint32_t>(header.id)) << "\",\"span\":\"" << Hex(header.span_id)
+					<< "\",\"parent\":\"" << Hex(CurrentSpan()) << "\",\"size\":" << header.size << "}";
+				Write(os.str());
+			}
+
+			// Called by the connection once a complete message has been read
+			template <typename HeaderType>
+			void RecordReceive(const HeaderType& header)
+			{
+				AdoptTraceID(header.trace_id);
+
+				std::ostringstream os;
+				os << "{\"ev\":\"recv\"" << Common(NowMicros()) << ",\"name\":\""
+					<< MessageName(static_cast<uint32_t>(header.id)) << "\",\"span\":\"" << Hex(header.span_id)
+					<< "\",\"send_ts\":" << header.send_ts << ",\"size\":" << header.size << "}";
+				Write(os.str());
+			}
+
+		private:
+			tracer()
+				: m_rng(std::random_device{}())
+			{}
+
+			static std::vector<uint64_t>& SpanStack()
+			{
+				static thread_local std::vector<uint64_t> stack;
+				return stack;
+			}
+
+			// Small stable number for the calling thread, used as the Chrome "tid"
+			static uint32_t ThreadNumber()
+			{
+				static std::atomic<uint32_t> nNext{ 1 };
+				static thread_local uint32_t nThread = nNext++;
+				return nThread;
+			}
+
+			static std::string Hex(uint64_t n)
+			{
+				std::ostringstream os;
+				os << std::hex << n;
+				return os.str();
+			}
+
+			// Fields shared by every event
+			std::string Common(uint64_t nTimestamp) const
+			{
+				std::ostringstream os;
+				os << ",\"party\":\"" << m_party << "\",\"tid\":" << ThreadNumber()
+					<< ",\"ts\":" << nTimestamp << ",\"trace\":\"" << Hex(m_nTraceID) << "\"";
+				return os.str();
+			}
+
+			void Write(const std::string& line)
+			{
+				std::scoped_lock lock(m_muxFile);
+				if (m_file.is_open())
+					m_file << line << "\n" << std::flush;
+			}
+
+		private:
+			std::atomic<bool> m_bEnabled{ false };
+			std::atomic<uint64_t> m_nTraceID{ 0 };
+			std::string m_party;
+			std::function<std::string(uint32_t)> m_fnNamer;
+
+			std::mutex m_muxFile;
+			std::ofstream m_file;
+
+			std::mutex m_muxRandom;
+			std::mt19937_64 m_rng;
+		};
+
+		// Scoped span - begins on construction, ends when it goes out of scope
+		class trace_span
+		{
+		public:
+			trace_span(const std::string& name, uint64_t nParent = 0)
+				: m_nSpan(tracer::Get().BeginSpan(name, nParent))
+			{}
+
+			~trace_span()
+			{
+				tracer::Get().EndSpan(m_nSpan);
+			}
+
+			trace_span(const trace_span&) = delete;
+			trace_span& operator=(const trace_span&) = delete;
+
+		private:
+			uint64_t m_nSpan;
+		};
+	}
+}
+
+// Open a span for the rest of the enclosing scope
+#define OLC_TRACE_CONCAT_(a, b) a##b
+#define OLC_TRACE_CONCAT(a, b) OLC_TRACE_CONCAT_(a, b)
+#define OLC_TRACE_SPAN(...) \
+	olc::net::trace_span OLC_TRACE_CONCAT(olcTraceSpan_, __LINE__)(__VA_ARGS__)
@@ -0,0 +1,104 @@
+/*
+	Transports for olc::net
+
+	Connections run over a generic stream socket, so the same connection,
+	server_interface and client_interface carry either TCP or a Unix domain
+	socket. Which one is chosen by the address:
+
+		"unix:/path/to/socket"   a Unix domain socket at that path, the port
+		                         is not used
+		anything else            a host name or IP address, with the port
+
+	Peers on the same host skip the TCP/IP stack with a Unix socket, which
+	matters for large key and ciphertext transfers.
+*/
+
+#pragma once
+
+#include "net_common.h"
+
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace olc
+{
+	namespace net
+	{
+		using stream_protocol = boost::asio::generic::stream_protocol;
+		using stream_acceptor = boost::asio::basic_socket_acceptor<stream_protocol>;
+
+		// Prefix of addresses that name a Unix domain socket
+		inline const std::string UNIX_SCHEME = "unix:";
+
+		inline bool IsUnixAddress(const std::string& address)
+		{
+			return address.compare(0, UNIX_SCHEME.size(), UNIX_SCHEME) == 0;
+		}
+
+		inline std::string UnixPath(const std::string& address)
+		{
+			return address.substr(UNIX_SCHEME.size());
+		}
+
+		// The endpoints to try, in order, to connect to address and port
+		inline std::vector<stream_protocol::endpoint> ResolveEndpoints(boost::asio::io_context& context,
+			const std::string& address, uint16_t port)
+		{
+			std::vector<stream_protocol::endpoint> endpoints;
+			if (IsUnixAddress(address))
+			{
+				endpoints.emplace_back(boost::asio::local::stream_protocol::endpoint(UnixPath(address)));
+				return endpoints;
+			}
+
+			boost::asio::ip::tcp::resolver resolver(context);
+			for (auto& entry : resolver.resolve(address, std::to_string(port)))
+				endpoints.emplace_back(entry.endpoint());
+			return endpoints;
+		}
+
+		// The endpoint to listen on: the Unix socket of address, or any IPv4
+		// address on port. A socket file left by an earlier run is removed, as
+		// bind() would fail on it. Anything else at the path is left alone and
+		// bind() reports it.
+		inline stream_protocol::endpoint ListenEndpoint(const std::string& address, uint16_t port)
+		{
+			if (IsUnixAddress(address))
+			{
+				struct stat st;
+				if (lstat(UnixPath(address).c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+					unlink(UnixPath(address).c_str());
+				return boost::asio::local::stream_protocol::endpoint(UnixPath(address));
+			}
+			return boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port);
+		}
+
+		// Printable form of an endpoint of either transport
+		inline std::string DescribeEndpoint(const stream_protocol::endpoint& endpoint)
+		{
+			if (endpoint.protocol().family() == AF_UNIX)
+			{
+				boost::asio::local::stream_protocol::endpoint local;
+				std::memcpy(local.data(), endpoint.data(), endpoint.size());
+				local.resize(endpoint.size());
+				// the connecting side of a Unix socket is normally unnamed
+				return UNIX_SCHEME + (local.path().empty() ? "(unnamed)" : local.path());
+			}
+
+			boost::asio::ip::tcp::endpoint ip;
+			std::memcpy(ip.data(), endpoint.data(), endpoint.size());
+			ip.resize(endpoint.size());
+			std::ostringstream os;
+			os << ip;
+			return os.str();
+		}
+	}
+}
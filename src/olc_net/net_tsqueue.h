@@ -113,6 +113,16 @@ namespace olc
 				cvBlocking.notify_one();
 			}
 
+			// Moves an item to back of Queue, without copying it
+			void push_back(T&& item)
+			{
+				std::scoped_lock lock(muxQueue);
+				deqQueue.emplace_back(std::move(item));
+
+				std::unique_lock<std::mutex> ul(muxBlocking);
+				cvBlocking.notify_one();
+			}
+
 			// Adds an item to front of Queue
 			void push_front(const T& item)
 			{
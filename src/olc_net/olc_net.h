@@ -59,6 +59,8 @@
 #include "net_common.h"
 #include "net_tsqueue.h"
 #include "net_message.h"
+#include "net_trace.h"
+#include "net_transport.h"
 #include "net_client.h"
 #include "net_server.h"
 #include "net_connection.h"
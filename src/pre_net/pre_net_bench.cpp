@@ -0,0 +1,169 @@
+// @file pre_net_bench.cpp - throughput of olc::net messages over TCP and over
+//    a Unix domain socket, in MB/s. Does not need PALISADE.
+// @author: Ian Quah, David Cousins
+// TPOC: contact@palisade-crypto.org
+
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <getopt.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <olc_net.h>
+
+enum class BenchMsgTypes : uint32_t {
+  Ready,    // server to client, the connection is accepted
+  Payload,  // client to server
+  Done,     // server to client, all payloads are in
+};
+
+/**
+ * BenchServer - counts payloads and answers Done once count are in
+ */
+class BenchServer : public olc::net::server_interface<BenchMsgTypes> {
+ public:
+  BenchServer(const std::string &address, uint16_t port, int count)
+      : olc::net::server_interface<BenchMsgTypes>(address, port),
+        m_count(count) {}
+
+  /**
+   * Serve - handle messages until the client has had its Done
+   */
+  void Serve(void) {
+    while (!m_done) Update(-1, true);
+  }
+
+ protected:
+  bool OnClientConnect(
+      std::shared_ptr<olc::net::connection<BenchMsgTypes>> client) override {
+    olc::net::message<BenchMsgTypes> msg;
+    msg.header.id = BenchMsgTypes::Ready;
+    client->Send(msg);
+    return true;
+  }
+
+  void OnMessage(std::shared_ptr<olc::net::connection<BenchMsgTypes>> client,
+                 olc::net::message<BenchMsgTypes> &msg) override {
+    if (msg.header.id != BenchMsgTypes::Payload) return;
+    if (++m_received < m_count) return;
+    olc::net::message<BenchMsgTypes> done;
+    done.header.id = BenchMsgTypes::Done;
+    client->Send(done);
+    m_done = true;
+  }
+
+ private:
+  int m_count;
+  int m_received = 0;
+  std::atomic<bool> m_done{false};
+};
+
+/**
+ * waitFor - the next message from the server, which must be of type id
+ */
+bool waitFor(olc::net::client_interface<BenchMsgTypes> &client,
+             BenchMsgTypes id) {
+  client.Incoming().wait();
+  return client.Incoming().pop_front().msg.header.id == id;
+}
+
+/**
+ * run - send count messages of size bytes to a server at address and port
+ * @return the throughput in MB/s, or a negative value on failure
+ */
+double run(const std::string &address, uint16_t port, size_t size,
+           int count) {
+  BenchServer server(address, port, count);
+  if (!server.Start()) return -1;
+  std::thread serving([&server]() { server.Serve(); });
+
+  olc::net::client_interface<BenchMsgTypes> client;
+  std::string host =
+      olc::net::IsUnixAddress(address) ? address : std::string("127.0.0.1");
+  if (!client.Connect(host, port) ||
+      !waitFor(client, BenchMsgTypes::Ready)) {
+    std::cerr << "cannot connect to " << address << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  olc::net::message<BenchMsgTypes> msg;
+  msg.header.id = BenchMsgTypes::Payload;
+  msg.body.resize(size);
+  msg.header.size = size;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) client.Send(msg);
+  bool ok = waitFor(client, BenchMsgTypes::Done);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  serving.join();
+  client.Disconnect();
+  return ok ? double(size) * count / elapsed.count() / (1 << 20) : -1;
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  size_t size(1 << 20);  // bytes in each message body
+  int count(1000);       // messages to send
+  uint16_t port(60000);
+  std::string path("/tmp/pre_net_bench.sock");
+
+  while ((opt = getopt(argc, argv, "b:n:p:u:h")) != -1) {
+    switch (opt) {
+      case 'b':
+        size = atol(optarg);
+        break;
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'u':
+        path = optarg;
+        break;
+      case 'h':
+      default: /* '?' */
+        std::cerr << "Usage: pre_net_bench [-b bytes] [-n messages] "
+                  << "[-p port] [-u socket-path]" << std::endl
+                  << "  -b bytes in each message (default 1MB)" << std::endl
+                  << "  -n messages to send (default 1000)" << std::endl
+                  << "  -p TCP port to use (default 60000)" << std::endl
+                  << "  -u Unix socket to use (default "
+                  << "/tmp/pre_net_bench.sock)" << std::endl;
+        return 1;
+    }
+  }
+  if (count < 1) {
+    std::cerr << "-n must be at least 1" << std::endl;
+    return 1;
+  }
+
+  std::cout << count << " messages of " << size << " bytes" << std::endl;
+  double tcpRate = run("", port, size, count);
+  double unixRate = run(olc::net::UNIX_SCHEME + path, 0, size, count);
+  std::cout << "tcp:  " << tcpRate << " MB/s" << std::endl
+            << "unix: " << unixRate << " MB/s" << std::endl;
+  return 0;
+}
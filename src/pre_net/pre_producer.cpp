@@ -93,7 +93,8 @@ int main(int argc, char *argv[]) {
 	  std::cerr << "Usage: " << std::endl
 				<< "arguments:" << std::endl
 				<< "  -n name of the consumer client" << std::endl
-				<< "  -i IP or hostname of the server" << std::endl
+				<< "  -i IP or hostname of the server, or unix:/path of its "
+				<< "Unix socket" << std::endl
 				<< "  -p port of the server" << std::endl
 				<< "  -h prints this message" << std::endl;
 	  std::exit(EXIT_FAILURE);
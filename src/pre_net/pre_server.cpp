@@ -53,9 +53,14 @@ int main(int argc, char *argv[]) {
   ////////////////////////////////////////////////////////////
   int opt;
   uint32_t port(0);
+  std::string address("");  // unix:/path to listen on a Unix socket
   
-  while ((opt = getopt(argc, argv, "p:h")) != -1) {
+  while ((opt = getopt(argc, argv, "i:p:h")) != -1) {
     switch (opt) {
+	case 'i':
+	  address = optarg;
+	  std::cout << "listening on " << address << std::endl;
+	  break;
 	case 'p':
 	  port = atoi(optarg);
 	  std::cout << "host port " << port << std::endl;
@@ -65,20 +70,23 @@ int main(int argc, char *argv[]) {
 	  std::cerr << "Usage: " << std::endl
 				<< "arguments:" << std::endl
 				<< "  -p port of the server" << std::endl
+				<< "  -i unix:/path to listen on a Unix socket instead, "
+				<< "for clients on this host run with the same -i"
+				<< std::endl
 				<< "  -h prints this message" << std::endl;
 	  std::exit(EXIT_FAILURE);
     }
   }
 
   //verify inputs
-  if (port == 0) {
-	std::cerr << "port must be specified "<<std::endl;
+  if (port == 0 && !olc::net::IsUnixAddress(address)) {
+	std::cerr << "port or unix socket must be specified "<<std::endl;
 	exit (EXIT_FAILURE);
   }
 
   PROFILELOG("SERVER: Initializing");
  
-  PreServer server(port); 
+  PreServer server(port, address); 
   server.Start();
   
   while (1) {
@@ -11,7 +11,9 @@ class PreServer : public olc::net::server_interface<PreMsgTypes> {
 public:
   DEBUG_FLAG(false);
   
-  PreServer(uint16_t nPort) : olc::net::server_interface<PreMsgTypes>(nPort),
+  // listens on nPort, or on a Unix socket if address is "unix:/path"
+  PreServer(uint16_t nPort, const std::string &address = "")
+	: olc::net::server_interface<PreMsgTypes>(address, nPort),
 							  m_producerPrivateKeyReceived(false),
 							  m_producerCTReceived(false),
 							  m_consumerVecIntReceived(false) {
@@ -164,17 +166,23 @@ protected:
   }
   
   void SendClientCC(std::shared_ptr<olc::net::connection<PreMsgTypes>> client){
-	std::string s;
-	std::ostringstream os(s);	
 	DEBUG("[SERVER]: sending cryptocontext to ["
 		  << client->GetID() << "]:");
-	Serial::Serialize(m_serverCC, os, SerType::BINARY);
-
-	olc::net::message<PreMsgTypes> msg;
-	msg.header.id = PreMsgTypes::SendCC;
-	msg<<os.str(); // push the string onto the message. 
+	// the context does not change, so it is serialized for the first client
+	// and every client is sent the same shared message
+	if (!m_ccMessage) {
+	  std::string s;
+	  std::ostringstream os(s);	
+	  Serial::Serialize(m_serverCC, os, SerType::BINARY);
+
+	  olc::net::message<PreMsgTypes> msg;
+	  msg.header.id = PreMsgTypes::SendCC;
+	  msg<<os.str(); // push the string onto the message. 
+	  m_ccMessage = std::make_shared<const olc::net::message<PreMsgTypes>>(
+		  std::move(msg));
+	}
 
-	client->Send(msg);
+	client->Send(m_ccMessage);
   }
   void RecvClientPrivateKey(std::shared_ptr<olc::net::connection<PreMsgTypes>> client, 	olc::net::message<PreMsgTypes> & msg){
 	// receive the private key from this client,
@@ -246,7 +254,7 @@ protected:
 
 	msg.header.id = PreMsgTypes::SendReEncryptionKey;
 	msg<<os.str(); // push the string onto the message. 
-	client->Send(msg);
+	client->Send(std::move(msg));
   }
 
   void RecvClientCT(std::shared_ptr<olc::net::connection<PreMsgTypes>> client, 	olc::net::message<PreMsgTypes> & msg){
@@ -291,7 +299,7 @@ protected:
 	msg<<os.str(); // push the string onto the message. 
 	DEBUG("[SERVER]: msg.size() " << msg.size());
 	DEBUG("[SERVER]: msg.body.size() " << msg.body.size());
-	client->Send(msg);
+	client->Send(std::move(msg));
 
   }
 
@@ -350,6 +358,7 @@ protected:
 private:
   // Server state
   CC m_serverCC;
+  olc::net::shared_message<PreMsgTypes> m_ccMessage;  // serialized m_serverCC
   
   // a full up server would have lists of producers and consumers,
   // and their approved connections,
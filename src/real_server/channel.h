@@ -0,0 +1,485 @@
+// @file channel.h - moves serialized objects between real_server and
+//    real_client, through files or through a ring in shared memory
+// @author: Ian Quah, David Cousins
+// TPOC: contact@palisade-crypto.org
+
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef REAL_SERVER_CHANNEL_H
+#define REAL_SERVER_CHANNEL_H
+
+#include "utils.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <sstream>
+
+#include <boost/interprocess/streams/bufferstream.hpp>
+
+/**
+ * Channel - objects go in with Put() under a name (the location of the
+ * object in GConf) and come out, once, with Take()
+ */
+class Channel {
+ public:
+  // serializes an object to a stream, or deserializes it from one
+  using Writer = std::function<bool(std::ostream &)>;
+  using Reader = std::function<bool(std::istream &)>;
+
+  virtual ~Channel() = default;
+
+  /**
+   * Put - hand over the bytes of an object
+   * @param name - name of the object
+   * @param bytes - serialized object
+   * @return false if the object could not be stored
+   */
+  virtual bool Put(const std::string &name, const std::string &bytes) = 0;
+
+  /**
+   * Take - take the bytes of an object out of the channel
+   * @param name - name of the object
+   * @param bytes - serialized object
+   * @return false if there is no such object
+   */
+  virtual bool Take(const std::string &name, std::string &bytes) = 0;
+
+  /**
+   * Write - Put() what writer serializes. A channel that can serialize
+   * straight to where the object goes overrides this.
+   */
+  virtual bool Write(const std::string &name, const Writer &writer) {
+    std::ostringstream os;
+    if (!writer(os)) return false;
+    return Put(name, os.str());
+  }
+
+  /**
+   * Read - Take() an object and hand it to reader. A channel that can
+   * deserialize straight from where the object is overrides this.
+   */
+  virtual bool Read(const std::string &name, const Reader &reader) {
+    std::string bytes;
+    if (!Take(name, bytes)) return false;
+    std::istringstream is(bytes);
+    return reader(is);
+  }
+
+  /**
+   * Send - serialize and Write() a PALISADE object
+   */
+  template <typename T>
+  bool Send(const std::string &name, const T &obj) {
+    return Write(name, [&obj](std::ostream &os) {
+      Serial::Serialize(obj, os, SerType::BINARY);
+      return os.good();
+    });
+  }
+
+  /**
+   * Receive - Read() and deserialize a PALISADE object
+   */
+  template <typename T>
+  bool Receive(const std::string &name, T &obj) {
+    return Read(name, [&obj](std::istream &is) {
+      Serial::Deserialize(obj, is, SerType::BINARY);
+      return true;
+    });
+  }
+};
+
+/**
+ * FileChannel - one file per object, the name is the path. Taking an object
+ * removes its file. The two processes take turns with the named_mutex locks
+ * in utils.h, Take() does not wait for a file to appear.
+ */
+class FileChannel : public Channel {
+ public:
+  bool Put(const std::string &name, const std::string &bytes) override {
+    std::ofstream file(name, std::ios::out | std::ios::binary);
+    if (!file.is_open()) return false;
+    file.write(bytes.data(), bytes.size());
+    return file.good();
+  }
+
+  bool Take(const std::string &name, std::string &bytes) override {
+    std::ifstream file(name, std::ios::in | std::ios::binary);
+    if (!file.is_open()) return false;
+    std::ostringstream os;
+    os << file.rdbuf();
+    bytes = os.str();
+    file.close();
+    fRemove(name);
+    return true;
+  }
+};
+
+/**
+ * NotifyChannel - one file per object like FileChannel, for directories that
+ * have to be shared as files (e.g. between containers), without the locks
+ * and without polling.
+ *
+ * Write() serializes to name.tmp and publishes it with an atomic rename(),
+ * so a reader never sees half an object. Read() waits for the rename with
+ * inotify and deserializes straight from an mmap of the file, then removes
+ * it.
+ */
+class NotifyChannel : public Channel {
+ public:
+  /**
+   * @param timeoutSeconds - how long Read() waits for an object before it
+   * fails, 0 for no limit
+   */
+  explicit NotifyChannel(int timeoutSeconds = 0)
+      : m_timeoutSeconds(timeoutSeconds) {}
+
+  bool Put(const std::string &name, const std::string &bytes) override {
+    return Write(name, [&bytes](std::ostream &os) {
+      os.write(bytes.data(), bytes.size());
+      return os.good();
+    });
+  }
+
+  bool Take(const std::string &name, std::string &bytes) override {
+    return Read(name, [&bytes](std::istream &is) {
+      std::ostringstream os;
+      os << is.rdbuf();
+      bytes = os.str();
+      return true;
+    });
+  }
+
+  bool Write(const std::string &name, const Writer &writer) override {
+    std::string tmp = name + ".tmp";
+    {
+      std::ofstream file(tmp, std::ios::out | std::ios::binary);
+      if (!file.is_open() || !writer(file)) return false;
+      file.close();
+      if (file.fail()) return false;
+    }
+    return std::rename(tmp.c_str(), name.c_str()) == 0;
+  }
+
+  bool Read(const std::string &name, const Reader &reader) override {
+    if (!waitFor(name, m_timeoutSeconds)) {
+      std::cerr << "NotifyChannel: no " << name << std::endl;
+      return false;
+    }
+
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return false;
+    }
+    size_t size = st.st_size;
+    void *data = nullptr;
+    if (size) {
+      data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+      }
+      madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    ibufferstream is(static_cast<const char *>(data), size);
+    bool ok = reader(is);
+    if (size) munmap(data, size);
+    std::remove(name.c_str());
+    return ok;
+  }
+
+ private:
+  /**
+   * waitFor - block until the file name has been published
+   * @param timeoutSeconds - give up after this long, 0 for no limit
+   * @return false if the directory cannot be watched or the time ran out
+   */
+  static bool waitFor(const std::string &name, int timeoutSeconds) {
+    auto slash = name.rfind('/');
+    std::string dir =
+        slash == std::string::npos ? "." : name.substr(0, slash);
+    std::string base =
+        slash == std::string::npos ? name : name.substr(slash + 1);
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) return false;
+    // watch before looking, so a rename in between is not missed
+    if (inotify_add_watch(fd, dir.c_str(), IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+      close(fd);
+      return false;
+    }
+    bool found = fExists(name);
+    alignas(struct inotify_event) char buf[4096];
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(timeoutSeconds);
+    while (!found) {
+      int waitMs = -1;
+      if (timeoutSeconds > 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) break;
+        waitMs = static_cast<int>(left.count());
+      }
+      struct pollfd pfd = {fd, POLLIN, 0};
+      int ready = poll(&pfd, 1, waitMs);
+      if (ready < 0 && errno == EINTR) continue;
+      if (ready <= 0) break;
+      ssize_t len = read(fd, buf, sizeof(buf));
+      if (len <= 0) break;
+      for (char *p = buf; p < buf + len;) {
+        auto event = reinterpret_cast<struct inotify_event *>(p);
+        if (event->len && base == event->name) found = true;
+        p += sizeof(struct inotify_event) + event->len;
+      }
+    }
+    close(fd);
+    return found;
+  }
+
+  int m_timeoutSeconds;
+};
+
+/**
+ * ShmChannel - a ring of object slots in a managed shared memory segment.
+ *
+ * Put() copies the bytes into memory allocated from the segment and queues
+ * a slot for them, Take() waits on a process shared condition until an
+ * object of that name is in the ring, copies it out and frees it. Nothing
+ * touches the disk and no lock has to be handed back and forth, a process
+ * that takes an object simply sleeps until the other one has put it.
+ *
+ * The server stamps the ring with a generation and its pid. A client that
+ * is kept waiting checks once a second that the segment under the name is
+ * still the one it opened and that the server is alive, so it fails on a
+ * segment left by a dead or restarted server instead of sleeping forever.
+ */
+class ShmChannel : public Channel {
+ public:
+  static const size_t kSlots = 32;
+  static const size_t kNameSize = 128;
+
+  /**
+   * @param segmentName - name of the shared memory segment
+   * @param create - true for the process that makes the segment (the
+   * server), false to wait for it and open it
+   * @param size - size of the segment in bytes, big enough for all objects
+   * in flight at once
+   * @param timeoutSeconds - how long Put() and Take() wait for the other
+   * side, 0 for no limit
+   */
+  ShmChannel(const std::string &segmentName, bool create, size_t size,
+             int timeoutSeconds = 0)
+      : m_segmentName(segmentName),
+        m_owner(create),
+        m_timeoutSeconds(timeoutSeconds) {
+    if (create) {
+      shared_memory_object::remove(segmentName.c_str());
+      m_segment = managed_shared_memory(create_only, segmentName.c_str(), size);
+      m_ring = m_segment.construct<Ring>("ring")();
+      boost::interprocess::scoped_lock<interprocess_mutex> lock(m_ring->mutex);
+      m_ring->pid = getpid();
+      m_ring->generation = newGeneration();
+      m_generation = m_ring->generation;
+      return;
+    }
+    // the ring is stamped last, a segment without a stamped ring is still
+    // being made
+    while (true) {
+      try {
+        m_segment = managed_shared_memory(open_only, segmentName.c_str());
+        m_ring = m_segment.find<Ring>("ring").first;
+        if (m_ring) {
+          boost::interprocess::scoped_lock<interprocess_mutex> lock(
+              m_ring->mutex);
+          m_generation = m_ring->generation;
+        }
+        if (m_ring && m_generation && current()) break;
+      } catch (interprocess_exception &) {
+      }
+      std::cout << "waiting for " << segmentName << " to be created"
+                << std::endl;
+      nap(100);
+    }
+  }
+
+  ~ShmChannel() override {
+    if (m_owner) shared_memory_object::remove(m_segmentName.c_str());
+  }
+
+  bool Put(const std::string &name, const std::string &bytes) override {
+    if (name.size() >= kNameSize) return false;
+    boost::interprocess::scoped_lock<interprocess_mutex> lock(m_ring->mutex);
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(m_timeoutSeconds);
+    while (m_ring->tail - m_ring->head == kSlots) {
+      if (!wait(lock, deadline)) {
+        std::cerr << "ShmChannel: gave up waiting for room for " << name
+                  << std::endl;
+        return false;
+      }
+    }
+    void *data = m_segment.allocate(bytes.size() ? bytes.size() : 1,
+                                    std::nothrow);
+    if (!data) {
+      std::cerr << "ShmChannel: no room for " << bytes.size()
+                << " bytes of " << name << std::endl;
+      return false;
+    }
+    std::memcpy(data, bytes.data(), bytes.size());
+
+    auto &slot = m_ring->slots[m_ring->tail % kSlots];
+    std::strncpy(slot.name, name.c_str(), kNameSize);
+    slot.handle = m_segment.get_handle_from_address(data);
+    slot.size = bytes.size();
+    slot.full = true;
+    m_ring->tail++;
+    m_ring->changed.notify_all();
+    return true;
+  }
+
+  bool Take(const std::string &name, std::string &bytes) override {
+    boost::interprocess::scoped_lock<interprocess_mutex> lock(m_ring->mutex);
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(m_timeoutSeconds);
+    while (true) {
+      for (uint64_t i = m_ring->head; i < m_ring->tail; i++) {
+        auto &slot = m_ring->slots[i % kSlots];
+        if (!slot.full || name != slot.name) continue;
+
+        auto data = static_cast<const char *>(
+            m_segment.get_address_from_handle(slot.handle));
+        bytes.assign(data, slot.size);
+        m_segment.deallocate(const_cast<char *>(data));
+        slot.full = false;
+        // objects are taken by name, the ring moves past every slot that
+        // has been taken
+        while (m_ring->head < m_ring->tail &&
+               !m_ring->slots[m_ring->head % kSlots].full) {
+          m_ring->head++;
+        }
+        m_ring->changed.notify_all();
+        return true;
+      }
+      if (!wait(lock, deadline)) {
+        std::cerr << "ShmChannel: gave up waiting for " << name << std::endl;
+        return false;
+      }
+    }
+  }
+
+ private:
+  struct Slot {
+    char name[kNameSize];
+    managed_shared_memory::handle_t handle;
+    uint64_t size;
+    bool full;
+  };
+
+  // lives in the segment, shared by both processes
+  struct Ring {
+    interprocess_mutex mutex;
+    interprocess_condition changed;
+    uint64_t generation = 0;  // 0 until the server has set up the ring
+    pid_t pid = 0;            // the server
+    uint64_t head = 0, tail = 0;
+    Slot slots[kSlots] = {};
+  };
+
+  static uint64_t newGeneration(void) {
+    uint64_t now = std::chrono::system_clock::now().time_since_epoch().count();
+    return (now ^ (uint64_t(getpid()) << 40)) | 1;
+  }
+
+  // true while the segment under m_segmentName is the one this channel
+  // opened and the server that made it is running
+  bool current(void) const {
+    if (m_owner) return true;
+    pid_t pid;
+    try {
+      managed_shared_memory segment(open_only, m_segmentName.c_str());
+      Ring *ring = segment.find<Ring>("ring").first;
+      if (!ring || ring->generation != m_generation) return false;
+      pid = ring->pid;
+    } catch (interprocess_exception &) {
+      return false;
+    }
+    return kill(pid, 0) == 0 || errno == EPERM;
+  }
+
+  // waits with the ring locked for it to change; false once the deadline
+  // has passed or the segment has gone stale
+  bool wait(boost::interprocess::scoped_lock<interprocess_mutex> &lock,
+            std::chrono::steady_clock::time_point deadline) {
+    while (true) {
+      auto until = boost::posix_time::microsec_clock::universal_time() +
+                   boost::posix_time::seconds(1);
+      if (m_ring->changed.timed_wait(lock, until)) return true;
+      if (!current()) return false;
+      if (m_timeoutSeconds > 0 && std::chrono::steady_clock::now() > deadline)
+        return false;
+    }
+  }
+
+  std::string m_segmentName;
+  bool m_owner;
+  int m_timeoutSeconds;
+  uint64_t m_generation = 0;
+  managed_shared_memory m_segment;
+  Ring *m_ring = nullptr;
+};
+
+/**
+ * makeChannel - the channel for the -m option of real_server and
+ * real_client
+ * @param mode - "file", "notify", "spool" or "shm". Spool jobs move through
+ * a JobChannel (spool.h) over the NotifyChannel.
+ * @param create - true for the server
+ * @param waitSeconds - how long to wait for each object, 0 for no limit
+ */
+inline std::unique_ptr<Channel> makeChannel(const std::string &mode,
+                                            bool create, int waitSeconds = 0) {
+  if (mode == "shm") {
+    return std::unique_ptr<Channel>(
+        new ShmChannel(GConf.SHM_NAME, create, GConf.SHM_SIZE, waitSeconds));
+  }
+  if (mode == "notify" || mode == "spool") {
+    return std::unique_ptr<Channel>(new NotifyChannel(waitSeconds));
+  }
+  return std::unique_ptr<Channel>(new FileChannel());
+}
+
+#endif  // REAL_SERVER_CHANNEL_H
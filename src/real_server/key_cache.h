@@ -0,0 +1,171 @@
+// @file key_cache.h - a read-only file of serialized evaluation keys that
+//    all client processes on a host map and share
+// @author: Ian Quah, David Cousins
+// TPOC: contact@palisade-crypto.org
+
+
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef REAL_SERVER_KEY_CACHE_H
+#define REAL_SERVER_KEY_CACHE_H
+
+#include "channel.h"
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+/**
+ * KeyCache - the serialized evaluation keys in one file, written once by
+ * the server. Every key starts on a page boundary, and clients map the file
+ * read-only and shared, so all clients on the host deserialize from the same
+ * page cache pages instead of each reading, or being sent, its own copy.
+ *
+ * Layout: a Header, then Header::count Entry records, then the keys, each
+ * at a page aligned offset.
+ */
+class KeyCache {
+ public:
+  /**
+   * Create - write a cache, atomically: it is written under a temporary
+   * name and renamed, so a client never maps a half written cache
+   * @param path - file of the cache
+   * @param keys - name and writer of each key
+   * @return false if the cache could not be written
+   */
+  static bool Create(
+      const std::string &path,
+      const std::vector<std::pair<std::string, Channel::Writer>> &keys) {
+    std::vector<std::string> blobs;
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.count = keys.size();
+    std::vector<Entry> entries(keys.size());
+    uint64_t offset = align(sizeof(Header) + keys.size() * sizeof(Entry));
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (keys[i].first.size() >= sizeof(entries[i].name)) return false;
+      std::ostringstream os;
+      if (!keys[i].second(os)) return false;
+      blobs.push_back(os.str());
+      std::strncpy(entries[i].name, keys[i].first.c_str(),
+                   sizeof(entries[i].name));
+      entries[i].offset = offset;
+      entries[i].size = blobs[i].size();
+      offset = align(offset + blobs[i].size());
+    }
+
+    std::string tmp = path + ".tmp";
+    {
+      std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+      if (!file.is_open()) return false;
+      file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char *>(entries.data()),
+                 entries.size() * sizeof(Entry));
+      for (size_t i = 0; i < blobs.size(); i++) {
+        file.seekp(entries[i].offset);
+        file.write(blobs[i].data(), blobs[i].size());
+      }
+      if (file.fail()) return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+  }
+
+  /**
+   * Map the cache at path, Ok() tells whether it is there and valid
+   */
+  explicit KeyCache(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header)) {
+      m_size = st.st_size;
+      m_data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (m_data == MAP_FAILED) m_data = nullptr;
+    }
+    close(fd);
+    if (!m_data) return;
+    auto header = static_cast<const Header *>(m_data);
+    if (std::memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0 ||
+        sizeof(Header) + header->count * sizeof(Entry) > m_size) {
+      return;
+    }
+    m_header = header;
+    // the keys are all read, and soon
+    madvise(m_data, m_size, MADV_WILLNEED);
+  }
+
+  ~KeyCache() {
+    if (m_data) munmap(m_data, m_size);
+  }
+
+  KeyCache(const KeyCache &) = delete;
+  KeyCache &operator=(const KeyCache &) = delete;
+
+  bool Ok(void) const { return m_header != nullptr; }
+
+  /**
+   * Read - deserialize a key straight from the mapped pages
+   * @param name - name the key was cached under
+   * @param reader - deserializes the key
+   * @return false if there is no such key or reader fails
+   */
+  bool Read(const std::string &name, const Channel::Reader &reader) const {
+    if (!m_header) return false;
+    auto entries = reinterpret_cast<const Entry *>(m_header + 1);
+    for (uint64_t i = 0; i < m_header->count; i++) {
+      const Entry &entry = entries[i];
+      if (name != std::string(entry.name,
+                              strnlen(entry.name, sizeof(entry.name)))) {
+        continue;
+      }
+      if (entry.offset + entry.size > m_size) return false;
+      ibufferstream is(static_cast<const char *>(m_data) + entry.offset,
+                       entry.size);
+      return reader(is);
+    }
+    return false;
+  }
+
+ private:
+  static constexpr const char *MAGIC = "PKEYCAC1";
+
+  struct Header {
+    char magic[8];
+    uint64_t count;
+  };
+
+  struct Entry {
+    char name[48];
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  static uint64_t align(uint64_t offset) {
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    return (offset + page - 1) / page * page;
+  }
+
+  void *m_data = nullptr;
+  size_t m_size = 0;
+  const Header *m_header = nullptr;
+};
+
+#endif  // REAL_SERVER_KEY_CACHE_H
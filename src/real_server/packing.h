@@ -0,0 +1,219 @@
+// @file packing.h - place many short vectors in the slots of one CKKS
+//    ciphertext
+// @author: Ian Quah, David Cousins
+// TPOC: contact@palisade-crypto.org
+
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef REAL_SERVER_PACKING_H
+#define REAL_SERVER_PACKING_H
+
+#include <palisade.h>
+
+#include <algorithm>
+#include <complex>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace lbcrypto;
+
+/**
+ * PackingPlan - lays out many short vectors side by side in the slots of as
+ * few CKKS ciphertexts as possible.
+ *
+ * Each vector gets a lane of its own length plus maxRotation zero slots of
+ * padding. Adding or multiplying two ciphertexts packed with the same plan
+ * works on all the vectors at once, and rotating by up to maxRotation slots
+ * in either direction rotates each vector with zeros shifted in, just as if
+ * it had a ciphertext of its own.
+ */
+class PackingPlan {
+ public:
+  // where one vector lives
+  struct Placement {
+    size_t ciphertext;  // index of the ciphertext
+    size_t offset;      // first slot
+    size_t length;      // number of values
+  };
+
+  /**
+   * @param slots - slots in one ciphertext (the batch size)
+   * @param lengths - length of each vector to place
+   * @param maxRotation - largest rotation the vectors must survive
+   */
+  PackingPlan(size_t slots, const std::vector<size_t> &lengths,
+              size_t maxRotation = 0)
+      : m_slots(slots), m_maxRotation(maxRotation) {
+    size_t ciphertext = 0, offset = 0;
+    for (auto length : lengths) {
+      size_t lane = length + maxRotation;
+      if (lane > slots) {
+        throw std::invalid_argument("PackingPlan: vector of length " +
+                                    std::to_string(length) +
+                                    " does not fit in " +
+                                    std::to_string(slots) + " slots");
+      }
+      if (offset + lane > slots) {
+        ciphertext++;
+        offset = 0;
+      }
+      m_placements.push_back({ciphertext, offset, length});
+      offset += lane;
+    }
+    m_numCiphertexts = lengths.empty() ? 0 : ciphertext + 1;
+  }
+
+  /**
+   * SlotsNeeded - slots needed to pack all the vectors in one ciphertext
+   * @param lengths - length of each vector
+   * @param maxRotation - largest rotation the vectors must survive
+   */
+  static size_t SlotsNeeded(const std::vector<size_t> &lengths,
+                            size_t maxRotation = 0) {
+    size_t slots = 0;
+    for (auto length : lengths) slots += length + maxRotation;
+    return slots;
+  }
+
+  size_t NumCiphertexts(void) const { return m_numCiphertexts; }
+  size_t NumVectors(void) const { return m_placements.size(); }
+  size_t Slots(void) const { return m_slots; }
+  const Placement &At(size_t i) const { return m_placements.at(i); }
+
+  /**
+   * Pack - the slot values of each ciphertext
+   * @param vectors - one vector per placement, in order
+   * @return one slot vector per ciphertext, ready for MakeCKKSPackedPlaintext
+   */
+  std::vector<std::vector<std::complex<double>>> Pack(
+      const std::vector<std::vector<std::complex<double>>> &vectors) const {
+    if (vectors.size() != m_placements.size()) {
+      throw std::invalid_argument("PackingPlan: wrong number of vectors");
+    }
+    std::vector<std::vector<std::complex<double>>> slots(
+        m_numCiphertexts, std::vector<std::complex<double>>(m_slots));
+    for (size_t i = 0; i < vectors.size(); i++) {
+      auto &place = m_placements[i];
+      if (vectors[i].size() != place.length) {
+        throw std::invalid_argument("PackingPlan: vector " +
+                                    std::to_string(i) + " has wrong length");
+      }
+      std::copy(vectors[i].begin(), vectors[i].end(),
+                slots[place.ciphertext].begin() + place.offset);
+    }
+    return slots;
+  }
+
+  /**
+   * Unpack - the values of vector i from the decrypted slots of its
+   * ciphertext
+   * @param slots - decrypted slots (GetCKKSPackedValue())
+   * @param i - vector to take out
+   * @param count - values to take, the vector's length if 0. Up to
+   * length + maxRotation to see what a rotation shifted in.
+   */
+  std::vector<std::complex<double>> Unpack(
+      const std::vector<std::complex<double>> &slots, size_t i,
+      size_t count = 0) const {
+    auto &place = m_placements.at(i);
+    if (count == 0) count = place.length;
+    if (count > place.length + m_maxRotation ||
+        place.offset + count > slots.size()) {
+      throw std::out_of_range("PackingPlan: unpacking past the lane");
+    }
+    return std::vector<std::complex<double>>(
+        slots.begin() + place.offset, slots.begin() + place.offset + count);
+  }
+
+  /**
+   * Mask - 1 in the slots of vector i, 0 everywhere else
+   */
+  std::vector<std::complex<double>> Mask(size_t i) const {
+    auto &place = m_placements.at(i);
+    std::vector<std::complex<double>> mask(m_slots);
+    std::fill(mask.begin() + place.offset,
+              mask.begin() + place.offset + place.length, 1.0);
+    return mask;
+  }
+
+  /**
+   * ExtractRotations - rotation indices Extract() needs keys for
+   */
+  std::vector<int32_t> ExtractRotations(void) const {
+    std::vector<int32_t> indices;
+    for (auto &place : m_placements) {
+      auto index = static_cast<int32_t>(place.offset);
+      if (index != 0 &&
+          std::find(indices.begin(), indices.end(), index) == indices.end()) {
+        indices.push_back(index);
+      }
+    }
+    return indices;
+  }
+
+  /**
+   * ExtractKeyGen - the keys of ExtractRotations(), by automorphism index.
+   * They are not inserted into the context, so they stay out of the keys
+   * it serializes for clients.
+   */
+  std::shared_ptr<std::map<usint, LPEvalKey<DCRTPoly>>> ExtractKeyGen(
+      const CryptoContext<DCRTPoly> &cc,
+      const LPPrivateKey<DCRTPoly> &secretKey) const {
+    std::vector<usint> autoIndices;
+    for (auto index : ExtractRotations()) {
+      autoIndices.push_back(
+          FindAutomorphismIndex2nComplex(index, cc->GetCyclotomicOrder()));
+    }
+    if (autoIndices.empty()) {
+      return std::make_shared<std::map<usint, LPEvalKey<DCRTPoly>>>();
+    }
+    return cc->EvalAutomorphismKeyGen(secretKey, autoIndices);
+  }
+
+  /**
+   * Extract - vector i on its own, moved to slot 0, from the ciphertext it
+   * was packed in. Costs one plaintext multiplication and one rotation.
+   * @param cc - crypto context of the ciphertext
+   * @param ct - ciphertext packed with this plan
+   * @param i - vector to take out
+   * @param keys - the keys from ExtractKeyGen()
+   */
+  Ciphertext<DCRTPoly> Extract(
+      const CryptoContext<DCRTPoly> &cc, const Ciphertext<DCRTPoly> &ct,
+      size_t i, const std::map<usint, LPEvalKey<DCRTPoly>> &keys) const {
+    auto masked = cc->EvalMult(ct, cc->MakeCKKSPackedPlaintext(Mask(i)));
+    auto offset = static_cast<int32_t>(m_placements.at(i).offset);
+    if (!offset) return masked;
+    usint m = cc->GetCyclotomicOrder();
+    return cc->EvalAutomorphism(masked,
+                                FindAutomorphismIndex2nComplex(offset, m), keys);
+  }
+
+ private:
+  size_t m_slots;
+  size_t m_maxRotation;
+  size_t m_numCiphertexts = 0;
+  std::vector<Placement> m_placements;
+};
+
+#endif  // REAL_SERVER_PACKING_H
@@ -32,14 +32,25 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <getopt.h>
+
 #include "utils.h"
+#include "channel.h"
+#include "key_cache.h"
 #include "palisade.h"
+#include "spool.h"
 
 using namespace lbcrypto;
 using CT = Ciphertext<DCRTPoly>;
 
+/**
+ * receiveCCAndKeys - receive the CryptoContext and keys
+ * @param channel - carries the objects from the server
+ * @param useKeyCache - deserialize the evaluation keys from the key cache
+ * the server writes with -k, instead of receiving them
+ */
 std::tuple<CryptoContext<DCRTPoly>, LPPublicKey<DCRTPoly>>
-receiveCCAndKeys(void) {
+receiveCCAndKeys(Channel &channel, bool useKeyCache) {
   /////////////////////////////////////////////////////////////////
   // NOTE: ReleaseAllContexts is imperative; it ensures that the environment
   // is cleared before loading anything. The function call ensures we are not
@@ -48,14 +59,11 @@ receiveCCAndKeys(void) {
   CryptoContextFactory<DCRTPoly>::ReleaseAllContexts();
 
   CryptoContext<DCRTPoly> clientCC;
-  if (!Serial::DeserializeFromFile(GConf.ccLocation,
-				   clientCC,
-				   SerType::BINARY)) {
+  if (!channel.Receive(GConf.ccLocation, clientCC)) {
     std::cerr << "CLIENT: cannot read serialized data from: "
               << GConf.DATAFOLDER << "/cryptocontext.txt" << std::endl;
     std::exit(1);
   }
-  fRemove(GConf.ccLocation);
   
   /////////////////////////////////////////////////////////////////
   // NOTE: the following 2 lines are essential
@@ -67,66 +75,83 @@ receiveCCAndKeys(void) {
   clientCC->ClearEvalAutomorphismKeys();
 
   LPPublicKey<DCRTPoly> clientPublicKey;
-  if (!Serial::DeserializeFromFile(GConf.pubKeyLocation,
-				   clientPublicKey,
-				   SerType::BINARY)) {
+  if (!channel.Receive(GConf.pubKeyLocation, clientPublicKey)) {
     std::cerr << "CLIENT: cannot read serialized data from: "
               << GConf.DATAFOLDER << "/cryptocontext.txt" << std::endl;
     std::exit(1);
   }
-  fRemove(GConf.pubKeyLocation);
   std::cout << "CLIENT: public key deserialized" << std::endl;
 
-  std::ifstream multKeyIStream(GConf.multKeyLocation,
-			       std::ios::in | std::ios::binary);
-  if (!multKeyIStream.is_open()) {
+  // mapped only now, the server writes the cache before the context
+  std::unique_ptr<KeyCache> cache;
+  if (useKeyCache) {
+    cache.reset(new KeyCache(GConf.keyCacheLocation));
+    if (!cache->Ok()) {
+      std::cerr << "CLIENT: no key cache at " << GConf.keyCacheLocation
+                << ", is the server running with -k?" << std::endl;
+      std::exit(1);
+    }
+  }
+  auto readKey = [&](const std::string &name, const Channel::Reader &reader) {
+    return cache ? cache->Read(name, reader) : channel.Read(name, reader);
+  };
+
+  auto multKeyReader = [&clientCC](std::istream &is) {
+    if (!clientCC->DeserializeEvalMultKey(is, SerType::BINARY)) {
+      std::cerr << "CLIENT: Could not deserialize eval mult key file"
+                << std::endl;
+      std::exit(1);
+    }
+    return true;
+  };
+  if (!readKey(GConf.multKeyLocation, multKeyReader)) {
     std::cerr << "CLIENT: cannot read serialization from "
               << GConf.multKeyLocation
               << std::endl;
     std::exit(1);
   }
-  if (!clientCC->DeserializeEvalMultKey(multKeyIStream, SerType::BINARY)) {
-    std::cerr << "CLIENT: Could not deserialize eval mult key file"
-              << std::endl;
-    std::exit(1);
-  }
-  multKeyIStream.close();
-  fRemove(GConf.multKeyLocation);
   std::cout << "CLIENT: Relinearization keys from server deserialized." << std::endl;
 
-  std::ifstream rotKeyIStream(GConf.rotKeyLocation,
-			      std::ios::in | std::ios::binary);
-  if (!rotKeyIStream.is_open()) {
+  auto rotKeyReader = [&clientCC](std::istream &is) {
+    if (!clientCC->DeserializeEvalAutomorphismKey(is, SerType::BINARY)) {
+      std::cerr << "CLIENT: Could not deserialize eval rot key file"
+                << std::endl;
+      std::exit(1);
+    }
+    return true;
+  };
+  if (!readKey(GConf.rotKeyLocation, rotKeyReader)) {
     std::cerr << "CLIENT: Cannot read serialization from "
-              << GConf.multKeyLocation
+              << GConf.rotKeyLocation
               << std::endl;
     std::exit(1);
   }
 
-  if (!clientCC->DeserializeEvalAutomorphismKey(rotKeyIStream,
-                                                SerType::BINARY)) {
-    std::cerr << "CLIENT: Could not deserialize eval rot key file" << std::endl;
-    std::exit(1);
-  }
-  rotKeyIStream.close();
-  fRemove(GConf.rotKeyLocation);
-
   return std::make_tuple(clientCC, clientPublicKey);
 }
 
-CT receiveCT(const std::string location){
+CT receiveCT(Channel &channel, const std::string location){
   CT c1;
-  if (!Serial::DeserializeFromFile(location, c1,
-				   SerType::BINARY)) {
+  if (!channel.Receive(location, c1)) {
     std::cerr << "CLIENT: Cannot read serialization from " << location << std::endl;
-    removeLock(GConf.clientLock, GConf.CLIENT_LOCK);
+    if (GConf.clientLock) removeLock(GConf.clientLock, GConf.CLIENT_LOCK);
     std::exit(EXIT_FAILURE);
   }
-  fRemove(location);
   return c1;
 }
 
-void computeAndSendData(CryptoContext<DCRTPoly> &clientCC,
+// the server waits for every result, so a result that cannot be sent (e.g.
+// no room in the shm segment) ends the client
+void sendCT(Channel &channel, const std::string location, const CT &ct){
+  if (!channel.Send(location, ct)) {
+    std::cerr << "CLIENT: Cannot send serialization to " << location << std::endl;
+    if (GConf.clientLock) removeLock(GConf.clientLock, GConf.CLIENT_LOCK);
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+void computeAndSendData(Channel &channel,
+			CryptoContext<DCRTPoly> &clientCC,
 			CT &clientC1,
 			CT &clientC2,
 			LPPublicKey<DCRTPoly> &clientPublicKey) {
@@ -134,8 +159,9 @@ void computeAndSendData(CryptoContext<DCRTPoly> &clientCC,
   std::cout << "CLIENT: Applying operations on data" << std::endl;
   auto clientCiphertextMult = clientCC->EvalMult(clientC1, clientC2);
   auto clientCiphertextAdd = clientCC->EvalAdd(clientC1, clientC2);
-  auto clientCiphertextRot = clientCC->EvalAtIndex(clientC1, 1);
-  auto clientCiphertextRotNeg = clientCC->EvalAtIndex(clientC1, -1);
+  auto rotations = evalAtIndices(clientCC, clientC1, {1, -1});
+  auto clientCiphertextRot = rotations[0];
+  auto clientCiphertextRotNeg = rotations[1];
 
   // Now, we want to simulate a client who is encrypting data for the server to
   // decrypt. E.g weights of a machine learning algorithm
@@ -150,28 +176,88 @@ void computeAndSendData(CryptoContext<DCRTPoly> &clientCC,
   auto clientPlaintext1 = clientCC->MakeCKKSPackedPlaintext(clientVector1);
   auto clientInitiatedEncryption =
     clientCC->Encrypt(clientPublicKey, clientPlaintext1);
-  Serial::SerializeToFile(GConf.cipherMultLocation,
-			  clientCiphertextMult, SerType::BINARY);
-  Serial::SerializeToFile(GConf.cipherAddLocation,
-			  clientCiphertextAdd, SerType::BINARY);
-  Serial::SerializeToFile(GConf.cipherRotLocation,
-			  clientCiphertextRot, SerType::BINARY);
-  Serial::SerializeToFile(GConf.cipherRotNegLocation,
-			  clientCiphertextRotNeg, SerType::BINARY);
-  Serial::SerializeToFile(GConf.clientVectorLocation,
-			  clientInitiatedEncryption, SerType::BINARY);
+  sendCT(channel, GConf.cipherMultLocation, clientCiphertextMult);
+  sendCT(channel, GConf.cipherAddLocation, clientCiphertextAdd);
+  sendCT(channel, GConf.cipherRotLocation, clientCiphertextRot);
+  sendCT(channel, GConf.cipherRotNegLocation, clientCiphertextRotNeg);
+  sendCT(channel, GConf.clientVectorLocation, clientInitiatedEncryption);
+}
+/**
+ * runSession - the whole exchange with the server over a channel that needs
+ * no locks, each Receive() sleeps until the server has sent the object
+ */
+void runSession(Channel &channel, bool useKeyCache) {
+  std::cout << "CLIENT: Getting CryptoContext and keys" << std::endl;
+  auto ccAndPubKeyAsTuple = receiveCCAndKeys(channel, useKeyCache);
+  auto clientCC = std::get<CRYPTOCONTEXT_INDEX>(ccAndPubKeyAsTuple);
+  auto clientPublicKey = std::get<PUBLICKEY_INDEX>(ccAndPubKeyAsTuple);
+
+  std::cout << "CLIENT: Getting ciphertexts" << std::endl;
+  CT clientC1 = receiveCT(channel, GConf.cipherOneLocation);
+  CT clientC2 = receiveCT(channel, GConf.cipherTwoLocation);
+
+  std::cout << "CLIENT: Computing and sending results" << std::endl;
+  computeAndSendData(channel, clientCC, clientC1, clientC2, clientPublicKey);
+  std::cout << "CLIENT: Exiting" << std::endl;
 }
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
 
-int main() {
+int main(int argc, char *argv[]) {
+  int opt;
+  std::string mode("file");  // must match the -m of real_server
+  bool keyCache(false);  // must match the -k of real_server
+
+  while ((opt = getopt(argc, argv, "m:kh")) != -1) {
+    switch (opt) {
+      case 'm':
+        mode = optarg;
+        std::cout << "using " << mode << " channel" << std::endl;
+        break;
+      case 'k':
+        keyCache = true;
+        break;
+      case 'h':
+      default: /* '?' */
+        std::cerr << "Usage: " << std::endl
+                  << "arguments:" << std::endl
+                  << "  -m file|notify|spool|shm files and locks (default), "
+                  << "files and inotify, a job in the server's spool, or a "
+                  << "shared memory ring" << std::endl
+                  << "  -k map the evaluation keys from the server's key "
+                  << "cache" << std::endl
+                  << "  -h prints this message" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+  }
+  if (mode != "file" && mode != "notify" && mode != "spool" &&
+      mode != "shm") {
+    std::cerr << "-m must be file, notify, spool or shm" << std::endl;
+    exit(EXIT_FAILURE);
+  }
 
   // note GConf is a global structure defined in utils.h
   
   std::cout << "This program requires the subdirectory "
             << GConf.DATAFOLDER << "' to exist, otherwise you will get "
             << "an error writing serializations." << std::endl;
+
+  // the shm channel waits for the server to create the segment
+  auto channel = makeChannel(mode, false);
+  if (mode == "spool") {
+    // a job directory of our own, other clients can run at the same time
+    Spool spool(GConf.SPOOL_DIR, false);
+    auto id = spool.NewJob();
+    std::cout << "CLIENT: started " << id << std::endl;
+    JobChannel job(*channel, spool.Dir(id));
+    runSession(job, keyCache);
+    return 0;
+  }
+  if (mode != "file") {
+    runSession(*channel, keyCache);
+    return 0;
+  }
   /////////////////////////////////////////////////////////////////
   // Actual client work
   /////////////////////////////////////////////////////////////////
@@ -193,16 +279,16 @@ int main() {
   std::cout << "CLIENT: Acquired server lock. Getting serialized CryptoContext and keys" << std::endl;
 
 
-  auto ccAndPubKeyAsTuple = receiveCCAndKeys();
+  auto ccAndPubKeyAsTuple = receiveCCAndKeys(*channel, keyCache);
   auto clientCC = std::get<CRYPTOCONTEXT_INDEX>(ccAndPubKeyAsTuple);
   auto clientPublicKey = std::get<PUBLICKEY_INDEX>(ccAndPubKeyAsTuple);
   
   std::cout << "CLIENT: Getting ciphertexts" << std::endl;
-  CT clientC1 = receiveCT(GConf.cipherOneLocation);
-  CT clientC2 = receiveCT(GConf.cipherTwoLocation);
+  CT clientC1 = receiveCT(*channel, GConf.cipherOneLocation);
+  CT clientC2 = receiveCT(*channel, GConf.cipherTwoLocation);
 
   std::cout << "CLIENT: Computing and Serializing results" << std::endl;
-  computeAndSendData(clientCC, clientC1, clientC2, clientPublicKey);
+  computeAndSendData(*channel, clientCC, clientC1, clientC2, clientPublicKey);
 
   std::cout << "CLIENT: Releasing Server lock" << std::endl;
   releaseLock(GConf.serverLock,GConf.SERVER_LOCK);
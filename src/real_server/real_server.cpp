@@ -32,7 +32,18 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <getopt.h>
+
+#include <functional>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
 #include "utils.h"
+#include "channel.h"
+#include "packing.h"
+#include "key_cache.h"
+#include "spool.h"
 #include "palisade.h"
 //#include "utils/debug.h"
 
@@ -49,18 +60,43 @@ class Server {
    * scheme
    * @param scaleFactorBits - scaleFactor
    * @param batchSize - size of the batch
+   * @param channel - carries the objects to and from the client
+   * @param numPairs - number of vector pairs packed into the two ciphertexts
    */
-  Server(int multDepth, int scaleFactorBits, int batchSize);
+  Server(int multDepth, int scaleFactorBits, int batchSize, Channel &channel,
+         int numPairs = 1);
+
   /**
-   * sendCCAndKeys send the CryptoContext and keys to client
+   * A session of its own for one more client, with the crypto context and
+   * keys of server
+   * @param server - server to share the crypto context and keys with
+   * @param channel - carries the objects to and from this client
+   */
+  Server(const Server &server, Channel &channel);
+
+  /**
+   * slotsNeeded - batch size needed to pack numPairs pairs of vectors
+   * @param numPairs - number of vector pairs
+   */
+  static size_t slotsNeeded(int numPairs);
+  /**
+   * sendCCAndKeys send the CryptoContext and keys to client, the evaluation
+   * keys only if they are not in a key cache
    */
   void sendCCAndKeys(void);
 
+  /**
+   * cacheKeys - write the evaluation keys once to a key cache (key_cache.h)
+   * that clients run with -k map, instead of sending them to every client
+   * @param path - file of the cache
+   */
+  void cacheKeys(const std::string &path);
+
   /**
    * generateAndSendData - read from some internal location, encrypt then send it off
    * for some client to process
-   *    - in this case we write the data directly to a file (specified in
-   * GConfig)
+   *    - in this case we put the data in the channel under the locations
+   * specified in GConfig
    */
   void generateAndSendData(void);
 
@@ -80,19 +116,32 @@ class Server {
  private:
   /**
    * readData - reads data from a local source (in reality just generate it) 
-   * @return complex matrix of values of interest
+   * @return complex matrix of values of interest, the two vectors of each
+   * pair one after the other
    */
   complexMatrix readData(void);
 
   /**
    * packAndEncrypt - pack messages (into plaintexts) and encrypt them (into
-   * ciphertexts)
+   * ciphertexts). The first vectors of all pairs go side by side into one
+   * ciphertext, the second vectors into the other (see packing.h), so that
+   * the client works on all pairs at once.
    * @param matrixOfData - matrix of raw data, unpacked data. Likely directly
    * from a data lake
    * @return - a vector of ciphertexts (which are themselves like vectors)
    */
   ciphertextMatrix packAndEncrypt(const complexMatrix &matrixOfData);
 
+  /**
+   * verifyPacked - check the result for every pair packed in a ciphertext
+   * @param name - name of the result
+   * @param packed - decrypted result
+   * @param expected - function giving the expected values of pair i
+   * @return true if all pairs are correct
+   */
+  bool verifyPacked(const std::string &name, const Plaintext &packed,
+                    std::function<complexVector(int)> expected);
+
   /**
    * actually writeData contained in matrix
    * @param matrix
@@ -102,14 +151,34 @@ class Server {
 
   LPKeyPair<DCRTPoly> m_kp;
   CryptoContext<DCRTPoly> m_cc;
+  Channel &m_channel;
   int m_vectorSize = 0;
+  bool m_keysCached = false;  // evaluation keys are in the key cache
+
+  // rotations the client applies, the packed vectors are padded for them
+  static const int m_maxRotation = 2;
+  int m_numPairs;
+  PackingPlan m_plan;
+  // rotation keys of m_plan.Extract(), the server's own
+  std::shared_ptr<std::map<usint, LPEvalKey<DCRTPoly>>> m_extractKeys;
+  complexMatrix m_data;  // the vectors that were sent, to verify the results
 };
 
 /////////////////////////////////////////////////////////////////
 // Public Interface
 /////////////////////////////////////////////////////////////////
 
-Server::Server(int multDepth, int scaleFactorBits, int batchSize) {
+Server::Server(int multDepth, int scaleFactorBits, int batchSize,
+               Channel &channel, int numPairs)
+    : m_channel(channel),
+      m_numPairs(numPairs),
+      m_plan(batchSize, std::vector<size_t>(numPairs, VECTORSIZE),
+             m_maxRotation) {
+  if (m_plan.NumCiphertexts() != 1) {
+    std::cerr << "SERVER: " << numPairs << " vector pairs do not fit in a "
+              << "batch of " << batchSize << std::endl;
+    exit(EXIT_FAILURE);
+  }
   m_cc = CryptoContextFactory<DCRTPoly>::genCryptoContextCKKS(
       multDepth, scaleFactorBits, batchSize);
 
@@ -120,9 +189,24 @@ Server::Server(int multDepth, int scaleFactorBits, int batchSize) {
   m_kp = m_cc->KeyGen();
   m_cc->EvalMultKeyGen(m_kp.secretKey);
   m_cc->EvalAtIndexKeyGen(m_kp.secretKey, {1, 2, -1, -2});
+  m_extractKeys = m_plan.ExtractKeyGen(m_cc, m_kp.secretKey);
 
 }
 
+Server::Server(const Server &server, Channel &channel)
+    : m_kp(server.m_kp),
+      m_cc(server.m_cc),
+      m_channel(channel),
+      m_keysCached(server.m_keysCached),
+      m_numPairs(server.m_numPairs),
+      m_plan(server.m_plan),
+      m_extractKeys(server.m_extractKeys) {}
+
+size_t Server::slotsNeeded(int numPairs) {
+  return PackingPlan::SlotsNeeded(std::vector<size_t>(numPairs, VECTORSIZE),
+                                  m_maxRotation);
+}
+
 /**
  * generateAndSendData - process a request from a client and "send"
  * data over by writing to a location
@@ -142,12 +226,9 @@ void Server::receiveAndVerifyData(void) {
   // Receive the data and decrpyt all of it
   /////////////////////////////////////////////////////////////////
   if (m_vectorSize == 0) {
-    std::cerr << "SERVER: Must have sent data to client first ";
-    std::cerr
-        << "which initiates a vector size tracker (dimensionality of data)";
-    std::cerr << "for use in decryption."
-              << "\n";
-    exit(EXIT_FAILURE);
+    throw std::runtime_error(
+        "SERVER: Must have sent data to client first which initiates a vector "
+        "size tracker (dimensionality of data) for use in decryption.");
   }
   Ciphertext<DCRTPoly> serverCiphertextFromClient_Mult;
   Ciphertext<DCRTPoly> serverCiphertextFromClient_Add;
@@ -155,26 +236,22 @@ void Server::receiveAndVerifyData(void) {
   Ciphertext<DCRTPoly> serverCiphertextFromClient_RogNeg;
   Ciphertext<DCRTPoly> serverCiphertextFromClient_Vec;
 
-  Serial::DeserializeFromFile(GConf.cipherMultLocation,
-                              serverCiphertextFromClient_Mult, SerType::BINARY);
-  fRemove(GConf.cipherMultLocation);
-  
-  Serial::DeserializeFromFile(GConf.cipherAddLocation,
-                              serverCiphertextFromClient_Add, SerType::BINARY);
-  fRemove(GConf.cipherAddLocation);
-
-  Serial::DeserializeFromFile(GConf.cipherRotLocation,
-                              serverCiphertextFromClient_Rot, SerType::BINARY);
-  fRemove(GConf.cipherRotLocation);
-
-  Serial::DeserializeFromFile(GConf.cipherRotNegLocation,
-                              serverCiphertextFromClient_RogNeg,
-                              SerType::BINARY);
-  fRemove(GConf.cipherRotNegLocation);
-  
-  Serial::DeserializeFromFile(GConf.clientVectorLocation,
-                              serverCiphertextFromClient_Vec, SerType::BINARY);
-  fRemove(GConf.clientVectorLocation);
+  // with the shm and notify channels each Receive() sleeps until the client
+  // has sent that result
+  bool received =
+      m_channel.Receive(GConf.cipherMultLocation,
+                        serverCiphertextFromClient_Mult) &&
+      m_channel.Receive(GConf.cipherAddLocation,
+                        serverCiphertextFromClient_Add) &&
+      m_channel.Receive(GConf.cipherRotLocation,
+                        serverCiphertextFromClient_Rot) &&
+      m_channel.Receive(GConf.cipherRotNegLocation,
+                        serverCiphertextFromClient_RogNeg) &&
+      m_channel.Receive(GConf.clientVectorLocation,
+                        serverCiphertextFromClient_Vec);
+  if (!received) {
+    throw std::runtime_error("SERVER: Error receiving results from client");
+  }
   std::cout << "SERVER: Deserialized all processed encrypted data from client" << std::endl;
 
   Plaintext serverPlaintextFromClient_Mult;
@@ -198,34 +275,63 @@ void Server::receiveAndVerifyData(void) {
   // Retrive the values from the CKKS packed Values
   /////////////////////////////////////////////////////////////////
 
-  serverPlaintextFromClient_Mult->SetLength(m_vectorSize);
-  serverPlaintextFromClient_Add->SetLength(m_vectorSize);
   serverPlaintextFromClient_Vec->SetLength(m_vectorSize);
-  serverPlaintextFromClient_Rot->SetLength(m_vectorSize + 1);
-  serverPlaintextFromClient_RotNeg->SetLength(m_vectorSize + 1);
 
-  complexVector multExpected = {12.5, 27, 43.5, 62};
-  complexVector addExpected = {13.5, 15.5, 17.5, 19.5};
-  complexVector vecExpected = {1, 2, 3, 4};
-  complexVector rotExpected = {2, 3, 4, 0.0000, 0.00000};
-  complexVector negRotExpected = {0.00000, 1, 2, 3, 4};
-
-  auto multFlag = validateData(
-      serverPlaintextFromClient_Mult->GetCKKSPackedValue(), multExpected);
+  // each pair is checked in its own lane of the packed results, a rotation
+  // shifts in zeros from the padding of the lane
+  auto left = [this](int i) { return m_data[2 * i]; };
+  auto right = [this](int i) { return m_data[2 * i + 1]; };
+  auto multFlag = verifyPacked(
+      "Mult", serverPlaintextFromClient_Mult, [&](int i) {
+        complexVector v(m_vectorSize);
+        for (int j = 0; j < m_vectorSize; j++) v[j] = left(i)[j] * right(i)[j];
+        return v;
+      });
   std::cout << "Mult correct: " << (multFlag ? "Yes" : "No ") << "\n";
-  auto addFlag = validateData(
-      serverPlaintextFromClient_Add->GetCKKSPackedValue(), addExpected);
+  auto addFlag = verifyPacked(
+      "Add", serverPlaintextFromClient_Add, [&](int i) {
+        complexVector v(m_vectorSize);
+        for (int j = 0; j < m_vectorSize; j++) v[j] = left(i)[j] + right(i)[j];
+        return v;
+      });
   std::cout << "Add correct: " << (addFlag ? "Yes" : "No ") << "\n";
+  complexVector vecExpected = {1, 2, 3, 4};
   auto vecFlag = validateData(
       serverPlaintextFromClient_Vec->GetCKKSPackedValue(), vecExpected);
   std::cout << "Vec encryption correct: " << (vecFlag ? "Yes" : "No ") << "\n";
-  auto rotFlag = validateData(
-      serverPlaintextFromClient_Rot->GetCKKSPackedValue(), rotExpected);
+  auto rotFlag = verifyPacked(
+      "Rotation", serverPlaintextFromClient_Rot, [&](int i) {
+        complexVector v(m_vectorSize + 1);
+        for (int j = 0; j + 1 < m_vectorSize; j++) v[j] = left(i)[j + 1];
+        return v;
+      });
   std::cout << "Rotation correct: " << (rotFlag ? "Yes" : "No ") << "\n";
-  auto negRotFlag = validateData(
-      serverPlaintextFromClient_RotNeg->GetCKKSPackedValue(), negRotExpected);
+  auto negRotFlag = verifyPacked(
+      "Negative rotation", serverPlaintextFromClient_RotNeg, [&](int i) {
+        complexVector v(m_vectorSize + 1);
+        for (int j = 0; j < m_vectorSize; j++) v[j + 1] = left(i)[j];
+        return v;
+      });
   std::cout << "Negative rotation correct: " << (negRotFlag ? "Yes" : "No ")
             << "\n";
+
+  // the last pair once more, this time taken out of the packed sum before
+  // decryption
+  int last = m_numPairs - 1;
+  Plaintext extracted;
+  m_cc->Decrypt(m_kp.secretKey,
+                m_plan.Extract(m_cc, serverCiphertextFromClient_Add, last,
+                               *m_extractKeys),
+                &extracted);
+  extracted->SetLength(m_vectorSize);
+  complexVector extractExpected(m_vectorSize);
+  for (int j = 0; j < m_vectorSize; j++) {
+    extractExpected[j] = left(last)[j] + right(last)[j];
+  }
+  auto extractFlag =
+      validateData(extracted->GetCKKSPackedValue(), extractExpected);
+  std::cout << "Extracted add of pair " << last
+            << " correct: " << (extractFlag ? "Yes" : "No ") << "\n";
 }
 
 /////////////////////////////////////////////////////////////////
@@ -246,10 +352,17 @@ std::vector<std::vector<std::complex<double>>> Server::readData(void) {
 
   m_vectorSize = vec1.size();
 
-  return {
-      vec1,
-      vec2,
-  };
+  // further pairs are the first one shifted by the pair number
+  complexMatrix data;
+  for (int i = 0; i < m_numPairs; i++) {
+    complexVector a(vec1), b(vec2);
+    for (auto &x : a) x += double(i);
+    for (auto &x : b) x += double(i);
+    data.push_back(a);
+    data.push_back(b);
+  }
+  m_data = data;
+  return data;
 }
 
 /**
@@ -258,93 +371,109 @@ std::vector<std::vector<std::complex<double>>> Server::readData(void) {
  * @return
  */
 ciphertextMatrix Server::packAndEncrypt(const complexMatrix &matrixOfData) {
-  auto container =
-      ciphertextMatrix(matrixOfData.size(), Ciphertext<DCRTPoly>());
-
-  unsigned int ind = 0;
-  for (auto &v : matrixOfData) {
-    container[ind] =
-        m_cc->Encrypt(m_kp.publicKey, m_cc->MakeCKKSPackedPlaintext(v));
-    ind += 1;
+  complexMatrix lefts, rights;
+  for (size_t i = 0; i + 1 < matrixOfData.size(); i += 2) {
+    lefts.push_back(matrixOfData[i]);
+    rights.push_back(matrixOfData[i + 1]);
+  }
+
+  ciphertextMatrix container;
+  for (auto &side : {lefts, rights}) {
+    auto slots = m_plan.Pack(side);
+    container.push_back(m_cc->Encrypt(
+        m_kp.publicKey, m_cc->MakeCKKSPackedPlaintext(slots[0])));
   }
+  std::cout << "SERVER: packed " << lefts.size() << " vector pairs into "
+            << container.size() << " ciphertexts" << std::endl;
   return container;
 }
 
+bool Server::verifyPacked(const std::string &name, const Plaintext &packed,
+                          std::function<complexVector(int)> expected) {
+  auto slots = packed->GetCKKSPackedValue();
+  bool correct = true;
+  for (int i = 0; i < m_numPairs; i++) {
+    auto want = expected(i);
+    if (!validateData(m_plan.Unpack(slots, i, want.size()), want)) {
+      std::cout << "SERVER: " << name << " wrong for pair " << i << "\n";
+      correct = false;
+    }
+  }
+  return correct;
+}
+
 /**
- * sendCCAndKeys - send the cc and keys specified locations.
+ * sendCCAndKeys - send the cc and keys under the specified locations.
  * @param conf
  */
 void Server::sendCCAndKeys(void) {
 
   std::cout << "SERVER: sending cryptocontext" << std::endl;
-  if (!Serial::SerializeToFile(GConf.ccLocation, m_cc,
-                               SerType::BINARY)) {
-    std::cerr << "Error writing serialization of the crypto context to "
-                 "cryptocontext.txt"
-              << std::endl;
-    std::exit(1);
+  if (!m_channel.Send(GConf.ccLocation, m_cc)) {
+    throw std::runtime_error(
+        "Error writing serialization of the crypto context to "
+        "cryptocontext.txt");
   }
 
   std::cout << "SERVER: sending Public key" << std::endl;
-  if (!Serial::SerializeToFile(GConf.pubKeyLocation,
-                               m_kp.publicKey, SerType::BINARY)) {
-    std::cerr << "Exception writing public key to pubkey.txt" << std::endl;
-    std::exit(1);
+  if (!m_channel.Send(GConf.pubKeyLocation, m_kp.publicKey)) {
+    throw std::runtime_error("Exception writing public key to pubkey.txt");
   }
 
+  if (m_keysCached) return;
+
   std::cout << "SERVER: sending EvalMult/reliniarization key" << std::endl;
-  std::ofstream multKeyFile(GConf.multKeyLocation,
-                            std::ios::out | std::ios::binary);
-  if (multKeyFile.is_open()) {
-    if (!m_cc->SerializeEvalMultKey(multKeyFile, SerType::BINARY)) {
-      std::cerr << "SERVER: Error writing eval mult keys" << std::endl;
-      std::exit(1);
-    }
-    multKeyFile.close();
-  } else {
-    std::cerr << "SERVER: Error serializing EvalMult keys" << std::endl;
-    std::exit(1);
+  auto multKeyWriter = [this](std::ostream &os) {
+    return m_cc->SerializeEvalMultKey(os, SerType::BINARY);
+  };
+  if (!m_channel.Write(GConf.multKeyLocation, multKeyWriter)) {
+    throw std::runtime_error("SERVER: Error serializing EvalMult keys");
   }
 
   std::cout << "SERVER: sending Rotation keys" << std::endl;
-  std::ofstream rotationKeyFile(GConf.rotKeyLocation,
-                                std::ios::out | std::ios::binary);
-  if (rotationKeyFile.is_open()) {
-    if (!m_cc->SerializeEvalAutomorphismKey(rotationKeyFile, SerType::BINARY)) {
-      std::cerr << "SERVER: Error writing rotation keys" << std::endl;
-      std::exit(1);
-    }
-    rotationKeyFile.close();
-  } else {
-    std::cerr << "SERVER: Error serializing Rotation keys" << std::endl;
-    std::exit(1);
+  auto rotationKeyWriter = [this](std::ostream &os) {
+    return m_cc->SerializeEvalAutomorphismKey(os, SerType::BINARY);
+  };
+  if (!m_channel.Write(GConf.rotKeyLocation, rotationKeyWriter)) {
+    throw std::runtime_error("SERVER: Error serializing Rotation keys");
+  }
+}
+void Server::cacheKeys(const std::string &path) {
+  std::cout << "SERVER: writing evaluation keys to " << path << std::endl;
+  auto multKeyWriter = [this](std::ostream &os) {
+    return m_cc->SerializeEvalMultKey(os, SerType::BINARY);
+  };
+  auto rotationKeyWriter = [this](std::ostream &os) {
+    return m_cc->SerializeEvalAutomorphismKey(os, SerType::BINARY);
+  };
+  if (!KeyCache::Create(path, {{GConf.multKeyLocation, multKeyWriter},
+                               {GConf.rotKeyLocation, rotationKeyWriter}})) {
+    throw std::runtime_error("SERVER: Error writing the key cache " + path);
   }
+  m_keysCached = true;
 }
 /**
- * writeData - write a matrix of data to the specified locations.
+ * writeData - send a matrix of data under the specified locations.
  * @param conf
  * @Param matrix
  */
 void Server::writeData(const ciphertextMatrix &matrix) {
 
   std::cout << "SERVER: sending encrypted data" << std::endl;
-  if (!Serial::SerializeToFile(GConf.cipherOneLocation,
-                               matrix[0], SerType::BINARY)) {
-    std::cerr << "SERVER: Error writing ciphertext 1" << std::endl;
-    std::exit(1);
+  if (!m_channel.Send(GConf.cipherOneLocation, matrix[0])) {
+    throw std::runtime_error("SERVER: Error writing ciphertext 1");
   }
 
   std::cout << "SERVER: ciphertext1 serialized" << std::endl;
-  if (!Serial::SerializeToFile(GConf.cipherTwoLocation,
-                               matrix[1], SerType::BINARY)) {
-    std::cerr << "SERVER: Error writing ciphertext 2" << std::endl;
-    std::exit(1);
-  };
+  if (!m_channel.Send(GConf.cipherTwoLocation, matrix[1])) {
+    throw std::runtime_error("SERVER: Error writing ciphertext 2");
+  }
   std::cout << "SERVER: ciphertext2 serialized" << std::endl;
 }
 
 /**
- * cleanupFiles - removes all files from the system
+ * cleanupFiles - removes all files from the system, except the key cache
+ * that is written before the startup cleanup
  * @param none
  */
 void Server::cleanupFiles(void) {
@@ -364,7 +493,85 @@ void Server::cleanupFiles(void) {
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
-int main() {
+/**
+ * serve - the server, main() reports the errors it throws
+ */
+int serve(int argc, char *argv[]) {
+  int opt;
+  int numPairs(1);  // vector pairs packed into each ciphertext
+  std::string mode("file");  // how objects move to and from the client
+  // spool mode: worker threads, and sessions to serve before exiting (0 for
+  // no limit)
+  int numWorkers(std::max(1u, std::thread::hardware_concurrency()));
+  int numSessions(0);
+  bool keyCache(false);  // evaluation keys go to a key cache
+  // notify and spool modes: seconds to wait for each object of the client
+  // before the session fails, 0 for no limit. A spool job's client is
+  // already running, so spool sessions give up after 300 by default.
+  int waitSeconds(-1);
+
+  while ((opt = getopt(argc, argv, "n:m:w:s:t:kh")) != -1) {
+    switch (opt) {
+      case 'n':
+        numPairs = atoi(optarg);
+        std::cout << "packing " << numPairs << " vector pairs" << std::endl;
+        break;
+      case 'm':
+        mode = optarg;
+        std::cout << "using " << mode << " channel" << std::endl;
+        break;
+      case 'w':
+        numWorkers = atoi(optarg);
+        std::cout << "serving with " << numWorkers << " workers" << std::endl;
+        break;
+      case 's':
+        numSessions = atoi(optarg);
+        std::cout << "serving " << numSessions << " sessions" << std::endl;
+        break;
+      case 't':
+        waitSeconds = atoi(optarg);
+        std::cout << "waiting " << waitSeconds << "s for each object"
+                  << std::endl;
+        break;
+      case 'k':
+        keyCache = true;
+        std::cout << "caching keys in " << GConf.keyCacheLocation
+                  << std::endl;
+        break;
+      case 'h':
+      default: /* '?' */
+        std::cerr << "Usage: " << std::endl
+                  << "arguments:" << std::endl
+                  << "  -n number of vector pairs to pack into the ciphertexts"
+                  << std::endl
+                  << "  -m file|notify|spool|shm files and locks (default), "
+                  << "files and inotify, a spool of client jobs, or a "
+                  << "shared memory ring" << std::endl
+                  << "  -w number of workers serving spool jobs" << std::endl
+                  << "  -s number of spool jobs to serve, 0 (default) for "
+                  << "no limit" << std::endl
+                  << "  -t seconds to wait for each object of a client in "
+                  << "notify, spool and shm modes, 0 for no limit (default "
+                  << "300 for spool, no limit otherwise)" << std::endl
+                  << "  -k write the evaluation keys once to a key cache "
+                  << "for clients run with -k" << std::endl
+                  << "  -h prints this message" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+  }
+  if (numPairs < 1) {
+    std::cerr << "-n must be at least 1" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (mode != "file" && mode != "notify" && mode != "spool" &&
+      mode != "shm") {
+    std::cerr << "-m must be file, notify, spool or shm" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (numWorkers < 1 || numSessions < 0) {
+    std::cerr << "-w must be at least 1 and -s at least 0" << std::endl;
+    exit(EXIT_FAILURE);
+  }
 
   std::cout << "This program requres the subdirectory `"
             << GConf.DATAFOLDER << "' to exist, otherwise you will get "
@@ -375,10 +582,90 @@ int main() {
   
   const int multDepth = 5;
   const int scaleFactorBits = 40;
-  const usint batchSize = 32;
-  Server server = Server(multDepth, scaleFactorBits, batchSize);
+  // a power of two with room for all pairs, and at least the 32 slots the
+  // single pair example has always used
+  usint batchSize = 32;
+  while (batchSize < Server::slotsNeeded(numPairs)) batchSize *= 2;
+  // the ring dimension follows from the depth and the security level, a
+  // context has at most half of it as slots
+  usint ringDim = CryptoContextFactory<DCRTPoly>::genCryptoContextCKKS(
+                      multDepth, scaleFactorBits, 32)->GetRingDimension();
+  if (batchSize > ringDim / 2) {
+    std::cerr << "-n " << numPairs << " needs a batch of " << batchSize
+              << " slots, the context has " << ringDim / 2 << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  // the shm channel makes a fresh segment, removing one left from a crash
+  if (waitSeconds < 0) waitSeconds = mode == "spool" ? 300 : 0;
+  auto channel = makeChannel(mode, true, waitSeconds);
+  Server server =
+      Server(multDepth, scaleFactorBits, batchSize, *channel, numPairs);
+  // before any client is sent the context, so none maps a stale cache. The
+  // stray file cleanup below leaves the cache alone.
+  if (keyCache) {
+    server.cacheKeys(GConf.keyCacheLocation);
+  } else {
+    fRemove(GConf.keyCacheLocation);
+  }
   TIC(t);
 
+  if (mode == "spool") {
+    // every client makes a job directory in the spool, each job is served
+    // by a worker with a session of its own over the same keys
+    Spool spool(GConf.SPOOL_DIR, true);
+    std::cout << "SERVER: waiting for jobs in " << GConf.SPOOL_DIR
+              << std::endl;
+    boost::asio::thread_pool workers(numWorkers);
+    for (int served = 0; numSessions == 0 || served < numSessions; served++) {
+      auto id = spool.NextJob();
+      std::cout << "SERVER: starting " << id << std::endl;
+      boost::asio::post(workers, [&server, &channel, &spool, id]() {
+        // a failed job only ends its own session
+        try {
+          JobChannel job(*channel, spool.Dir(id));
+          Server session(server, job);
+          session.sendCCAndKeys();
+          session.generateAndSendData();
+          session.receiveAndVerifyData();
+          std::cout << "SERVER: finished " << id << std::endl;
+        } catch (std::exception &e) {
+          std::cerr << "SERVER: " << id << " failed: " << e.what()
+                    << std::endl;
+        }
+        spool.Finish(id);
+      });
+    }
+    workers.join();
+
+    std::cout << "SERVER: Exiting" << std::endl;
+    double totalTimeMSec = TOC_MS(t);
+    std::cout << "SERVER: Total time: " << totalTimeMSec << " mSec"
+              << std::endl;
+    return 0;
+  }
+
+  if (mode != "file") {
+    // no locks, the client's Receive() calls wait for the objects and ours
+    // wait for its results. Files left from a crash would be taken for new
+    // ones, the shm segment is always fresh.
+    if (mode == "notify") {
+      std::cout << "SERVER: Cleaning up stray files" << std::endl;
+      server.cleanupFiles();
+    }
+    std::cout << "SERVER: computing crypto context and keys" << std::endl;
+    server.sendCCAndKeys();
+    server.generateAndSendData();
+
+    std::cout << "SERVER: Receive and Verify data" << std::endl;
+    server.receiveAndVerifyData();
+
+    std::cout << "SERVER: Exiting" << std::endl;
+    double totalTimeMSec = TOC_MS(t);
+    std::cout << "SERVER: Total time: " << totalTimeMSec << " mSec"
+              << std::endl;
+    return 0;
+  }
+
   // clean up any stray files left from a previous crash!
 
   std::cout << "SERVER: Cleaning up stray files" << std::endl;
@@ -409,10 +696,21 @@ int main() {
 
   std::cout << "SERVER: Cleaning up stray files and locks" << std::endl;
   server.cleanupFiles();
+  fRemove(GConf.keyCacheLocation);
 
   removeLock(GConf.serverLock, GConf.SERVER_LOCK);
   removeLock(GConf.clientLock, GConf.CLIENT_LOCK);
   std::cout << "SERVER: Exiting" << std::endl;
   double totalTimeMSec = TOC_MS(t);
   std::cout << "SERVER: Total time: " << totalTimeMSec << " mSec" << std::endl;  
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    return serve(argc, argv);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
 }
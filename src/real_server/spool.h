@@ -0,0 +1,167 @@
+// @file spool.h - a spool directory of per-client job directories, so
+//    that real_server can serve many real_client sessions at once
+// @author: Ian Quah, David Cousins
+// TPOC: contact@palisade-crypto.org
+
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef REAL_SERVER_SPOOL_H
+#define REAL_SERVER_SPOOL_H
+
+#include "channel.h"
+
+#include <filesystem>
+
+/**
+ * JobChannel - a Channel for one job. It keeps the object names of GConf
+ * but moves each object into the job's own directory, so that the sessions
+ * of several clients never share a file.
+ */
+class JobChannel : public Channel {
+ public:
+  /**
+   * @param channel - the channel that does the work (a NotifyChannel)
+   * @param dir - the job directory
+   */
+  JobChannel(Channel &channel, const std::string &dir)
+      : m_channel(channel), m_dir(dir) {}
+
+  bool Put(const std::string &name, const std::string &bytes) override {
+    return m_channel.Put(path(name), bytes);
+  }
+  bool Take(const std::string &name, std::string &bytes) override {
+    return m_channel.Take(path(name), bytes);
+  }
+  bool Write(const std::string &name, const Writer &writer) override {
+    return m_channel.Write(path(name), writer);
+  }
+  bool Read(const std::string &name, const Reader &reader) override {
+    return m_channel.Read(path(name), reader);
+  }
+
+ private:
+  std::string path(const std::string &name) const {
+    return m_dir + "/" + std::filesystem::path(name).filename().string();
+  }
+
+  Channel &m_channel;
+  std::string m_dir;
+};
+
+/**
+ * Spool - the directory clients make their job directories in.
+ *
+ * A client starts a job by making a directory named after its job id, the
+ * server is woken by inotify, hands the job to a worker and removes the
+ * directory once the session is over. The objects of a job move through a
+ * JobChannel over a NotifyChannel.
+ */
+class Spool {
+ public:
+  /**
+   * @param dir - the spool directory
+   * @param create - true for the server, which empties the spool of jobs
+   * left from a crash. Clients wait for the server to make it.
+   */
+  Spool(const std::string &dir, bool create) : m_dir(dir), m_fd(-1) {
+    if (create) {
+      std::filesystem::remove_all(dir);
+      std::filesystem::create_directories(dir);
+      m_fd = inotify_init1(IN_CLOEXEC);
+      if (m_fd < 0 || inotify_add_watch(m_fd, dir.c_str(),
+                                        IN_CREATE | IN_MOVED_TO) < 0) {
+        throw std::runtime_error("Spool: cannot watch " + dir);
+      }
+    } else {
+      while (!std::filesystem::is_directory(dir)) {
+        std::cout << "waiting for " << dir << " to be created" << std::endl;
+        nap(100);
+      }
+    }
+  }
+
+  ~Spool() {
+    if (m_fd >= 0) close(m_fd);
+  }
+
+  Spool(const Spool &) = delete;
+  Spool &operator=(const Spool &) = delete;
+
+  /**
+   * NewJob - (client) start a job with a fresh job id
+   * @return the job id
+   */
+  std::string NewJob(void) {
+    static unsigned count = 0;
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    std::string id =
+        "job-" + std::to_string(getpid()) + "-" +
+        std::to_string(
+            std::chrono::duration_cast<std::chrono::microseconds>(now)
+                .count()) +
+        "-" + std::to_string(count++);
+    // inotify tells the server about the new directory
+    std::filesystem::create_directory(Dir(id));
+    return id;
+  }
+
+  /**
+   * NextJob - (server) wait for a client to start a job
+   * @return the job id
+   */
+  std::string NextJob(void) {
+    alignas(struct inotify_event) char buf[4096];
+    while (m_ready.empty()) {
+      ssize_t len = read(m_fd, buf, sizeof(buf));
+      if (len <= 0) throw std::runtime_error("Spool: cannot read " + m_dir);
+      for (char *p = buf; p < buf + len;) {
+        auto event = reinterpret_cast<struct inotify_event *>(p);
+        if (event->len && (event->mask & IN_ISDIR)) {
+          m_ready.push_back(event->name);
+        }
+        p += sizeof(struct inotify_event) + event->len;
+      }
+    }
+    auto id = m_ready.front();
+    m_ready.erase(m_ready.begin());
+    return id;
+  }
+
+  /**
+   * Dir - the directory of a job
+   */
+  std::string Dir(const std::string &id) const { return m_dir + "/" + id; }
+
+  /**
+   * Finish - (server) remove the directory of a finished job
+   */
+  void Finish(const std::string &id) {
+    std::error_code ec;
+    std::filesystem::remove_all(Dir(id), ec);
+  }
+
+ private:
+  std::string m_dir;
+  int m_fd;
+  std::vector<std::string> m_ready;  // jobs read from inotify, not started
+};
+
+#endif  // REAL_SERVER_SPOOL_H
@@ -44,6 +44,9 @@
 #include <fstream>
 #include <thread>
 #include <cstring>
+#include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
 #include <boost/interprocess/sync/named_mutex.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
 
@@ -78,6 +81,7 @@ struct Configs {
   std::string pubKeyLocation = DATAFOLDER + "/key_pub.txt";    // Pub key
   std::string multKeyLocation = DATAFOLDER + "/key_mult.txt";  // relinearization key
   std::string rotKeyLocation = DATAFOLDER + "/key_rot.txt";    // automorphism / rotation key
+  std::string keyCacheLocation = DATAFOLDER + "/key_cache.bin";  // both, for -k
   
   // Save-load locations for RAW ciphertexts
   std::string cipherOneLocation = DATAFOLDER + "/ciphertext1.txt";
@@ -90,6 +94,14 @@ struct Configs {
   std::string cipherRotNegLocation = DATAFOLDER + "/ciphertextRotNegLocation.txt";
   std::string clientVectorLocation = DATAFOLDER + "/ciphertextVectorFromClient.txt";
   
+  // shared memory segment of the shm channel (channel.h), it must hold all
+  // the objects that are in flight at once, the keys are the biggest
+  const std::string SHM_NAME = "real_server_shm";
+  const size_t SHM_SIZE = size_t(512) << 20;
+
+  // spool of per-client job directories (spool.h)
+  std::string SPOOL_DIR = DATAFOLDER + "/spool";
+
   const std::string SERVER_LOCK = "s_lock";
   const std::string CLIENT_LOCK = "c_lock";
 
@@ -143,6 +155,33 @@ void displayVectors(T v1, T v2) {
   }
 }
 
+/**
+ * evalAtIndices - rotate one ciphertext by each of a list of indices, like
+ * calling EvalAtIndex once per index but much cheaper. The digit
+ * decomposition of ct, the expensive part of a rotation, is computed once
+ * with EvalFastRotationPrecompute and shared by an EvalFastRotation per
+ * index. The rotations run in parallel.
+ * @param cc - crypto context with rotation keys for all the indices
+ * @param ct - ciphertext to rotate
+ * @param indices - rotations, negative to rotate right
+ * @return one ciphertext per index, in the order of indices
+ */
+std::vector<Ciphertext<DCRTPoly>> evalAtIndices(
+    const CryptoContext<DCRTPoly> &cc, const Ciphertext<DCRTPoly> &ct,
+    const std::vector<int32_t> &indices) {
+  auto digits = cc->EvalFastRotationPrecompute(ct);
+  usint m = cc->GetCyclotomicOrder();
+  std::vector<Ciphertext<DCRTPoly>> rotated(indices.size());
+  // EvalFastRotation takes the index unsigned and reads it back as signed,
+  // so negative indices work as they do for EvalAtIndex
+#pragma omp parallel for
+  for (size_t i = 0; i < indices.size(); i++) {
+    rotated[i] =
+        cc->EvalFastRotation(ct, static_cast<usint>(indices[i]), m, digits);
+  }
+  return rotated;
+}
+
 /////////////////////////////////////////////////////////////////
 // Synchronization material
 //  - uses mutex "locks" to coordinate the two processes
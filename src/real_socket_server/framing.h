@@ -0,0 +1,307 @@
+// @file framing.h - length prefixed frames over a tcp socket, used by the
+//    real_socket_server example. Does not need PALISADE.
+// @author: Ian Quah, David Cousins
+// TPOC: contact@palisade-crypto.org
+
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef REAL_SOCKET_FRAMING_H
+#define REAL_SOCKET_FRAMING_H
+
+#include <array>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "uring.h"
+
+using boost::asio::ip::tcp;
+
+// build with -DREAL_SOCKET_DEBUG for a line per frame, nothing is printed
+// on the data path otherwise
+#ifdef REAL_SOCKET_DEBUG
+#define FRAME_LOG(x) (std::cout << x << std::endl)
+#else
+#define FRAME_LOG(x) ((void)0)
+#endif
+
+// kernel buffer size asked for in each direction
+const int FRAME_SOCKET_BUFFER = 4 << 20;
+
+/**
+ * tuneSocket - send small frames at once instead of waiting for more data
+ * (TCP_NODELAY), and give the socket buffers large enough for a key. Only
+ * a tuning, the socket works without it.
+ * @param s connected socket
+ * @return false if an option could not be set
+ */
+inline bool tuneSocket(tcp::socket &s) {
+  boost::system::error_code ec1, ec2, ec3;
+  s.set_option(tcp::no_delay(true), ec1);
+  s.set_option(boost::asio::socket_base::send_buffer_size(FRAME_SOCKET_BUFFER),
+               ec2);
+  s.set_option(
+      boost::asio::socket_base::receive_buffer_size(FRAME_SOCKET_BUFFER), ec3);
+  return !ec1 && !ec2 && !ec3;
+}
+
+/**
+ * writeAll - write all of buffers, a large write goes through io_uring
+ * (uring.h) when the thread can have a ring
+ */
+template <typename Buffers>
+inline void writeAll(tcp::socket &s, const Buffers &buffers) {
+  UringTransport *ring = nullptr;
+  if (boost::asio::buffer_size(buffers) >= UringTransport::MIN_BYTES) {
+    ring = UringTransport::get();
+  }
+  if (!ring) {
+    boost::asio::write(s, buffers);
+    return;
+  }
+  std::vector<UringTransport::Span> spans;
+  for (auto it = boost::asio::buffer_sequence_begin(buffers);
+       it != boost::asio::buffer_sequence_end(buffers); ++it) {
+    spans.push_back({it->data(), it->size()});
+  }
+  if (!ring->write(s.native_handle(), spans)) {
+    throw std::runtime_error("writeAll: io_uring write failed");
+  }
+}
+
+/**
+ * readAll - read exactly size bytes, a large read goes through io_uring
+ * when the thread can have a ring
+ */
+inline void readAll(tcp::socket &s, char *data, size_t size) {
+  UringTransport *ring = nullptr;
+  if (size >= UringTransport::MIN_BYTES) ring = UringTransport::get();
+  if (!ring) {
+    boost::asio::read(s, boost::asio::buffer(data, size));
+    return;
+  }
+  if (!ring->read(s.native_handle(), data, size)) {
+    throw std::runtime_error("readAll: io_uring read failed");
+  }
+}
+
+/**
+ * sendFrame - a size_t length then size bytes at data, in one gathered
+ * write that loops until all of it is sent
+ * @param s socket to send over
+ * @param data bytes to send
+ * @param size number of bytes
+ */
+inline void sendFrame(tcp::socket &s, const void *data, size_t size) {
+  std::array<boost::asio::const_buffer, 2> buffers = {
+      boost::asio::buffer(&size, sizeof(size)),
+      boost::asio::buffer(data, size)};
+  writeAll(s, buffers);
+  FRAME_LOG("sent frame of " << size << " bytes");
+}
+
+/**
+ * sendFrame - the readable bytes of a streambuf as one frame
+ */
+inline void sendFrame(tcp::socket &s, boost::asio::streambuf &b) {
+  auto data = b.data();
+  std::vector<boost::asio::const_buffer> buffers;
+  size_t size = b.size();
+  buffers.push_back(boost::asio::buffer(&size, sizeof(size)));
+  for (auto it = boost::asio::buffer_sequence_begin(data);
+       it != boost::asio::buffer_sequence_end(data); ++it) {
+    buffers.push_back(*it);
+  }
+  writeAll(s, buffers);
+  b.consume(size);
+  FRAME_LOG("sent frame of " << size << " bytes");
+}
+
+/**
+ * batchBuffers - the buffers of a batch frame: one frame holding the number
+ * of items, then a size_t length and the bytes of each item
+ * @param items - the items, must live until the write is done
+ * @param header - filled with the lengths, must live until the write is
+ * done
+ * @return buffers for one gathered write
+ */
+inline std::vector<boost::asio::const_buffer> batchBuffers(
+    const std::vector<std::string> &items, std::vector<size_t> &header) {
+  // frame length, item count, then the length of each item
+  header.assign(2 + items.size(), 0);
+  header[0] = sizeof(size_t) * (1 + items.size());
+  header[1] = items.size();
+  for (size_t i = 0; i < items.size(); i++) {
+    header[2 + i] = items[i].size();
+    header[0] += items[i].size();
+  }
+  std::vector<boost::asio::const_buffer> buffers = {
+      boost::asio::buffer(&header[0], sizeof(size_t)),
+      boost::asio::buffer(&header[1], sizeof(size_t))};
+  for (size_t i = 0; i < items.size(); i++) {
+    buffers.push_back(boost::asio::buffer(&header[2 + i], sizeof(size_t)));
+    buffers.push_back(boost::asio::buffer(items[i]));
+  }
+  return buffers;
+}
+
+/**
+ * sendBatch - items as one batch frame, in one gathered write
+ */
+inline void sendBatch(tcp::socket &s, const std::vector<std::string> &items) {
+  std::vector<size_t> header;
+  writeAll(s, batchBuffers(items, header));
+  FRAME_LOG("sent batch of " << items.size() << " items");
+}
+
+/**
+ * sendTagged - a frame starting with a uint32_t tag, for results that are
+ * sent in the order they are ready rather than a fixed one
+ */
+inline void sendTagged(tcp::socket &s, uint32_t tag, const std::string &bytes) {
+  size_t size = sizeof(tag) + bytes.size();
+  std::array<boost::asio::const_buffer, 3> buffers = {
+      boost::asio::buffer(&size, sizeof(size)),
+      boost::asio::buffer(&tag, sizeof(tag)), boost::asio::buffer(bytes)};
+  writeAll(s, buffers);
+  FRAME_LOG("sent frame " << tag << " of " << bytes.size() << " bytes");
+}
+
+/**
+ * splitTag - take the tag off the front of a tagged frame
+ * @param frame - payload of a tagged frame, the bytes after the tag are
+ * left
+ * @return the tag
+ */
+inline uint32_t splitTag(std::string &frame) {
+  uint32_t tag;
+  if (frame.size() < sizeof(tag)) {
+    throw std::runtime_error("splitTag: frame too short");
+  }
+  std::memcpy(&tag, frame.data(), sizeof(tag));
+  frame.erase(0, sizeof(tag));
+  return tag;
+}
+
+/**
+ * FrameReader - receives frames into one buffer that is kept from frame to
+ * frame, it only grows when a frame is bigger than any before it
+ */
+class FrameReader {
+ public:
+  /**
+   * read - receive the next frame
+   * @param s socket to receive from
+   * @return stream over the frame, good until the next read
+   */
+  std::istream &read(tcp::socket &s) {
+    size_t size;
+    boost::asio::read(s, boost::asio::buffer(&size, sizeof(size)));
+    if (size > m_buffer.size()) m_buffer.resize(size);
+    readAll(s, m_buffer.data(), size);
+    FRAME_LOG("read frame of " << size << " bytes");
+    m_size = size;
+    return stream(0, size);
+  }
+
+  /**
+   * readBatch - receive the next frame, a batch sent by sendBatch()
+   * @return the number of items, see item()
+   */
+  size_t readBatch(tcp::socket &s) {
+    read(s);
+    m_items.clear();
+    size_t offset = 0, count;
+    if (!take(offset, count)) throw std::runtime_error("readBatch: no count");
+    for (size_t i = 0; i < count; i++) {
+      size_t length;
+      if (!take(offset, length) || length > m_size - offset) {
+        throw std::runtime_error("readBatch: item past the frame");
+      }
+      m_items.push_back({offset, length});
+      offset += length;
+    }
+    return count;
+  }
+
+  /**
+   * item - stream over item i of the last batch, good until the next read
+   */
+  std::istream &item(size_t i) {
+    auto &place = m_items.at(i);
+    return stream(place.first, place.second);
+  }
+
+  /**
+   * readTagged - receive the next frame, sent by sendTagged()
+   * @param tag - set to the tag of the frame
+   * @return stream over the bytes after the tag, good until the next read
+   */
+  std::istream &readTagged(tcp::socket &s, uint32_t &tag) {
+    read(s);
+    if (m_size < sizeof(tag)) throw std::runtime_error("readTagged: no tag");
+    std::memcpy(&tag, m_buffer.data(), sizeof(tag));
+    return stream(sizeof(tag), m_size - sizeof(tag));
+  }
+
+ private:
+  // reads in place from the buffer
+  class FrameBuf : public std::streambuf {
+   public:
+    void reset(char *data, size_t size) { setg(data, data, data + size); }
+  };
+
+  std::istream &stream(size_t offset, size_t size) {
+    m_streambuf.reset(m_buffer.data() + offset, size);
+    m_stream.clear();
+    return m_stream;
+  }
+
+  // a size_t at offset in the last frame, offset moves past it
+  bool take(size_t &offset, size_t &value) {
+    if (m_size - offset < sizeof(value)) return false;
+    std::memcpy(&value, m_buffer.data() + offset, sizeof(value));
+    offset += sizeof(value);
+    return true;
+  }
+
+  std::vector<char> m_buffer;
+  size_t m_size = 0;  // bytes of the last frame in m_buffer
+  std::vector<std::pair<size_t, size_t>> m_items;  // offset, length
+  FrameBuf m_streambuf;
+  std::istream m_stream{&m_streambuf};
+};
+
+/**
+ * frameReader - the FrameReader of the calling thread
+ */
+inline FrameReader &frameReader(void) {
+  thread_local FrameReader reader;
+  return reader;
+}
+
+#endif  // REAL_SOCKET_FRAMING_H
@@ -0,0 +1,153 @@
+// @file real_socket_bench.cpp - throughput of the frames of framing.h over
+//    loopback, in MB/s. Does not need PALISADE.
+// @author: Ian Quah, David Cousins
+// TPOC: contact@palisade-crypto.org
+
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <getopt.h>
+
+#include <chrono>
+#include <thread>
+
+#include "framing.h"
+
+/**
+ * sendLegacy - a frame the way utils_socket.h used to send one: the length
+ * and the data in two send() calls, short writes not retried
+ */
+void sendLegacy(tcp::socket &s, const std::vector<char> &payload) {
+  size_t size = payload.size();
+  s.send(boost::asio::buffer(&size, sizeof(size)));
+  s.send(boost::asio::buffer(payload));
+}
+
+/**
+ * readLegacy - a frame the way utils_socket.h used to read one, into a
+ * fresh streambuf
+ */
+size_t readLegacy(tcp::socket &s) {
+  size_t size;
+  boost::asio::read(s, boost::asio::buffer(&size, sizeof(size)));
+  boost::asio::streambuf b(size);
+  return boost::asio::read(s, b);
+}
+
+/**
+ * pump - send count frames and read count frames on one socket, each
+ * direction on a thread of its own, so both directions are busy at once
+ * @param duplex - false to only send
+ */
+void pump(tcp::socket &s, const std::vector<char> &payload, int count,
+          bool duplex, bool legacy) {
+  std::thread reader;
+  if (duplex) {
+    reader = std::thread([&s, count, legacy]() {
+      FrameReader frames;
+      for (int i = 0; i < count; i++) {
+        legacy ? (void)readLegacy(s) : (void)frames.read(s);
+      }
+    });
+  }
+  for (int i = 0; i < count; i++) {
+    legacy ? sendLegacy(s, payload)
+           : sendFrame(s, payload.data(), payload.size());
+  }
+  if (duplex) reader.join();
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  size_t frameSize(1 << 20);  // bytes in each frame
+  int count(1000);            // frames in each direction
+  bool duplex(false);         // frames in both directions at once
+  bool legacy(false);         // the old two send() framing
+
+  while ((opt = getopt(argc, argv, "b:n:dluh")) != -1) {
+    switch (opt) {
+      case 'b':
+        frameSize = atol(optarg);
+        break;
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'd':
+        duplex = true;
+        break;
+      case 'l':
+        legacy = true;
+        break;
+      case 'u':
+        UringTransport::enabled() = false;
+        break;
+      case 'h':
+      default: /* '?' */
+        std::cerr << "Usage: real_socket_bench [-b bytes] [-n frames] [-d] "
+                  << "[-l] [-u]" << std::endl
+                  << "  -b bytes in each frame (default 1MB)" << std::endl
+                  << "  -n frames to send (default 1000)" << std::endl
+                  << "  -d send in both directions at once" << std::endl
+                  << "  -l use the old framing, without socket tuning"
+                  << std::endl
+                  << "  -u do not use io_uring for large frames"
+                  << std::endl;
+        return 1;
+    }
+  }
+
+  boost::asio::io_context io_context;
+  tcp::acceptor a(io_context,
+                  tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+  tcp::socket server(io_context), client(io_context);
+  std::thread acceptor([&]() { a.accept(server); });
+  client.connect(a.local_endpoint());
+  acceptor.join();
+  if (!legacy) {
+    tuneSocket(server);
+    tuneSocket(client);
+  }
+
+  std::vector<char> payload(frameSize, 'x');
+  auto start = std::chrono::steady_clock::now();
+  std::thread far([&]() { pump(server, payload, count, duplex, legacy); });
+  if (duplex) {
+    pump(client, payload, count, duplex, legacy);
+  } else {
+    FrameReader frames;
+    for (int i = 0; i < count; i++) {
+      legacy ? (void)readLegacy(client) : (void)frames.read(client);
+    }
+  }
+  far.join();
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  double megabytes = double(frameSize) * count * (duplex ? 2 : 1) / 1e6;
+  bool uring = !legacy && frameSize >= UringTransport::MIN_BYTES &&
+               UringTransport::get();
+  std::cout << (legacy ? "old framing, "
+                       : uring ? "framing.h with io_uring, " : "framing.h, ")
+            << (duplex ? "both directions, " : "one direction, ") << count
+            << " frames of " << frameSize << " bytes: " << megabytes / seconds
+            << " MB/s" << std::endl;
+  return 0;
+}
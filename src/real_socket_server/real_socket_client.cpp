@@ -32,12 +32,28 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <getopt.h>
+
+#include <functional>
+#include <mutex>
+
+#include <boost/asio/thread_pool.hpp>
+
 #include "utils_socket.h"
 #include "palisade.h"
 
 using namespace lbcrypto;
 
-std::tuple<CC, PublicKey> recvCCAndKeys(tcp::socket &s) {
+// the evaluation keys the operations below use
+const KeyPlan FULL_PLAN = {true, {1, -1}};
+
+/**
+ * recvCCAndKeys - send the key plan, then receive the CryptoContext, the
+ * public key and the evaluation keys of the plan
+ */
+std::tuple<CC, PublicKey> recvCCAndKeys(tcp::socket &s, const KeyPlan &plan) {
+  sendKeyRequest(s, plan);
+
   /////////////////////////////////////////////////////////////////
   // NOTE: ReleaseAllContexts is imperative; it ensures that the environment
   // is cleared before loading anything. The function call ensures we are not
@@ -58,13 +74,26 @@ std::tuple<CC, PublicKey> recvCCAndKeys(tcp::socket &s) {
 
   PublicKey clientPublicKey = recvPublicKey(s);
 
-  recvEvalMultKey(s, clientCC);
-  recvEvalAutomorphismKey(s, clientCC);
+  recvKeys(s, clientCC, plan);
 
   return std::make_tuple(clientCC, clientPublicKey);
 }
 
 
+// Now, we want to simulate a client who is encrypting data for the server to
+// decrypt. E.g weights of a machine learning algorithm
+CT encryptClientVector(CC &clientCC, PublicKey &clientPublicKey) {
+  std::cout << "CLIENT: encrypting a vector" << std::endl;
+  complexVector clientVector1 = {1.0, 2.0, 3.0, 4.0};
+  if (clientVector1.size() != VECTORSIZE) {
+    std::cerr << "clientVector1 size was modified. Must be of length 4"
+	      << std::endl;
+    exit(1);
+  }
+  auto clientPlaintext1 = clientCC->MakeCKKSPackedPlaintext(clientVector1);
+  return clientCC->Encrypt(clientPublicKey, clientPlaintext1);
+}
+
 void computeAndSendData(tcp::socket &s,
 						CC &clientCC,
 						CT &clientC1,
@@ -74,28 +103,64 @@ void computeAndSendData(tcp::socket &s,
   std::cout << "CLIENT: Applying operations on data" << std::endl;
   auto clientCiphertextMult = clientCC->EvalMult(clientC1, clientC2);
   auto clientCiphertextAdd = clientCC->EvalAdd(clientC1, clientC2);
-  auto clientCiphertextRot = clientCC->EvalAtIndex(clientC1, 1);
-  auto clientCiphertextRotNeg = clientCC->EvalAtIndex(clientC1, -1);
+  auto rotations = evalAtIndices(clientCC, clientC1, {1, -1});
+  auto clientCiphertextRot = rotations[0];
+  auto clientCiphertextRotNeg = rotations[1];
+  auto clientInitiatedEncryption =
+    encryptClientVector(clientCC, clientPublicKey);
 
-  // Now, we want to simulate a client who is encrypting data for the server to
-  // decrypt. E.g weights of a machine learning algorithm
+  sendTaggedCT(s, MultResult, clientCiphertextMult);
+  sendTaggedCT(s, AddResult, clientCiphertextAdd);
+  sendTaggedCT(s, RotResult, clientCiphertextRot);
+  sendTaggedCT(s, RotNegResult, clientCiphertextRotNeg);
+  sendTaggedCT(s, VecResult, clientInitiatedEncryption);
+}
 
-  std::cout << "CLIENT: encrypting a vector" << std::endl;
-  complexVector clientVector1 = {1.0, 2.0, 3.0, 4.0};
-  if (clientVector1.size() != VECTORSIZE) {
-    std::cerr << "clientVector1 size was modified. Must be of length 4"
-	      << std::endl;
-    exit(1);
-  }
-  auto clientPlaintext1 = clientCC->MakeCKKSPackedPlaintext(clientVector1);
-  auto clientInitiatedEncryption =
-    clientCC->Encrypt(clientPublicKey, clientPlaintext1);
+/**
+ * computeAndSendBatch - batch mode version of computeAndSendData. The
+ * operations are independent, so they run at the same time on a thread
+ * pool and each result is tagged and sent the moment it is done, while the
+ * others are still computing.
+ */
+void computeAndSendBatch(tcp::socket &s,
+						 CC &clientCC,
+						 CT &clientC1,
+						 CT &clientC2,
+						 PublicKey &clientPublicKey) {
+  std::cout << "CLIENT: Applying operations on data in parallel" << std::endl;
+  // each operation gives one or more tagged results, both rotations come
+  // from one evalAtIndices
+  using Results = std::vector<std::pair<ResultTag, CT>>;
+  std::vector<std::function<Results(void)>> operations = {
+      [&]() {
+        return Results{{MultResult, clientCC->EvalMult(clientC1, clientC2)}};
+      },
+      [&]() {
+        return Results{{AddResult, clientCC->EvalAdd(clientC1, clientC2)}};
+      },
+      [&]() {
+        auto rotations = evalAtIndices(clientCC, clientC1, {1, -1});
+        return Results{{RotResult, rotations[0]},
+                       {RotNegResult, rotations[1]}};
+      },
+      [&]() {
+        return Results{
+            {VecResult, encryptClientVector(clientCC, clientPublicKey)}};
+      }};
 
-  sendCT(s, clientCiphertextMult);
-  sendCT(s, clientCiphertextAdd);
-  sendCT(s, clientCiphertextRot);
-  sendCT(s, clientCiphertextRotNeg);
-  sendCT(s, clientInitiatedEncryption);
+  std::mutex sendMutex;  // one result on the socket at a time
+  boost::asio::thread_pool pool(
+      std::min<size_t>(operations.size(),
+                       std::max(1u, std::thread::hardware_concurrency())));
+  for (auto &operation : operations) {
+    boost::asio::post(pool, [&s, &sendMutex, &operation]() {
+      for (auto &result : operation()) {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        sendTaggedCT(s, result.first, result.second);
+      }
+    });
+  }
+  pool.join();
 }
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
@@ -104,27 +169,51 @@ void computeAndSendData(tcp::socket &s,
 int main(int argc, char* argv[]) {
 
   // note GConf is a global structure defined in utils.h
+  int opt;
+  bool batch(false);  // batched data and parallel results, as the server's -b
+  bool onDemand(false);  // fetch the keys once the data is in
+
+  while ((opt = getopt(argc, argv, "boh")) != -1) {
+    switch (opt) {
+      case 'b':
+        batch = true;
+        break;
+      case 'o':
+        onDemand = true;
+        break;
+      case 'h':
+      default: /* '?' */
+        std::cerr << "Usage: real-socket-client [-b] [-o] <host> <port>\n"
+                  << "  -b batch mode, for a server run with -b\n"
+                  << "  -o fetch the evaluation keys only once the "
+                  << "ciphertexts are in\n";
+        return 1;
+    }
+  }
+
    try
   {
-    if (argc != 3)
+    if (argc - optind != 2)
     {
-      std::cerr << "Usage: real-socket-client <host> <port>\n";
+      std::cerr << "Usage: real-socket-client [-b] [-o] <host> <port>\n";
       return 1;
     }
+    const char *host = argv[optind];
+    const char *port = argv[optind + 1];
 
     boost::asio::io_context io_context;
 
     tcp::socket s(io_context);
     tcp::resolver resolver(io_context);
-	std::cout << "CLIENT: connecting to " << argv[1] << ":" << argv[2] << std::endl;
+	std::cout << "CLIENT: connecting to " << host << ":" << port << std::endl;
 	bool connected(false);
 	while (!connected) {
 	  try { 
-		boost::asio::connect(s, resolver.resolve(argv[1], argv[2]));
+		boost::asio::connect(s, resolver.resolve(host, port));
 		connected = true;
 	  } catch (std::exception& e) {
 	    if (e.what() == std::string("connect: Connection refused")) {
-		  std::cout << "waiting for socket " << argv[1] << ":" << argv[2]
+		  std::cout << "waiting for socket " << host << ":" << port
 					<< " to be created" << std::endl;
 		} else {
 		  std::cerr<<"Error in socket connect " << e.what() << std::endl;
@@ -134,19 +223,36 @@ int main(int argc, char* argv[]) {
 	  }
 	}
 	  
+	tuneSocket(s);
 	std::cout << "CLIENT: connected" << std::endl;
   
 	/////////////////////////////////////////////////////////////////
 	// Actual client work
 	/////////////////////////////////////////////////////////////////
 
-	auto ccAndPubKeyAsTuple = recvCCAndKeys(s);
+	// with -o the first plan is empty and the keys are fetched later, the
+	// server then makes them while the ciphertexts are on the wire
+	auto ccAndPubKeyAsTuple =
+	  recvCCAndKeys(s, onDemand ? KeyPlan{} : FULL_PLAN);
 	auto clientCC = std::get<CRYPTOCONTEXT_INDEX>(ccAndPubKeyAsTuple);
 	auto clientPublicKey = std::get<PUBLICKEY_INDEX>(ccAndPubKeyAsTuple);
   
 	std::cout << "CLIENT: Getting ciphertexts" << std::endl;
+	if (batch) {
+	  auto matrix = recvCTBatch(s);
+	  if (matrix.size() != 2) {
+	    std::cerr << "CLIENT: expected 2 ciphertexts, got " << matrix.size()
+	              << std::endl;
+	    exit(EXIT_FAILURE);
+	  }
+	  if (onDemand) fetchKeys(s, clientCC, FULL_PLAN);
+	  std::cout << "CLIENT: Computing and sending results" << std::endl;
+	  computeAndSendBatch(s, clientCC, matrix[0], matrix[1], clientPublicKey);
+	  return EXIT_SUCCESS;
+	}
 	CT clientC1 = recvCT(s);
 	CT clientC2 = recvCT(s);
+	if (onDemand) fetchKeys(s, clientCC, FULL_PLAN);
 
 	std::cout << "CLIENT: Computing and Serializing results" << std::endl;
 	computeAndSendData(s, clientCC, clientC1, clientC2, clientPublicKey);
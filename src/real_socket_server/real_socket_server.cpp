@@ -8,6 +8,9 @@
 // data, and sends the results back to the server.  Finally, the
 // server decrypts the result and in this demo verifies that results
 // are correct.
+//
+// The server runs until stopped and serves any number of clients at
+// once, each in a session of its own.
 // 
 // @author: Ian Quah, Dave Cousins
 // TPOC: contact@palisade-crypto.org
@@ -32,15 +35,29 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <boost/asio/thread_pool.hpp>
+
 #include "utils_socket.h"
 #include "palisade.h"
 //#include "palisade/core/utils/debug.h"
 
 using namespace lbcrypto;
 
-
 /**
- * Mocks a server which supports some basic operations
+ * Mocks a server which supports some basic operations. It holds what all
+ * sessions share, the crypto context and keys. Evaluation keys are made
+ * the first time a client asks for them, under a mutex, everything else is
+ * not changed once made, so any number of sessions can use it at the same
+ * time.
  */
 class Server {
  public:
@@ -52,31 +69,45 @@ class Server {
    * @param batchSize - size of the batch
    */
   Server(int multDepth, int scaleFactorBits, int batchSize);
+
   /**
-   * sendCCAndKeys send the CryptoContext and keys to client via socket s
+   * contextFrames - the serialized CryptoContext and public key every client
+   * gets, serialized once
    */
-  void sendCCAndKeys(tcp::socket &s);
+  const std::vector<std::string> &contextFrames(void) const {
+    return m_contextFrames;
+  }
 
   /**
-   * generateAndSendData - read from some internal location, encrypt then send it off
-   * for some client to process
-   *    - in this case we write the data directly to socket s
+   * keyFrames - the evaluation keys of a plan, the EvalMult key if asked
+   * for and then the rotation keys of just the plan's indices. Keys not
+   * made yet are made now and kept for the next client. Throws on a plan
+   * of more than KeyPlan::MAX_INDICES indices or an index outside the batch.
+   * @param plan - keys the client asked for
+   * @return the frames to send, in the order recvKeys() reads them
    */
-  void generateAndSendData(tcp::socket &s);
+  std::vector<std::string> keyFrames(const KeyPlan &plan) const;
 
   /**
-   * receiveAndVerifyData - receive data from client and
-   * verify it. 
-   *
+   * generateData - read from some internal location and encrypt it for one
+   * session
+   * @return the serialized ciphertexts to send to the client
    */
-  void receiveAndVerifyData(tcp::socket &s);
+  std::vector<std::string> generateData(void) const;
+
+  /**
+   * verifyData - decrypt and verify the results of one session
+   * @param frames - the serialized ciphertexts from the client
+   * @return a line of results for the log
+   */
+  std::string verifyData(const std::vector<std::string> &frames) const;
 
  private:
   /**
    * readData - reads data from a local source (in reality just generate it) 
    * @return complex matrix of values of interest
    */
-  complexMatrix readData(void);
+  complexMatrix readData(void) const;
 
   /**
    * packAndEncrypt - pack messages (into plaintexts) and encrypt them (into
@@ -85,25 +116,25 @@ class Server {
    * from a data lake
    * @return - a vector of ciphertexts (which are themselves like vectors)
    */
-  ciphertextMatrix packAndEncrypt(const complexMatrix &matrixOfData);
-
-  /**
-   * actually writeData contained in matrix to socket s
-   * @param s socket 
-   * @param matrix
-   */
-  void writeData(tcp::socket &s, const ciphertextMatrix &matrix);
+  ciphertextMatrix packAndEncrypt(const complexMatrix &matrixOfData) const;
 
   KeyPair m_kp; //contains secret and public key!
   CC m_cc;
-  int m_vectorSize = 0;
+  int m_batchSize;
+  std::vector<std::string> m_contextFrames;
+
+  // evaluation keys made so far
+  mutable std::mutex m_keyMutex;
+  mutable std::string m_multKeyFrame;
+  mutable std::map<usint, LPEvalKey<DCRTPoly>> m_rotationKeys;
 };
 
 /////////////////////////////////////////////////////////////////
 // Public Interface
 /////////////////////////////////////////////////////////////////
 
-Server::Server(int multDepth, int scaleFactorBits, int batchSize) {
+Server::Server(int multDepth, int scaleFactorBits, int batchSize)
+    : m_batchSize(batchSize) {
   m_cc = CFactory::genCryptoContextCKKS(multDepth, scaleFactorBits, batchSize);
 
   m_cc->Enable(ENCRYPTION);
@@ -111,100 +142,126 @@ Server::Server(int multDepth, int scaleFactorBits, int batchSize) {
   m_cc->Enable(LEVELEDSHE);
 
   m_kp = m_cc->KeyGen();
-  m_cc->EvalMultKeyGen(m_kp.secretKey);
-  m_cc->EvalAtIndexKeyGen(m_kp.secretKey, {1, 2, -1, -2});
 
+  // in the order the client receives them, the evaluation keys are made
+  // when a client asks for them
+  std::ostringstream cc, pk;
+  Serial::Serialize(m_cc, cc, SerType::BINARY);
+  Serial::Serialize(m_kp.publicKey, pk, SerType::BINARY);
+  m_contextFrames = {cc.str(), pk.str()};
 }
 
-/**
- * generateAndSendData - process a request from a client and "send"
- * data over by writing to a location
- *
- */
-void Server::generateAndSendData(tcp::socket &s) {
-  auto rawData = readData();
-  auto ciphertexts = packAndEncrypt(rawData);
-  writeData(s, ciphertexts);
+std::vector<std::string> Server::keyFrames(const KeyPlan &plan) const {
+  // the plan comes from the client, check it before making any keys
+  if (plan.indices.size() > KeyPlan::MAX_INDICES) {
+    throw std::runtime_error("key plan of " +
+                             std::to_string(plan.indices.size()) +
+                             " rotations");
+  }
+  for (auto index : plan.indices) {
+    if (index <= -m_batchSize || index >= m_batchSize) {
+      throw std::runtime_error("rotation index " + std::to_string(index) +
+                               " outside the batch");
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(m_keyMutex);
+  std::vector<std::string> frames;
+  auto keyTag = m_kp.secretKey->GetKeyTag();
+
+  if (plan.mult) {
+    if (m_multKeyFrame.empty()) {
+      m_cc->EvalMultKeyGen(m_kp.secretKey);
+      std::ostringstream mult;
+      if (!m_cc->SerializeEvalMultKey(mult, SerType::BINARY, keyTag)) {
+        throw std::runtime_error("cannot serialize the eval mult key");
+      }
+      m_multKeyFrame = mult.str();
+    }
+    frames.push_back(m_multKeyFrame);
+  }
+
+  if (!plan.indices.empty()) {
+    // rotation keys are kept by automorphism index, make the missing ones
+    usint m = m_cc->GetCyclotomicOrder();
+    std::vector<usint> wanted, missing;
+    for (auto index : plan.indices) {
+      auto autoIndex = FindAutomorphismIndex2nComplex(index, m);
+      wanted.push_back(autoIndex);
+      if (!m_rotationKeys.count(autoIndex) &&
+          std::find(missing.begin(), missing.end(), autoIndex) ==
+              missing.end()) {
+        missing.push_back(autoIndex);
+      }
+    }
+    if (!missing.empty()) {
+      auto made = m_cc->EvalAutomorphismKeyGen(m_kp.secretKey, missing);
+      m_rotationKeys.insert(made->begin(), made->end());
+    }
+
+    // the layout SerializeEvalAutomorphismKey writes, with only the keys
+    // of the plan
+    auto subset = std::make_shared<std::map<usint, LPEvalKey<DCRTPoly>>>();
+    for (auto autoIndex : wanted) {
+      subset->emplace(autoIndex, m_rotationKeys.at(autoIndex));
+    }
+    std::map<std::string, std::shared_ptr<std::map<usint, LPEvalKey<DCRTPoly>>>>
+        keyMap = {{keyTag, subset}};
+    std::ostringstream rot;
+    Serial::Serialize(keyMap, rot, SerType::BINARY);
+    frames.push_back(rot.str());
+  }
+  return frames;
 }
 
-/**
- * receiveAndVerifyData - "receive" a payload from the client and verify the results
- */
-void Server::receiveAndVerifyData(tcp::socket &s) {
+std::vector<std::string> Server::generateData(void) const {
+  auto ciphertexts = packAndEncrypt(readData());
+  std::vector<std::string> frames;
+  for (auto &ct : ciphertexts) {
+    std::ostringstream os;
+    Serial::Serialize(ct, os, SerType::BINARY);
+    frames.push_back(os.str());
+  }
+  return frames;
+}
+
+std::string Server::verifyData(const std::vector<std::string> &frames) const {
   /////////////////////////////////////////////////////////////////
   // Receive the data and decrpyt all of it
   /////////////////////////////////////////////////////////////////
-  if (m_vectorSize == 0) {
-    std::cerr << "SERVER: Must have sent data to client first ";
-    std::cerr
-        << "which initiates a vector size tracker (dimensionality of data)";
-    std::cerr << "for use in decryption."
-              << "\n";
-    exit(EXIT_FAILURE);
+  // mult, add, rotation, negative rotation, and the client's own vector
+  std::vector<Plaintext> plaintexts;
+  for (auto &frame : frames) {
+    CT ct;
+    std::istringstream is(frame);
+    Serial::Deserialize(ct, is, SerType::BINARY);
+    Plaintext pt;
+    m_cc->Decrypt(m_kp.secretKey, ct, &pt);
+    plaintexts.push_back(pt);
   }
-  CT serverCiphertextFromClient_Mult;
-  CT serverCiphertextFromClient_Add;
-  CT serverCiphertextFromClient_Rot;
-  CT serverCiphertextFromClient_RogNeg;
-  CT serverCiphertextFromClient_Vec;
-
-  serverCiphertextFromClient_Mult = recvCT(s);
-  serverCiphertextFromClient_Add = recvCT(s);
-  serverCiphertextFromClient_Rot = recvCT(s);
-  serverCiphertextFromClient_RogNeg = recvCT(s);
-  serverCiphertextFromClient_Vec = recvCT(s);
-  
-  std::cout << "SERVER: Deserialized all processed encrypted data from client" << std::endl;
-
-  Plaintext serverPlaintextFromClient_Mult;
-  Plaintext serverPlaintextFromClient_Add;
-  Plaintext serverPlaintextFromClient_Rot;
-  Plaintext serverPlaintextFromClient_RotNeg;
-  Plaintext serverPlaintextFromClient_Vec;
-
-  m_cc->Decrypt(m_kp.secretKey, serverCiphertextFromClient_Mult,
-                &serverPlaintextFromClient_Mult);
-  m_cc->Decrypt(m_kp.secretKey, serverCiphertextFromClient_Add,
-                &serverPlaintextFromClient_Add);
-  m_cc->Decrypt(m_kp.secretKey, serverCiphertextFromClient_Rot,
-                &serverPlaintextFromClient_Rot);
-  m_cc->Decrypt(m_kp.secretKey, serverCiphertextFromClient_RogNeg,
-                &serverPlaintextFromClient_RotNeg);
-  m_cc->Decrypt(m_kp.secretKey, serverCiphertextFromClient_Vec,
-                &serverPlaintextFromClient_Vec);
 
   /////////////////////////////////////////////////////////////////
   // Retrive the values from the CKKS packed Values
   /////////////////////////////////////////////////////////////////
 
-  serverPlaintextFromClient_Mult->SetLength(m_vectorSize);
-  serverPlaintextFromClient_Add->SetLength(m_vectorSize);
-  serverPlaintextFromClient_Vec->SetLength(m_vectorSize);
-  serverPlaintextFromClient_Rot->SetLength(m_vectorSize + 1);
-  serverPlaintextFromClient_RotNeg->SetLength(m_vectorSize + 1);
-
-  complexVector multExpected = {12.5, 27, 43.5, 62};
-  complexVector addExpected = {13.5, 15.5, 17.5, 19.5};
-  complexVector vecExpected = {1, 2, 3, 4};
-  complexVector rotExpected = {2, 3, 4, 0.0000, 0.00000};
-  complexVector negRotExpected = {0.00000, 1, 2, 3, 4};
-
-  auto multFlag = validateData(
-      serverPlaintextFromClient_Mult->GetCKKSPackedValue(), multExpected);
-  std::cout << "Mult correct: " << (multFlag ? "Yes" : "No ") << "\n";
-  auto addFlag = validateData(
-      serverPlaintextFromClient_Add->GetCKKSPackedValue(), addExpected);
-  std::cout << "Add correct: " << (addFlag ? "Yes" : "No ") << "\n";
-  auto vecFlag = validateData(
-      serverPlaintextFromClient_Vec->GetCKKSPackedValue(), vecExpected);
-  std::cout << "Vec encryption correct: " << (vecFlag ? "Yes" : "No ") << "\n";
-  auto rotFlag = validateData(
-      serverPlaintextFromClient_Rot->GetCKKSPackedValue(), rotExpected);
-  std::cout << "Rotation correct: " << (rotFlag ? "Yes" : "No ") << "\n";
-  auto negRotFlag = validateData(
-      serverPlaintextFromClient_RotNeg->GetCKKSPackedValue(), negRotExpected);
-  std::cout << "Negative rotation correct: " << (negRotFlag ? "Yes" : "No ")
-            << "\n";
+  std::vector<std::pair<std::string, complexVector>> expected = {
+      {"Mult", {12.5, 27, 43.5, 62}},
+      {"Add", {13.5, 15.5, 17.5, 19.5}},
+      {"Rotation", {2, 3, 4, 0.0000, 0.00000}},
+      {"Negative rotation", {0.00000, 1, 2, 3, 4}},
+      {"Vec encryption", {1, 2, 3, 4}}};
+  if (plaintexts.size() != expected.size()) {
+    return "wrong number of results";
+  }
+  std::string results;
+  for (size_t i = 0; i < expected.size(); i++) {
+    plaintexts[i]->SetLength(expected[i].second.size());
+    auto flag = validateData(plaintexts[i]->GetCKKSPackedValue(),
+                             expected[i].second);
+    results += expected[i].first + " correct: " + (flag ? "Yes" : "No") +
+               (i + 1 < expected.size() ? ", " : "");
+  }
+  return results;
 }
 
 /////////////////////////////////////////////////////////////////
@@ -217,13 +274,11 @@ void Server::receiveAndVerifyData(tcp::socket &s) {
  * @return
  *  vector of hard-coded vectors (basically a matrix)
  */
-std::vector<std::vector<std::complex<double>>> Server::readData(void) {
+std::vector<std::vector<std::complex<double>>> Server::readData(void) const {
 
   complexVector vec1 = {1.0, 2.0, 3.0, 4.0};
   complexVector vec2 = {12.5, 13.5, 14.5, 15.5};
 
-  m_vectorSize = vec1.size();
-
   return {
       vec1,
       vec2,
@@ -235,7 +290,8 @@ std::vector<std::vector<std::complex<double>>> Server::readData(void) {
  * @param matrixOfData
  * @return
  */
-ciphertextMatrix Server::packAndEncrypt(const complexMatrix &matrixOfData) {
+ciphertextMatrix Server::packAndEncrypt(
+    const complexMatrix &matrixOfData) const {
   auto container =
       ciphertextMatrix(matrixOfData.size(), CT());
 
@@ -248,66 +304,357 @@ ciphertextMatrix Server::packAndEncrypt(const complexMatrix &matrixOfData) {
   return container;
 }
 
-/**
- * sendCCAndKeys - send the cc and keys specified locations.
- * @param conf
- */
-void Server::sendCCAndKeys(tcp::socket &s) {
+/////////////////////////////////////////////////////////////////
+// Sessions
+/////////////////////////////////////////////////////////////////
 
-  sendCC(s, m_cc);
-  sendPublicKey(s, m_kp.publicKey);
-  sendEvalMultKey(s, m_cc);
-  sendEvalAutomorphismKey(s, m_cc);
-}
 /**
- * writeData - write a matrix of data to the specified locations.
- * @param s socket
- * @Param matrix of data
+ * Session - one client, from accept to verified results. The socket is
+ * only touched by handlers on its strand, the encryption and decryption go
+ * to the compute pool so the I/O threads never wait for PALISADE. The
+ * session keeps itself alive through the shared_ptr captured by every
+ * handler and is gone when the last one finishes.
+ *
+ * Every frame is a size_t length followed by the bytes (framing.h). The
+ * client's frames are tagged: its KeyPlan first, then its results and any
+ * further key requests. In batch mode the ciphertexts go as one batch
+ * frame and the results come back in the order the client finishes them.
  */
-void Server::writeData(tcp::socket &s, const ciphertextMatrix &matrix) {
+class Session : public std::enable_shared_from_this<Session> {
+ public:
+  // largest frame a client may send, its results and key requests are far
+  // smaller
+  static const size_t MAX_IN_FRAME = size_t(64) << 20;
 
-  std::cout << "SERVER: sending encrypted data" << std::endl;
-  for (size_t i = 0; i < matrix.size(); i++){
-	sendCT(s, matrix[i]);
-	std::cout << "SERVER: ciphertext " << i << " serialized" << std::endl;
+  /**
+   * @param batch - batch mode, the client must be in batch mode too
+   */
+  Session(tcp::socket socket, const Server &server,
+          boost::asio::thread_pool &compute, unsigned id, bool batch,
+          std::function<void(void)> done)
+      : m_socket(std::move(socket)),
+        m_server(server),
+        m_compute(compute),
+        m_id(id),
+        m_batch(batch),
+        m_done(done) {}
+
+  ~Session() { m_done(); }
+
+  /**
+   * start - read the client's key plan, send the context and keys while
+   * the data is encrypted, then the data, then serve key requests until all
+   * results are in
+   */
+  void start(void) {
+    log("started");
+    auto self = shared_from_this();
+    readFrame([self](std::string frame) {
+      if (splitTag(frame) != KEYREQUEST_TAG) {
+        return self->log("expected a key plan");
+      }
+      auto plan = KeyPlan::decode(frame);
+      self->log("plan: " + std::string(plan.mult ? "mult, " : "") +
+                std::to_string(plan.indices.size()) + " rotations");
+      self->sendKeys(plan, [self]() { self->sendData(); });
+      boost::asio::post(self->m_compute, [self]() {
+        auto frames = self->m_server.generateData();
+        boost::asio::post(self->m_socket.get_executor(),
+                          [self, frames = std::move(frames)]() mutable {
+                            self->m_dataFrames = std::move(frames);
+                            self->sendData();
+                          });
+      });
+    });
   }
-}
 
+ private:
+  /**
+   * sendKeys - make or look up the keys of a plan on the compute pool and
+   * send them, with the context first if it has not been sent
+   */
+  void sendKeys(const KeyPlan &plan, std::function<void(void)> next) {
+    auto self = shared_from_this();
+    boost::asio::post(m_compute, [self, plan, next]() {
+      std::vector<std::string> frames;
+      try {
+        frames = self->m_server.keyFrames(plan);
+      } catch (std::exception &e) {
+        return self->log(std::string("cannot make keys: ") + e.what());
+      }
+      boost::asio::post(
+          self->m_socket.get_executor(),
+          [self, frames = std::move(frames), next]() mutable {
+            auto &out = self->m_keyFrames;
+            out.clear();
+            if (!self->m_contextSent) {
+              out = self->m_server.contextFrames();
+              self->m_contextSent = true;
+            }
+            out.insert(out.end(), frames.begin(), frames.end());
+            self->writeFrames(out, next);
+          });
+    });
+  }
+
+  /**
+   * sendData - called once the keys are out and once the data is
+   * encrypted, sends the data when both have happened
+   */
+  void sendData(void) {
+    if (++m_ready < 2) return;
+    auto self = shared_from_this();
+    auto next = [self]() { self->readResults(); };
+    if (m_batch) {
+      writeBatch(m_dataFrames, next);
+    } else {
+      writeFrames(m_dataFrames, next);
+    }
+  }
+
+  /**
+   * readResults - read tagged results until all are in, sending the keys
+   * of any key request that comes in between
+   */
+  void readResults(void) {
+    if (m_results.size() == NumResults) return verify();
+    auto self = shared_from_this();
+    readFrame([self](std::string frame) {
+      auto tag = splitTag(frame);
+      if (tag != KEYREQUEST_TAG) {
+        self->m_results.push_back({tag, std::move(frame)});
+        return self->readResults();
+      }
+      auto plan = KeyPlan::decode(frame);
+      self->log("fetching " + std::to_string(plan.indices.size()) +
+                " rotations" + (plan.mult ? " and mult" : ""));
+      self->sendKeys(plan, [self]() { self->readResults(); });
+    });
+  }
+
+  void verify(void) {
+    auto self = shared_from_this();
+    boost::asio::post(m_compute, [self]() {
+      try {
+        self->log(self->m_server.verifyData(self->sortResults()));
+      } catch (std::exception &e) {
+        self->log(std::string("cannot verify: ") + e.what());
+      }
+    });
+  }
+
+  /**
+   * writeFrames - write frames, with all lengths and bytes in one gathered
+   * write. The frames must live until next is called.
+   */
+  void writeFrames(const std::vector<std::string> &frames,
+                   std::function<void(void)> next) {
+    auto lengths = std::make_shared<std::vector<size_t>>();
+    for (auto &frame : frames) lengths->push_back(frame.size());
+    std::vector<boost::asio::const_buffer> buffers;
+    for (size_t i = 0; i < frames.size(); i++) {
+      buffers.push_back(boost::asio::buffer(&(*lengths)[i], sizeof(size_t)));
+      buffers.push_back(boost::asio::buffer(frames[i]));
+    }
+    auto self = shared_from_this();
+    boost::asio::async_write(
+        m_socket, buffers,
+        [self, lengths, next](boost::system::error_code ec, size_t) {
+          if (ec) return self->log("write failed: " + ec.message());
+          next();
+        });
+  }
+
+  /**
+   * writeBatch - write frames as one batch frame. The frames must live until
+   * next is called.
+   */
+  void writeBatch(const std::vector<std::string> &frames,
+                  std::function<void(void)> next) {
+    auto header = std::make_shared<std::vector<size_t>>();
+    auto buffers = batchBuffers(frames, *header);
+    auto self = shared_from_this();
+    boost::asio::async_write(
+        m_socket, buffers,
+        [self, header, next](boost::system::error_code ec, size_t) {
+          if (ec) return self->log("write failed: " + ec.message());
+          next();
+        });
+  }
+
+  /**
+   * sortResults - the results in ResultTag order
+   */
+  std::vector<std::string> sortResults(void) {
+    std::vector<std::string> sorted(NumResults);
+    std::vector<bool> seen(NumResults, false);
+    for (auto &result : m_results) {
+      auto tag = result.first;
+      if (tag >= NumResults || seen[tag]) {
+        throw std::runtime_error("bad result tag " + std::to_string(tag));
+      }
+      seen[tag] = true;
+      sorted[tag] = std::move(result.second);
+    }
+    return sorted;
+  }
+
+  /**
+   * readFrame - read one frame and hand it to next. A length over
+   * MAX_IN_FRAME drops the session, as the client is broken or hostile.
+   */
+  void readFrame(std::function<void(std::string)> next) {
+    auto self = shared_from_this();
+    boost::asio::async_read(
+        m_socket, boost::asio::buffer(&m_inLength, sizeof(m_inLength)),
+        [self, next](boost::system::error_code ec, size_t) {
+          if (ec) return self->log("read failed: " + ec.message());
+          if (self->m_inLength > MAX_IN_FRAME) {
+            self->log("frame of " + std::to_string(self->m_inLength) +
+                      " bytes is too large, dropping the session");
+            boost::system::error_code ignored;
+            self->m_socket.close(ignored);
+            return;
+          }
+          self->m_inFrame.assign(self->m_inLength, '\0');
+          boost::asio::async_read(
+              self->m_socket, boost::asio::buffer(self->m_inFrame),
+              [self, next](boost::system::error_code ec, size_t) {
+                if (ec) return self->log("read failed: " + ec.message());
+                try {
+                  next(std::move(self->m_inFrame));
+                } catch (std::exception &e) {
+                  self->log(std::string("bad frame: ") + e.what());
+                }
+              });
+        });
+  }
+
+  void log(const std::string &line) {
+    std::cout << "SERVER: session " + std::to_string(m_id) + ": " + line + "\n"
+              << std::flush;
+  }
+
+  tcp::socket m_socket;
+  const Server &m_server;
+  boost::asio::thread_pool &m_compute;
+  unsigned m_id;
+  bool m_batch;
+  std::function<void(void)> m_done;
+
+  int m_ready = 0;  // keys written and data encrypted
+  bool m_contextSent = false;
+  std::vector<std::string> m_keyFrames;
+  std::vector<std::string> m_dataFrames;
+  size_t m_inLength = 0;
+  std::string m_inFrame;
+  std::vector<std::pair<uint32_t, std::string>> m_results;  // tag, result
+};
 
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
 int main(int argc, char* argv[]) {
   TimeVar t;
-  
+  int opt;
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  int ioThreads(std::max(1u, cores / 4));  // threads running the sockets
+  int computeThreads(cores);  // threads encrypting and decrypting
+  int numSessions(0);         // sessions to serve, 0 for no limit
+  bool batch(false);          // batched data and tagged results
+
+  while ((opt = getopt(argc, argv, "i:c:s:bh")) != -1) {
+    switch (opt) {
+      case 'i':
+        ioThreads = atoi(optarg);
+        break;
+      case 'c':
+        computeThreads = atoi(optarg);
+        break;
+      case 's':
+        numSessions = atoi(optarg);
+        break;
+      case 'b':
+        batch = true;
+        break;
+      case 'h':
+      default: /* '?' */
+        std::cerr << "Usage: real-socket-server [-i n] [-c n] [-s n] [-b] "
+                  << "<port>" << std::endl
+                  << "  -i threads for socket I/O" << std::endl
+                  << "  -c threads for encryption and decryption" << std::endl
+                  << "  -s sessions to serve, 0 (default) for no limit"
+                  << std::endl
+                  << "  -b batch mode, for clients run with -b" << std::endl;
+        return 1;
+    }
+  }
+  if (optind != argc - 1 || ioThreads < 1 || computeThreads < 1 ||
+      numSessions < 0) {
+    std::cerr << "Usage: real-socket-server [-i n] [-c n] [-s n] [-b] <port>\n";
+    return 1;
+  }
+
   try {
-	if (argc != 2) {
-	  std::cerr << "Usage: real-socket-server <port>\n";
-	  return 1;
-	}
 	const int multDepth = 5;
 	const int scaleFactorBits = 40;
 	const usint batchSize = 32;
 	Server server = Server(multDepth, scaleFactorBits, batchSize);
 	TIC(t);
 
-	boost::asio::io_service io_service;
-
-	std::cout << "SERVER: creating acceptor for " << argv[1] << std::endl;
-	tcp::acceptor a(io_service, tcp::endpoint(tcp::v4(), atoi( argv[1])));
-	std::cout << "SERVER: accepting socket" << std::endl;
-
-	tcp::socket s(io_service);
-	a.accept(s);
-
-	std::cout << "SERVER: sending CC and Keys" << std::endl;
-	server.sendCCAndKeys(s);
-
-	std::cout << "SERVER: Generate and Send data" << std::endl;  
-	server.generateAndSendData(s);
-
-	std::cout << "SERVER: Receive and Verify data" << std::endl;
-	server.receiveAndVerifyData(s);
+	boost::asio::io_context io_context;
+	boost::asio::thread_pool compute(computeThreads);
+
+	std::cout << "SERVER: creating acceptor for " << argv[optind] << std::endl;
+	tcp::acceptor a(io_context,
+	                tcp::endpoint(tcp::v4(), atoi(argv[optind])));
+
+	// accept sessions until numSessions have been accepted, stop once they
+	// are all done. The guard keeps the I/O threads running while every
+	// session is busy in the compute pool.
+	auto work = boost::asio::make_work_guard(io_context);
+	std::atomic<int> finished(0);
+	int accepted = 0;
+	auto done = [&]() {
+	  if (++finished == numSessions) io_context.stop();
+	};
+	std::function<void(void)> accept = [&]() {
+	  a.async_accept(
+	      boost::asio::make_strand(io_context),
+	      [&](boost::system::error_code ec, tcp::socket s) {
+	        if (!ec) {
+	          tuneSocket(s);
+	          std::make_shared<Session>(std::move(s), server, compute,
+	                                    accepted++, batch, done)
+	              ->start();
+	        } else {
+	          std::cerr << "SERVER: accept failed: " << ec.message()
+	                    << std::endl;
+	        }
+	        if (numSessions == 0 || accepted < numSessions) accept();
+	      });
+	};
+	std::cout << "SERVER: accepting sessions" << std::endl;
+	accept();
+
+	std::vector<std::thread> io;
+	for (int i = 0; i < ioThreads; i++) {
+	  // a handler that throws would end the thread and the process, log it
+	  // and keep serving the other sessions
+	  io.emplace_back([&io_context]() {
+	    for (;;) {
+	      try {
+	        io_context.run();
+	        break;
+	      } catch (std::exception &e) {
+	        std::cerr << "SERVER: I/O handler failed: " << e.what()
+	                  << std::endl;
+	      }
+	    }
+	  });
+	}
+	for (auto &thread : io) thread.join();
+	compute.join();
 
   } catch (std::exception& e) {
     std::cerr << "Exception: " << e.what() << "\n";
@@ -0,0 +1,320 @@
+// @file uring.h - bulk socket transfers through io_uring, used by framing.h
+//    on Linux. Does not need PALISADE.
+// @author: Ian Quah, David Cousins
+// TPOC: contact@palisade-crypto.org
+
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef REAL_SOCKET_URING_H
+#define REAL_SOCKET_URING_H
+
+// io_uring is used where the kernel headers have it, build with
+// -DREAL_SOCKET_NO_URING to leave it out
+#if !defined(REAL_SOCKET_NO_URING) && defined(__linux__) && \
+    __has_include(<linux/io_uring.h>)
+#define REAL_SOCKET_HAS_URING 1
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#ifdef REAL_SOCKET_HAS_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#endif
+
+/**
+ * UringTransport - moves the bytes of large frames with io_uring. A write
+ * of a gathered frame goes to the kernel as up to DEPTH linked sends in
+ * one io_uring_enter(), the link keeps them in order on the stream, and a
+ * read is one receive of the whole frame. Both ask for MSG_WAITALL, so the
+ * kernel finishes them without a return to user space per chunk, and the
+ * bytes go straight from and to the caller's memory. Each thread gets a
+ * ring of its own. Where io_uring is missing, not allowed, lacks the send
+ * and receive operations (before Linux 5.6) or is turned off, get() returns
+ * nullptr and framing.h uses plain boost::asio reads and writes. A ring
+ * that fails is retired, and its thread falls back from then on.
+ */
+class UringTransport {
+ public:
+  // a range of bytes to write
+  using Span = std::pair<const void *, size_t>;
+
+  // frames smaller than this go through boost::asio, it is not worth it
+  static const size_t MIN_BYTES = 256 << 10;
+
+  /**
+   * enabled - switch for all threads, to compare with the plain path
+   */
+  static std::atomic<bool> &enabled(void) {
+    static std::atomic<bool> on(true);
+    return on;
+  }
+
+#ifdef REAL_SOCKET_HAS_URING
+  // sends linked in one io_uring_enter()
+  static const unsigned DEPTH = 8;
+  // largest length of one entry, it is 32 bits
+  static const size_t MAX_ENTRY = size_t(1) << 30;
+
+  /**
+   * get - the ring of the calling thread, made on first use
+   * @return nullptr if io_uring cannot be used, the caller falls back
+   */
+  static UringTransport *get(void) {
+    if (!enabled()) return nullptr;
+    thread_local std::unique_ptr<UringTransport> ring;
+    thread_local bool tried = false;
+    if (!tried) {
+      tried = true;
+      std::unique_ptr<UringTransport> made(new UringTransport());
+      if (made->m_ok) ring = std::move(made);
+    }
+    return ring && ring->m_ok ? ring.get() : nullptr;
+  }
+
+  ~UringTransport() {
+    if (m_sqes) munmap(m_sqes, m_sqesSize);
+    if (m_cqRing && m_cqRing != m_sqRing) munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing) munmap(m_sqRing, m_sqRingSize);
+    if (m_fd >= 0) close(m_fd);
+  }
+
+  UringTransport(const UringTransport &) = delete;
+  UringTransport &operator=(const UringTransport &) = delete;
+
+  /**
+   * write - write all bytes of spans, in order, to a blocking socket
+   * @return false on a socket error
+   */
+  bool write(int fd, const std::vector<Span> &spans) {
+    size_t span = 0, inSpan = 0;  // next byte to send
+    for (;;) {
+      const char *addrs[DEPTH];
+      size_t lengths[DEPTH];
+      unsigned n = 0;
+      for (size_t i = span, at = inSpan; n < DEPTH && i < spans.size();
+           i++, at = 0) {
+        size_t left = spans[i].second - at;
+        if (!left) continue;
+        addrs[n] = static_cast<const char *>(spans[i].first) + at;
+        lengths[n++] = std::min(left, MAX_ENTRY);
+        if (left > MAX_ENTRY) break;
+      }
+      if (n == 0) return true;
+
+      ssize_t done = transfer(fd, IORING_OP_SEND, addrs, lengths, n);
+      if (done < 0) return false;
+      // move past what was sent, the rest goes in the next batch
+      while (done) {
+        size_t step = std::min<size_t>(done, spans[span].second - inSpan);
+        inSpan += step;
+        done -= step;
+        if (inSpan == spans[span].second) {
+          span++;
+          inSpan = 0;
+        }
+      }
+    }
+  }
+
+  /**
+   * read - read exactly size bytes from a blocking socket into data
+   * @return false on a socket error or end of stream
+   */
+  bool read(int fd, char *data, size_t size) {
+    size_t got = 0;
+    while (got < size) {
+      const char *addr = data + got;
+      size_t length = std::min(size - got, MAX_ENTRY);
+      ssize_t done = transfer(fd, IORING_OP_RECV, &addr, &length, 1);
+      if (done < 0) return false;
+      got += done;
+    }
+    return true;
+  }
+
+ private:
+  UringTransport() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    m_fd = syscall(__NR_io_uring_setup, DEPTH, &params);
+    if (m_fd < 0) return;
+
+    // the submission and completion rings, and the submission entries
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+      m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = map(m_sqRingSize, IORING_OFF_SQ_RING);
+    m_cqRing = single ? m_sqRing : map(m_cqRingSize, IORING_OFF_CQ_RING);
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = static_cast<io_uring_sqe *>(map(m_sqesSize, IORING_OFF_SQES));
+    if (!m_sqRing || !m_cqRing || !m_sqes) return;
+
+    auto sq = static_cast<char *>(m_sqRing);
+    m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    auto cq = static_cast<char *>(m_cqRing);
+    m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    m_ok = supports({IORING_OP_SEND, IORING_OP_RECV});
+  }
+
+  /**
+   * supports - ask the kernel (IORING_REGISTER_PROBE) whether it has all of
+   * ops. A kernel too old to probe is too old for send and receive too.
+   */
+  bool supports(std::initializer_list<uint8_t> ops) {
+    const unsigned count = 256;
+    std::vector<char> buffer(sizeof(io_uring_probe) +
+                             count * sizeof(io_uring_probe_op));
+    auto probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe,
+                count) < 0) {
+      return false;
+    }
+    for (auto op : ops) {
+      if (op > probe->last_op ||
+          !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void *map(size_t size, off_t offset) {
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, m_fd, offset);
+    return p == MAP_FAILED ? nullptr : p;
+  }
+
+  /**
+   * transfer - submit n linked sends or receives in one call and wait for
+   * all of them. A short one ends the chain and the rest come back
+   * cancelled.
+   * @return the bytes moved in order from the first entry, -1 on error or
+   * end of stream
+   */
+  ssize_t transfer(int fd, uint8_t op, const char **addrs,
+                   const size_t *lengths, unsigned n) {
+    unsigned tail = *m_sqTail;
+    for (unsigned i = 0; i < n; i++, tail++) {
+      unsigned index = tail & m_sqMask;
+      io_uring_sqe &sqe = m_sqes[index];
+      std::memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = op;
+      sqe.fd = fd;
+      sqe.addr = reinterpret_cast<uint64_t>(addrs[i]);
+      sqe.len = lengths[i];
+      sqe.msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+      sqe.flags = i + 1 < n ? IOSQE_IO_LINK : 0;
+      sqe.user_data = i;
+      m_sqArray[index] = index;
+    }
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+
+    unsigned toSubmit = n;
+    int results[DEPTH] = {0};
+    for (unsigned reaped = 0; reaped < n;) {
+      int ret = syscall(__NR_io_uring_enter, m_fd, toSubmit, n - reaped,
+                        IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0 && errno != EINTR) {
+        retire(fd, n - toSubmit - reaped);
+        return -1;
+      }
+      if (ret > 0) toSubmit -= std::min<unsigned>(ret, toSubmit);
+      unsigned head = *m_cqHead;
+      unsigned cqTail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+      for (; head != cqTail; head++, reaped++) {
+        io_uring_cqe &cqe = m_cqes[head & m_cqMask];
+        results[cqe.user_data] = cqe.res;
+      }
+      __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    if (results[0] == -EINTR || results[0] == -EAGAIN) return 0;
+    // nothing moved at all is the end of the stream
+    if (results[0] <= 0) return -1;
+    ssize_t done = 0;
+    for (unsigned i = 0; i < n && results[i] > 0; i++) {
+      done += results[i];
+      if (size_t(results[i]) < lengths[i]) break;
+    }
+    return done;
+  }
+
+  /**
+   * retire - after io_uring_enter() failed, entries may still be in flight
+   * on the caller's buffers and others may sit unsubmitted in the ring.
+   * Shut the socket down so the ones in flight end, wait for them, and
+   * never use the ring again, so the unsubmitted ones never run.
+   * @param inFlight - entries submitted and not yet completed
+   */
+  void retire(int fd, unsigned inFlight) {
+    m_ok = false;
+    shutdown(fd, SHUT_RDWR);
+    for (int tries = 0; inFlight && tries < 1000; tries++) {
+      syscall(__NR_io_uring_enter, m_fd, 0, inFlight, IORING_ENTER_GETEVENTS,
+              nullptr, 0);
+      unsigned head = *m_cqHead;
+      unsigned cqTail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+      for (; head != cqTail && inFlight; head++) inFlight--;
+      __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+      if (inFlight) usleep(1000);
+    }
+  }
+
+  bool m_ok = false;
+  int m_fd = -1;
+  void *m_sqRing = nullptr, *m_cqRing = nullptr;
+  size_t m_sqRingSize = 0, m_cqRingSize = 0, m_sqesSize = 0;
+  io_uring_sqe *m_sqes = nullptr;
+  unsigned *m_sqTail = nullptr, *m_sqArray = nullptr;
+  unsigned m_sqMask = 0;
+  unsigned *m_cqHead = nullptr, *m_cqTail = nullptr;
+  unsigned m_cqMask = 0;
+  io_uring_cqe *m_cqes = nullptr;
+#else
+  static UringTransport *get(void) { return nullptr; }
+  bool write(int, const std::vector<Span> &) { return false; }
+  bool read(int, char *, size_t) { return false; }
+#endif
+};
+
+#endif  // REAL_SOCKET_URING_H
@@ -46,6 +46,8 @@
 #include <cstring>
 #include <boost/asio.hpp>
 
+#include "framing.h"
+
 using namespace lbcrypto;
 
 #define short versions of commonly used PALISADE data types
@@ -65,6 +67,57 @@ const int VECTORSIZE = 4;
 const int CRYPTOCONTEXT_INDEX = 0;
 const int PUBLICKEY_INDEX = 1;
 
+// the results the client sends back, each tagged with its ResultTag. Without
+// batch mode they are sent in this order.
+enum ResultTag : uint32_t {
+  MultResult = 0,
+  AddResult,
+  RotResult,
+  RotNegResult,
+  VecResult,
+  NumResults
+};
+
+// tag of a KeyPlan the client sends, first to get the keys it needs and
+// later to fetch more
+const uint32_t KEYREQUEST_TAG = 0xffffffff;
+
+/**
+ * KeyPlan - the evaluation keys a client needs. The server generates and
+ * sends only these.
+ */
+struct KeyPlan {
+  // most rotation indices one plan may ask for, each one costs the server
+  // a key generation
+  static const size_t MAX_INDICES = 64;
+
+  bool mult = false;             // relinearization key
+  std::vector<int32_t> indices;  // rotation indices
+
+  std::string encode(void) const {
+    uint32_t flag = mult;
+    std::string bytes(reinterpret_cast<const char *>(&flag), sizeof(flag));
+    bytes.append(reinterpret_cast<const char *>(indices.data()),
+                 indices.size() * sizeof(int32_t));
+    return bytes;
+  }
+
+  static KeyPlan decode(const std::string &bytes) {
+    KeyPlan plan;
+    uint32_t flag;
+    if (bytes.size() < sizeof(flag) ||
+        (bytes.size() - sizeof(flag)) % sizeof(int32_t)) {
+      throw std::runtime_error("KeyPlan: malformed request");
+    }
+    std::memcpy(&flag, bytes.data(), sizeof(flag));
+    plan.mult = flag;
+    plan.indices.resize((bytes.size() - sizeof(flag)) / sizeof(int32_t));
+    std::memcpy(plan.indices.data(), bytes.data() + sizeof(flag),
+                plan.indices.size() * sizeof(int32_t));
+    return plan;
+  }
+};
+
 
 /**
  * validateData - test if two vectors (really, two indexable containers) are
@@ -93,6 +146,33 @@ bool validateData(const T &v1, const T &v2, const float &tol = 0.0001) {
   return true;
 }
 
+/**
+ * evalAtIndices - rotate one ciphertext by each of a list of indices, like
+ * calling EvalAtIndex once per index but much cheaper. The digit
+ * decomposition of ct, the expensive part of a rotation, is computed once
+ * with EvalFastRotationPrecompute and shared by an EvalFastRotation per
+ * index. The rotations run in parallel.
+ * @param cc - crypto context with rotation keys for all the indices
+ * @param ct - ciphertext to rotate
+ * @param indices - rotations, negative to rotate right
+ * @return one ciphertext per index, in the order of indices
+ */
+std::vector<Ciphertext<DCRTPoly>> evalAtIndices(
+    const CryptoContext<DCRTPoly> &cc, const Ciphertext<DCRTPoly> &ct,
+    const std::vector<int32_t> &indices) {
+  auto digits = cc->EvalFastRotationPrecompute(ct);
+  usint m = cc->GetCyclotomicOrder();
+  std::vector<Ciphertext<DCRTPoly>> rotated(indices.size());
+  // EvalFastRotation takes the index unsigned and reads it back as signed,
+  // so negative indices work as they do for EvalAtIndex
+#pragma omp parallel for
+  for (size_t i = 0; i < indices.size(); i++) {
+    rotated[i] =
+        cc->EvalFastRotation(ct, static_cast<usint>(indices[i]), m, digits);
+  }
+  return rotated;
+}
+
 /**
  * Take a powernap of 0.5 seconds
  */
@@ -103,38 +183,15 @@ void nap(const int &ms = 500) {
 
 
 /**
- * sendBuffer over socket. sends a size_t size of buffer then the buffer itself 
+ * sendBuffer over socket. sends a size_t size of buffer then the buffer itself
+ * in one write (see framing.h)
  * @param b streambuf to be sent. 
  * @param s socket to send over
  */
 void sendBuffer(boost::asio::streambuf &b, tcp::socket &s){
-  size_t bSize = b.size();
-  std::cout << "streamed to buffer " << bSize << " bytes" << std::endl;
-  std::cout << "SERVER: send size to socket" << std::endl;  
-  size_t nSent;
-  nSent = s.send(boost::asio::buffer(&bSize, sizeof(bSize)));  
-  std::cout << "SERVER: sent " << nSent << " bytes to socket" << std::endl;    
-  std::cout << "SERVER: sending data to socket" << std::endl;  
-  nSent = s.send(b.data());
-  std::cout << "SERVER: sent " << nSent << " data bytes to socket" << std::endl;    
+  sendFrame(s, b);
 }
 
-/**
- * recvLength returns length of next buffer to be received over socket s
- * @param s socket to use
- */
-size_t recvLength(tcp::socket &s){
-  
-  //read length
-  size_t inLength;
-  std::cout << "CLIENT: reading length from socket" << std::endl;
-  size_t nRead = boost::asio::read(s, boost::asio::buffer(&inLength, sizeof(inLength)));
-  std::cout << "CLIENT: read "<< nRead << " bytes from socket" << std::endl;
-  std::cout << "CLIENT: will read "<< inLength << " bytes from socket" << std::endl;
-  return inLength;
-}
-
-
 /**
  * sendCT sends a CT over socket s
  * @param s socket to send over
@@ -144,7 +201,7 @@ size_t recvLength(tcp::socket &s){
 void sendCT(tcp::socket &s, const CT &ct){
   boost::asio::streambuf b;
   std::ostream os(&b);
-  std::cout << "SERVER: sending cryptotext" << std::endl;
+  FRAME_LOG("SERVER: sending cryptotext");
   Serial::Serialize(ct, os, SerType::BINARY);
   sendBuffer(b, s);
 }
@@ -157,17 +214,41 @@ void sendCT(tcp::socket &s, const CT &ct){
  
 CT recvCT(tcp::socket &s){
   CT c1;
-  {
-	boost::asio::streambuf b(recvLength(s));
-	std::istream is(&b);
-	size_t nRead = boost::asio::read(s, b);
-	std::cout << "CLIENT: read "<< nRead << " bytes from socket" << std::endl;
-	Serial::Deserialize(c1, is, SerType::BINARY);
-	std::cout << "CLIENT: ciphertext deserialized" << std::endl;
-  }  
+  Serial::Deserialize(c1, frameReader().read(s), SerType::BINARY);
+  FRAME_LOG("CLIENT: ciphertext deserialized");
   return c1;
 }
 
+/**
+ * recvCTBatch receives a batch of CTs, sent as one frame, over socket s
+ * @param s socket to receive from
+ * @return ciphertextMatrix received CTs
+ */
+
+ciphertextMatrix recvCTBatch(tcp::socket &s){
+  auto &reader = frameReader();
+  ciphertextMatrix matrix(reader.readBatch(s));
+  for (size_t i = 0; i < matrix.size(); i++) {
+    Serial::Deserialize(matrix[i], reader.item(i), SerType::BINARY);
+  }
+  FRAME_LOG("CLIENT: batch of " << matrix.size()
+                                << " ciphertexts deserialized");
+  return matrix;
+}
+
+/**
+ * sendTaggedCT sends a CT tagged with what it is over socket s
+ * @param s socket to send over
+ * @param tag what the CT is
+ * @param ct CT to send
+ */
+
+void sendTaggedCT(tcp::socket &s, ResultTag tag, const CT &ct){
+  std::ostringstream os;
+  Serial::Serialize(ct, os, SerType::BINARY);
+  sendTagged(s, tag, os.str());
+}
+
 /**
  * sendCC sends a CC over socket s
  * @param s socket to send over
@@ -177,7 +258,7 @@ CT recvCT(tcp::socket &s){
 void sendCC(tcp::socket &s, const CC &cc){
   boost::asio::streambuf b;
   std::ostream os(&b);
-  std::cout << "SERVER: sending cryptocontext" << std::endl;
+  FRAME_LOG("SERVER: sending cryptocontext");
   Serial::Serialize(cc, os, SerType::BINARY);
   sendBuffer(b, s);
 }
@@ -190,14 +271,8 @@ void sendCC(tcp::socket &s, const CC &cc){
  
 CC recvCC(tcp::socket &s){
   CC cc;
-  {
-	boost::asio::streambuf b(recvLength(s));
-	std::istream is(&b);
-	size_t nRead = boost::asio::read(s, b);
-	std::cout << "CLIENT: read "<< nRead << " bytes CC from socket" << std::endl;
-	Serial::Deserialize(cc, is, SerType::BINARY);
-	std::cout << "CLIENT: CC deserialized" << std::endl;
-  }  
+  Serial::Deserialize(cc, frameReader().read(s), SerType::BINARY);
+  FRAME_LOG("CLIENT: CC deserialized");
   return cc;
 }
 
@@ -210,7 +285,7 @@ CC recvCC(tcp::socket &s){
 void sendPublicKey(tcp::socket &s, const PublicKey &pk){
   boost::asio::streambuf b;
   std::ostream os(&b);
-  std::cout << "SERVER: sending Public key" << std::endl;
+  FRAME_LOG("SERVER: sending Public key");
   Serial::Serialize(pk, os, SerType::BINARY);
   sendBuffer(b, s);
 }
@@ -224,14 +299,8 @@ void sendPublicKey(tcp::socket &s, const PublicKey &pk){
  
 PublicKey recvPublicKey(tcp::socket &s){
   PublicKey pk;
-  {
-	boost::asio::streambuf b(recvLength(s));
-	std::istream is(&b);
-	size_t nRead = boost::asio::read(s, b);
-	std::cout << "CLIENT: read "<< nRead << " bytes PublicKey from socket" << std::endl;
-	Serial::Deserialize(pk, is, SerType::BINARY);
-	std::cout << "CLIENT: PublicKey deserialized" << std::endl;
-  }  
+  Serial::Deserialize(pk, frameReader().read(s), SerType::BINARY);
+  FRAME_LOG("CLIENT: PublicKey deserialized");
   return pk;
 }
 
@@ -244,7 +313,7 @@ PublicKey recvPublicKey(tcp::socket &s){
 void sendEvalMultKey(tcp::socket &s, const CC &cc){
   boost::asio::streambuf b;
   std::ostream os(&b);
-  std::cout << "SERVER: sending EvalMult/reliniarization key" << std::endl;
+  FRAME_LOG("SERVER: sending EvalMult/reliniarization key");
   if (!cc->SerializeEvalMultKey(os, SerType::BINARY)) {
 	std::cerr << "SERVER: Error writing eval mult keys" << std::endl;
 	std::exit(1);
@@ -259,16 +328,12 @@ void sendEvalMultKey(tcp::socket &s, const CC &cc){
  */
  
 void recvEvalMultKey(tcp::socket &s, CC &cc){
-  boost::asio::streambuf b(recvLength(s));
-  std::istream is(&b);
-  size_t nRead = boost::asio::read(s, b);
-  std::cout << "CLIENT: read "<< nRead << " bytes evalMult key from socket" << std::endl;
-  if (!cc->DeserializeEvalMultKey(is, SerType::BINARY)) {
+  if (!cc->DeserializeEvalMultKey(frameReader().read(s), SerType::BINARY)) {
 	std::cerr << "CLIENT: Could not deserialize eval mult key file"
 			  << std::endl;
 	std::exit(1);
   }
-  std::cout << "CLIENT: Relinearization keys from server deserialized." << std::endl;
+  FRAME_LOG("CLIENT: Relinearization keys from server deserialized.");
 }
 
 
@@ -281,7 +346,7 @@ void recvEvalMultKey(tcp::socket &s, CC &cc){
 void sendEvalAutomorphismKey(tcp::socket &s, const CC &cc){
   boost::asio::streambuf b;
   std::ostream os(&b);
-  std::cout << "SERVER: sending Rotation keys" << std::endl;
+  FRAME_LOG("SERVER: sending Rotation keys");
   if (!cc->SerializeEvalAutomorphismKey(os, SerType::BINARY)) {
 	std::cerr << "SERVER: Error writing rotation keys" << std::endl;
 	std::exit(1);
@@ -297,16 +362,61 @@ void sendEvalAutomorphismKey(tcp::socket &s, const CC &cc){
  */
  
 void recvEvalAutomorphismKey(tcp::socket &s, CC &cc){
-  boost::asio::streambuf b(recvLength(s));
-  std::istream is(&b);
-  size_t nRead = boost::asio::read(s, b);
-  std::cout << "CLIENT: read "<< nRead << " bytes eval automorphism key from socket" << std::endl;
-  if (!cc->DeserializeEvalAutomorphismKey(is, SerType::BINARY)) {
+  // deserializing replaces the rotation keys held for a key tag, keep the
+  // ones fetched before
+  auto &all = CryptoContextImpl<DCRTPoly>::GetAllEvalAutomorphismKeys();
+  auto held = all;
+  if (!cc->DeserializeEvalAutomorphismKey(frameReader().read(s),
+                                          SerType::BINARY)) {
 	std::cerr << "CLIENT: Could not deserialize eval automorphism (rotation) key"
 			  << std::endl;
 	std::exit(1);
   }
-  std::cout << "CLIENT: Relinearization keys from server deserialized." << std::endl;
+  for (auto &tag : held) {
+    auto it = all.find(tag.first);
+    if (it == all.end()) {
+      all[tag.first] = tag.second;
+    } else if (it->second != tag.second) {
+      it->second->insert(tag.second->begin(), tag.second->end());
+    }
+  }
+  FRAME_LOG("CLIENT: Rotation keys from server deserialized.");
+}
+
+/**
+ * sendKeyRequest asks the server for the keys of a plan over socket s
+ * @param s socket to send over
+ * @param plan keys to ask for
+ */
+
+void sendKeyRequest(tcp::socket &s, const KeyPlan &plan){
+  sendTagged(s, KEYREQUEST_TAG, plan.encode());
+}
+
+/**
+ * recvKeys receives the keys of a plan, in the order the server sends them,
+ * over socket s
+ * @param s socket to receive from
+ * @param cc CC to load the keys into
+ * @param plan keys asked for
+ */
+
+void recvKeys(tcp::socket &s, CC &cc, const KeyPlan &plan){
+  if (plan.mult) recvEvalMultKey(s, cc);
+  if (!plan.indices.empty()) recvEvalAutomorphismKey(s, cc);
+}
+
+/**
+ * fetchKeys asks the server for more keys once the session is running, and
+ * waits for them
+ * @param s socket to use
+ * @param cc CC to load the keys into
+ * @param plan keys to fetch
+ */
+
+void fetchKeys(tcp::socket &s, CC &cc, const KeyPlan &plan){
+  sendKeyRequest(s, plan);
+  recvKeys(s, cc, plan);
 }
 
 
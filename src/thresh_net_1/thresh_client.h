@@ -51,6 +51,50 @@ class ThreshCommonClient : public olc::net::client_interface<ThreshMsgTypes> {
     return ct;
   }
 
+  // compute once (-C): ask the server for a result, it answers with the
+  // result, NackComputedCT if it is still being computed, ComputeCT if this
+  // party is to compute it, or DenyComputedCT if each party computes its own
+  void RequestComputedCT(ComputedKind kind) {
+    olc::net::message<ThreshMsgTypes> msg;
+    DEBUG("Client: Requesting computed CT " << kind);
+    msg.header.id = ThreshMsgTypes::RequestComputedCT;
+    msg.header.SubType_ID = kind;
+    Send(msg);
+  }
+
+  // upload a result this party computed for everybody
+  void SendComputedCT(ComputedKind kind, const CT &ct) {
+    Send(ComputedCTMsg(kind, ct));
+  }
+
+  // a result computed by another party, false if the digest does not match
+  bool RecvComputedCT(olc::net::message<ThreshMsgTypes> &msg, CT &ct) {
+    if (!CheckComputedDigest(msg)) return false;
+    Digest digest;
+    msg >> digest;
+    ct = RecvCT(msg);
+    return true;
+  }
+
+  void RequestFusedResults(void) {
+    olc::net::message<ThreshMsgTypes> msg;
+    DEBUG("Client: Requesting fused results");
+    msg.header.id = ThreshMsgTypes::RequestFusedResults;
+    Send(msg);
+  }
+
+  // values of the add, mult and sum results fused by the server
+  vector<vector<double>> RecvFusedResults(
+      olc::net::message<ThreshMsgTypes> &msg) {
+    vector<vector<double>> results;
+    SerialReader reader(msg);
+    while (reader.More()) {
+      results.emplace_back();
+      reader.NextValues(results.back());
+    }
+    return results;
+  }
+
   void DisconnectClient(void) {
     olc::net::message<ThreshMsgTypes> msg;
     DEBUG("Client: Disconnecting");
@@ -71,9 +71,35 @@ enum class ClientAStates : uint64_t {
   RequestDecryptMainAdd,
   RequestDecryptMainMult,
   RequestDecryptMainSum,
+  RequestFusedResults,
   DecryptFusion,
 };
 
+// names of the states above, in the same order (used for tracing)
+vector<string> ClientAStateNames{
+    "GetMessage",
+    "RequestCC",
+    "GenPubKeys",
+    "SendRnd1evalMultKey",
+    "SendRnd1evalSumKeys",
+    "RequestRnd2SharedKey",
+    "RequestRnd2evalMultAB",
+    "RequestRnd2evalMultBAB",
+    "RequestRnd2evalSumKeysJoin",
+    "GenFinalSharedKeys",
+    "RequestCT1",
+    "RequestCT2",
+    "RequestCT3",
+    "DecryptLeadPartialAdd",
+    "DecryptLeadPartialMult",
+    "DecryptLeadPartialSum",
+    "RequestDecryptMainAdd",
+    "RequestDecryptMainMult",
+    "RequestDecryptMainSum",
+    "RequestFusedResults",
+    "DecryptFusion",
+};
+
 int main(int argc, char *argv[]) {
   ////////////////////////////////////////////////////////////
   // Set-up of parameters
@@ -82,8 +108,11 @@ int main(int argc, char *argv[]) {
   string myName("");  // name of client to run
   uint32_t port(0);
   string hostName("");  // name of server host
+  string traceFile("");  // trace events are written here if set
+  bool serverFusion(false);  // ask the server for the fused results
+  bool computeOnce(false);   // use results computed once for everybody
 
-  while ((opt = getopt(argc, argv, "i:n:p:h")) != -1) {
+  while ((opt = getopt(argc, argv, "i:n:p:t:FCh")) != -1) {
     switch (opt) {
       case 'i':
         hostName = optarg;
@@ -97,6 +126,18 @@ int main(int argc, char *argv[]) {
         port = atoi(optarg);
         std::cout << "host port " << port << std::endl;
         break;
+      case 't':
+        traceFile = optarg;
+        std::cout << "tracing to " << traceFile << std::endl;
+        break;
+      case 'F':
+        serverFusion = true;
+        std::cout << "requesting fused results from the server" << std::endl;
+        break;
+      case 'C':
+        computeOnce = true;
+        std::cout << "using results computed once for everybody" << std::endl;
+        break;
       case 'h':
       default: /* '?' */
         std::cerr << "Usage: " << std::endl
@@ -104,10 +145,18 @@ int main(int argc, char *argv[]) {
                   << "  -n name of the client" << std::endl
                   << "  -i IP or hostname of the server" << std::endl
                   << "  -p port of the server" << std::endl
+                  << "  -t file to write trace events to" << std::endl
+                  << "  -F request results fused by the server" << std::endl
+                  << "  -C use results computed once by the server or a party"
+                  << std::endl
                   << "  -h prints this message" << std::endl;
         std::exit(EXIT_FAILURE);
     }
   }
+  if (!traceFile.empty()) {
+    OpenTrace(myName, traceFile);
+  }
+
   ClientA c;
   // connect to the server
   PROFILELOG(myName << ": Connecing to server at " << hostName << ":" << port);
@@ -160,15 +209,46 @@ int main(int argc, char *argv[]) {
 
   TimeVar t;  // time benchmarking variable
 
+
+  // the add, mult and sum results, computed here unless they were computed
+  // once for everybody (-C)
+  bool computed[] = {false, false, false};
+  auto resultCT = [&](unsigned int kind) -> CT & {
+    return kind == ComputedAdd    ? ciphertextAdd123
+           : kind == ComputedMult ? ciphertextMult
+                                  : ciphertextSum;
+  };
+  auto computeResult = [&](ComputedKind kind) {
+    if (kind == ComputedSum) clientCC->InsertEvalSumKey(Rnd2EvalSumKeysJoin);
+    return resultCT(kind) = EvalComputed(clientCC, kind, ciphertext1,
+                                         ciphertext2, ciphertext3, batchSize);
+  };
+  // the state that decrypts each result
+  auto decryptState = [](unsigned int kind) {
+    return kind == ComputedAdd    ? ClientAStates::DecryptLeadPartialAdd
+           : kind == ComputedMult ? ClientAStates::DecryptLeadPartialMult
+                                  : ClientAStates::DecryptLeadPartialSum;
+  };
+
   DEBUG_FLAG(false);  // Turns on and off DEBUG() statements
 
   while (!done) {
     if (c.IsConnected()) {
+      // trace each step of the state machine, messages are traced as they
+      // are taken off the queue below
+      uint64_t stateSpan = 0;
+      if (state != ClientAStates::GetMessage) {
+        stateSpan = olc::net::tracer::Get().BeginSpan(
+            ClientAStateNames[static_cast<size_t>(state)]);
+      }
+
       switch (state) {  // sequence of states that the client executes
         case ClientAStates::GetMessage:
           // client tests for a response from the server
           if (!c.Incoming().empty()) {
             auto msg = c.Incoming().pop_front().msg;
+            OLC_TRACE_SPAN(ThreshMsgName(static_cast<uint32_t>(msg.header.id)),
+                           msg.header.span_id);
 
             switch (msg.header.id) {
               case ThreshMsgTypes::ServerAccept:
@@ -275,7 +355,8 @@ int main(int argc, char *argv[]) {
                 PROFILELOG(
                     myName
                     << ": acknowledging Partially decrypted Lead sum CT");
-                state = ClientAStates::RequestDecryptMainAdd;
+                state = serverFusion ? ClientAStates::RequestFusedResults
+                                     : ClientAStates::RequestDecryptMainAdd;
                 break;
 
               case ThreshMsgTypes::SendDecryptMainAdd:
@@ -390,6 +471,83 @@ int main(int argc, char *argv[]) {
                 state = ClientAStates::RequestDecryptMainSum;
                 break;
 
+              case ThreshMsgTypes::SendFusedResults: {
+                PROFILELOG(myName << ": reading results fused by the server");
+                auto results = c.RecvFusedResults(msg);
+                const char *names[] = {"Add", "Mult", "Sum"};
+                for (size_t i = 0; i < results.size() && i < 3; i++) {
+                  std::cout << "\n Resulting Fused Plaintext " << names[i]
+                            << ": \n(";
+                  for (size_t j = 0; j < results[i].size() && j < 12; j++) {
+                    std::cout << (j ? ", " : "") << results[i][j];
+                  }
+                  std::cout << ", ... )\n";
+                }
+                done = true;
+                break;
+              }
+
+              case ThreshMsgTypes::NackFusedResults:
+                // the other party has not sent its partial decryptions yet
+                DEBUG("Server NackFusedResults");
+                nap(1000);  // sleep for a second and retry.
+                state = ClientAStates::RequestFusedResults;
+                break;
+
+              case ThreshMsgTypes::SendComputedCT: {
+                unsigned int kind = msg.header.SubType_ID;
+                PROFILELOG(myName << ": reading computed CT " << kind);
+                TIC(t);
+                if (kind > ComputedSum ||
+                    !c.RecvComputedCT(msg, resultCT(kind))) {
+                  std::cerr << myName << ": bad digest on computed CT "
+                            << kind << std::endl;
+                  std::exit(EXIT_FAILURE);
+                }
+                computed[kind] = true;
+                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+                state = decryptState(kind);
+                break;
+              }
+
+              case ThreshMsgTypes::ComputeCT: {
+                // we are the first to ask, compute it for everybody
+                auto kind = ComputedKind(msg.header.SubType_ID);
+                PROFILELOG(myName << ": computing CT " << kind
+                                  << " for all parties");
+                TIC(t);
+                c.SendComputedCT(kind, computeResult(kind));
+                computed[kind] = true;
+                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+                state = decryptState(kind);
+                break;
+              }
+
+              case ThreshMsgTypes::AckComputedCT:
+                PROFILELOG(myName << ": Acknowledged computed CT "
+                                  << msg.header.SubType_ID);
+                break;
+
+              case ThreshMsgTypes::NackComputedCT:
+                // still being computed
+                DEBUG("Server NackComputedCT");
+                nap(1000);  // sleep for a second and retry.
+                state = decryptState(msg.header.SubType_ID);
+                break;
+
+              case ThreshMsgTypes::DenyComputedCT:
+                PROFILELOG(myName << ": server does not compute once, "
+                                     "computing locally");
+                computeOnce = false;
+                state = decryptState(msg.header.SubType_ID);
+                break;
+
+              case ThreshMsgTypes::DenyFusedResults:
+                PROFILELOG(myName << ": server will not fuse for us, fusing "
+                                     "locally");
+                state = ClientAStates::RequestDecryptMainAdd;
+                break;
+
               default:
                 PROFILELOG(myName << ": received unhandled message from Server "
                                   << msg.header.id);
@@ -545,11 +703,15 @@ int main(int argc, char *argv[]) {
           break;
 
         case ClientAStates::DecryptLeadPartialAdd:
+          if (computeOnce && !computed[ComputedAdd]) {
+            c.RequestComputedCT(ComputedAdd);
+            state = ClientAStates::GetMessage;
+            break;
+          }
           PROFILELOG(myName << ": Partial decryption of eval add ciphertext");
           TIC(t);
 
-          ciphertextAdd12 = clientCC->EvalAdd(ciphertext1, ciphertext2);
-          ciphertextAdd123 = clientCC->EvalAdd(ciphertextAdd12, ciphertext3);
+          if (!computed[ComputedAdd]) computeResult(ComputedAdd);
 
           ciphertextPartialAdd1 = clientCC->MultipartyDecryptLead(
               keyPair.secretKey, {ciphertextAdd123});
@@ -559,11 +721,15 @@ int main(int argc, char *argv[]) {
           break;
 
         case ClientAStates::DecryptLeadPartialMult:
+          if (computeOnce && !computed[ComputedMult]) {
+            c.RequestComputedCT(ComputedMult);
+            state = ClientAStates::GetMessage;
+            break;
+          }
           PROFILELOG(myName << ": Partial decryption of eval mult ciphertext");
           TIC(t);
 
-          ciphertextMultTemp = clientCC->EvalMult(ciphertext1, ciphertext3);
-          ciphertextMult = clientCC->ModReduce(ciphertextMultTemp);
+          if (!computed[ComputedMult]) computeResult(ComputedMult);
 
           ciphertextPartialMult1 = clientCC->MultipartyDecryptLead(
               keyPair.secretKey, {ciphertextMult});
@@ -573,13 +739,17 @@ int main(int argc, char *argv[]) {
           break;
 
         case ClientAStates::DecryptLeadPartialSum:
+          if (computeOnce && !computed[ComputedSum]) {
+            c.RequestComputedCT(ComputedSum);
+            state = ClientAStates::GetMessage;
+            break;
+          }
           PROFILELOG(myName << ": Partial decryption of eval sum ciphertext");
           TIC(t);
-          clientCC->InsertEvalSumKey(Rnd2EvalSumKeysJoin);
           // compute ciphertextSum[0] =
           // ciphertext3[0]+...+ciphertext[batchsize-1] compute ciphertextSum[1]
           // = ciphertext3[1]+...+ciphertext3[batchsize] and so on.
-          ciphertextSum = clientCC->EvalSum(ciphertext3, batchSize);
+          if (!computed[ComputedSum]) computeResult(ComputedSum);
 
           ciphertextPartialSum1 = clientCC->MultipartyDecryptLead(
               keyPair.secretKey, {ciphertextSum});
@@ -612,6 +782,12 @@ int main(int argc, char *argv[]) {
           state = ClientAStates::GetMessage;
           break;
 
+        case ClientAStates::RequestFusedResults:
+          PROFILELOG(myName << ": Request results fused by the server");
+          c.RequestFusedResults();
+          state = ClientAStates::GetMessage;
+          break;
+
         case ClientAStates::DecryptFusion:
           PROFILELOG(myName << ": Final decryption fusion of add, mult, sum");
 
@@ -666,6 +842,8 @@ int main(int argc, char *argv[]) {
 
       }  // switch state
 
+      olc::net::tracer::Get().EndSpan(stateSpan);
+
     }  // IsConnected()
 
     nap(100);  // take a 100 msec pause
@@ -71,9 +71,35 @@ enum class ClientBStates : uint64_t {
   RequestDecryptLeadAdd,
   RequestDecryptLeadMult,
   RequestDecryptLeadSum,
+  RequestFusedResults,
   DecryptFusion,
 };
 
+// names of the states above, in the same order (used for tracing)
+vector<string> ClientBStateNames{
+    "GetMessage",
+    "RequestCC",
+    "RequestRnd1PubKey",
+    "RequestRnd1evalMultKey",
+    "RequestRnd1evalSumKeys",
+    "GenRnd2Keys",
+    "SendRnd2evalMultAB",
+    "SendRnd2evalMultBAB",
+    "SendRnd2evalSumKeysJoin",
+    "RequestRnd3evalMultFinal",
+    "GenCT1",
+    "GenCT2",
+    "GenCT3",
+    "DecryptMainPartialAdd",
+    "DecryptMainPartialMult",
+    "DecryptMainPartialSum",
+    "RequestDecryptLeadAdd",
+    "RequestDecryptLeadMult",
+    "RequestDecryptLeadSum",
+    "RequestFusedResults",
+    "DecryptFusion",
+};
+
 int main(int argc, char *argv[]) {
   ////////////////////////////////////////////////////////////
   // Set-up of parameters
@@ -82,8 +108,11 @@ int main(int argc, char *argv[]) {
   string myName("");  // name of client to run
   uint32_t port(0);
   string hostName("");  // name of server host
+  string traceFile("");  // trace events are written here if set
+  bool serverFusion(false);  // ask the server for the fused results
+  bool computeOnce(false);   // use results computed once for everybody
 
-  while ((opt = getopt(argc, argv, "i:n:p:h")) != -1) {
+  while ((opt = getopt(argc, argv, "i:n:p:t:FCh")) != -1) {
     switch (opt) {
       case 'i':
         hostName = optarg;
@@ -97,6 +126,18 @@ int main(int argc, char *argv[]) {
         port = atoi(optarg);
         std::cout << "host port " << port << std::endl;
         break;
+      case 't':
+        traceFile = optarg;
+        std::cout << "tracing to " << traceFile << std::endl;
+        break;
+      case 'F':
+        serverFusion = true;
+        std::cout << "requesting fused results from the server" << std::endl;
+        break;
+      case 'C':
+        computeOnce = true;
+        std::cout << "using results computed once for everybody" << std::endl;
+        break;
       case 'h':
       default: /* '?' */
         std::cerr << "Usage: " << std::endl
@@ -104,10 +145,18 @@ int main(int argc, char *argv[]) {
                   << "  -n name of the client" << std::endl
                   << "  -i IP or hostname of the server" << std::endl
                   << "  -p port of the server" << std::endl
+                  << "  -t file to write trace events to" << std::endl
+                  << "  -F request results fused by the server" << std::endl
+                  << "  -C use results computed once by the server or a party"
+                  << std::endl
                   << "  -h prints this message" << std::endl;
         std::exit(EXIT_FAILURE);
     }
   }
+  if (!traceFile.empty()) {
+    OpenTrace(myName, traceFile);
+  }
+
   ClientB c;
   // connect to the server
   PROFILELOG(myName << ": Connecing to server at " << hostName << ":" << port);
@@ -168,15 +217,46 @@ int main(int argc, char *argv[]) {
   vector<CT> ciphertextPartialAdd2, ciphertextPartialMult2,
       ciphertextPartialSum2;
 
+
+  // the add, mult and sum results, computed here unless they were computed
+  // once for everybody (-C)
+  bool computed[] = {false, false, false};
+  auto resultCT = [&](unsigned int kind) -> CT & {
+    return kind == ComputedAdd    ? ciphertextAdd123
+           : kind == ComputedMult ? ciphertextMult
+                                  : ciphertextSum;
+  };
+  auto computeResult = [&](ComputedKind kind) {
+    if (kind == ComputedSum) clientCC->InsertEvalSumKey(evalSumKeysJoin);
+    return resultCT(kind) = EvalComputed(clientCC, kind, ciphertext1,
+                                         ciphertext2, ciphertext3, batchSize);
+  };
+  // the state that decrypts each result
+  auto decryptState = [](unsigned int kind) {
+    return kind == ComputedAdd    ? ClientBStates::DecryptMainPartialAdd
+           : kind == ComputedMult ? ClientBStates::DecryptMainPartialMult
+                                  : ClientBStates::DecryptMainPartialSum;
+  };
+
   DEBUG_FLAG(false);  // turns on and off DEBUG() statements
   while (!done) {
     if (c.IsConnected()) {
       // client executes a state
+      // trace each step of the state machine, messages are traced as they
+      // are taken off the queue below
+      uint64_t stateSpan = 0;
+      if (state != ClientBStates::GetMessage) {
+        stateSpan = olc::net::tracer::Get().BeginSpan(
+            ClientBStateNames[static_cast<size_t>(state)]);
+      }
+
       switch (state) {  // sequence of states that the client executes
         case ClientBStates::GetMessage:
           // client tests for a response from the server
           if (!c.Incoming().empty()) {
             auto msg = c.Incoming().pop_front().msg;
+            OLC_TRACE_SPAN(ThreshMsgName(static_cast<uint32_t>(msg.header.id)),
+                           msg.header.span_id);
 
             switch (msg.header.id) {
               case ThreshMsgTypes::ServerAccept:
@@ -305,7 +385,8 @@ int main(int argc, char *argv[]) {
                 PROFILELOG(
                     myName
                     << ": acknowledging partially decrypted main sum CT");
-                state = ClientBStates::RequestDecryptLeadAdd;
+                state = serverFusion ? ClientBStates::RequestFusedResults
+                                     : ClientBStates::RequestDecryptLeadAdd;
                 break;
 
               case ThreshMsgTypes::SendDecryptLeadAdd:
@@ -397,6 +478,83 @@ int main(int argc, char *argv[]) {
                 state = ClientBStates::DecryptMainPartialSum;
                 break;
 
+              case ThreshMsgTypes::SendFusedResults: {
+                PROFILELOG(myName << ": reading results fused by the server");
+                auto results = c.RecvFusedResults(msg);
+                const char *names[] = {"Add", "Mult", "Sum"};
+                for (size_t i = 0; i < results.size() && i < 3; i++) {
+                  std::cout << "\n Resulting Fused Plaintext " << names[i]
+                            << ": \n(";
+                  for (size_t j = 0; j < results[i].size() && j < 12; j++) {
+                    std::cout << (j ? ", " : "") << results[i][j];
+                  }
+                  std::cout << ", ... )\n";
+                }
+                done = true;
+                break;
+              }
+
+              case ThreshMsgTypes::NackFusedResults:
+                // the other party has not sent its partial decryptions yet
+                DEBUG("Server NackFusedResults");
+                nap(1000);  // sleep for a second and retry.
+                state = ClientBStates::RequestFusedResults;
+                break;
+
+              case ThreshMsgTypes::SendComputedCT: {
+                unsigned int kind = msg.header.SubType_ID;
+                PROFILELOG(myName << ": reading computed CT " << kind);
+                TIC(t);
+                if (kind > ComputedSum ||
+                    !c.RecvComputedCT(msg, resultCT(kind))) {
+                  std::cerr << myName << ": bad digest on computed CT "
+                            << kind << std::endl;
+                  std::exit(EXIT_FAILURE);
+                }
+                computed[kind] = true;
+                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+                state = decryptState(kind);
+                break;
+              }
+
+              case ThreshMsgTypes::ComputeCT: {
+                // we are the first to ask, compute it for everybody
+                auto kind = ComputedKind(msg.header.SubType_ID);
+                PROFILELOG(myName << ": computing CT " << kind
+                                  << " for all parties");
+                TIC(t);
+                c.SendComputedCT(kind, computeResult(kind));
+                computed[kind] = true;
+                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+                state = decryptState(kind);
+                break;
+              }
+
+              case ThreshMsgTypes::AckComputedCT:
+                PROFILELOG(myName << ": Acknowledged computed CT "
+                                  << msg.header.SubType_ID);
+                break;
+
+              case ThreshMsgTypes::NackComputedCT:
+                // still being computed
+                DEBUG("Server NackComputedCT");
+                nap(1000);  // sleep for a second and retry.
+                state = decryptState(msg.header.SubType_ID);
+                break;
+
+              case ThreshMsgTypes::DenyComputedCT:
+                PROFILELOG(myName << ": server does not compute once, "
+                                     "computing locally");
+                computeOnce = false;
+                state = decryptState(msg.header.SubType_ID);
+                break;
+
+              case ThreshMsgTypes::DenyFusedResults:
+                PROFILELOG(myName << ": server will not fuse for us, fusing "
+                                     "locally");
+                state = ClientBStates::RequestDecryptLeadAdd;
+                break;
+
               default:
                 PROFILELOG(myName << ": received unhandled message from Server "
                                   << msg.header.id);
@@ -538,12 +696,16 @@ int main(int argc, char *argv[]) {
           break;
 
         case ClientBStates::DecryptMainPartialAdd:
+          if (computeOnce && !computed[ComputedAdd]) {
+            c.RequestComputedCT(ComputedAdd);
+            state = ClientBStates::GetMessage;
+            break;
+          }
           PROFILELOG(myName << ": Partial decryption of eval add ciphertext");
           TIC(t);
 
           // compute ciphertext123 = ciphertext1+ciphertext2+ciphertext3
-          ciphertextAdd12 = clientCC->EvalAdd(ciphertext1, ciphertext2);
-          ciphertextAdd123 = clientCC->EvalAdd(ciphertextAdd12, ciphertext3);
+          if (!computed[ComputedAdd]) computeResult(ComputedAdd);
 
           ciphertextPartialAdd2 = clientCC->MultipartyDecryptMain(
               keyPair.secretKey, {ciphertextAdd123});
@@ -554,12 +716,16 @@ int main(int argc, char *argv[]) {
           break;
 
         case ClientBStates::DecryptMainPartialMult:
+          if (computeOnce && !computed[ComputedMult]) {
+            c.RequestComputedCT(ComputedMult);
+            state = ClientBStates::GetMessage;
+            break;
+          }
           PROFILELOG(myName << ": Partial decryption of eval mult ciphertext");
           TIC(t);
 
           // compute ciphertextMult = ciphertext1*ciphertext3
-          ciphertextMultTemp = clientCC->EvalMult(ciphertext1, ciphertext3);
-          ciphertextMult = clientCC->ModReduce(ciphertextMultTemp);
+          if (!computed[ComputedMult]) computeResult(ComputedMult);
 
           ciphertextPartialMult2 = clientCC->MultipartyDecryptMain(
               keyPair.secretKey, {ciphertextMult});
@@ -569,14 +735,18 @@ int main(int argc, char *argv[]) {
           break;
 
         case ClientBStates::DecryptMainPartialSum:
+          if (computeOnce && !computed[ComputedSum]) {
+            c.RequestComputedCT(ComputedSum);
+            state = ClientBStates::GetMessage;
+            break;
+          }
           PROFILELOG(myName << ": Partial decryption of eval sum ciphertext");
           TIC(t);
 
           // compute ciphertextSum[0] =
           // ciphertext3[0]+...+ciphertext[batchsize-1] compute ciphertextSum[1]
           // = ciphertext3[1]+...+ciphertext3[batchsize] and so on.
-          clientCC->InsertEvalSumKey(evalSumKeysJoin);
-          ciphertextSum = clientCC->EvalSum(ciphertext3, batchSize);
+          if (!computed[ComputedSum]) computeResult(ComputedSum);
 
           ciphertextPartialSum2 = clientCC->MultipartyDecryptMain(
               keyPair.secretKey, {ciphertextSum});
@@ -613,6 +783,12 @@ int main(int argc, char *argv[]) {
           state = ClientBStates::GetMessage;
           break;
 
+        case ClientBStates::RequestFusedResults:
+          PROFILELOG(myName << ": Request results fused by the server");
+          c.RequestFusedResults();
+          state = ClientBStates::GetMessage;
+          break;
+
         case ClientBStates::DecryptFusion:
           PROFILELOG(myName << ": perform decrypt fusion");
           TIC(t);
@@ -670,6 +846,8 @@ int main(int argc, char *argv[]) {
           break;
       }  // switch state
 
+      olc::net::tracer::Get().EndSpan(stateSpan);
+
     }  // IsConnected()
 
   }  // while !done
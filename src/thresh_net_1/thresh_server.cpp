@@ -55,19 +55,41 @@ int main(int argc, char *argv[]) {
   ////////////////////////////////////////////////////////////
   int opt;
   uint32_t port(0);
+  string traceFile("");  // trace events are written here if set
+  string fuseFor("");    // parties that get results fused by the server
+  string computeOn("");  // where results are computed once for everybody
   std::cout << "here debug";
 
-  while ((opt = getopt(argc, argv, "p:h")) != -1) {
+  while ((opt = getopt(argc, argv, "p:t:F:C:h")) != -1) {
     switch (opt) {
       case 'p':
         port = atoi(optarg);
         std::cout << "host port " << port << std::endl;
         break;
+      case 't':
+        traceFile = optarg;
+        std::cout << "tracing to " << traceFile << std::endl;
+        break;
+      case 'F':
+        fuseFor = optarg;
+        std::cout << "fusing results on the server for " << fuseFor
+                  << std::endl;
+        break;
+      case 'C':
+        computeOn = optarg;
+        std::cout << "computing each result once on the " << computeOn
+                  << std::endl;
+        break;
       case 'h':
       default: /* '?' */
         std::cerr << "Usage: " << std::endl
                   << "arguments:" << std::endl
                   << "  -p port of the server" << std::endl
+                  << "  -t file to write trace events to" << std::endl
+                  << "  -F fuse decryptions on the server for lead, main or"
+                  << " all parties" << std::endl
+                  << "  -C compute each result once on the server or the"
+                  << " first party that asks" << std::endl
                   << "  -h prints this message" << std::endl;
         std::exit(EXIT_FAILURE);
     }
@@ -79,9 +101,29 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  if (!traceFile.empty()) {
+    OpenTrace("server", traceFile, true);
+  }
+
+  bool fuseForLead = (fuseFor == "lead" || fuseFor == "all");
+  bool fuseForMain = (fuseFor == "main" || fuseFor == "all");
+  if (!fuseFor.empty() && !fuseForLead && !fuseForMain) {
+    std::cerr << "-F must be lead, main or all" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (!computeOn.empty() && computeOn != "server" && computeOn != "party") {
+    std::cerr << "-C must be server or party" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
   PROFILELOG("SERVER: Initializing");
 
   ThreshServer server(port);
+  server.EnableFusion(fuseForLead, fuseForMain);
+  if (!computeOn.empty()) {
+    server.EnableComputeOnce(computeOn == "server");
+  }
   server.Start();
 
   while (1) {
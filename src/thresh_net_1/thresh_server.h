@@ -1,6 +1,8 @@
 #ifndef THRESH_SERVER_H
 #define THRESH_SERVER_H
 
+#include <future>
+
 #include "thresh_utils.h"
 
 // based on asio connection objects from olc_net thanks to
@@ -23,6 +25,20 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     InitializeCC();
   }
 
+  // Fuse decryptions on the server (-F) for the lead (Alice) and/or the main
+  // (Bob) party, see SendClientFusedResults()
+  void EnableFusion(bool forLead, bool forMain) {
+    fuseForLead = forLead;
+    fuseForMain = forMain;
+  }
+
+  // Compute each result once (-C) instead of on every party, on the server
+  // or on the first party that asks for it, see SendClientComputedCT()
+  void EnableComputeOnce(bool onServer) {
+    computeOnce = true;
+    computeOnServer = onServer;
+  }
+
  protected:
   virtual bool OnClientConnect(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
@@ -43,12 +59,22 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
     std::cout << "Removing client [" << client->GetID() << "]\n";
     // remove client from the data structures
+    for (auto it = computingFor.begin(); it != computingFor.end();) {
+      if (it->second.client == client->GetID()) {
+        it = computingFor.erase(it);
+      } else {
+        ++it;
+      }
+    }
   }
 
   // Called when a message arrives
   virtual void OnMessage(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
       olc::net::message<ThreshMsgTypes>& msg) {
+    // trace the handling of each message as a child of the message itself
+    OLC_TRACE_SPAN(ThreshMsgName(static_cast<uint32_t>(msg.header.id)),
+                   msg.header.span_id);
     switch (msg.header.id) {
       case ThreshMsgTypes::RequestCC:
         std::cout << "[" << client->GetID() << "]: RequestCC\n";
@@ -310,6 +336,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         std::cout << "[" << client->GetID() << "]: SendDecryptPartialMainAdd\n";
         // receive ciphertext
         // store it in the ClientB's data structure.
+        if (!FromRole(client, mainID, ThreshMsgTypes::NackPartialMainAdd))
+          break;
         RecvClientPartialMainAddCT(client, msg);
         {
           // send acknowledgement
@@ -323,6 +351,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         std::cout << "[" << client->GetID() << "]: SendDecryptPartialLeadAdd\n";
         // receive ciphertext
         // store it in the ClientA's data structure.
+        if (!FromRole(client, leadID, ThreshMsgTypes::NackPartialLeadAdd))
+          break;
         RecvClientPartialLeadAddCT(client, msg);
         {
           // send acknowledgement
@@ -338,6 +368,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
                   << "]: SendDecryptPartialMainMult\n";
         // receive ciphertext
         // store it in the ClientB's data structure.
+        if (!FromRole(client, mainID, ThreshMsgTypes::NackPartialMainMult))
+          break;
         RecvClientPartialMainMultCT(client, msg);
         {
           // send acknowledgement
@@ -353,6 +385,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
                   << "]: SendDecryptPartialLeadMult\n";
         // receive ciphertext
         // store it in the ClientA's data structure.
+        if (!FromRole(client, leadID, ThreshMsgTypes::NackPartialLeadMult))
+          break;
         RecvClientPartialLeadMultCT(client, msg);
         {
           // send acknowledgement
@@ -367,6 +401,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         std::cout << "[" << client->GetID() << "]: SendDecryptPartialMainSum\n";
         // receive ciphertext
         // store it in the ClientB's data structure.
+        if (!FromRole(client, mainID, ThreshMsgTypes::NackPartialMainSum))
+          break;
         RecvClientPartialMainSumCT(client, msg);
         {
           // send acknowledgement
@@ -381,6 +417,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         std::cout << "[" << client->GetID() << "]: SendDecryptPartialLeadSum\n";
         // receive ciphertext
         // store it in the ClientA's data structure.
+        if (!FromRole(client, leadID, ThreshMsgTypes::NackPartialLeadSum))
+          break;
         RecvClientPartialLeadSumCT(client, msg);
         {
           // send acknowledgement
@@ -389,6 +427,23 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
           client->Send(ackMsg);
         }
         break;
+      case ThreshMsgTypes::RequestComputedCT:
+        std::cout << "[" << client->GetID() << "]: RequestComputedCT "
+                  << msg.header.SubType_ID << "\n";
+        SendClientComputedCT(client, msg.header.SubType_ID);
+        break;
+
+      case ThreshMsgTypes::SendComputedCT:
+        std::cout << "[" << client->GetID() << "]: SendComputedCT "
+                  << msg.header.SubType_ID << "\n";
+        RecvClientComputedCT(client, msg);
+        break;
+
+      case ThreshMsgTypes::RequestFusedResults:
+        std::cout << "[" << client->GetID() << "]: RequestFusedResults\n";
+        SendClientFusedResults(client);
+        break;
+
 	case ThreshMsgTypes::DisconnectClient:
 	  
 	  std::cout << "[" << client->GetID() << "]: DisconnectClient\n";
@@ -685,6 +740,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Deserialize");
     Serial::Deserialize(A_Rnd1PublicKey, is, SerType::BINARY);
     A_Rnd1PubKeyRecd = true;
+    // the first connection to send it registers the role
+    if (leadID == 0) leadID = client->GetID();
     DEBUG("[SERVER] Done");
     assert(is.good());
   }
@@ -756,6 +813,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Deserialize");
     Serial::Deserialize(B_Rnd2PublicKey, is, SerType::BINARY);
     B_Rnd2PublicKeyRecd = true;
+    // the first connection to send it registers the role
+    if (mainID == 0) mainID = client->GetID();
     DEBUG("[SERVER] Done");
     assert(is.good());
   }
@@ -1033,6 +1092,19 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     client->Send(msg);
   }
 
+  // Partial decryptions are only taken from the connection registered for
+  // their role, anybody else is sent nack and the share is dropped
+  bool FromRole(std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+                uint32_t roleID, ThreshMsgTypes nack) {
+    if (roleID != 0 && client->GetID() == roleID) return true;
+    std::cout << "[SERVER] [" << client->GetID()
+              << "] does not hold the role of its partial decryption\n";
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.id = nack;
+    client->Send(msg);
+    return false;
+  }
+
   void RecvClientPartialMainAddCT(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
       olc::net::message<ThreshMsgTypes>& msg) {
@@ -1057,6 +1129,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_MainAddRecd = true;
+    fusedResults.clear();
   }
 
   void RecvClientPartialMainMultCT(
@@ -1082,6 +1155,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_MainMultRecd = true;
+    fusedResults.clear();
   }
 
   void RecvClientPartialMainSumCT(
@@ -1107,6 +1181,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_MainSumRecd = true;
+    fusedResults.clear();
   }
 
   void RecvClientPartialLeadAddCT(
@@ -1133,6 +1208,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_LeadAddRecd = true;
+    fusedResults.clear();
   }
 
   void RecvClientPartialLeadMultCT(
@@ -1158,6 +1234,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_LeadMultRecd = true;
+    fusedResults.clear();
   }
 
   void RecvClientPartialLeadSumCT(
@@ -1183,6 +1260,183 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_LeadSumRecd = true;
+    fusedResults.clear();
+  }
+
+  // Server side fusion (-F)
+  //
+  // Rather than fetching each other's partial decryptions and fusing every
+  // result locally, a party can ask the server for all results at once. The
+  // server fuses the add, mult and sum results in parallel the first time an
+  // authorized party asks and returns the plaintext values. Only the parties
+  // enabled with EnableFusion() get them, the server tells everybody else to
+  // fuse locally.
+
+  void SendClientFusedResults(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
+    olc::net::message<ThreshMsgTypes> msg;
+    // a party's role is known once it has sent its public key
+    bool authorized =
+        (fuseForLead && leadID != 0 && client->GetID() == leadID) ||
+        (fuseForMain && mainID != 0 && client->GetID() == mainID);
+    if (!authorized) {
+      std::cout << "[SERVER] sending DenyFusedResults to [" << client->GetID()
+                << "]:\n";
+      msg.header.id = ThreshMsgTypes::DenyFusedResults;
+      client->Send(msg);
+      return;
+    }
+    if (!(Partial_LeadAddRecd && Partial_MainAddRecd && Partial_LeadMultRecd &&
+          Partial_MainMultRecd && Partial_LeadSumRecd && Partial_MainSumRecd)) {
+      DEBUG("[SERVER] sending NackFusedResults to [" << client->GetID()
+                                                     << "]:");
+      msg.header.id = ThreshMsgTypes::NackFusedResults;
+      client->Send(msg);
+      return;
+    }
+
+    if (fusedResults.empty()) {
+      FuseResults();
+    }
+    msg.header.id = ThreshMsgTypes::SendFusedResults;
+    for (auto& values : fusedResults) {
+      AppendValues(msg, values);  // add, mult, sum
+    }
+    DEBUG("[SERVER]: msg.body.size() " << msg.body.size());
+    client->Send(msg);
+  }
+
+  // fuse the batch of results, one task per result
+  void FuseResults(void) {
+    TimeVar t;
+    TIC(t);
+    vector<vector<CT>> batch = {{Partial_LeadAdd, Partial_MainAdd},
+                                {Partial_LeadMult, Partial_MainMult},
+                                {Partial_LeadSum, Partial_MainSum}};
+    vector<std::future<vector<double>>> fused;
+    for (auto& partials : batch) {
+      fused.push_back(std::async(std::launch::async, [this, &partials] {
+        PT plaintext;
+        m_serverCC->MultipartyDecryptFusion(partials, &plaintext);
+        return plaintext->GetRealPackedValue();
+      }));
+    }
+    for (auto& result : fused) {
+      fusedResults.push_back(result.get());
+    }
+    PROFILELOG("[SERVER] fused " << batch.size() << " results, elapsed time "
+                                 << TOC_MS(t) << "msec.");
+  }
+
+  // Compute once (-C)
+  //
+  // Every party normally downloads the ciphertexts and computes the add, mult
+  // and sum results itself. With -C each result is computed once, either by
+  // the server or by the first party that asks for it, and the serialized
+  // result is passed to the other parties with its SHA-256 digest
+  // (ComputedCTMsg()), which they check before they decrypt it.
+
+  void SendClientComputedCT(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      unsigned int kind) {
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.SubType_ID = kind;
+    if (!computeOnce || kind > ComputedSum) {
+      std::cout << "[SERVER] sending DenyComputedCT to [" << client->GetID()
+                << "]:\n";
+      msg.header.id = ThreshMsgTypes::DenyComputedCT;
+      client->Send(msg);
+      return;
+    }
+
+    if (computeOnServer && computedCTs.empty() && B_CTreceived.size() >= 3 &&
+        A_evalMultFinalRecd && B_evalSumKeysJoin) {
+      ComputeResults();
+    }
+    auto found = computedCTs.find(kind);
+    if (found != computedCTs.end()) {
+      DEBUG("[SERVER]: sending computed CT " << kind << " to ["
+                                             << client->GetID() << "]:");
+      client->Send(found->second);
+      return;
+    }
+
+    auto computing = computingFor.find(kind);
+    if (computing != computingFor.end() &&
+        std::chrono::steady_clock::now() > computing->second.deadline) {
+      std::cout << "[SERVER] [" << computing->second.client
+                << "] did not upload computed CT " << kind << " in time\n";
+      computingFor.erase(computing);
+    }
+    if (!computeOnServer && !computingFor.count(kind)) {
+      // the first party to ask computes the result for everybody
+      std::cout << "[SERVER] sending ComputeCT " << kind << " to ["
+                << client->GetID() << "]:\n";
+      computingFor[kind] = {client->GetID(),
+                            std::chrono::steady_clock::now() + kComputeTimeout};
+      msg.header.id = ThreshMsgTypes::ComputeCT;
+      client->Send(msg);
+      return;
+    }
+
+    DEBUG("[SERVER] sending NackComputedCT to [" << client->GetID() << "]:");
+    msg.header.id = ThreshMsgTypes::NackComputedCT;
+    client->Send(msg);
+  }
+
+  void RecvClientComputedCT(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      olc::net::message<ThreshMsgTypes>& msg) {
+    unsigned int kind = msg.header.SubType_ID;
+    auto computing = computingFor.find(kind);
+    if (computing == computingFor.end() ||
+        computing->second.client != client->GetID()) {
+      std::cout << "[SERVER] [" << client->GetID()
+                << "] was not asked to compute CT " << kind << "\n";
+      return;
+    }
+    if (!CheckComputedDigest(msg)) {
+      // let the next party that asks compute it instead
+      std::cout << "[SERVER] bad digest on computed CT " << kind << " from ["
+                << client->GetID() << "]\n";
+      computingFor.erase(computing);
+      return;
+    }
+    // keep the body as it is, the parties check the digest themselves
+    computedCTs[kind] = msg;
+    computingFor.erase(computing);
+
+    olc::net::message<ThreshMsgTypes> ackMsg;
+    ackMsg.header.id = ThreshMsgTypes::AckComputedCT;
+    ackMsg.header.SubType_ID = kind;
+    client->Send(ackMsg);
+  }
+
+  // compute the add, mult and sum results on the server, one task each
+  void ComputeResults(void) {
+    TimeVar t;
+    TIC(t);
+    // the context keeps the keys, they only go in once
+    if (!evalKeysInserted) {
+      m_serverCC->InsertEvalMultKey({A_evalMultFinal});
+      m_serverCC->InsertEvalSumKey(B_evalSumKeysJoin);
+      evalKeysInserted = true;
+    }
+    std::map<unsigned int, std::future<olc::net::message<ThreshMsgTypes>>>
+        tasks;
+    for (auto kind : {ComputedAdd, ComputedMult, ComputedSum}) {
+      tasks[kind] = std::async(std::launch::async, [this, kind] {
+        return ComputedCTMsg(
+            kind, EvalComputed(m_serverCC, kind, B_CipherTexts[0],
+                               B_CipherTexts[1], B_CipherTexts[2], batchSize));
+      });
+    }
+    for (auto& task : tasks) {
+      computedCTs[task.first] = task.second.get();
+    }
+    PROFILELOG("[SERVER] computed " << computedCTs.size()
+                                    << " results, elapsed time " << TOC_MS(t)
+                                    << "msec.");
   }
 
   void incrementNumClients(void){
@@ -1232,6 +1486,28 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
   bool Partial_LeadAddRecd = false, Partial_MainAddRecd = false,
        Partial_LeadMultRecd = false, Partial_MainMultRecd = false;
   bool Partial_LeadSumRecd = false, Partial_MainSumRecd = false;
+
+  // server side fusion, connection IDs of the lead and main party (0 until
+  // they send their round 1 / round 2 public key) and the fused add, mult,
+  // sum values, cleared whenever a partial decryption arrives
+  bool fuseForLead = false, fuseForMain = false;
+  uint32_t leadID = 0, mainID = 0;
+  vector<vector<double>> fusedResults;
+
+  // compute once (-C), the results (SendComputedCT messages ready to pass
+  // on) by ComputedKind and the party computing each of them
+  bool computeOnce = false, computeOnServer = false;
+  usint batchSize = 16;  // batch size for vector sum computation
+  std::map<unsigned int, olc::net::message<ThreshMsgTypes>> computedCTs;
+  // a party that does not upload its result in time, or disconnects, loses
+  // it to the next party that asks
+  struct Computing {
+    uint32_t client;
+    std::chrono::steady_clock::time_point deadline;
+  };
+  static constexpr std::chrono::seconds kComputeTimeout{60};
+  std::map<unsigned int, Computing> computingFor;
+  bool evalKeysInserted = false;  // see ComputeResults()
 };
 
 #endif  // THRESH_SERVER_H
@@ -37,6 +37,7 @@
 #include <iostream>
 #include <fstream>
 #include <olc_net.h>
+#include "thresh_digest.h"
 #include <boost/interprocess/streams/bufferstream.hpp>  // to convert between Serialize and msg
 
 using namespace lbcrypto;
@@ -134,6 +135,18 @@ enum class ThreshMsgTypes : uint32_t {
   SendDecryptMainSum,
   SendDecryptLeadSum,
   DisconnectClient,
+  // server side fusion (-F)
+  RequestFusedResults,
+  SendFusedResults,
+  NackFusedResults,
+  DenyFusedResults,
+  // compute once (-C), one party computes each result for everybody
+  RequestComputedCT,
+  SendComputedCT,
+  NackComputedCT,
+  ComputeCT,
+  AckComputedCT,
+  DenyComputedCT,
 };
 
 vector<string> ThreshMsgNames{
@@ -215,14 +228,36 @@ vector<string> ThreshMsgNames{
     "SendDecryptMainSum",
     "SendDecryptLeadSum",
 	"DisconnectClient",
+    "RequestFusedResults",
+    "SendFusedResults",
+    "NackFusedResults",
+    "DenyFusedResults",
+    "RequestComputedCT",
+    "SendComputedCT",
+    "NackComputedCT",
+    "ComputeCT",
+    "AckComputedCT",
+    "DenyComputedCT",
 };
 
+// Results that are computed once for all parties with -C, carried in
+// header.SubType_ID of the *ComputedCT messages
+enum ComputedKind : unsigned int {
+  ComputedAdd = 0,
+  ComputedMult = 1,
+  ComputedSum = 2,
+};
+
+// Name of a message ID, or its number if the ID is not one of ours, as
+// the header of a message from a peer can hold anything
+string ThreshMsgName(uint32_t id) {
+  return id < ThreshMsgNames.size() ? ThreshMsgNames[id] : std::to_string(id);
+}
+
 // Code to convert from enum class to underlying int for reference.
 std::ostream& operator<<(std::ostream& os, const ThreshMsgTypes& obj) {
   os << static_cast<std::underlying_type<ThreshMsgTypes>::type>(obj);
-  os << ": "
-     << ThreshMsgNames[static_cast<std::underlying_type<ThreshMsgTypes>::type>(
-            obj)];
+  os << ": " << ThreshMsgName(static_cast<uint32_t>(obj));
   return os;
 }
 
@@ -235,4 +270,129 @@ void nap(const int& ms = 500) {
   std::this_thread::sleep_for(timespan);
 }
 
+/**
+ * Append a serialized PALISADE object to a message body. Several objects can
+ * be appended to one message, each is written as a 64 bit length followed by
+ * its bytes so that SerialReader can take them off front to back.
+ * @param msg - message to append to
+ * @param obj - object to serialize
+ */
+template <typename T>
+void AppendSerial(olc::net::message<ThreshMsgTypes>& msg, const T& obj) {
+  std::ostringstream os;
+  Serial::Serialize(obj, os, SerType::BINARY);
+  uint64_t len = os.str().size();
+  msg << len;
+  msg << os.str();
+}
+
+/**
+ * Append a vector of doubles (e.g. decrypted CKKS values) to a message body
+ * in the same framing as AppendSerial, read back with
+ * SerialReader::NextValues
+ * @param msg - message to append to
+ * @param values - values to append
+ */
+void AppendValues(olc::net::message<ThreshMsgTypes>& msg,
+                  const std::vector<double>& values) {
+  uint64_t len = values.size() * sizeof(double);
+  msg << len;
+  size_t i = msg.body.size();
+  msg.body.resize(i + len);
+  std::memcpy(msg.body.data() + i, values.data(), len);
+  msg.header.size = msg.size();
+}
+
+// Reads the objects written by AppendSerial() in the order they were written
+class SerialReader {
+ public:
+  explicit SerialReader(const olc::net::message<ThreshMsgTypes>& msg)
+      : body(msg.body) {}
+
+  // true if there is another object in the body
+  bool More(void) const { return pos + sizeof(uint64_t) <= body.size(); }
+
+  template <typename T>
+  void Next(T& obj) {
+    uint64_t len = NextLength();
+    std::istringstream is(string(body.begin() + pos, body.begin() + pos + len));
+    Serial::Deserialize(obj, is, SerType::BINARY);
+    pos += len;
+  }
+
+  void NextValues(std::vector<double>& values) {
+    uint64_t len = NextLength();
+    values.resize(len / sizeof(double));
+    std::memcpy(values.data(), body.data() + pos, len);
+    pos += len;
+  }
+
+ private:
+  uint64_t NextLength(void) {
+    uint64_t len;
+    if (!More()) throw std::runtime_error("SerialReader: body exhausted");
+    std::memcpy(&len, body.data() + pos, sizeof(len));
+    pos += sizeof(len);
+    if (len > body.size() - pos)
+      throw std::runtime_error("SerialReader: truncated object");
+    return len;
+  }
+
+  const std::vector<uint8_t>& body;
+  size_t pos = 0;
+};
+
+// Evaluate one of the results from the three uploaded ciphertexts, the same
+// way on the server and in the parties. The eval mult key, and for the sum
+// the eval sum keys, must already be in cc.
+CT EvalComputed(const CC& cc, ComputedKind kind, const CT& ct1, const CT& ct2,
+                const CT& ct3, usint batchSize) {
+  switch (kind) {
+    case ComputedAdd:
+      return cc->EvalAdd(cc->EvalAdd(ct1, ct2), ct3);
+    case ComputedMult:
+      return cc->ModReduce(cc->EvalMult(ct1, ct3));
+    case ComputedSum:
+      return cc->EvalSum(ct3, batchSize);
+  }
+  return CT();
+}
+
+// A result computed once for everybody: the serialized ciphertext followed
+// by its SHA-256 digest, so that the parties can check what they got before
+// they decrypt it. The server passes the body on unchanged.
+olc::net::message<ThreshMsgTypes> ComputedCTMsg(ComputedKind kind,
+                                                const CT& ct) {
+  std::ostringstream os;
+  Serial::Serialize(ct, os, SerType::BINARY);
+  olc::net::message<ThreshMsgTypes> msg;
+  msg.header.id = ThreshMsgTypes::SendComputedCT;
+  msg.header.SubType_ID = kind;
+  msg << os.str();
+  msg << Sha256(os.str());
+  return msg;
+}
+
+// true if the digest at the end of a SendComputedCT body matches the bytes
+// in front of it
+bool CheckComputedDigest(const olc::net::message<ThreshMsgTypes>& msg) {
+  if (msg.body.size() < sizeof(Digest)) return false;
+  size_t size = msg.body.size() - sizeof(Digest);
+  Digest digest;
+  std::memcpy(digest.data(), msg.body.data() + size, sizeof(Digest));
+  return Sha256(msg.body.data(), size) == digest;
+}
+
+/**
+ * Start writing trace events for this process (see olc_net/net_trace.h).
+ * The trace files of all parties are combined with bin/trace_merge.
+ * @param party - name of this party in the merged trace
+ * @param filename - trace file to write
+ * @param root - true for the server, which mints the trace ID
+ */
+void OpenTrace(const string& party, const string& filename, bool root = false) {
+  olc::net::tracer::Get().SetMessageNamer(ThreshMsgName);
+  olc::net::tracer::Get().Open(party, filename, root);
+}
+
 #endif  // THRESH_UTILS_H
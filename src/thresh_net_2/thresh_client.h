@@ -2,6 +2,7 @@
 #define THRESH_CLIENT_H
 
 #include "thresh_utils.h"
+#include "thresh_graph.h"
 
 // common to both parties (Alice and Bob) in the threshold encryption
 // computation
@@ -69,6 +70,60 @@ class ThreshCommonClient : public olc::net::client_interface<ThreshMsgTypes> {
     return ct;
   }
 
+  void RequestFusedResults(void) {
+    olc::net::message<ThreshMsgTypes> msg;
+    DEBUG("Client: Requesting fused results");
+    msg.header.id = ThreshMsgTypes::RequestFusedResults;
+    Send(msg);
+  }
+
+  // one key of an eval sum key map, sent as soon as it is made (may be
+  // called from several threads)
+  void SendEvalSumKeyEntry(EvalSumKeySet set, usint index,
+                           const EvalKey &key) {
+    Send(EvalSumKeyEntryMsg(set, index, key));
+  }
+
+  // follows the last entry, the server acknowledges the whole map
+  void EndEvalSumKeys(EvalSumKeySet set, uint32_t count) {
+    DEBUG("Client: sent " << count << " eval sum keys of set " << set);
+    Send(EndEvalSumKeysMsg(set, count));
+  }
+
+  // from now on the server pushes the keys this party needs for the two
+  // party ceremony as soon as they are there, see PushKeys
+  void JoinCeremony(CeremonyRole role) {
+    olc::net::message<ThreshMsgTypes> msg;
+    DEBUG("Client: joining the ceremony as " << role);
+    msg.header.id = ThreshMsgTypes::JoinCeremony;
+    msg.header.SubType_ID = role;
+    Send(msg);
+  }
+
+  // keys pushed by the server, returns the artifacts in this message
+  vector<uint32_t> RecvPushKeys(olc::net::message<ThreshMsgTypes> &msg,
+                                CeremonyKeys &keys) {
+    return ReadPushKeys(msg, keys);
+  }
+
+  // an entry of the eval sum keys streamed by the server
+  void RecvEvalSumKeyEntry(olc::net::message<ThreshMsgTypes> &msg,
+                           usint &index, EvalKey &key) {
+    ReadEvalSumKeyEntry(msg, index, key);
+  }
+
+  // values of the add, mult and sum results fused by the server
+  vector<vector<double>> RecvFusedResults(
+      olc::net::message<ThreshMsgTypes> &msg) {
+    vector<vector<double>> results;
+    SerialReader reader(msg);
+    while (reader.More()) {
+      results.emplace_back();
+      reader.NextValues(results.back());
+    }
+    return results;
+  }
+
   void DisconnectClient(void) {
     olc::net::message<ThreshMsgTypes> msg;
     DEBUG("Client: Disconnecting");
@@ -236,21 +291,6 @@ class ClientA : public ThreshCommonClient {
     return evalMultBAB;
   }
 
-  auto RecvRnd2evalSumKeysJoin(olc::net::message<ThreshMsgTypes> &msg) {
-    std::shared_ptr<std::map<usint, EvalKey>> evalSumKeysJoin;
-    unsigned int msgSize(msg.body.size());
-    DEBUG("CLIENT: read evalsumkeysjoin of " << msgSize << " bytes");
-    DEBUG("Client: msg.size() " << msg.size());
-    DEBUG("Client: msg.body.size() " << msg.body.size());
-    // make an istringstream from the message
-    std::istringstream is(string(msg.body.begin(), msg.body.end()));
-    DEBUG("CLIENT istringstream.str.size(): " << is.str().size());
-    // NOTE Deserialize needs a basic_istream<char>
-    DEBUG("CLIENT: Deserialize");
-    Serial::Deserialize(evalSumKeysJoin, is, SerType::BINARY);
-    return evalSumKeysJoin;
-  }
-
   void SendCTPartialAdd(CT &ct) {
     DEBUG("Client: serializing add lead partial decrypt ct");
     std::string s;
@@ -374,21 +414,6 @@ class ClientB : public ThreshCommonClient {
     return evalMultKey;
   }
 
-  auto RecvRnd1evalSumKeys(olc::net::message<ThreshMsgTypes> &msg) {
-    std::shared_ptr<std::map<usint, EvalKey>> evalSumKeys;
-    unsigned int msgSize(msg.body.size());
-    DEBUG("CLIENT: read evalsumkeys key of " << msgSize << " bytes");
-    DEBUG("Client: msg.size() " << msg.size());
-    DEBUG("Client: msg.body.size() " << msg.body.size());
-    // make an istringstream from the message
-    std::istringstream is(string(msg.body.begin(), msg.body.end()));
-    DEBUG("CLIENT istringstream.str.size(): " << is.str().size());
-    // NOTE Deserialize needs a basic_istream<char>
-    DEBUG("CLIENT: Deserialize");
-    Serial::Deserialize(evalSumKeys, is, SerType::BINARY);
-    return evalSumKeys;
-  }
-
   auto RecvRnd3evalMultFinal(olc::net::message<ThreshMsgTypes> &msg) {
     EvalKey evalMultKey;
     unsigned int msgSize(msg.body.size());
@@ -536,4 +561,149 @@ class ClientB : public ThreshCommonClient {
   }
 };
 
+// Party of the N party ceremony (thresh2_party), see
+// ThreshServer::ScheduleCeremony() for the order of the steps
+class ThreshParty : public ThreshCommonClient {
+ public:
+  DEBUG_FLAG(false);  // set to true to turn on DEBUG() statements
+
+  void RegisterParty(void) {
+    olc::net::message<ThreshMsgTypes> msg;
+    DEBUG("Party: Registering");
+    msg.header.id = ThreshMsgTypes::RegisterParty;
+    Send(msg);
+  }
+
+  // index of this party and the total number of parties
+  void RecvAssignParty(olc::net::message<ThreshMsgTypes> &msg, usint &index,
+                       usint &numParties) {
+    msg >> index >> numParties;
+  }
+
+  // the keys of the lead (party 0), the message is empty for the lead
+  void RecvKeyGenStep(
+      olc::net::message<ThreshMsgTypes> &msg, PublicKey &leadPubKey,
+      EvalKey &leadEvalMultKey,
+      std::shared_ptr<std::map<usint, EvalKey>> &leadEvalSumKeys) {
+    DEBUG("Party: read key generation step of " << msg.body.size() << " bytes");
+    SerialReader reader(msg);
+    if (!reader.More()) return;
+    reader.Next(leadPubKey);
+    reader.Next(leadEvalMultKey);
+    reader.Next(leadEvalSumKeys);
+  }
+
+  void SendKeyGenStep(KeyPair &kp, EvalKey &evalMultKey,
+                      std::shared_ptr<std::map<usint, EvalKey>> &evalSumKeys) {
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.id = ThreshMsgTypes::SendKeyGenStep;
+    AppendSerial(msg, kp.publicKey);
+    AppendSerial(msg, evalMultKey);
+    AppendSerial(msg, evalSumKeys);
+    DEBUG("Party: final msg.body.size " << msg.body.size());
+    Send(msg);
+  }
+
+  void RecvMultKeyStep(olc::net::message<ThreshMsgTypes> &msg,
+                       PublicKey &jointPubKey, EvalKey &jointEvalMultKey) {
+    SerialReader reader(msg);
+    reader.Next(jointPubKey);
+    reader.Next(jointEvalMultKey);
+  }
+
+  void SendMultKeyStep(EvalKey &evalMultShare) {
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.id = ThreshMsgTypes::SendMultKeyStep;
+    AppendSerial(msg, evalMultShare);
+    Send(msg);
+  }
+
+  // num is 0, 1, 2 for ciphertexts 1, 2, 3
+  void SendCT(CT &ct, unsigned int num) {
+    const ThreshMsgTypes ids[] = {ThreshMsgTypes::SendCT1,
+                                  ThreshMsgTypes::SendCT2,
+                                  ThreshMsgTypes::SendCT3};
+    DEBUG("Party: serializing CT" << num + 1);
+    std::string s;
+    std::ostringstream os(s);
+    Serial::Serialize(ct, os, SerType::BINARY);
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.id = ids[num];
+    msg << os.str();
+    Send(msg);
+  }
+
+  // kind is a PartialKind or the handle of a graph result
+  void SendPartialDecrypt(CT &ct, unsigned int kind) {
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.id = ThreshMsgTypes::SendPartialDecrypt;
+    msg.header.SubType_ID = kind;
+    AppendSerial(msg, ct);
+    Send(msg);
+  }
+
+  void RequestPartialDecrypts(unsigned int kind) {
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.id = ThreshMsgTypes::RequestPartialDecrypts;
+    msg.header.SubType_ID = kind;
+    Send(msg);
+  }
+
+  // partial decryptions of all parties, lead first, or their sum if the
+  // server runs with -C
+  vector<CT> RecvPartialDecrypts(olc::net::message<ThreshMsgTypes> &msg) {
+    vector<CT> partials;
+    SerialReader reader(msg);
+    while (reader.More()) {
+      CT ct;
+      reader.Next(ct);
+      partials.push_back(ct);
+    }
+    return partials;
+  }
+
+  // announce count ciphertexts whose sum is kept under handle
+  void BeginCTBatch(uint32_t count, uint32_t handle) {
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.id = ThreshMsgTypes::BeginCTBatch;
+    msg << count << handle;
+    Send(msg);
+  }
+
+  void SendBatchCT(CT &ct, uint32_t seq) {
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.id = ThreshMsgTypes::SendBatchCT;
+    msg.header.SubType_ID = seq;
+    AppendSerial(msg, ct);
+    Send(msg);
+  }
+
+  void SubmitGraph(const ComputeGraph &graph) {
+    olc::net::message<ThreshMsgTypes> msg;
+    DEBUG("Party: submitting graph of " << graph.nodes.size() << " nodes");
+    msg.header.id = ThreshMsgTypes::SubmitGraph;
+    graph.AppendTo(msg);
+    Send(msg);
+  }
+
+  void RequestResult(uint32_t handle) {
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.id = ThreshMsgTypes::RequestResult;
+    msg.header.SubType_ID = handle;
+    Send(msg);
+  }
+
+  CT RecvResult(olc::net::message<ThreshMsgTypes> &msg) {
+    CT ct;
+    SerialReader reader(msg);
+    reader.Next(ct);
+    return ct;
+  }
+
+  // reason sent with RejectGraph and FailedResult
+  string RecvReason(olc::net::message<ThreshMsgTypes> &msg) {
+    return string(msg.body.begin(), msg.body.end());
+  }
+};
+
 #endif  // THRESH_CLIENT_H
@@ -44,6 +44,7 @@
 #include "thresh_utils.h"
 
 #include "thresh_client.h"
+#include "thresh_keys.h"
 
 using namespace lbcrypto;
 /**
@@ -55,12 +56,6 @@ enum class ClientAStates : uint64_t {
   GetMessage,
   RequestCC,
   GenPubKeys,
-  SendRnd1evalMultKey,
-  SendRnd1evalSumKeys,
-  RequestRnd2SharedKey,
-  RequestRnd2evalMultAB,
-  RequestRnd2evalMultBAB,
-  RequestRnd2evalSumKeysJoin,
   GenFinalSharedKeys, /*
    RequestCT1,
    RequestCT2,
@@ -74,9 +69,29 @@ enum class ClientAStates : uint64_t {
   RequestDecryptMainAdd,
   RequestDecryptMainMult,
   RequestDecryptMainSum,
+  RequestFusedResults,
   DecryptFusion,
 };
 
+// names of the states above, in the same order (used for tracing)
+vector<string> ClientAStateNames{
+    "GetMessage",
+    "RequestCC",
+    "GenPubKeys",
+    "GenFinalSharedKeys",
+    "RequestAddCT",
+    "RequestMultCT",
+    "RequestSumCT",
+    "DecryptLeadPartialAdd",
+    "DecryptLeadPartialMult",
+    "DecryptLeadPartialSum",
+    "RequestDecryptMainAdd",
+    "RequestDecryptMainMult",
+    "RequestDecryptMainSum",
+    "RequestFusedResults",
+    "DecryptFusion",
+};
+
 int main(int argc, char *argv[]) {
   ////////////////////////////////////////////////////////////
   // Set-up of parameters
@@ -85,8 +100,10 @@ int main(int argc, char *argv[]) {
   string myName("");  // name of client to run
   uint32_t port(0);
   string hostName("");  // name of server host
+  string traceFile("");  // trace events are written here if set
+  bool serverFusion(false);  // ask the server for the fused results
 
-  while ((opt = getopt(argc, argv, "i:n:p:h")) != -1) {
+  while ((opt = getopt(argc, argv, "i:n:p:t:Fh")) != -1) {
     switch (opt) {
       case 'i':
         hostName = optarg;
@@ -100,6 +117,14 @@ int main(int argc, char *argv[]) {
         port = atoi(optarg);
         std::cout << "host port " << port << std::endl;
         break;
+      case 't':
+        traceFile = optarg;
+        std::cout << "tracing to " << traceFile << std::endl;
+        break;
+      case 'F':
+        serverFusion = true;
+        std::cout << "requesting fused results from the server" << std::endl;
+        break;
       case 'h':
       default: /* '?' */
         std::cerr << "Usage: " << std::endl
@@ -107,10 +132,16 @@ int main(int argc, char *argv[]) {
                   << "  -n name of the client" << std::endl
                   << "  -i IP or hostname of the server" << std::endl
                   << "  -p port of the server" << std::endl
+                  << "  -t file to write trace events to" << std::endl
+                  << "  -F request results fused by the server" << std::endl
                   << "  -h prints this message" << std::endl;
         std::exit(EXIT_FAILURE);
     }
   }
+  if (!traceFile.empty()) {
+    OpenTrace(myName, traceFile);
+  }
+
   ClientA c;
   // connect to the server
   PROFILELOG(myName << ": Connecing to server at " << hostName << ":" << port);
@@ -139,10 +170,11 @@ int main(int argc, char *argv[]) {
   EvalKey evalMultKey;
   std::shared_ptr<std::map<usint, EvalKey>> evalSumKeys;
 
-  // Keys from Round 2
-  PublicKey Rnd2SharedKey;
-  EvalKey Rnd2EvalMultAB, Rnd2EvalMultBAB;
-  std::shared_ptr<std::map<usint, EvalKey>> Rnd2EvalSumKeysJoin;
+  // Keys from Round 2, pushed by the server as soon as Bob has made them
+  CeremonyKeys pushed;
+  bool round3Started = false;
+  std::shared_ptr<std::map<usint, EvalKey>> Rnd2EvalSumKeysJoin =
+      std::make_shared<std::map<usint, EvalKey>>();
 
   // Keys from Round 3
   EvalKey evalMultAAB, evalMultFinal;
@@ -162,15 +194,29 @@ int main(int argc, char *argv[]) {
 
   TimeVar t;  // time benchmarking variable
 
+  // generates the eval sum keys, one index per task
+  boost::asio::thread_pool keyPool{
+      std::max(1u, std::thread::hardware_concurrency())};
+
   DEBUG_FLAG(false);  // Turns on and off DEBUG() statements
 
   while (!done) {
     if (c.IsConnected()) {
+      // trace each step of the state machine, messages are traced as they
+      // are taken off the queue below
+      uint64_t stateSpan = 0;
+      if (state != ClientAStates::GetMessage) {
+        stateSpan = olc::net::tracer::Get().BeginSpan(
+            ClientAStateNames[static_cast<size_t>(state)]);
+      }
+
       switch (state) {  // sequence of states that the client executes
         case ClientAStates::GetMessage:
           // client tests for a response from the server
           if (!c.Incoming().empty()) {
             auto msg = c.Incoming().pop_front().msg;
+            OLC_TRACE_SPAN(ThreshMsgName(static_cast<uint32_t>(msg.header.id)),
+                           msg.header.span_id);
 
             switch (msg.header.id) {
               case ThreshMsgTypes::ServerAccept:
@@ -184,55 +230,68 @@ int main(int argc, char *argv[]) {
                 TIC(t);
                 clientCC = c.RecvCC(msg);
                 PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+                // the server pushes Bob's keys to us from now on
+                c.JoinCeremony(CeremonyLead);
                 state = ClientAStates::GenPubKeys;
                 break;
 
+              // the Round 1 keys are all sent at once, the acks are only
+              // for the log
               case ThreshMsgTypes::AckRnd1PubKey:
                 PROFILELOG(myName << ": Acknowledged Round 1 Public key");
-                state = ClientAStates::SendRnd1evalMultKey;
                 break;
 
               case ThreshMsgTypes::AckRnd1evalMultKey:
                 PROFILELOG(myName << ": Acknowledged Round 1 EvalMultKey");
-                state = ClientAStates::SendRnd1evalSumKeys;
                 break;
+
               case ThreshMsgTypes::AckRnd1evalSumKeys:
                 PROFILELOG(myName << ": Acknowledged Round 1 EvalSumKeys");
-                nap(100);  // sleep until Round 2 key generation is done.
-                state = ClientAStates::RequestRnd2SharedKey;
-                break;
-
-              case ThreshMsgTypes::SendRnd2SharedKey:
-                PROFILELOG(myName << ": Reading Round 2 Shared key");
-                TIC(t);
-                Rnd2SharedKey = c.RecvRnd2SharedKey(msg);
-                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-                state = ClientAStates::RequestRnd2evalMultAB;
                 break;
 
-              case ThreshMsgTypes::SendRnd2EvalMultAB:
-                PROFILELOG(myName << ": Reading Round 2 EvalMultAB");
-                TIC(t);
-                Rnd2EvalMultAB = c.RecvRnd2evalMultAB(msg);
-                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-                state = ClientAStates::RequestRnd2evalMultBAB;
-                break;
+              case ThreshMsgTypes::NackRnd1evalSumKeys:
+                // the ceremony cannot go on without the keys
+                std::cerr << myName << ": server did not get all "
+                          << "Round 1 EvalSumKeys" << std::endl;
+                c.DisconnectClient();
+                std::exit(EXIT_FAILURE);
 
-              case ThreshMsgTypes::SendRnd2EvalMultBAB:
-                PROFILELOG(myName << ": Reading Round 2 EvalMultBAB");
+              case ThreshMsgTypes::PushKeys:
+                PROFILELOG(myName << ": reading pushed Round 2 keys");
                 TIC(t);
-                Rnd2EvalMultBAB = c.RecvRnd2evalMultBAB(msg);
+                c.RecvPushKeys(msg, pushed);
                 PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-                state = ClientAStates::RequestRnd2evalSumKeysJoin;
-                break;
-
-              case ThreshMsgTypes::SendRnd2EvalSumKeysJoin:
-                PROFILELOG(myName << ": Reading Round 2 EvalSumKeysJoin");
-                TIC(t);
-                Rnd2EvalSumKeysJoin = c.RecvRnd2evalSumKeysJoin(msg);
-                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-                state = ClientAStates::GenFinalSharedKeys;
-                break;
+                if (!round3Started &&
+                    pushed.Has({CeremonyRnd2SharedKey, CeremonyRnd2EvalMultAB,
+                                CeremonyRnd2EvalMultBAB})) {
+                  round3Started = true;
+                  state = ClientAStates::GenFinalSharedKeys;
+                }
+                break;
+
+              case ThreshMsgTypes::SendEvalSumKeyEntry: {
+                // the joint keys arrive one by one
+                usint index;
+                EvalKey key;
+                c.RecvEvalSumKeyEntry(msg, index, key);
+                DEBUG("read Round 2 EvalSumKeysJoin " << index);
+                (*Rnd2EvalSumKeysJoin)[index] = key;
+                break;
+              }
+
+              case ThreshMsgTypes::EndEvalSumKeys: {
+                uint32_t count;
+                msg >> count;
+                PROFILELOG(myName << ": read all " << count
+                                  << " Round 2 EvalSumKeysJoin");
+                if (Rnd2EvalSumKeysJoin->size() != count) {
+                  std::cerr << myName << ": got " << Rnd2EvalSumKeysJoin->size()
+                            << " of " << count << " Round 2 EvalSumKeysJoin"
+                            << std::endl;
+                  std::exit(EXIT_FAILURE);
+                }
+                break;
+              }
 
               case ThreshMsgTypes::AckRnd3EvalMultFinal:
                 PROFILELOG(myName << ": Acknowledged Round 3 EvalMultFinal");
@@ -282,7 +341,8 @@ int main(int argc, char *argv[]) {
                 PROFILELOG(
                     myName
                     << ": acknowledging Partially decrypted Lead sum CT");
-                state = ClientAStates::RequestDecryptMainAdd;
+                state = serverFusion ? ClientAStates::RequestFusedResults
+                                     : ClientAStates::RequestDecryptMainAdd;
                 break;
 
               case ThreshMsgTypes::SendDecryptMainAdd:
@@ -312,37 +372,6 @@ int main(int argc, char *argv[]) {
                 state = ClientAStates::DecryptFusion;
                 break;
 
-              case ThreshMsgTypes::NackRnd2SharedKey:
-                // Server has responded to a SendRnd2PubKey with a NAC, retry
-                DEBUG("Server NackRnd2SharedKey");
-                nap(1000);  // sleep for a second and retry.
-                state = ClientAStates::RequestRnd2SharedKey;
-                break;
-
-              case ThreshMsgTypes::NackRnd2EvalMultAB:
-                // Server has responded to a SendRnd2EvalMultAB with a NAC,
-                // retry
-                DEBUG("Server NackRnd2EvalMultAB");
-                nap(1000);  // sleep for a second and retry.
-                state = ClientAStates::RequestRnd2evalMultAB;
-                break;
-
-              case ThreshMsgTypes::NackRnd2EvalMultBAB:
-                // Server has responded to a SendRnd2EvalMultBAB with a NAC,
-                // retry
-                DEBUG("Server NackRnd2EvalMultBAB");
-                nap(1000);  // sleep for a second and retry.
-                state = ClientAStates::RequestRnd2evalMultBAB;
-                break;
-
-              case ThreshMsgTypes::NackRnd2EvalSumKeysJoin:
-                // Server has responded to a SendRnd2EvalSumKeysJoin with a NAC,
-                // retry
-                DEBUG("Server NackRnd2EvalSumKeysJoin");
-                nap(1000);  // sleep for a second and retry.
-                state = ClientAStates::RequestRnd2evalSumKeysJoin;
-                break;
-
               case ThreshMsgTypes::NackAddCT:
                 PROFILELOG("Server NackAddCT");
                 nap(1000);
@@ -397,6 +426,35 @@ int main(int argc, char *argv[]) {
                 state = ClientAStates::RequestDecryptMainSum;
                 break;
 
+              case ThreshMsgTypes::SendFusedResults: {
+                PROFILELOG(myName << ": reading results fused by the server");
+                auto results = c.RecvFusedResults(msg);
+                const char *names[] = {"Add", "Mult", "Sum"};
+                for (size_t i = 0; i < results.size() && i < 3; i++) {
+                  std::cout << "\n Resulting Fused Plaintext " << names[i]
+                            << ": \n(";
+                  for (size_t j = 0; j < results[i].size() && j < 12; j++) {
+                    std::cout << (j ? ", " : "") << results[i][j];
+                  }
+                  std::cout << ", ... )\n";
+                }
+                done = true;
+                break;
+              }
+
+              case ThreshMsgTypes::NackFusedResults:
+                // the other party has not sent its partial decryptions yet
+                DEBUG("Server NackFusedResults");
+                nap(1000);  // sleep for a second and retry.
+                state = ClientAStates::RequestFusedResults;
+                break;
+
+              case ThreshMsgTypes::DenyFusedResults:
+                PROFILELOG(myName << ": server will not fuse for us, fusing "
+                                     "locally");
+                state = ClientAStates::RequestDecryptMainAdd;
+                break;
+
               default:
                 PROFILELOG(myName << ": received unhandled message from Server "
                                   << msg.header.id);
@@ -418,80 +476,36 @@ int main(int argc, char *argv[]) {
           PROFILELOG(myName << ": Generating Round 1 keys");
           TIC(t);
           keyPair = clientCC->KeyGen();
-
-          // Generate evalmult key part for A
-          evalMultKey =
-              clientCC->KeySwitchGen(keyPair.secretKey, keyPair.secretKey);
-
-          // Generate evalsum key part for A
-          clientCC->EvalSumKeyGen(keyPair.secretKey);
-          evalSumKeys = std::make_shared<std::map<usint, EvalKey>>(
-              clientCC->GetEvalSumKeyMap(keyPair.secretKey->GetKeyTag()));
-
-          PROFILELOG(myName << ": Serializing and sending Round 1 Public key");
-          c.SendRnd1PubKey(keyPair);
-          PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientAStates::GetMessage;
-
           if (!keyPair.good()) {
             std::cerr << myName << "Round 1 Key generation failed!"
                       << std::endl;
             std::exit(EXIT_FAILURE);
           }
-          break;
 
-        case ClientAStates::SendRnd1evalMultKey:
+          // nothing waits for an ack, each key goes out as soon as it
+          // is made so that Bob can start on Round 2
+          PROFILELOG(myName << ": Serializing and sending Round 1 Public key");
+          c.SendRnd1PubKey(keyPair);
+
+          // Generate evalmult key part for A
+          evalMultKey =
+              clientCC->KeySwitchGen(keyPair.secretKey, keyPair.secretKey);
           PROFILELOG(myName
                      << ": Serializing and sending Round 1 EvalMult key");
-          TIC(t);
           c.SendRnd1evalMultKey(evalMultKey);
-          PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientAStates::GetMessage;
-          break;
 
-        case ClientAStates::SendRnd1evalSumKeys:
-          PROFILELOG(myName << ": Serializing and sending Round 1 EvalSumKeys");
-          TIC(t);
-          c.SendRnd1evalSumKeys(evalSumKeys);
+          // Generate evalsum key part for A, one index per task, each key is
+          // on its way to the server as soon as it is done
+          evalSumKeys = ParallelEvalSumKeyGen(
+              keyPool, clientCC, keyPair.secretKey,
+              [&c](usint index, const EvalKey &key) {
+                c.SendEvalSumKeyEntry(Rnd1EvalSumKeys, index, key);
+              });
+          c.EndEvalSumKeys(Rnd1EvalSumKeys, evalSumKeys->size());
           PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
           state = ClientAStates::GetMessage;
           break;
 
-        case ClientAStates::RequestRnd2SharedKey:
-          TIC(t);
-          PROFILELOG(myName << ": Requesting Round 2 public key");
-          c.RequestRnd2SharedKey();  // request the round 2 public key from Bob.
-          PROFILELOG(myName << ":elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientAStates::GetMessage;
-          break;
-
-        case ClientAStates::RequestRnd2evalMultAB:
-          TIC(t);
-          PROFILELOG(myName << ": Requesting Round 2 EvalMultAB");
-          c.RequestRnd2evalMultAB();  // request the round 2 EvalMultAB from
-                                      // Bob.
-          PROFILELOG(myName << ":elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientAStates::GetMessage;
-          break;
-
-        case ClientAStates::RequestRnd2evalMultBAB:
-          TIC(t);
-          PROFILELOG(myName << ": Requesting Round 2 EvalMultAB");
-          c.RequestRnd2evalMultBAB();  // request the round 2 EvalMultBAB from
-                                       // Bob.
-          PROFILELOG(myName << ":elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientAStates::GetMessage;
-          break;
-
-        case ClientAStates::RequestRnd2evalSumKeysJoin:
-          TIC(t);
-          PROFILELOG(myName << ": Requesting Round 2 EvalSumKeysJoin");
-          c.RequestRnd2evalSumKeysJoin();  // request the round 2
-                                           // EvalSumKeysJoin from Bob.
-          PROFILELOG(myName << ":elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientAStates::GetMessage;
-          break;
-
         case ClientAStates::GenFinalSharedKeys:  // if have received the Round 2
                                                  // keys from the server
           // then generate keys and send the evalmultfinal key to server
@@ -502,10 +516,12 @@ int main(int argc, char *argv[]) {
           std::cout << "Round 3 (party A) started." << std::endl;
 
           evalMultAAB = clientCC->MultiMultEvalKey(
-              Rnd2EvalMultAB, keyPair.secretKey, Rnd2SharedKey->GetKeyTag());
+              pushed.rnd2EvalMultAB, keyPair.secretKey,
+              pushed.rnd2SharedKey->GetKeyTag());
 
           evalMultFinal = clientCC->MultiAddEvalMultKeys(
-              evalMultAAB, Rnd2EvalMultBAB, Rnd2EvalMultAB->GetKeyTag());
+              evalMultAAB, pushed.rnd2EvalMultBAB,
+              pushed.rnd2EvalMultAB->GetKeyTag());
 
           clientCC->InsertEvalMultKey({evalMultFinal});
 
@@ -613,6 +629,12 @@ int main(int argc, char *argv[]) {
           state = ClientAStates::GetMessage;
           break;
 
+        case ClientAStates::RequestFusedResults:
+          PROFILELOG(myName << ": Request results fused by the server");
+          c.RequestFusedResults();
+          state = ClientAStates::GetMessage;
+          break;
+
         case ClientAStates::DecryptFusion:
           PROFILELOG(myName << ": Final decryption fusion of add, mult, sum");
 
@@ -667,6 +689,8 @@ int main(int argc, char *argv[]) {
 
       }  // switch state
 
+      olc::net::tracer::Get().EndSpan(stateSpan);
+
     }  // IsConnected()
 
     nap(100);  // take a 100 msec pause
@@ -44,6 +44,7 @@
 #include "thresh_utils.h"
 
 #include "thresh_client.h"
+#include "thresh_keys.h"
 
 using namespace lbcrypto;
 /**
@@ -54,14 +55,8 @@ using namespace lbcrypto;
 enum class ClientBStates : uint64_t {
   GetMessage,
   RequestCC,
-  RequestRnd1PubKey,
-  RequestRnd1evalMultKey,
-  RequestRnd1evalSumKeys,
   GenRnd2Keys,
-  SendRnd2evalMultAB,
-  SendRnd2evalMultBAB,
   SendRnd2evalSumKeysJoin,
-  RequestRnd3evalMultFinal,
   GenCT1,
   GenCT2,
   GenCT3,
@@ -74,9 +69,32 @@ enum class ClientBStates : uint64_t {
   RequestDecryptLeadAdd,
   RequestDecryptLeadMult,
   RequestDecryptLeadSum,
+  RequestFusedResults,
   DecryptFusion,
 };
 
+// names of the states above, in the same order (used for tracing)
+vector<string> ClientBStateNames{
+    "GetMessage",
+    "RequestCC",
+    "GenRnd2Keys",
+    "SendRnd2evalSumKeysJoin",
+    "GenCT1",
+    "GenCT2",
+    "GenCT3",
+    "RequestAddCT",
+    "RequestMultCT",
+    "RequestSumCT",
+    "DecryptMainPartialAdd",
+    "DecryptMainPartialMult",
+    "DecryptMainPartialSum",
+    "RequestDecryptLeadAdd",
+    "RequestDecryptLeadMult",
+    "RequestDecryptLeadSum",
+    "RequestFusedResults",
+    "DecryptFusion",
+};
+
 int main(int argc, char *argv[]) {
   ////////////////////////////////////////////////////////////
   // Set-up of parameters
@@ -85,8 +103,10 @@ int main(int argc, char *argv[]) {
   string myName("");  // name of client to run
   uint32_t port(0);
   string hostName("");  // name of server host
+  string traceFile("");  // trace events are written here if set
+  bool serverFusion(false);  // ask the server for the fused results
 
-  while ((opt = getopt(argc, argv, "i:n:p:h")) != -1) {
+  while ((opt = getopt(argc, argv, "i:n:p:t:Fh")) != -1) {
     switch (opt) {
       case 'i':
         hostName = optarg;
@@ -100,6 +120,14 @@ int main(int argc, char *argv[]) {
         port = atoi(optarg);
         std::cout << "host port " << port << std::endl;
         break;
+      case 't':
+        traceFile = optarg;
+        std::cout << "tracing to " << traceFile << std::endl;
+        break;
+      case 'F':
+        serverFusion = true;
+        std::cout << "requesting fused results from the server" << std::endl;
+        break;
       case 'h':
       default: /* '?' */
         std::cerr << "Usage: " << std::endl
@@ -107,10 +135,16 @@ int main(int argc, char *argv[]) {
                   << "  -n name of the client" << std::endl
                   << "  -i IP or hostname of the server" << std::endl
                   << "  -p port of the server" << std::endl
+                  << "  -t file to write trace events to" << std::endl
+                  << "  -F request results fused by the server" << std::endl
                   << "  -h prints this message" << std::endl;
         std::exit(EXIT_FAILURE);
     }
   }
+  if (!traceFile.empty()) {
+    OpenTrace(myName, traceFile);
+  }
+
   ClientB c;
   // connect to the server
   PROFILELOG(myName << ": Connecing to server at " << hostName << ":" << port);
@@ -133,18 +167,26 @@ int main(int argc, char *argv[]) {
 
   CC clientCC;
 
-  // received keys from Round1
-  PublicKey Rnd1Pubkey;
-  EvalKey Rnd1evalMultKey;
-  std::shared_ptr<std::map<usint, EvalKey>> Rnd1evalSumKeys;
+  // generates the eval sum keys, one index per task
+  boost::asio::thread_pool keyPool{
+      std::max(1u, std::thread::hardware_concurrency())};
+
+  // keys from Round 1 and 3, pushed by the server as soon as Alice has
+  // made them
+  CeremonyKeys pushed;
+  bool round2Started = false, round3Done = false;
+  // Alice's eval sum keys arrive one by one and go straight into
+  // sumKeysJoin, which makes the joint keys, the count comes last. Entries
+  // that arrive before Round 2 has started wait in earlySumKeys.
+  std::unique_ptr<StreamedKeyGen> sumKeysJoin;
+  vector<std::pair<usint, EvalKey>> earlySumKeys;
+  uint32_t Rnd1evalSumKeysCount = 0;
+  bool sumKeysJoinDue = false;  // waiting for the count to finish the join
 
   // keys generated in Round2
   KeyPair keyPair;
   EvalKey evalMultKey2, evalMultAB, evalMultBAB;
-  std::shared_ptr<std::map<usint, EvalKey>> evalSumKeysJoin, evalSumKeysB;
-
-  // received keys from Round3
-  EvalKey Rnd3evalMultFinal;
+  std::shared_ptr<std::map<usint, EvalKey>> evalSumKeysJoin;
 
   TimeVar t;  // time benchmarking variable
 
@@ -174,11 +216,21 @@ int main(int argc, char *argv[]) {
   while (!done) {
     if (c.IsConnected()) {
       // client executes a state
+      // trace each step of the state machine, messages are traced as they
+      // are taken off the queue below
+      uint64_t stateSpan = 0;
+      if (state != ClientBStates::GetMessage) {
+        stateSpan = olc::net::tracer::Get().BeginSpan(
+            ClientBStateNames[static_cast<size_t>(state)]);
+      }
+
       switch (state) {  // sequence of states that the client executes
         case ClientBStates::GetMessage:
           // client tests for a response from the server
           if (!c.Incoming().empty()) {
             auto msg = c.Incoming().pop_front().msg;
+            OLC_TRACE_SPAN(ThreshMsgName(static_cast<uint32_t>(msg.header.id)),
+                           msg.header.span_id);
 
             switch (msg.header.id) {
               case ThreshMsgTypes::ServerAccept:
@@ -192,84 +244,74 @@ int main(int argc, char *argv[]) {
                 TIC(t);
                 clientCC = c.RecvCC(msg);
                 PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-                state = ClientBStates::RequestRnd1PubKey;
-                break;
-
-              case ThreshMsgTypes::SendRnd1PubKey:
-                PROFILELOG(myName << ": reading Round 1 public key");
-                TIC(t);
-                Rnd1Pubkey = c.RecvRnd1PubKey(msg);
-                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-                state = ClientBStates::RequestRnd1evalMultKey;
-                break;
-
-              case ThreshMsgTypes::SendRnd1evalMultKey:
-                PROFILELOG(myName << ": reading Round 1 eval mult key");
-                TIC(t);
-                Rnd1evalMultKey = c.RecvRnd1evalMultKey(msg);
-                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-                state = ClientBStates::RequestRnd1evalSumKeys;
+                // the server pushes Alice's keys to us from now on
+                c.JoinCeremony(CeremonyMain);
                 break;
 
-              case ThreshMsgTypes::SendRnd1evalSumKeys:
-                PROFILELOG(myName << ": reading Round 1 eval sum key");
+              case ThreshMsgTypes::PushKeys:
+                PROFILELOG(myName << ": reading pushed keys");
                 TIC(t);
-                Rnd1evalSumKeys = c.RecvRnd1evalSumKeys(msg);
+                c.RecvPushKeys(msg, pushed);
                 PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-                state = ClientBStates::GenRnd2Keys;
-                break;
-
-              case ThreshMsgTypes::NackRnd1PubKey:
-                // Server has responded to a SendRnd1PubKey with a NAC, retry
-                DEBUG("Server NackRnd1PubKey");
-                nap(1000);  // sleep for a second and retry.
-                state = ClientBStates::RequestRnd1PubKey;
-                break;
-
-              case ThreshMsgTypes::NackRnd1evalMultKey:
-                // Server has responded to a SendRnd1evalMultKey with a NAC,
-                // retry
-                DEBUG("Server NackRnd1evalMultKey");
-                nap(1000);  // sleep for a second and retry.
-                state = ClientBStates::RequestRnd1evalMultKey;
-                break;
-
-              case ThreshMsgTypes::NackRnd1evalSumKeys:
-                // Server has responded to a SendRnd1evalSumKeys with a NAC,
-                // retry
-                DEBUG("Server NackRnd1evalSumKeys");
-                nap(1000);  // sleep for a second and retry.
-                state = ClientBStates::RequestRnd1evalSumKeys;
-                break;
-
+                if (!round2Started &&
+                    pushed.Has({CeremonyRnd1PubKey, CeremonyRnd1EvalMultKey})) {
+                  round2Started = true;
+                  state = ClientBStates::GenRnd2Keys;
+                }
+                if (!round3Done && pushed.Has({CeremonyRnd3EvalMultFinal})) {
+                  round3Done = true;
+                  clientCC->InsertEvalMultKey({pushed.rnd3EvalMultFinal});
+                  state = ClientBStates::GenCT1;
+                }
+                break;
+
+              case ThreshMsgTypes::SendEvalSumKeyEntry: {
+                // start on each of Alice's keys as soon as it is here
+                usint index;
+                EvalKey key;
+                c.RecvEvalSumKeyEntry(msg, index, key);
+                DEBUG("read Round 1 eval sum key " << index);
+                if (sumKeysJoin) {
+                  sumKeysJoin->Add(index, key);
+                } else {
+                  earlySumKeys.emplace_back(index, key);
+                }
+                break;
+              }
+
+              case ThreshMsgTypes::EndEvalSumKeys:
+                msg >> Rnd1evalSumKeysCount;
+                PROFILELOG(myName << ": read all " << Rnd1evalSumKeysCount
+                                  << " Round 1 eval sum keys");
+                if (sumKeysJoinDue) {
+                  state = ClientBStates::SendRnd2evalSumKeysJoin;
+                }
+                break;
+
+              // the Round 2 keys are all sent at once, the acks are only
+              // for the log
               case ThreshMsgTypes::AckRnd2SharedKey:
                 PROFILELOG(myName << ": Acknowledged Round 2 Public key");
-                state = ClientBStates::SendRnd2evalMultAB;
                 break;
 
               case ThreshMsgTypes::AckRnd2EvalMultAB:
                 PROFILELOG(myName << ": Acknowledged Round 2 EvalMultAB");
-                state = ClientBStates::SendRnd2evalMultBAB;
                 break;
 
               case ThreshMsgTypes::AckRnd2EvalMultBAB:
                 PROFILELOG(myName << ": Acknowledged Round 2 EvalMultBAB");
-                state = ClientBStates::SendRnd2evalSumKeysJoin;
                 break;
 
               case ThreshMsgTypes::AckRnd2EvalSumKeysJoin:
                 PROFILELOG(myName << ": Acknowledged Round 2 EvalSumKeysJoin");
-                state = ClientBStates::RequestRnd3evalMultFinal;
                 break;
 
-              case ThreshMsgTypes::SendRnd3EvalMultFinal:
-                PROFILELOG(myName << ": reading Round 3 eval mult final key");
-                TIC(t);
-                Rnd3evalMultFinal = c.RecvRnd3evalMultFinal(msg);
-                clientCC->InsertEvalMultKey({Rnd3evalMultFinal});
-                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-                state = ClientBStates::GenCT1;
-                break;
+              case ThreshMsgTypes::NackRnd2EvalSumKeysJoin:
+                // the ceremony cannot go on without the keys
+                std::cerr << myName << ": server did not get all "
+                          << "Round 2 EvalSumKeysJoin" << std::endl;
+                c.DisconnectClient();
+                std::exit(EXIT_FAILURE);
 
               case ThreshMsgTypes::AckCT1:
                 PROFILELOG(myName << ": Acknowledging Ciphertext1");
@@ -331,7 +373,8 @@ int main(int argc, char *argv[]) {
                 PROFILELOG(
                     myName
                     << ": acknowledging partially decrypted main sum CT");
-                state = ClientBStates::RequestDecryptLeadAdd;
+                state = serverFusion ? ClientBStates::RequestFusedResults
+                                     : ClientBStates::RequestDecryptLeadAdd;
                 break;
 
               case ThreshMsgTypes::SendDecryptLeadAdd:
@@ -397,14 +440,6 @@ int main(int argc, char *argv[]) {
                 state = ClientBStates::RequestSumCT;
                 break;
 
-              case ThreshMsgTypes::NackRnd3evalMultFinal:
-                // Server has responded to a SendRnd3EvalMultFinal with a NAC,
-                // retry
-                DEBUG("Server NackRnd3EvalMultFinal");
-                nap(1000);  // sleep for a second and retry.
-                state = ClientBStates::RequestRnd3evalMultFinal;
-                break;
-
               case ThreshMsgTypes::NackPartialLeadAdd:
                 PROFILELOG("Server NackPartialLeadAdd");
                 nap(1000);  // sleep for a second and retry.
@@ -441,6 +476,35 @@ int main(int argc, char *argv[]) {
                 state = ClientBStates::DecryptMainPartialSum;
                 break;
 
+              case ThreshMsgTypes::SendFusedResults: {
+                PROFILELOG(myName << ": reading results fused by the server");
+                auto results = c.RecvFusedResults(msg);
+                const char *names[] = {"Add", "Mult", "Sum"};
+                for (size_t i = 0; i < results.size() && i < 3; i++) {
+                  std::cout << "\n Resulting Fused Plaintext " << names[i]
+                            << ": \n(";
+                  for (size_t j = 0; j < results[i].size() && j < 12; j++) {
+                    std::cout << (j ? ", " : "") << results[i][j];
+                  }
+                  std::cout << ", ... )\n";
+                }
+                done = true;
+                break;
+              }
+
+              case ThreshMsgTypes::NackFusedResults:
+                // the other party has not sent its partial decryptions yet
+                DEBUG("Server NackFusedResults");
+                nap(1000);  // sleep for a second and retry.
+                state = ClientBStates::RequestFusedResults;
+                break;
+
+              case ThreshMsgTypes::DenyFusedResults:
+                PROFILELOG(myName << ": server will not fuse for us, fusing "
+                                     "locally");
+                state = ClientBStates::RequestDecryptLeadAdd;
+                break;
+
               default:
                 PROFILELOG(myName << ": received unhandled message from Server "
                                   << msg.header.id);
@@ -456,60 +520,47 @@ int main(int argc, char *argv[]) {
           state = ClientBStates::GetMessage;
           break;
 
-        case ClientBStates::RequestRnd1PubKey:
-          TIC(t);
-          PROFILELOG(myName << ": Requesting Round 1 public key");
-          c.RequestRnd1PubKey();  // request the round 1 public key from Alice.
-          PROFILELOG(myName << ":elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientBStates::GetMessage;
-          break;
-
-        case ClientBStates::RequestRnd1evalMultKey:
-          TIC(t);
-          PROFILELOG(myName << ": Requesting Round 1 EvalMultKey");
-          c.RequestRnd1evalMultKey();  // request the Round 1 EvalMultKey from
-                                       // Alice.
-          PROFILELOG(myName << ":elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientBStates::GetMessage;
-          break;
-
-        case ClientBStates::RequestRnd1evalSumKeys:
-          TIC(t);
-          PROFILELOG(myName << ": Requesting Round 1 EvalSumKeys");
-          c.RequestRnd1evalSumKeys();  // request the Round 1 EvalSumKeys from
-                                       // Alice.
-          PROFILELOG(myName << ":elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientBStates::GetMessage;
-          break;
-
         case ClientBStates::GenRnd2Keys:
           PROFILELOG("Round 2 " << myName << " started.");
           TIC(t);
           std::cout << "Joint public key for (s_a + s_b) is generated..."
                     << std::endl;
-          keyPair = clientCC->MultipartyKeyGen(Rnd1Pubkey);
+          keyPair = clientCC->MultipartyKeyGen(pushed.rnd1PubKey);
 
           evalMultKey2 = clientCC->MultiKeySwitchGen(
-              keyPair.secretKey, keyPair.secretKey, Rnd1evalMultKey);
+              keyPair.secretKey, keyPair.secretKey, pushed.rnd1EvalMultKey);
 
-          evalMultAB = clientCC->MultiAddEvalKeys(
-              Rnd1evalMultKey, evalMultKey2, keyPair.publicKey->GetKeyTag());
+          evalMultAB =
+              clientCC->MultiAddEvalKeys(pushed.rnd1EvalMultKey, evalMultKey2,
+                                         keyPair.publicKey->GetKeyTag());
 
           evalMultBAB = clientCC->MultiMultEvalKey(
               evalMultAB, keyPair.secretKey, keyPair.publicKey->GetKeyTag());
 
+          // nothing waits for an ack, Alice can start on Round 3 as soon
+          // as these are through
           c.SendRnd2SharedKey(keyPair);
+          c.SendRnd2EvalMultAB(evalMultAB);
+          c.SendRnd2EvalMultBAB(evalMultBAB);
 
-          evalSumKeysB =
-              clientCC->MultiEvalSumKeyGen(keyPair.secretKey, Rnd1evalSumKeys,
-                                           keyPair.publicKey->GetKeyTag());
-
-          evalSumKeysJoin = clientCC->MultiAddEvalSumKeys(
-              Rnd1evalSumKeys, evalSumKeysB, keyPair.publicKey->GetKeyTag());
+          // make and join Bob's share of each of Alice's eval sum keys in
+          // its own task as they arrive, each joint key is on its way to
+          // the server as soon as it is done
+          sumKeysJoin = std::make_unique<StreamedKeyGen>(
+              keyPool,
+              MultiEvalSumKeyJoin(clientCC, keyPair.secretKey,
+                                  keyPair.publicKey->GetKeyTag()),
+              [&c](usint index, const EvalKey &key) {
+                c.SendEvalSumKeyEntry(Rnd2EvalSumKeysJoin, index, key);
+              });
+          for (auto &entry : earlySumKeys) {
+            sumKeysJoin->Add(entry.first, entry.second);
+          }
+          earlySumKeys.clear();
 
           PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
 
-          state = ClientBStates::GetMessage;
+          state = ClientBStates::SendRnd2evalSumKeysJoin;
           if (!keyPair.good()) {
             std::cerr << myName << "Round 2 Key generation failed!"
                       << std::endl;
@@ -517,40 +568,28 @@ int main(int argc, char *argv[]) {
           }
           break;
 
-        case ClientBStates::SendRnd2evalMultAB:
-          PROFILELOG(myName << ": Serializing and sending Round 2 EvalMultAB");
-          TIC(t);
-          c.SendRnd2EvalMultAB(evalMultAB);
-          PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientBStates::GetMessage;
-          break;
-
-        case ClientBStates::SendRnd2evalMultBAB:
-          PROFILELOG(myName << ": Serializing and sending Round 2 EvalMultBAB");
-          TIC(t);
-          c.SendRnd2EvalMultBAB(evalMultBAB);
-          PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientBStates::GetMessage;
-          break;
-
         case ClientBStates::SendRnd2evalSumKeysJoin:
-          PROFILELOG(myName
-                     << ": Serializing and sending Round 2 EvalSumKeysJoin");
+          // wait for the rest of Alice's keys, EndEvalSumKeys comes back here
+          if (Rnd1evalSumKeysCount == 0) {
+            sumKeysJoinDue = true;
+            state = ClientBStates::GetMessage;
+            break;
+          }
+          PROFILELOG(myName << ": Finishing Round 2 EvalSumKeysJoin");
           TIC(t);
-          c.SendRnd2EvalSumKeysJoin(evalSumKeysJoin);
+          evalSumKeysJoin = sumKeysJoin->Finish();
+          if (evalSumKeysJoin->size() != Rnd1evalSumKeysCount) {
+            std::cerr << myName << ": got " << evalSumKeysJoin->size()
+                      << " of " << Rnd1evalSumKeysCount
+                      << " Round 1 eval sum keys" << std::endl;
+            std::exit(EXIT_FAILURE);
+          }
+          // the keys were streamed as they were made, close the map
+          c.EndEvalSumKeys(Rnd2EvalSumKeysJoin, evalSumKeysJoin->size());
           PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
           state = ClientBStates::GetMessage;
           break;
 
-        case ClientBStates::RequestRnd3evalMultFinal:
-          PROFILELOG(myName << ": Requesting Round 3 final shared Mult key");
-          TIC(t);
-          c.RequestRnd3evalMultFinal();  // request the Round 3 EvalMultFinal
-                                         // from Alice.
-          PROFILELOG(myName << ":elapsed time " << TOC_MS(t) << "msec.");
-          state = ClientBStates::GetMessage;
-          break;
-
         case ClientBStates::GenCT1:
           PROFILELOG(myName << ": Generate ciphertext 1");
           plaintext1 = clientCC->MakeCKKSPackedPlaintext(vectorOfInts1);
@@ -670,6 +709,12 @@ int main(int argc, char *argv[]) {
           state = ClientBStates::GetMessage;
           break;
 
+        case ClientBStates::RequestFusedResults:
+          PROFILELOG(myName << ": Request results fused by the server");
+          c.RequestFusedResults();
+          state = ClientBStates::GetMessage;
+          break;
+
         case ClientBStates::DecryptFusion:
           PROFILELOG(myName << ": perform decrypt fusion");
           TIC(t);
@@ -727,6 +772,8 @@ int main(int argc, char *argv[]) {
           break;
       }  // switch state
 
+      olc::net::tracer::Get().EndSpan(stateSpan);
+
     }  // IsConnected()
 
   }  // while !done
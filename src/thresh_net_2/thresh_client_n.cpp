@@ -0,0 +1,757 @@
+// @file thresh_client_n.cpp - Example of a party in an N party threshold fhe
+// ceremony
+// @author TPOC: contact@palisade-crypto.org
+//
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// @section DESCRIPTION
+// Example software for multiparty threshold fhe of an integer buffer using
+// CKKS scheme with any number of parties. Client application.
+// uses lightweight ASIO connection library Copyright 2018 - 2020
+// OneLoneCoder.com
+
+// Start the server with -N <number of parties> and then that many copies of
+// this client. The parties are numbered in the order they register with the
+// server. Party 0 generates the first keys and is the lead in the
+// decryption, every other party generates its share of the joint keys from
+// party 0's keys, all at the same time. The server adds up the shares and
+// schedules each step as soon as its inputs exist. The last party encrypts
+// the example ciphertexts with the joint public key, the server computes on
+// them, and every party contributes a partial decryption and fuses the
+// partial decryptions of all parties (or their sum, with server -C) to show
+// the result.
+//
+// With -g (given to every party) the last party also submits an example
+// computation graph, ((CT1 - CT2) * CT3) rescaled and rotated by one slot,
+// and every party fetches and decrypts its result as well. With -b <count>
+// (again given to every party) the last party also streams count more
+// ciphertexts to the server, which sums them as they arrive, and every
+// party decrypts the sum.
+
+#define PROFILE
+
+#include <getopt.h>
+
+#include "palisade.h"
+#include "thresh_utils.h"
+
+#include "thresh_client.h"
+#include "thresh_keys.h"
+
+using namespace lbcrypto;
+/**
+ * main program
+ * requires inputs
+ */
+
+enum class PartyStates : uint64_t {
+  GetMessage,
+  RequestCC,
+  RegisterParty,
+  RunKeyGenStep,
+  RunMultKeyStep,
+  GenCT1,
+  GenCT2,
+  GenCT3,
+  RequestAddCT,
+  RequestMultCT,
+  RequestSumCT,
+  DecryptPartialAdd,
+  DecryptPartialMult,
+  DecryptPartialSum,
+  RequestPartialsAdd,
+  RequestPartialsMult,
+  RequestPartialsSum,
+  SubmitGraph,
+  UploadBatch,
+  RequestResult,
+  DecryptPartialResult,
+  RequestPartialsResult,
+  DecryptFusion,
+};
+
+// names of the states above, in the same order (used for tracing)
+vector<string> PartyStateNames{
+    "GetMessage",
+    "RequestCC",
+    "RegisterParty",
+    "RunKeyGenStep",
+    "RunMultKeyStep",
+    "GenCT1",
+    "GenCT2",
+    "GenCT3",
+    "RequestAddCT",
+    "RequestMultCT",
+    "RequestSumCT",
+    "DecryptPartialAdd",
+    "DecryptPartialMult",
+    "DecryptPartialSum",
+    "RequestPartialsAdd",
+    "RequestPartialsMult",
+    "RequestPartialsSum",
+    "SubmitGraph",
+    "UploadBatch",
+    "RequestResult",
+    "DecryptPartialResult",
+    "RequestPartialsResult",
+    "DecryptFusion",
+};
+
+// handles of the result of the example graph and of the batch sum
+const uint32_t kGraphResult = kFirstResultHandle;
+const uint32_t kBatchSum = kFirstResultHandle + 1;
+
+int main(int argc, char *argv[]) {
+  ////////////////////////////////////////////////////////////
+  // Set-up of parameters
+  ////////////////////////////////////////////////////////////
+  int opt;
+  string myName("");  // name of client to run
+  uint32_t port(0);
+  string hostName("");  // name of server host
+  string traceFile("");  // trace events are written here if set
+  bool useGraph = false;  // run the example computation graph
+  uint32_t batchCount = 0;  // # of ciphertexts in the streamed upload
+
+  while ((opt = getopt(argc, argv, "i:n:p:t:gb:h")) != -1) {
+    switch (opt) {
+      case 'i':
+        hostName = optarg;
+        std::cout << "host name " << hostName << std::endl;
+        break;
+      case 'n':
+        myName = optarg;
+        std::cout << "starting client named " << myName << std::endl;
+        break;
+      case 'p':
+        port = atoi(optarg);
+        std::cout << "host port " << port << std::endl;
+        break;
+      case 't':
+        traceFile = optarg;
+        std::cout << "tracing to " << traceFile << std::endl;
+        break;
+      case 'g':
+        useGraph = true;
+        std::cout << "running the example computation graph" << std::endl;
+        break;
+      case 'b':
+        batchCount = atoi(optarg);
+        std::cout << "streaming " << batchCount << " ciphertexts" << std::endl;
+        break;
+      case 'h':
+      default: /* '?' */
+        std::cerr << "Usage: " << std::endl
+                  << "arguments:" << std::endl
+                  << "  -n name of the client" << std::endl
+                  << "  -i IP or hostname of the server" << std::endl
+                  << "  -p port of the server" << std::endl
+                  << "  -t file to write trace events to" << std::endl
+                  << "  -g run the example computation graph (all parties)"
+                  << std::endl
+                  << "  -b number of ciphertexts to stream and sum (all "
+                  << "parties)" << std::endl
+                  << "  -h prints this message" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+  }
+  if (!traceFile.empty()) {
+    OpenTrace(myName, traceFile);
+  }
+
+  ThreshParty c;
+  // connect to the server
+  PROFILELOG(myName << ": Connecing to server at " << hostName << ":" << port);
+  c.Connect(hostName, port);
+  if (c.IsConnected()) {
+    PROFILELOG(myName << ": Connected to server");
+  } else {
+    PROFILELOG(myName << ": Not Connected to server. Exiting");
+    exit(EXIT_FAILURE);
+  }
+
+  bool done = false;
+
+  // each party is a simple state machine, set initial state
+  PartyStates state(PartyStates::GetMessage);
+
+  CC clientCC;  // cryptocontext of the client
+
+  usint partyIndex = 0, numParties = 0;  // assigned by the server
+
+  // keys of the lead (party 0) that the other parties build on
+  PublicKey leadPubKey;
+  EvalKey leadEvalMultKey;
+  std::shared_ptr<std::map<usint, EvalKey>> leadEvalSumKeys;
+
+  // this party's keys and its contributions to the joint keys
+  KeyPair keyPair;
+  EvalKey evalMultKey;
+  std::shared_ptr<std::map<usint, EvalKey>> evalSumKeys;
+
+  // joint keys of all parties
+  PublicKey jointPubKey;
+  EvalKey jointEvalMultKey;
+
+  // example plaintext vectors
+  std::vector<double> vectorOfInts1 = {1, 2, 3, 4, 5, 6, 5, 4, 3, 2, 1, 0};
+  std::vector<double> vectorOfInts2 = {1, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+  std::vector<double> vectorOfInts3 = {2, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 0};
+
+  // evaluated ciphertexts of add, mult, sum operations
+  CT ciphertextAdd123, ciphertextMult, ciphertextSum;
+
+  // handles of further results kept by the server (graph, batch sum), the
+  // one being decrypted and the one whose partial decryptions are fetched
+  vector<uint32_t> resultHandles;
+  if (useGraph) resultHandles.push_back(kGraphResult);
+  if (batchCount > 0) resultHandles.push_back(kBatchSum);
+  size_t decryptResult = 0, partialsResult = 0;
+  CT ciphertextResult;
+
+  // partial decryptions of all parties, by PartialKind or graph handle
+  std::map<unsigned int, vector<CT>> partials;
+
+  TimeVar t;  // time benchmarking variable
+
+  // generates the eval sum keys, one index per task
+  boost::asio::thread_pool keyPool{
+      std::max(1u, std::thread::hardware_concurrency())};
+
+  DEBUG_FLAG(false);  // Turns on and off DEBUG() statements
+
+  // party 0 is the lead in the decryption, everybody else is a main
+  auto partialDecrypt = [&](CT &ct, unsigned int kind) {
+    TIC(t);
+    vector<CT> partial;
+    if (partyIndex == 0) {
+      partial = clientCC->MultipartyDecryptLead(keyPair.secretKey, {ct});
+    } else {
+      partial = clientCC->MultipartyDecryptMain(keyPair.secretKey, {ct});
+    }
+    c.SendPartialDecrypt(partial[0], kind);
+    PROFILELOG(myName << ":elapsed time " << TOC_MS(t) << "msec.");
+  };
+
+  // the states that follow each acknowledged or received kind of result,
+  // the results in resultHandles come after the sum, one after the other
+  auto nextDecrypt = [&](unsigned int kind) {
+    switch (kind) {
+      case PartialAdd:
+        return PartyStates::DecryptPartialMult;
+      case PartialMult:
+        return PartyStates::DecryptPartialSum;
+      case PartialSum:
+        decryptResult = 0;
+        break;
+      default:
+        decryptResult++;
+    }
+    return decryptResult < resultHandles.size()
+               ? PartyStates::RequestResult
+               : PartyStates::RequestPartialsAdd;
+  };
+  auto nextPartials = [&](unsigned int kind) {
+    switch (kind) {
+      case PartialAdd:
+        return PartyStates::RequestPartialsMult;
+      case PartialMult:
+        return PartyStates::RequestPartialsSum;
+      case PartialSum:
+        partialsResult = 0;
+        break;
+      default:
+        partialsResult++;
+    }
+    return partialsResult < resultHandles.size()
+               ? PartyStates::RequestPartialsResult
+               : PartyStates::DecryptFusion;
+  };
+  auto retryPartials = [&](unsigned int kind) {
+    switch (kind) {
+      case PartialAdd:
+        return PartyStates::RequestPartialsAdd;
+      case PartialMult:
+        return PartyStates::RequestPartialsMult;
+      case PartialSum:
+        return PartyStates::RequestPartialsSum;
+      default:
+        return PartyStates::RequestPartialsResult;
+    }
+  };
+  // the example uploads that follow the three ciphertexts
+  auto nextUpload = [&](PartyStates after) {
+    if (after == PartyStates::GenCT3 && useGraph) {
+      return PartyStates::SubmitGraph;
+    }
+    if (after != PartyStates::UploadBatch && batchCount > 0) {
+      return PartyStates::UploadBatch;
+    }
+    return PartyStates::RequestAddCT;
+  };
+
+  while (!done) {
+    if (c.IsConnected()) {
+      // trace each step of the state machine, messages are traced as they
+      // are taken off the queue below
+      uint64_t stateSpan = 0;
+      if (state != PartyStates::GetMessage) {
+        stateSpan = olc::net::tracer::Get().BeginSpan(
+            PartyStateNames[static_cast<size_t>(state)]);
+      }
+
+      switch (state) {  // sequence of states that the client executes
+        case PartyStates::GetMessage:
+          // client tests for a response from the server
+          if (!c.Incoming().empty()) {
+            auto msg = c.Incoming().pop_front().msg;
+            OLC_TRACE_SPAN(ThreshMsgName(static_cast<uint32_t>(msg.header.id)),
+                           msg.header.span_id);
+
+            switch (msg.header.id) {
+              case ThreshMsgTypes::ServerAccept:
+                // Server has responded to the Connect()
+                DEBUG("Server Accepted Connection");
+                state = PartyStates::RequestCC;
+                break;
+
+              case ThreshMsgTypes::SendCC:
+                PROFILELOG(myName << ": reading crypto context from server");
+                TIC(t);
+                clientCC = c.RecvCC(msg);
+                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+                state = PartyStates::RegisterParty;
+                break;
+
+              case ThreshMsgTypes::AssignParty:
+                c.RecvAssignParty(msg, partyIndex, numParties);
+                PROFILELOG(myName << ": registered as party " << partyIndex
+                                  << " of " << numParties);
+                break;
+
+              case ThreshMsgTypes::RejectParty:
+                std::cerr << myName << ": server rejected registration, "
+                          << "is it running with -N?" << std::endl;
+                c.DisconnectClient();
+                std::exit(EXIT_FAILURE);
+
+              case ThreshMsgTypes::NackMessage:
+                // the ceremony cannot go on without the message
+                std::cerr << myName << ": server could not read message "
+                          << msg.header.SubType_ID << ": " << c.RecvReason(msg)
+                          << std::endl;
+                c.DisconnectClient();
+                std::exit(EXIT_FAILURE);
+
+              case ThreshMsgTypes::RunKeyGenStep:
+                PROFILELOG(myName << ": reading key generation step inputs");
+                TIC(t);
+                c.RecvKeyGenStep(msg, leadPubKey, leadEvalMultKey,
+                                 leadEvalSumKeys);
+                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+                state = PartyStates::RunKeyGenStep;
+                break;
+
+              case ThreshMsgTypes::AckKeyGenStep:
+                PROFILELOG(myName << ": Acknowledged key generation step");
+                break;
+
+              case ThreshMsgTypes::RunMultKeyStep:
+                PROFILELOG(myName << ": reading joint keys");
+                TIC(t);
+                c.RecvMultKeyStep(msg, jointPubKey, jointEvalMultKey);
+                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+                state = PartyStates::RunMultKeyStep;
+                break;
+
+              case ThreshMsgTypes::AckMultKeyStep:
+                PROFILELOG(myName << ": Acknowledged mult key step");
+                break;
+
+              case ThreshMsgTypes::CeremonyComplete:
+                PROFILELOG(myName << ": key ceremony complete");
+                // the last party provides the example ciphertexts
+                state = (partyIndex + 1 == numParties)
+                            ? PartyStates::GenCT1
+                            : PartyStates::RequestAddCT;
+                break;
+
+              case ThreshMsgTypes::AckCT1:
+                PROFILELOG(myName << ": Acknowledging Ciphertext1");
+                state = PartyStates::GenCT2;
+                break;
+
+              case ThreshMsgTypes::AckCT2:
+                PROFILELOG(myName << ": Acknowledging Ciphertext2");
+                state = PartyStates::GenCT3;
+                break;
+
+              case ThreshMsgTypes::AckCT3:
+                PROFILELOG(myName << ": Acknowledging Ciphertext3");
+                state = nextUpload(PartyStates::GenCT3);
+                break;
+
+              case ThreshMsgTypes::AckSubmitGraph:
+                PROFILELOG(myName << ": graph accepted");
+                state = nextUpload(PartyStates::SubmitGraph);
+                break;
+
+              case ThreshMsgTypes::RejectGraph:
+                // its outputs are not claimed, nobody waits for them
+                std::cerr << myName << ": graph rejected: " << c.RecvReason(msg)
+                          << std::endl;
+                state = nextUpload(PartyStates::SubmitGraph);
+                break;
+
+              case ThreshMsgTypes::AckCTBatch: {
+                uint32_t count;
+                msg >> count;
+                PROFILELOG(myName << ": Acknowledging batch of " << count
+                                  << " ciphertexts");
+                state = nextUpload(PartyStates::UploadBatch);
+                break;
+              }
+
+              case ThreshMsgTypes::NackCTBatch:
+                std::cerr << myName << ": server rejected batch ciphertext "
+                          << msg.header.SubType_ID << std::endl;
+                break;
+
+              case ThreshMsgTypes::SendResult:
+                PROFILELOG(myName << ": reading result "
+                                  << msg.header.SubType_ID);
+                ciphertextResult = c.RecvResult(msg);
+                state = PartyStates::DecryptPartialResult;
+                break;
+
+              case ThreshMsgTypes::NackResult:
+                // not submitted or still running
+                DEBUG("Server NackResult " << msg.header.SubType_ID);
+                nap(1000);  // sleep for a second and retry.
+                state = PartyStates::RequestResult;
+                break;
+
+              case ThreshMsgTypes::FailedResult:
+                std::cerr << myName << ": result " << msg.header.SubType_ID
+                          << " failed: " << c.RecvReason(msg) << std::endl;
+                resultHandles.erase(resultHandles.begin() + decryptResult);
+                state = decryptResult < resultHandles.size()
+                            ? PartyStates::RequestResult
+                            : PartyStates::RequestPartialsAdd;
+                break;
+
+              case ThreshMsgTypes::SendAddCT:
+                PROFILELOG(myName << ": reading Addition ciphertext");
+                ciphertextAdd123 = c.RecvCT(msg);
+                state = PartyStates::RequestMultCT;
+                break;
+
+              case ThreshMsgTypes::SendMultCT:
+                PROFILELOG(myName << ": reading Multiplication ciphertext");
+                ciphertextMult = c.RecvCT(msg);
+                state = PartyStates::RequestSumCT;
+                break;
+
+              case ThreshMsgTypes::SendSumCT:
+                PROFILELOG(myName << ": reading Sum ciphertext");
+                ciphertextSum = c.RecvCT(msg);
+                state = PartyStates::DecryptPartialAdd;
+                break;
+
+              case ThreshMsgTypes::NackCT1:
+              case ThreshMsgTypes::NackCT2:
+              case ThreshMsgTypes::NackCT3:
+                // the ciphertexts are not there yet, followed by a Nack of
+                // the result which is retried below
+                DEBUG("Server " << msg.header.id);
+                break;
+
+              case ThreshMsgTypes::NackAddCT:
+                DEBUG("Server NackAddCT");
+                nap(1000);  // sleep for a second and retry.
+                state = PartyStates::RequestAddCT;
+                break;
+
+              case ThreshMsgTypes::NackMultCT:
+                DEBUG("Server NackMultCT");
+                nap(1000);  // sleep for a second and retry.
+                state = PartyStates::RequestMultCT;
+                break;
+
+              case ThreshMsgTypes::NackSumCT:
+                DEBUG("Server NackSumCT");
+                nap(1000);  // sleep for a second and retry.
+                state = PartyStates::RequestSumCT;
+                break;
+
+              case ThreshMsgTypes::AckPartialDecrypt:
+                PROFILELOG(myName << ": acknowledging partial decryption "
+                                  << msg.header.SubType_ID);
+                state = nextDecrypt(msg.header.SubType_ID);
+                break;
+
+              case ThreshMsgTypes::SendPartialDecrypts:
+                PROFILELOG(myName << ": reading partial decryptions "
+                                  << msg.header.SubType_ID);
+                TIC(t);
+                partials[msg.header.SubType_ID] = c.RecvPartialDecrypts(msg);
+                PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+                state = nextPartials(msg.header.SubType_ID);
+                break;
+
+              case ThreshMsgTypes::NackPartialDecrypts:
+                // not every party has decrypted yet
+                DEBUG("Server NackPartialDecrypts " << msg.header.SubType_ID);
+                nap(1000);  // sleep for a second and retry.
+                state = retryPartials(msg.header.SubType_ID);
+                break;
+
+              default:
+                PROFILELOG(myName << ": received unhandled message from Server "
+                                  << msg.header.id);
+            }
+          }  // end isEmpty -- could sleep here
+          break;
+
+        case PartyStates::RequestCC:  // first step
+          TIC(t);
+          PROFILELOG(myName << ": Requesting CC");
+          c.RequestCC();  // request the CC from the server.
+          PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::RegisterParty:
+          PROFILELOG(myName << ": Registering with the server");
+          c.RegisterParty();
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::RunKeyGenStep:
+          PROFILELOG(myName << ": key generation step of party " << partyIndex);
+          TIC(t);
+          if (partyIndex == 0) {
+            // the lead generates the keys everybody else builds on
+            keyPair = clientCC->KeyGen();
+            evalMultKey =
+                clientCC->KeySwitchGen(keyPair.secretKey, keyPair.secretKey);
+            evalSumKeys =
+                ParallelEvalSumKeyGen(keyPool, clientCC, keyPair.secretKey);
+          } else {
+            // this party's shares depend on the lead's keys only (fresh),
+            // the server adds up the shares of all parties
+            keyPair = clientCC->MultipartyKeyGen(leadPubKey, false, true);
+            evalMultKey = clientCC->MultiKeySwitchGen(
+                keyPair.secretKey, keyPair.secretKey, leadEvalMultKey);
+            evalSumKeys = ParallelMultiEvalSumKeyGen(
+                keyPool, clientCC, keyPair.secretKey, leadEvalSumKeys,
+                keyPair.publicKey->GetKeyTag());
+          }
+          if (!keyPair.good()) {
+            std::cerr << myName << ": Key generation failed!" << std::endl;
+            std::exit(EXIT_FAILURE);
+          }
+          c.SendKeyGenStep(keyPair, evalMultKey, evalSumKeys);
+          PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::RunMultKeyStep: {
+          PROFILELOG(myName << ": mult key step of party " << partyIndex);
+          TIC(t);
+          auto evalMultShare = clientCC->MultiMultEvalKey(
+              jointEvalMultKey, keyPair.secretKey, jointPubKey->GetKeyTag());
+          c.SendMultKeyStep(evalMultShare);
+          PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+          state = PartyStates::GetMessage;
+          break;
+        }
+
+        case PartyStates::GenCT1: {
+          PROFILELOG(myName << ": Generate ciphertext 1");
+          auto plaintext = clientCC->MakeCKKSPackedPlaintext(vectorOfInts1);
+          auto ciphertext = clientCC->Encrypt(jointPubKey, plaintext);
+          c.SendCT(ciphertext, 0);
+          state = PartyStates::GetMessage;
+          break;
+        }
+
+        case PartyStates::GenCT2: {
+          PROFILELOG(myName << ": Generate ciphertext 2");
+          auto plaintext = clientCC->MakeCKKSPackedPlaintext(vectorOfInts2);
+          auto ciphertext = clientCC->Encrypt(jointPubKey, plaintext);
+          c.SendCT(ciphertext, 1);
+          state = PartyStates::GetMessage;
+          break;
+        }
+
+        case PartyStates::GenCT3: {
+          PROFILELOG(myName << ": Generate ciphertext 3");
+          auto plaintext = clientCC->MakeCKKSPackedPlaintext(vectorOfInts3);
+          auto ciphertext = clientCC->Encrypt(jointPubKey, plaintext);
+          c.SendCT(ciphertext, 2);
+          state = PartyStates::GetMessage;
+          break;
+        }
+
+        case PartyStates::RequestAddCT:
+          PROFILELOG(myName << ": Requesting eval add ciphertext");
+          c.RequestAddCT();  // request the eval add ciphertext from server.
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::RequestMultCT:
+          PROFILELOG(myName << ": Requesting eval mult ciphertext");
+          c.RequestMultCT();  // request the eval mult ciphertext from server.
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::RequestSumCT:
+          PROFILELOG(myName << ": Requesting eval sum ciphertext");
+          c.RequestSumCT();  // request the eval sum ciphertext from server.
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::DecryptPartialAdd:
+          PROFILELOG(myName << ": Partial decryption of eval add ciphertext");
+          partialDecrypt(ciphertextAdd123, PartialAdd);
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::DecryptPartialMult:
+          PROFILELOG(myName << ": Partial decryption of eval mult ciphertext");
+          partialDecrypt(ciphertextMult, PartialMult);
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::DecryptPartialSum:
+          PROFILELOG(myName << ": Partial decryption of eval sum ciphertext");
+          partialDecrypt(ciphertextSum, PartialSum);
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::RequestPartialsAdd:
+          PROFILELOG(myName << ": Request partial decryptions of add");
+          c.RequestPartialDecrypts(PartialAdd);
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::RequestPartialsMult:
+          PROFILELOG(myName << ": Request partial decryptions of mult");
+          c.RequestPartialDecrypts(PartialMult);
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::RequestPartialsSum:
+          PROFILELOG(myName << ": Request partial decryptions of sum");
+          c.RequestPartialDecrypts(PartialSum);
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::SubmitGraph: {
+          PROFILELOG(myName << ": Submitting the example graph");
+          ComputeGraph graph;
+          auto diff = graph.Sub(graph.Input(0), graph.Input(1));
+          auto prod = graph.Rescale(graph.Mult(diff, graph.Input(2)));
+          graph.Output(graph.Rotate(prod, 1), kGraphResult);
+          c.SubmitGraph(graph);
+          state = PartyStates::GetMessage;
+          break;
+        }
+
+        case PartyStates::UploadBatch: {
+          PROFILELOG(myName << ": Streaming " << batchCount
+                            << " ciphertexts");
+          TIC(t);
+          auto plaintext = clientCC->MakeCKKSPackedPlaintext(vectorOfInts1);
+          c.BeginCTBatch(batchCount, kBatchSum);
+          for (uint32_t seq = 0; seq < batchCount; seq++) {
+            auto ciphertext = clientCC->Encrypt(jointPubKey, plaintext);
+            c.SendBatchCT(ciphertext, seq);
+          }
+          PROFILELOG(myName << ": elapsed time " << TOC_MS(t) << "msec.");
+          state = PartyStates::GetMessage;
+          break;
+        }
+
+        case PartyStates::RequestResult:
+          PROFILELOG(myName << ": Requesting result "
+                            << resultHandles[decryptResult]);
+          c.RequestResult(resultHandles[decryptResult]);
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::DecryptPartialResult:
+          PROFILELOG(myName << ": Partial decryption of result "
+                            << resultHandles[decryptResult]);
+          partialDecrypt(ciphertextResult, resultHandles[decryptResult]);
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::RequestPartialsResult:
+          PROFILELOG(myName << ": Request partial decryptions of result "
+                            << resultHandles[partialsResult]);
+          c.RequestPartialDecrypts(resultHandles[partialsResult]);
+          state = PartyStates::GetMessage;
+          break;
+
+        case PartyStates::DecryptFusion: {
+          PROFILELOG(myName << ": Final decryption fusion of all results");
+          TIC(t);
+          const char *names[] = {"Add", "Mult", "Sum"};
+          for (auto &entry : partials) {
+            unsigned int kind = entry.first;
+            PT plaintextMultiparty;
+            clientCC->MultipartyDecryptFusion(entry.second,
+                                              &plaintextMultiparty);
+            plaintextMultiparty->SetLength(12);  // ptlength;
+
+            string name = kind <= PartialSum    ? names[kind]
+                          : kind == kGraphResult ? "Graph"
+                                                 : "Batch sum";
+            std::cout << "\n Resulting Fused Plaintext " << name << ": \n";
+            std::cout << plaintextMultiparty;
+            std::cout << "\n";
+          }
+          PROFILELOG(myName << ":elapsed time " << TOC_MS(t) << "msec.");
+
+          done = true;
+          break;
+        }
+      }  // switch state
+
+      olc::net::tracer::Get().EndSpan(stateSpan);
+
+    }  // IsConnected()
+
+    nap(100);  // take a 100 msec pause
+
+  }  // while !done
+
+  ////////////////////////////////////////////////////////////
+  // Done
+  ////////////////////////////////////////////////////////////
+
+  PROFILELOG(myName << ": Execution Completed.");
+  c.DisconnectClient();
+  nap(1000);
+  std::exit(EXIT_SUCCESS);  // successful return
+}
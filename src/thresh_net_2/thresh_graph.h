@@ -0,0 +1,360 @@
+// @file thresh_graph.h - encrypted computation graphs for the threshold server
+// @author TPOC: contact@palisade-crypto.org
+//
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// A client describes a computation as a small DAG over ciphertext handles.
+// Nodes are listed in topological order, every operand refers to an earlier
+// node, so a graph can not contain a cycle. The server checks the graph
+// against the ciphertexts and evaluation keys it holds (ValidateGraph), then
+// runs it on a thread pool (GraphRun) with every node started as soon as its
+// operands are done, so independent branches run in parallel. The outputs
+// are stored under handles chosen by the client, which any party can then
+// request.
+
+#ifndef THRESH_GRAPH_H
+#define THRESH_GRAPH_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include "thresh_utils.h"
+
+enum class GraphOp : uint32_t {
+  Input,    // param = handle of a ciphertext on the server
+  Add,      // a + b
+  Sub,      // a - b
+  Mult,     // a * b, relinearized with the joint eval mult key
+  Rotate,   // a rotated by param slots
+  Sum,      // sum of the first batch size slots of a
+  Rescale,  // a rescaled (ModReduce), needed after Mult
+};
+
+const vector<string> GraphOpNames{"Input", "Add",    "Sub",    "Mult",
+                                  "Rotate", "Sum", "Rescale"};
+
+struct GraphNode {
+  GraphOp op;
+  uint32_t a = 0, b = 0;  // operand nodes
+  int32_t param = 0;
+};
+
+// an output node and the handle its result is stored under
+struct GraphOutput {
+  uint32_t node;
+  uint32_t handle;
+};
+
+// Handles below this are the ciphertexts uploaded with SendCT1..3 (in the
+// order they arrived), results of graphs must use handles from here on
+const uint32_t kFirstResultHandle = 0x10000;
+
+class ComputeGraph {
+ public:
+  vector<GraphNode> nodes;
+  vector<GraphOutput> outputs;
+
+  // builders, each returns the new node
+  uint32_t Input(uint32_t handle) {
+    return AddNode(GraphOp::Input, 0, 0, handle);
+  }
+  uint32_t Add(uint32_t a, uint32_t b) { return AddNode(GraphOp::Add, a, b); }
+  uint32_t Sub(uint32_t a, uint32_t b) { return AddNode(GraphOp::Sub, a, b); }
+  uint32_t Mult(uint32_t a, uint32_t b) {
+    return AddNode(GraphOp::Mult, a, b);
+  }
+  uint32_t Rotate(uint32_t a, int32_t index) {
+    return AddNode(GraphOp::Rotate, a, 0, index);
+  }
+  uint32_t Sum(uint32_t a) { return AddNode(GraphOp::Sum, a); }
+  uint32_t Rescale(uint32_t a) { return AddNode(GraphOp::Rescale, a); }
+  void Output(uint32_t node, uint32_t handle) {
+    outputs.push_back({node, handle});
+  }
+
+  static bool IsBinary(GraphOp op) {
+    return op == GraphOp::Add || op == GraphOp::Sub || op == GraphOp::Mult;
+  }
+
+  void AppendTo(olc::net::message<ThreshMsgTypes>& msg) const {
+    AppendRaw(msg, nodes);
+    AppendRaw(msg, outputs);
+  }
+
+  void ReadFrom(olc::net::message<ThreshMsgTypes>& msg) {
+    SerialReader reader(msg);
+    reader.NextRaw(nodes);
+    reader.NextRaw(outputs);
+  }
+
+ private:
+  uint32_t AddNode(GraphOp op, uint32_t a, uint32_t b = 0, int32_t param = 0) {
+    nodes.push_back({op, a, b, param});
+    return nodes.size() - 1;
+  }
+};
+
+// What the server can evaluate with, see ValidateGraph()
+struct GraphKeys {
+  bool multKey = false;        // joint eval mult key present
+  bool sumKeys = false;        // joint eval sum keys present
+  std::set<usint> rotations;   // automorphism indices with a key
+  usint cyclotomicOrder = 0;
+  usint maxLevel = 0;          // # of rescales the moduli allow
+};
+
+/**
+ * Check a graph before it is run: operands must refer to earlier nodes,
+ * inputs must exist, every Mult, Rotate and Sum must have its key, the
+ * operands of Add and Sub must be at the same level and scale (Mult only the
+ * same level), and no path
+ * may rescale more often than the moduli allow.
+ * @param graph - graph to check
+ * @param lookup - returns the ciphertext of a handle, or nullptr
+ * @param keys - keys available on the server
+ * @param error - set to the reason if the graph is rejected
+ * @return true if the graph can be run
+ */
+bool ValidateGraph(const ComputeGraph& graph,
+                   const std::function<CT(uint32_t)>& lookup,
+                   const GraphKeys& keys, string& error) {
+  // level (rescales so far) and depth (scaling degree) of every node
+  vector<size_t> level(graph.nodes.size()), depth(graph.nodes.size());
+  std::ostringstream why;
+
+  if (graph.nodes.empty() || graph.outputs.empty()) {
+    error = "graph has no nodes or no outputs";
+    return false;
+  }
+  for (size_t i = 0; i < graph.nodes.size(); i++) {
+    const GraphNode& n = graph.nodes[i];
+    if (static_cast<uint32_t>(n.op) >= GraphOpNames.size()) {
+      error = "node " + std::to_string(i) + ": unknown operation";
+      return false;
+    }
+    why << "node " << i << " (" << GraphOpNames[static_cast<uint32_t>(n.op)]
+        << "): ";
+    if (n.op != GraphOp::Input &&
+        (n.a >= i || (ComputeGraph::IsBinary(n.op) && n.b >= i))) {
+      why << "operands must be earlier nodes";
+      error = why.str();
+      return false;
+    }
+
+    switch (n.op) {
+      case GraphOp::Input: {
+        CT ct = lookup(n.param);
+        if (!ct) {
+          why << "no ciphertext with handle " << n.param;
+          error = why.str();
+          return false;
+        }
+        level[i] = ct->GetLevel();
+        depth[i] = ct->GetDepth();
+        break;
+      }
+      case GraphOp::Add:
+      case GraphOp::Sub:
+        if (level[n.a] != level[n.b] || depth[n.a] != depth[n.b]) {
+          why << "operands at different levels, rescale first";
+          error = why.str();
+          return false;
+        }
+        level[i] = level[n.a];
+        depth[i] = depth[n.a];
+        break;
+      case GraphOp::Mult:
+        if (!keys.multKey) {
+          why << "no eval mult key";
+          error = why.str();
+          return false;
+        }
+        if (level[n.a] != level[n.b]) {
+          why << "operands at different levels, rescale first";
+          error = why.str();
+          return false;
+        }
+        level[i] = level[n.a];
+        depth[i] = depth[n.a] + depth[n.b];
+        break;
+      case GraphOp::Rotate: {
+        usint index =
+            FindAutomorphismIndex2nComplex(n.param, keys.cyclotomicOrder);
+        if (!keys.rotations.count(index)) {
+          why << "no rotation key for index " << n.param;
+          error = why.str();
+          return false;
+        }
+        level[i] = level[n.a];
+        depth[i] = depth[n.a];
+        break;
+      }
+      case GraphOp::Sum:
+        if (!keys.sumKeys) {
+          why << "no eval sum keys";
+          error = why.str();
+          return false;
+        }
+        level[i] = level[n.a];
+        depth[i] = depth[n.a];
+        break;
+      case GraphOp::Rescale:
+        if (depth[n.a] < 2 || level[n.a] + 1 > keys.maxLevel) {
+          why << "nothing to rescale or out of levels";
+          error = why.str();
+          return false;
+        }
+        level[i] = level[n.a] + 1;
+        depth[i] = depth[n.a] - 1;
+        break;
+    }
+    why.str("");
+  }
+
+  std::set<uint32_t> handles;
+  for (auto& out : graph.outputs) {
+    if (out.node >= graph.nodes.size() || out.handle < kFirstResultHandle ||
+        !handles.insert(out.handle).second) {
+      error = "bad output node or handle " + std::to_string(out.handle);
+      return false;
+    }
+  }
+  return true;
+}
+
+// One execution of a validated graph. Every node keeps a count of the
+// operands it still waits for, when a node finishes it starts each
+// dependent whose count drops to zero. onDone is called on a pool thread
+// once every node has run.
+class GraphRun : public std::enable_shared_from_this<GraphRun> {
+ public:
+  // inputs holds one entry per node, the ciphertext of every Input node
+  // filled in (and null for the others). Mult, rotate and sum nodes hold
+  // keyMutex shared while they use the eval keys of the context. Must be
+  // owned by a shared_ptr.
+  GraphRun(CC cc, ComputeGraph graph, vector<CT> inputs, usint batchSize,
+           std::shared_mutex& keyMutex, std::function<void(GraphRun&)> onDone)
+      : cc(cc),
+        graph(std::move(graph)),
+        values(std::move(inputs)),
+        batchSize(batchSize),
+        keyMutex(keyMutex),
+        onDone(std::move(onDone)),
+        waiting(this->graph.nodes.size()),
+        dependents(this->graph.nodes.size()),
+        remaining(this->graph.nodes.size()) {
+    for (size_t i = 0; i < this->graph.nodes.size(); i++) {
+      const GraphNode& n = this->graph.nodes[i];
+      if (n.op == GraphOp::Input) continue;
+      waiting[i] = 1;
+      dependents[n.a].push_back(i);
+      if (ComputeGraph::IsBinary(n.op) && n.b != n.a) {
+        waiting[i] = 2;
+        dependents[n.b].push_back(i);
+      }
+    }
+  }
+
+  // inputs are already in values, start from them
+  void Start(boost::asio::thread_pool& pool) {
+    this->pool = &pool;
+    for (size_t i = 0; i < graph.nodes.size(); i++) {
+      if (graph.nodes[i].op == GraphOp::Input) Finish(i);
+    }
+  }
+
+  const ComputeGraph& Graph(void) const { return graph; }
+  const CT& Value(uint32_t node) const { return values[node]; }
+  const string& Error(void) const { return error; }
+
+ private:
+  void Run(size_t i) {
+    const GraphNode& n = graph.nodes[i];
+    try {
+      const CT& a = values[n.a];
+      // b is only validated for binary operations
+      CT b = ComputeGraph::IsBinary(n.op) ? values[n.b] : CT();
+      if (!a || (ComputeGraph::IsBinary(n.op) && !b)) {
+        // an operand failed, so does this node
+      } else if (n.op == GraphOp::Add) {
+        values[i] = cc->EvalAdd(a, b);
+      } else if (n.op == GraphOp::Sub) {
+        values[i] = cc->EvalSub(a, b);
+      } else if (n.op == GraphOp::Mult) {
+        std::shared_lock lock(keyMutex);
+        values[i] = cc->EvalMult(a, b);
+      } else if (n.op == GraphOp::Rotate) {
+        std::shared_lock lock(keyMutex);
+        values[i] = cc->EvalAtIndex(a, n.param);
+      } else if (n.op == GraphOp::Sum) {
+        std::shared_lock lock(keyMutex);
+        values[i] = cc->EvalSum(a, batchSize);
+      } else if (n.op == GraphOp::Rescale) {
+        values[i] = cc->ModReduce(a);
+      }
+    } catch (const std::exception& e) {
+      std::scoped_lock lock(errorMutex);
+      if (error.empty()) {
+        error = "node " + std::to_string(i) + ": " + e.what();
+      }
+    }
+    Finish(i);
+  }
+
+  void Finish(size_t i) {
+    auto self = shared_from_this();
+    for (size_t d : dependents[i]) {
+      if (--waiting[d] == 0) {
+        boost::asio::post(*pool, [self, d] { self->Run(d); });
+      }
+    }
+    if (--remaining == 0) {
+      onDone(*this);
+    }
+  }
+
+  CC cc;
+  ComputeGraph graph;
+  vector<CT> values;  // result of every node
+  usint batchSize;
+  std::shared_mutex& keyMutex;
+  std::function<void(GraphRun&)> onDone;
+  boost::asio::thread_pool* pool = nullptr;
+
+  vector<std::atomic<uint32_t>> waiting;  // operands not yet done
+  vector<vector<size_t>> dependents;
+  std::atomic<size_t> remaining;         // nodes not yet done
+
+  std::mutex errorMutex;
+  string error;  // first failure
+};
+
+#endif  // THRESH_GRAPH_H
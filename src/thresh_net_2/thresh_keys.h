@@ -0,0 +1,188 @@
+// @file thresh_keys.h - parallel generation of per index automorphism keys
+// @author TPOC: contact@palisade-crypto.org
+//
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// The eval sum keys are a map of automorphism keys, one per rotation that
+// EvalSum() uses. Every key depends on its index only, so rather than one
+// call to EvalSumKeyGen() (or MultiEvalSumKeyGen() and
+// MultiAddEvalSumKeys()) that makes them one after the other, the code
+// below makes each key as its own task on a thread pool and hands it to a
+// callback as soon as it is done, e.g. to send it while the others are
+// still being generated.
+
+#ifndef THRESH_KEYS_H
+#define THRESH_KEYS_H
+
+#include <cmath>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include "thresh_utils.h"
+
+// called with each finished key, on a thread of the pool
+using EvalKeyCallback = std::function<void(usint index, const EvalKey& key)>;
+
+/**
+ * Automorphism indices EvalSumKeyGen() makes keys for: g, g^2, g^4, ... with
+ * g = 5, the rotations by 1, 2, 4, ... slots. Same as PALISADE's
+ * GenerateIndices_2n() for CKKS with a power of two cyclotomic order.
+ * @param cc - crypto context, gives the batch size and cyclotomic order
+ */
+vector<usint> EvalSumIndices(const CC& cc) {
+  usint batchSize = cc->GetEncodingParams()->GetBatchSize();
+  usint m = cc->GetCyclotomicOrder();
+  vector<usint> indices;
+  if (batchSize > 1) {
+    usint isize = std::ceil(std::log2(batchSize)) - 1;
+    usint g = 5;
+    for (usint i = 0; i < isize; i++) {
+      indices.push_back(g);
+      g = (g * g) % m;
+    }
+    indices.push_back(2 * batchSize < m ? g : m - 1);
+  }
+  return indices;
+}
+
+// Makes a key from each entry of a key map in its own task on the pool, as
+// soon as the entry is added. The entries can be added while they arrive
+// one at a time (see ThreshServer::SendClientEvalSumKeys), so making the
+// keys overlaps with receiving the map, and only the entries still being
+// worked on are held.
+class StreamedKeyGen {
+ public:
+  // EvalKey(usint index, const EvalKey& entry), exceptions are passed on
+  using MakeKey = std::function<EvalKey(usint, const EvalKey&)>;
+
+  // onKey is called with each key as soon as it is done (may be empty)
+  StreamedKeyGen(boost::asio::thread_pool& pool, MakeKey makeKey,
+                 EvalKeyCallback onKey = nullptr)
+      : pool(pool),
+        makeKey(std::move(makeKey)),
+        onKey(std::move(onKey)),
+        keys(std::make_shared<std::map<usint, EvalKey>>()) {}
+
+  // the tasks refer to this object
+  ~StreamedKeyGen() { Wait(); }
+
+  StreamedKeyGen(const StreamedKeyGen&) = delete;
+  StreamedKeyGen& operator=(const StreamedKeyGen&) = delete;
+
+  void Add(usint index, const EvalKey& entry) {
+    auto task = std::make_shared<std::packaged_task<void()>>([this, index,
+                                                              entry] {
+      EvalKey key = makeKey(index, entry);
+      if (onKey) onKey(index, key);
+      std::scoped_lock lock(keysMutex);
+      (*keys)[index] = key;
+    });
+    done.push_back(task->get_future());
+    boost::asio::post(pool, [task] { (*task)(); });
+  }
+
+  size_t Added(void) const { return done.size(); }
+
+  // Waits for the keys of all entries added so far and returns them.
+  // Must not be called from a thread of the pool itself.
+  std::shared_ptr<std::map<usint, EvalKey>> Finish(void) {
+    Wait();
+    for (auto& f : done) {
+      f.get();
+    }
+    done.clear();
+    return keys;
+  }
+
+ private:
+  void Wait(void) {
+    for (auto& f : done) {
+      if (f.valid()) f.wait();
+    }
+  }
+
+  boost::asio::thread_pool& pool;
+  MakeKey makeKey;
+  EvalKeyCallback onKey;
+  vector<std::future<void>> done;
+  std::mutex keysMutex;
+  std::shared_ptr<std::map<usint, EvalKey>> keys;
+};
+
+// Same keys as EvalSumKeyGen(secretKey), which the lead party makes
+std::shared_ptr<std::map<usint, EvalKey>> ParallelEvalSumKeyGen(
+    boost::asio::thread_pool& pool, CC cc, const PrivateKey& secretKey,
+    const EvalKeyCallback& onKey = nullptr) {
+  StreamedKeyGen gen(
+      pool,
+      [&](usint index, const EvalKey&) {
+        return cc->EvalAutomorphismKeyGen(secretKey, {index})->at(index);
+      },
+      onKey);
+  for (usint index : EvalSumIndices(cc)) {
+    gen.Add(index, EvalKey());
+  }
+  return gen.Finish();
+}
+
+// Makes this party's share of the key for one entry of the lead's eval sum
+// keys, as MultiEvalSumKeyGen(secretKey, leadKeys, keyTag) does for all
+StreamedKeyGen::MakeKey MultiEvalSumKeyShare(CC cc, PrivateKey secretKey,
+                                             string keyTag) {
+  return [=](usint index, const EvalKey& leadKey) {
+    auto lead = std::make_shared<std::map<usint, EvalKey>>();
+    (*lead)[index] = leadKey;
+    return cc->MultiEvalAutomorphismKeyGen(secretKey, lead, {index}, keyTag)
+        ->at(index);
+  };
+}
+
+// Makes the joint key of the lead and this party for one entry of the
+// lead's eval sum keys, as MultiAddEvalSumKeys(leadKeys,
+// MultiEvalSumKeyGen(...)) does for all
+StreamedKeyGen::MakeKey MultiEvalSumKeyJoin(CC cc, PrivateKey secretKey,
+                                            string keyTag) {
+  auto share = MultiEvalSumKeyShare(cc, secretKey, keyTag);
+  return [=](usint index, const EvalKey& leadKey) {
+    return cc->MultiAddEvalKeys(leadKey, share(index, leadKey), keyTag);
+  };
+}
+
+// MultiEvalSumKeyShare() for all of the lead's keys at once
+std::shared_ptr<std::map<usint, EvalKey>> ParallelMultiEvalSumKeyGen(
+    boost::asio::thread_pool& pool, CC cc, const PrivateKey& secretKey,
+    const std::shared_ptr<std::map<usint, EvalKey>>& leadKeys,
+    const string& keyTag, const EvalKeyCallback& onKey = nullptr) {
+  StreamedKeyGen gen(pool, MultiEvalSumKeyShare(cc, secretKey, keyTag),
+                     onKey);
+  for (auto& entry : *leadKeys) {
+    gen.Add(entry.first, entry.second);
+  }
+  return gen.Finish();
+}
+
+#endif  // THRESH_KEYS_H
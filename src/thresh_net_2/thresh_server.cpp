@@ -55,19 +55,49 @@ int main(int argc, char *argv[]) {
   ////////////////////////////////////////////////////////////
   int opt;
   uint32_t port(0);
+  string traceFile("");  // trace events are written here if set
+  string fuseFor("");    // parties that get results fused by the server
+  usint numParties(0);   // parties in the N party ceremony, 0 = off
+  bool combine(false);   // send the parties the sum of the partials
   std::cout << "here debug";
 
-  while ((opt = getopt(argc, argv, "p:h")) != -1) {
+  while ((opt = getopt(argc, argv, "p:t:N:F:Ch")) != -1) {
     switch (opt) {
       case 'p':
         port = atoi(optarg);
         std::cout << "host port " << port << std::endl;
         break;
+      case 't':
+        traceFile = optarg;
+        std::cout << "tracing to " << traceFile << std::endl;
+        break;
+      case 'N':
+        numParties = atoi(optarg);
+        std::cout << "N party ceremony with " << numParties << " parties"
+                  << std::endl;
+        break;
+      case 'F':
+        fuseFor = optarg;
+        std::cout << "fusing results on the server for " << fuseFor
+                  << std::endl;
+        break;
+      case 'C':
+        combine = true;
+        std::cout << "combining partial decryptions on the server"
+                  << std::endl;
+        break;
       case 'h':
       default: /* '?' */
         std::cerr << "Usage: " << std::endl
                   << "arguments:" << std::endl
                   << "  -p port of the server" << std::endl
+                  << "  -t file to write trace events to" << std::endl
+                  << "  -F fuse decryptions on the server for lead, main or"
+                  << " all parties" << std::endl
+                  << "  -N number of parties for thresh2_party clients"
+                  << std::endl
+                  << "  -C send thresh2_party clients the sum of the partial"
+                  << " decryptions instead of each one" << std::endl
                   << "  -h prints this message" << std::endl;
         std::exit(EXIT_FAILURE);
     }
@@ -79,9 +109,22 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  if (!traceFile.empty()) {
+    OpenTrace("server", traceFile, true);
+  }
+
+  bool fuseForLead = (fuseFor == "lead" || fuseFor == "all");
+  bool fuseForMain = (fuseFor == "main" || fuseFor == "all");
+  if (!fuseFor.empty() && !fuseForLead && !fuseForMain) {
+    std::cerr << "-F must be lead, main or all" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
   PROFILELOG("SERVER: Initializing");
 
-  ThreshServer server(port);
+  ThreshServer server(port, numParties);
+  server.EnableFusion(fuseForLead, fuseForMain);
+  server.EnableCombine(combine);
   server.Start();
 
   while (1) {
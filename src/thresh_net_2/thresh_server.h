@@ -1,7 +1,12 @@
 #ifndef THRESH_SERVER_H
 #define THRESH_SERVER_H
 
+#include <future>
+#include <shared_mutex>
+
 #include "thresh_utils.h"
+#include "thresh_graph.h"
+#include "thresh_tree.h"
 
 // based on asio connection objects from olc_net thanks to
 // David Barr, aka javidx9, ©OneLoneCoder 2019, 2020
@@ -10,19 +15,37 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
  public:
   DEBUG_FLAG(false);
 
-  ThreshServer(uint16_t nPort)
+  // nParties > 0 enables the N party ceremony for thresh2_party clients,
+  // the two party Alice/Bob exchange is always available
+  ThreshServer(uint16_t nPort, usint nParties = 0)
       : olc::net::server_interface<ThreshMsgTypes>(nPort),
         A_Rnd1PubKeyRecd(false),
         A_evalMultKeyRecd(false),
         B_Rnd2PublicKeyRecd(false),
         B_evalMultKeyABRecd(false),
         B_evalMultKeyBABRecd(false),
-        A_evalMultFinalRecd(false) {
+        A_evalMultFinalRecd(false),
+        numParties(nParties),
+        partyPubKeys(nParties),
+        partyEvalMultKeys(nParties),
+        partyEvalSumKeys(nParties),
+        multKeyShares(nParties) {
     // initialize CC and data structures.
     DEBUG("[SERVER]: Initialize CC");
     InitializeCC();
   }
 
+  // Fuse decryptions on the server (-F) for the lead (Alice) and/or the main
+  // (Bob) party, see SendClientFusedResults()
+  void EnableFusion(bool forLead, bool forMain) {
+    fuseForLead = forLead;
+    fuseForMain = forMain;
+  }
+
+  // Send the parties the sum of the partial decryptions (-C) instead of
+  // every party's share, see SendClientPartialDecrypts()
+  void EnableCombine(bool combine) { combinePartials = combine; }
+
  protected:
   virtual bool OnClientConnect(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
@@ -43,12 +66,53 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
     std::cout << "Removing client [" << client->GetID() << "]\n";
     // remove client from the data structures
+    auto batch = batches.find(client->GetID());
+    if (batch != batches.end()) {
+      StoreResult(batch->second.handle, CT(), "uploader disconnected");
+      batches.erase(batch);
+    }
+    for (auto it = streamedSumKeys.begin(); it != streamedSumKeys.end();) {
+      if (it->first.first == client->GetID()) {
+        it = streamedSumKeys.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for (auto it = sumKeySource.begin(); it != sumKeySource.end();) {
+      if (it->second == client->GetID()) {
+        it = sumKeySource.erase(it);
+      } else {
+        ++it;
+      }
+    }
   }
 
   // Called when a message arrives
   virtual void OnMessage(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
       olc::net::message<ThreshMsgTypes>& msg) {
+    // trace the handling of each message as a child of the message itself
+    OLC_TRACE_SPAN(ThreshMsgName(static_cast<uint32_t>(msg.header.id)),
+                   msg.header.span_id);
+    // a truncated or malformed body throws while it is read, that only
+    // fails this message
+    try {
+      HandleMessage(client, msg);
+    } catch (const std::exception& e) {
+      std::cout << "[SERVER] bad message "
+                << static_cast<uint32_t>(msg.header.id) << " from ["
+                << client->GetID() << "]: " << e.what() << "\n";
+      olc::net::message<ThreshMsgTypes> nack;
+      nack.header.id = ThreshMsgTypes::NackMessage;
+      nack.header.SubType_ID = static_cast<uint32_t>(msg.header.id);
+      nack << string(e.what());
+      client->Send(nack);
+    }
+  }
+
+  void HandleMessage(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      olc::net::message<ThreshMsgTypes>& msg) {
     switch (msg.header.id) {
       case ThreshMsgTypes::RequestCC:
         std::cout << "[" << client->GetID() << "]: RequestCC\n";
@@ -62,6 +126,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         // Round 2 key generation.
 
         RecvClientAPublicKey(client, msg);
+        PushCeremony();
         {
           // send acknowledgement
           olc::net::message<ThreshMsgTypes> ackMsg;
@@ -77,6 +142,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         // Round 2 key generation
 
         RecvClientAevalMultKey(client, msg);
+        PushCeremony();
         {
           // send acknowledgement
           olc::net::message<ThreshMsgTypes> ackMsg;
@@ -99,6 +165,18 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         }
         break;
 
+      case ThreshMsgTypes::SendEvalSumKeyEntry:
+        DEBUG("[" << client->GetID() << "]: SendEvalSumKeyEntry "
+                  << msg.header.SubType_ID);
+        RecvEvalSumKeyEntry(client, msg);
+        break;
+
+      case ThreshMsgTypes::EndEvalSumKeys:
+        std::cout << "[" << client->GetID() << "]: EndEvalSumKeys "
+                  << msg.header.SubType_ID << "\n";
+        RecvEvalSumKeysEnd(client, msg);
+        break;
+
       case ThreshMsgTypes::SendRnd2SharedKey:
 
         std::cout << "[" << client->GetID() << "]: SendRnd2SharedKey\n";
@@ -106,6 +184,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         // key that the plaintexts will be encrypted with.
 
         RecvClientBPublicKey(client, msg);
+        PushCeremony();
         {
           // send acknowledgement
           olc::net::message<ThreshMsgTypes> ackMsg;
@@ -121,6 +200,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         // client for Round 3 key generation of evalMultFinal
 
         RecvClientBevalMultKeyAB(client, msg);
+        PushCeremony();
         {
           // send acknowledgement
           olc::net::message<ThreshMsgTypes> ackMsg;
@@ -136,6 +216,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         // client for Round 3 key generation of evalMultFinal
 
         RecvClientBevalMultKeyBAB(client, msg);
+        PushCeremony();
         {
           // send acknowledgement
           olc::net::message<ThreshMsgTypes> ackMsg;
@@ -166,6 +247,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         // evaluation key for multiplication on ciphertexts
 
         RecvClientAevalMultFinal(client, msg);
+        PushCeremony();
         {
           // send acknowledgement
           olc::net::message<ThreshMsgTypes> ackMsg;
@@ -174,6 +256,14 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         }
         break;
 
+      case ThreshMsgTypes::JoinCeremony:
+        std::cout << "[" << client->GetID() << "]: JoinCeremony "
+                  << msg.header.SubType_ID << "\n";
+        RecvJoinCeremony(client, msg.header.SubType_ID);
+        break;
+
+      // the Request* messages below are kept for clients that do not join
+      // the ceremony and poll for each key instead
       case ThreshMsgTypes::RequestRnd1PubKey:
         std::cout << "[" << client->GetID() << "]: RequestRnd1PubKey\n";
         SendClientRnd1PubKey(client);  // this queues next task
@@ -186,7 +276,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
 
       case ThreshMsgTypes::RequestRnd1evalSumKeys:
         std::cout << "[" << client->GetID() << "]: RequestRnd1evalSumKeys\n";
-        SendClientRnd1evalSumKeys(client);  // this queues next task
+        SendClientEvalSumKeys(client, Rnd1EvalSumKeys);
         break;
 
       case ThreshMsgTypes::RequestRnd2SharedKey:
@@ -207,7 +297,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
       case ThreshMsgTypes::RequestRnd2EvalSumKeysJoin:
         std::cout << "[" << client->GetID()
                   << "]: RequestRnd2EvalSumKeysJoin\n";
-        SendClientRnd2evalSumKeysJoin(client);  // this queues next task
+        SendClientEvalSumKeys(client, Rnd2EvalSumKeysJoin);
         break;
 
       case ThreshMsgTypes::RequestRnd3EvalMultFinal:
@@ -258,6 +348,17 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         }
         break;
 
+      case ThreshMsgTypes::BeginCTBatch:
+        std::cout << "[" << client->GetID() << "]: BeginCTBatch\n";
+        RecvCTBatchBegin(client, msg);
+        break;
+
+      case ThreshMsgTypes::SendBatchCT:
+        DEBUG("[" << client->GetID() << "]: SendBatchCT "
+                  << msg.header.SubType_ID);
+        RecvBatchCT(client, msg);
+        break;
+
       case ThreshMsgTypes::RequestAddCT:
         std::cout << "[" << client->GetID() << "]: RequestAddCT\n";
         // Compute the addition ciphertext and send it.
@@ -309,6 +410,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         std::cout << "[" << client->GetID() << "]: SendDecryptPartialMainAdd\n";
         // receive ciphertext
         // store it in the ClientB's data structure.
+        if (!FromRole(client, mainID, ThreshMsgTypes::NackPartialMainAdd))
+          break;
         RecvClientPartialMainAddCT(client, msg);
         {
           // send acknowledgement
@@ -322,6 +425,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         std::cout << "[" << client->GetID() << "]: SendDecryptPartialLeadAdd\n";
         // receive ciphertext
         // store it in the ClientA's data structure.
+        if (!FromRole(client, leadID, ThreshMsgTypes::NackPartialLeadAdd))
+          break;
         RecvClientPartialLeadAddCT(client, msg);
         {
           // send acknowledgement
@@ -337,6 +442,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
                   << "]: SendDecryptPartialMainMult\n";
         // receive ciphertext
         // store it in the ClientB's data structure.
+        if (!FromRole(client, mainID, ThreshMsgTypes::NackPartialMainMult))
+          break;
         RecvClientPartialMainMultCT(client, msg);
         {
           // send acknowledgement
@@ -352,6 +459,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
                   << "]: SendDecryptPartialLeadMult\n";
         // receive ciphertext
         // store it in the ClientA's data structure.
+        if (!FromRole(client, leadID, ThreshMsgTypes::NackPartialLeadMult))
+          break;
         RecvClientPartialLeadMultCT(client, msg);
         {
           // send acknowledgement
@@ -366,6 +475,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         std::cout << "[" << client->GetID() << "]: SendDecryptPartialMainSum\n";
         // receive ciphertext
         // store it in the ClientB's data structure.
+        if (!FromRole(client, mainID, ThreshMsgTypes::NackPartialMainSum))
+          break;
         RecvClientPartialMainSumCT(client, msg);
         {
           // send acknowledgement
@@ -380,6 +491,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         std::cout << "[" << client->GetID() << "]: SendDecryptPartialLeadSum\n";
         // receive ciphertext
         // store it in the ClientA's data structure.
+        if (!FromRole(client, leadID, ThreshMsgTypes::NackPartialLeadSum))
+          break;
         RecvClientPartialLeadSumCT(client, msg);
         {
           // send acknowledgement
@@ -389,6 +502,52 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         }
         break;
 
+      case ThreshMsgTypes::RegisterParty:
+        std::cout << "[" << client->GetID() << "]: RegisterParty\n";
+        RegisterParty(client);
+        ScheduleCeremony();
+        break;
+
+      case ThreshMsgTypes::SendKeyGenStep:
+        std::cout << "[" << client->GetID() << "]: SendKeyGenStep\n";
+        RecvKeyGenStep(client, msg);
+        ScheduleCeremony();
+        break;
+
+      case ThreshMsgTypes::SendMultKeyStep:
+        std::cout << "[" << client->GetID() << "]: SendMultKeyStep\n";
+        RecvMultKeyStep(client, msg);
+        ScheduleCeremony();
+        break;
+
+      case ThreshMsgTypes::SendPartialDecrypt:
+        std::cout << "[" << client->GetID() << "]: SendPartialDecrypt "
+                  << msg.header.SubType_ID << "\n";
+        RecvPartialDecrypt(client, msg);
+        break;
+
+      case ThreshMsgTypes::RequestPartialDecrypts:
+        std::cout << "[" << client->GetID() << "]: RequestPartialDecrypts "
+                  << msg.header.SubType_ID << "\n";
+        SendClientPartialDecrypts(client, msg.header.SubType_ID);
+        break;
+
+      case ThreshMsgTypes::RequestFusedResults:
+        std::cout << "[" << client->GetID() << "]: RequestFusedResults\n";
+        SendClientFusedResults(client);
+        break;
+
+      case ThreshMsgTypes::SubmitGraph:
+        std::cout << "[" << client->GetID() << "]: SubmitGraph\n";
+        RecvGraph(client, msg);
+        break;
+
+      case ThreshMsgTypes::RequestResult:
+        DEBUG("[" << client->GetID() << "]: RequestResult "
+                  << msg.header.SubType_ID);
+        SendClientResult(client, msg.header.SubType_ID);
+        break;
+
 	case ThreshMsgTypes::DisconnectClient:
 
 	  std::cout << "[" << client->GetID() << "]: DisconnectClient\n";
@@ -418,6 +577,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
         2,                    /*maxDepth*/
         60,                   /*firstMod*/
         5, OPTIMIZED);
+    graphMaxLevel = init_size - 1;
 
     // enable features that you wish to use
     m_serverCC->Enable(ENCRYPTION);
@@ -488,30 +648,6 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     client->Send(msg);
   }
 
-  void SendClientRnd1evalSumKeys(
-      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
-    std::string s;
-    std::ostringstream os(s);
-    olc::net::message<ThreshMsgTypes> msg;
-
-    if (!A_evalSumKeys) {
-      std::cout << "[SERVER] sending NackRnd1evalSumKeys to ["
-                << client->GetID() << "]:\n";
-      msg.header.id = ThreshMsgTypes::NackRnd1evalSumKeys;
-      client->Send(msg);
-      return;
-    }
-
-    DEBUG("[SERVER]: sending Round 1 EvalSumKeys to [" << client->GetID()
-                                                       << "]:");
-    Serial::Serialize(A_evalSumKeys, os, SerType::BINARY);
-
-    msg.header.id = ThreshMsgTypes::SendRnd1evalSumKeys;
-    msg << os.str();  // push the string onto the message.
-
-    client->Send(msg);
-  }
-
   void SendClientRnd2PubKey(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
     std::string s;
@@ -581,29 +717,6 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     client->Send(msg);
   }
 
-  void SendClientRnd2evalSumKeysJoin(
-      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
-    std::string s;
-    std::ostringstream os(s);
-    olc::net::message<ThreshMsgTypes> msg;
-    if (!B_evalSumKeysJoin) {
-      std::cout << "[SERVER] sending NackRnd2EvalSumKeysJoin to ["
-                << client->GetID() << "]:\n";
-      msg.header.id = ThreshMsgTypes::NackRnd2EvalSumKeysJoin;
-      client->Send(msg);
-      return;
-    }
-
-    DEBUG("[SERVER]: sending Round 2 EvalSumKeysJoin to [" << client->GetID()
-                                                           << "]:");
-    Serial::Serialize(B_evalSumKeysJoin, os, SerType::BINARY);
-
-    msg.header.id = ThreshMsgTypes::SendRnd2EvalSumKeysJoin;
-    msg << os.str();  // push the string onto the message.
-
-    client->Send(msg);
-  }
-
   void SendClientRnd3evalMultFinal(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
     std::string s;
@@ -632,7 +745,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     std::string s;
     std::ostringstream os(s);
     olc::net::message<ThreshMsgTypes> msg;
-    if (!B_CTreceived[num]) {
+    if (B_CTreceived.size() <= size_t(num) || !B_CTreceived[num]) {
       if (num == 0) {
         std::cout << "[SERVER] sending NackCT1 to [" << client->GetID()
                   << "]:\n";
@@ -685,6 +798,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Deserialize");
     Serial::Deserialize(A_Rnd1PublicKey, is, SerType::BINARY);
     A_Rnd1PubKeyRecd = true;
+    // the first connection to send it registers the role
+    if (leadID == 0) leadID = client->GetID();
     DEBUG("[SERVER] Done");
     assert(is.good());
   }
@@ -736,6 +851,205 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     assert(is.good());
   }
 
+  // The clients send the eval sum keys one entry at a time as they make
+  // them (see thresh_keys.h), the map is complete with EndEvalSumKeys. The
+  // entries are kept per sender, the first sender of a set is the one whose
+  // entries are passed on to the parties waiting for that set.
+  void RecvEvalSumKeyEntry(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      olc::net::message<ThreshMsgTypes>& msg) {
+    unsigned int set = msg.header.SubType_ID;
+    usint index;
+    EvalKey key;
+    ReadEvalSumKeyEntry(msg, index, key);
+    streamedSumKeys[{client->GetID(), set}][index] = key;
+    // pass the entry on to the parties waiting for it, the read above has
+    // taken the index off msg
+    auto source = sumKeySource.emplace(set, client->GetID()).first;
+    if (source->second == client->GetID() && sumKeyWaiting.count(set)) {
+      auto entry = EvalSumKeyEntryMsg(EvalSumKeySet(set), index, key);
+      for (auto& waiting : sumKeyWaiting[set]) {
+        waiting->Send(entry);
+      }
+    }
+  }
+
+  void RecvEvalSumKeysEnd(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      olc::net::message<ThreshMsgTypes>& msg) {
+    uint32_t count;
+    if (msg.body.size() != sizeof(count)) {
+      throw std::runtime_error("malformed end of eval sum keys");
+    }
+    msg >> count;
+    unsigned int set = msg.header.SubType_ID;
+    auto stream = streamedSumKeys.find({client->GetID(), set});
+    size_t got = stream == streamedSumKeys.end() ? 0 : stream->second.size();
+    auto keys = std::make_shared<std::map<usint, EvalKey>>();
+    if (stream != streamedSumKeys.end()) {
+      *keys = std::move(stream->second);
+      streamedSumKeys.erase(stream);
+    }
+    bool fromSource = sumKeySource.count(set) &&
+                      sumKeySource[set] == client->GetID();
+    if (fromSource) sumKeySource.erase(set);
+    if (set != Rnd1EvalSumKeys && set != Rnd2EvalSumKeysJoin) {
+      throw std::runtime_error("unknown eval sum key set " +
+                               std::to_string(set));
+    }
+
+    olc::net::message<ThreshMsgTypes> reply;
+    if (got != count) {
+      std::cout << "[SERVER] got " << got << " of " << count
+                << " eval sum keys of set " << set << " from ["
+                << client->GetID() << "]\n";
+      reply.header.id = set == Rnd1EvalSumKeys
+                            ? ThreshMsgTypes::NackRnd1evalSumKeys
+                            : ThreshMsgTypes::NackRnd2EvalSumKeysJoin;
+      client->Send(reply);
+      return;
+    }
+
+    if (fromSource) {
+      for (auto& waiting : sumKeyWaiting[set]) {
+        waiting->Send(EndEvalSumKeysMsg(EvalSumKeySet(set), count));
+      }
+      sumKeyWaiting.erase(set);
+    }
+    if (set == Rnd1EvalSumKeys) {
+      A_evalSumKeys = keys;
+      reply.header.id = ThreshMsgTypes::AckRnd1evalSumKeys;
+    } else {
+      B_evalSumKeysJoin = keys;
+      sumKeyVersion++;
+      reply.header.id = ThreshMsgTypes::AckRnd2EvalSumKeysJoin;
+    }
+    client->Send(reply);
+  }
+
+  // The eval sum keys go to the other party one entry at a time too. If
+  // they are still arriving, the party gets the entries that are there and
+  // then each further entry as soon as the server has it, so the party can
+  // start on them while the rest are being made.
+  void SendClientEvalSumKeys(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      EvalSumKeySet set) {
+    auto& keys = set == Rnd1EvalSumKeys ? A_evalSumKeys : B_evalSumKeysJoin;
+    if (keys) {
+      DEBUG("[SERVER]: sending " << keys->size() << " eval sum keys to ["
+                                 << client->GetID() << "]:");
+      for (auto& entry : *keys) {
+        client->Send(EvalSumKeyEntryMsg(set, entry.first, entry.second));
+      }
+      client->Send(EndEvalSumKeysMsg(set, keys->size()));
+      return;
+    }
+
+    DEBUG("[SERVER]: streaming eval sum keys to [" << client->GetID()
+                                                   << "]:");
+    auto source = sumKeySource.find(set);
+    if (source != sumKeySource.end()) {
+      for (auto& entry : streamedSumKeys[{source->second, set}]) {
+        client->Send(EvalSumKeyEntryMsg(set, entry.first, entry.second));
+      }
+    }
+    sumKeyWaiting[set].push_back(client);
+  }
+
+  // A party that joins the ceremony is sent each key it needs as soon as
+  // the server has it, instead of asking for it until it is there
+  void RecvJoinCeremony(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      unsigned int role) {
+    if (role != CeremonyLead && role != CeremonyMain) {
+      std::cout << "[SERVER] unknown ceremony role " << role << " from ["
+                << client->GetID() << "]\n";
+      return;
+    }
+    ceremony[role].client = client;
+    ceremony[role].pushed.clear();
+    // the eval sum keys stream on their own, entry by entry
+    SendClientEvalSumKeys(client, role == CeremonyMain ? Rnd1EvalSumKeys
+                                                       : Rnd2EvalSumKeysJoin);
+    PushCeremony();
+  }
+
+  bool CeremonyReady(CeremonyArtifact artifact) const {
+    switch (artifact) {
+      case CeremonyRnd1PubKey:
+        return A_Rnd1PubKeyRecd;
+      case CeremonyRnd1EvalMultKey:
+        return A_evalMultKeyRecd;
+      case CeremonyRnd2SharedKey:
+        return B_Rnd2PublicKeyRecd;
+      case CeremonyRnd2EvalMultAB:
+        return B_evalMultKeyABRecd;
+      case CeremonyRnd2EvalMultBAB:
+        return B_evalMultKeyBABRecd;
+      case CeremonyRnd3EvalMultFinal:
+        return A_evalMultFinalRecd;
+    }
+    return false;
+  }
+
+  void AppendCeremonyKey(olc::net::message<ThreshMsgTypes>& msg,
+                         CeremonyArtifact artifact) const {
+    switch (artifact) {
+      case CeremonyRnd1PubKey:
+        AppendSerial(msg, A_Rnd1PublicKey);
+        break;
+      case CeremonyRnd1EvalMultKey:
+        AppendSerial(msg, A_evalMultKey);
+        break;
+      case CeremonyRnd2SharedKey:
+        AppendSerial(msg, B_Rnd2PublicKey);
+        break;
+      case CeremonyRnd2EvalMultAB:
+        AppendSerial(msg, B_evalMultKeyAB);
+        break;
+      case CeremonyRnd2EvalMultBAB:
+        AppendSerial(msg, B_evalMultKeyBAB);
+        break;
+      case CeremonyRnd3EvalMultFinal:
+        AppendSerial(msg, A_evalMultFinal);
+        break;
+    }
+  }
+
+  // Send every party the keys it needs that are there and that it does not
+  // have yet, keys that became ready together go in one PushKeys message.
+  // Called whenever a party joins or a key arrives.
+  void PushCeremony(void) {
+    static const std::map<unsigned int, vector<CeremonyArtifact>> needs{
+        {CeremonyLead,
+         {CeremonyRnd2SharedKey, CeremonyRnd2EvalMultAB,
+          CeremonyRnd2EvalMultBAB}},
+        {CeremonyMain,
+         {CeremonyRnd1PubKey, CeremonyRnd1EvalMultKey,
+          CeremonyRnd3EvalMultFinal}},
+    };
+    for (auto& party : ceremony) {
+      if (!party.second.client) continue;
+      vector<uint32_t> ready;
+      for (auto artifact : needs.at(party.first)) {
+        if (CeremonyReady(artifact) && !party.second.pushed.count(artifact))
+          ready.push_back(artifact);
+      }
+      if (ready.empty()) continue;
+
+      olc::net::message<ThreshMsgTypes> msg;
+      msg.header.id = ThreshMsgTypes::PushKeys;
+      AppendRaw(msg, ready);
+      for (auto artifact : ready) {
+        AppendCeremonyKey(msg, CeremonyArtifact(artifact));
+        party.second.pushed.insert(artifact);
+      }
+      DEBUG("[SERVER]: pushing " << ready.size() << " ceremony keys to ["
+                                 << party.second.client->GetID() << "]");
+      party.second.client->Send(msg);
+    }
+  }
+
   void RecvClientBPublicKey(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
       olc::net::message<ThreshMsgTypes>& msg) {
@@ -756,6 +1070,8 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Deserialize");
     Serial::Deserialize(B_Rnd2PublicKey, is, SerType::BINARY);
     B_Rnd2PublicKeyRecd = true;
+    // the first connection to send it registers the role
+    if (mainID == 0) mainID = client->GetID();
     DEBUG("[SERVER] Done");
     assert(is.good());
   }
@@ -827,6 +1143,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     // NOTE Deserialize needs a basic_istream<char>
     DEBUG("[SERVER] Deserialize");
     Serial::Deserialize(B_evalSumKeysJoin, is, SerType::BINARY);
+    sumKeyVersion++;
     DEBUG("[SERVER] Done");
     assert(is.good());
   }
@@ -851,6 +1168,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Deserialize");
     Serial::Deserialize(A_evalMultFinal, is, SerType::BINARY);
     A_evalMultFinalRecd = true;
+    multKeyVersion++;
     DEBUG("[SERVER] Done");
     assert(is.good());
   }
@@ -877,11 +1195,110 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
 
     Serial::Deserialize(ct, is, SerType::BINARY);
 
-    B_CipherTexts.push_back(ct);
-
     DEBUG("[SERVER] Done");
     assert(is.good());
+    StoreCT(ct);
+  }
+
+  // every uploaded ciphertext, its handle in graphs is its position
+  void StoreCT(const CT& ct) {
+    B_CipherTexts.push_back(ct);
     B_CTreceived.push_back(true);
+    ctVersion++;
+  }
+
+  // Streamed upload
+  //
+  // BeginCTBatch announces how many ciphertexts follow and the result handle
+  // for their sum, then each arrives as SendBatchCT tagged with its sequence
+  // number (in any order). The server adds every ciphertext to a running
+  // EvalAdd aggregate as it lands, so the sum is ready as soon as the last
+  // one is in, and answers a single AckCTBatch. Each connection has at most
+  // one batch in progress. Only the sum is kept, under the handle, where
+  // graphs can use it as an input.
+
+  void RecvCTBatchBegin(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      olc::net::message<ThreshMsgTypes>& msg) {
+    uint32_t count = 0, handle = 0;
+    // >> does not check the size of the body
+    if (msg.body.size() != sizeof(handle) + sizeof(count)) {
+      throw std::runtime_error("malformed batch header");
+    }
+    msg >> handle >> count;
+
+    bool ok = count > 0 && count <= kMaxBatchCTs &&
+              handle >= kFirstResultHandle && !batches.count(client->GetID());
+    if (ok) {
+      std::scoped_lock lock(m_storeMutex);
+      ok = !resultStore.count(handle);
+      if (ok) resultStore[handle];  // pending until the last ciphertext
+    }
+    if (!ok) {
+      std::cout << "[SERVER] rejecting batch of " << count << " for handle "
+                << handle << " from [" << client->GetID() << "]\n";
+      olc::net::message<ThreshMsgTypes> nackMsg;
+      nackMsg.header.id = ThreshMsgTypes::NackCTBatch;
+      nackMsg.header.SubType_ID = handle;
+      client->Send(nackMsg);
+      return;
+    }
+    CTBatch& batch = batches[client->GetID()];
+    batch.expected = count;
+    batch.handle = handle;
+    batch.seen.assign(count, false);
+    TIC(batch.timer);
+  }
+
+  void RecvBatchCT(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      olc::net::message<ThreshMsgTypes>& msg) {
+    unsigned int seq = msg.header.SubType_ID;
+    auto it = batches.find(client->GetID());
+    if (it == batches.end() || seq >= it->second.seen.size() ||
+        it->second.seen[seq]) {
+      std::cout << "[SERVER] unexpected batch ciphertext " << seq << " from ["
+                << client->GetID() << "]\n";
+      olc::net::message<ThreshMsgTypes> nackMsg;
+      nackMsg.header.id = ThreshMsgTypes::NackCTBatch;
+      nackMsg.header.SubType_ID = seq;
+      client->Send(nackMsg);
+      return;
+    }
+    CTBatch& batch = it->second;
+    try {
+      CT ct;
+      SerialReader reader(msg);
+      reader.Next(ct);
+      batch.sum = batch.sum ? m_serverCC->EvalAdd(batch.sum, ct) : ct;
+    } catch (const std::exception& e) {
+      // the sum cannot be completed, fail the whole batch
+      std::cout << "[SERVER] bad batch ciphertext " << seq << " from ["
+                << client->GetID() << "]: " << e.what() << "\n";
+      StoreResult(batch.handle, CT(),
+                  "batch ciphertext " + std::to_string(seq) + ": " + e.what());
+      batches.erase(it);
+      olc::net::message<ThreshMsgTypes> nackMsg;
+      nackMsg.header.id = ThreshMsgTypes::NackCTBatch;
+      nackMsg.header.SubType_ID = seq;
+      client->Send(nackMsg);
+      return;
+    }
+    batch.seen[seq] = true;
+
+    if (++batch.recd == batch.expected) {
+      PROFILELOG("[SERVER] batch of " << batch.expected
+                                      << " ciphertexts summed, elapsed time "
+                                      << TOC_MS(batch.timer) << "msec.");
+      StoreResult(batch.handle, batch.sum, "");
+
+      olc::net::message<ThreshMsgTypes> ackMsg;
+      ackMsg.header.id = ThreshMsgTypes::AckCTBatch;
+      ackMsg.header.SubType_ID = batch.handle;
+      ackMsg << batch.recd;
+      batches.erase(it);
+      client->Send(ackMsg);
+    }
   }
 
   CT EvaluateAddCiphertext(
@@ -889,18 +1306,18 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     CT ciphertextAdd12;
     CT ciphertextAdd123;
     olc::net::message<ThreshMsgTypes> msg;
-    if (!B_CTreceived[0]) {
+    if (B_CTreceived.size() < 1 || !B_CTreceived[0]) {
       std::cout << "[SERVER] sending NackCT1 to [" << client->GetID() << "]:\n";
       msg.header.id = ThreshMsgTypes::NackCT1;
       client->Send(msg);
       return ciphertextAdd123;
-    } else if (!B_CTreceived[1]) {
+    } else if (B_CTreceived.size() < 2 || !B_CTreceived[1]) {
       std::cout << "[SERVER] sending NackCT2 to [" << client->GetID() << "]:\n";
       msg.header.id = ThreshMsgTypes::NackCT2;
       client->Send(msg);
       return ciphertextAdd123;
 
-    } else if (!B_CTreceived[2]) {
+    } else if (B_CTreceived.size() < 3 || !B_CTreceived[2]) {
       std::cout << "[SERVER] sending NackCT3 to [" << client->GetID() << "]:\n";
       msg.header.id = ThreshMsgTypes::NackCT3;
       client->Send(msg);
@@ -914,9 +1331,42 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     return ciphertextAdd123;
   }
 
+  // the context keeps the keys, only insert them again if they changed.
+  // Running graphs read the keys on m_pool, so they are replaced under an
+  // exclusive m_evalKeyMutex.
+  void InsertMultKeyIfChanged(void) {
+    if (A_evalMultFinalRecd && insertedMultKeyVersion != multKeyVersion) {
+      std::unique_lock lock(m_evalKeyMutex);
+      m_serverCC->InsertEvalMultKey({ThreshServer::A_evalMultFinal});
+      insertedMultKeyVersion = multKeyVersion;
+    }
+  }
+
+  void InsertSumKeyIfChanged(void) {
+    if (B_evalSumKeysJoin && insertedSumKeyVersion != sumKeyVersion) {
+      std::unique_lock lock(m_evalKeyMutex);
+      m_serverCC->InsertEvalSumKey(B_evalSumKeysJoin);
+      insertedSumKeyVersion = sumKeyVersion;
+    }
+  }
+
+  // the sum keys double as rotation keys for EvalAtIndex
+  void InsertRotationKeysIfChanged(void) {
+    if (B_evalSumKeysJoin && insertedRotKeyVersion != sumKeyVersion) {
+      std::unique_lock lock(m_evalKeyMutex);
+      CryptoContextImpl<DCRTPoly>::InsertEvalAutomorphismKey(
+          B_evalSumKeysJoin);
+      insertedRotKeyVersion = sumKeyVersion;
+    }
+  }
+
   CT EvaluateMultCiphertext(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
-    m_serverCC->InsertEvalMultKey({ThreshServer::A_evalMultFinal});
+    // the ciphertexts and the joint mult key may not have arrived yet
+    if (B_CipherTexts.size() < 3 || !A_evalMultFinalRecd) {
+      return CT();
+    }
+    InsertMultKeyIfChanged();
 
     auto ciphertextMultTemp =
         m_serverCC->EvalMult(B_CipherTexts[0], B_CipherTexts[2]);
@@ -930,23 +1380,23 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
   void SendClientAddCT(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
     olc::net::message<ThreshMsgTypes> msg;
-    // if the PrivateKey does not yet exist, send a Nack
-
-    EvalAddCT = EvaluateAddCiphertext(client);
-    if (!EvalAddCTDone) {
-      std::cout << "[SERVER] sending NackAddCT to [" << client->GetID()
-                << "]:\n";
-      msg.header.id = ThreshMsgTypes::NackAddCT;
-      client->Send(msg);
-      return;
+    // evaluate only if the inputs changed since the cached result
+    if (!EvalAddResult.IsCurrent(ctVersion, 0)) {
+      EvalAddCT = EvaluateAddCiphertext(client);
+      // if the inputs do not yet exist, send a Nack
+      if (!EvalAddCTDone) {
+        std::cout << "[SERVER] sending NackAddCT to [" << client->GetID()
+                  << "]:\n";
+        msg.header.id = ThreshMsgTypes::NackAddCT;
+        client->Send(msg);
+        return;
+      }
+      EvalAddResult.Store(EvalAddCT, ctVersion, 0);
     }
-    std::string s;
-    std::ostringstream os(s);
-    DEBUG("[SERVER]: sending eval add CT to [" << client->GetID() << "]:");
-    Serial::Serialize(EvalAddCT, os, SerType::BINARY);
 
+    DEBUG("[SERVER]: sending eval add CT to [" << client->GetID() << "]:");
     msg.header.id = ThreshMsgTypes::SendAddCT;
-    msg << os.str();  // push the string onto the message.
+    msg << EvalAddResult.bytes;  // push the cached bytes onto the message.
     DEBUG("[SERVER]: msg.size() " << msg.size());
     DEBUG("[SERVER]: msg.body.size() " << msg.body.size());
     client->Send(msg);
@@ -955,23 +1405,23 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
   void SendClientMultCT(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
     olc::net::message<ThreshMsgTypes> msg;
-    // if the PrivateKey does not yet exist, send a Nack
-    EvalMultCT = EvaluateMultCiphertext(client);
-    if (!EvalMultCTDone) {
-      std::cout << "[SERVER] sending NackMultCT to [" << client->GetID()
-                << "]:\n";
-      msg.header.id = ThreshMsgTypes::NackMultCT;
-      client->Send(msg);
-      return;
+    // evaluate only if the inputs changed since the cached result
+    if (!EvalMultResult.IsCurrent(ctVersion, multKeyVersion)) {
+      EvalMultCT = EvaluateMultCiphertext(client);
+      // if the inputs do not yet exist, send a Nack
+      if (!EvalMultCTDone) {
+        std::cout << "[SERVER] sending NackMultCT to [" << client->GetID()
+                  << "]:\n";
+        msg.header.id = ThreshMsgTypes::NackMultCT;
+        client->Send(msg);
+        return;
+      }
+      EvalMultResult.Store(EvalMultCT, ctVersion, multKeyVersion);
     }
 
-    std::string s;
-    std::ostringstream os(s);
     DEBUG("[SERVER]: sending eval mult CT to [" << client->GetID() << "]:");
-    Serial::Serialize(EvalMultCT, os, SerType::BINARY);
-
     msg.header.id = ThreshMsgTypes::SendMultCT;
-    msg << os.str();  // push the string onto the message.
+    msg << EvalMultResult.bytes;  // push the cached bytes onto the message.
     DEBUG("[SERVER]: msg.size() " << msg.size());
     DEBUG("[SERVER]: msg.body.size() " << msg.body.size());
     client->Send(msg);
@@ -979,7 +1429,11 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
 
   CT EvaluateSumCiphertext(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
-    m_serverCC->InsertEvalSumKey(B_evalSumKeysJoin);
+    // the ciphertexts and the joint sum keys may not have arrived yet
+    if (B_CipherTexts.size() < 3 || !B_evalSumKeysJoin) {
+      return CT();
+    }
+    InsertSumKeyIfChanged();
 
     // compute ciphertextSum[0] = ciphertext3[0]+...+ciphertext[batchsize-1]
     // compute ciphertextSum[1] = ciphertext3[1]+...+ciphertext3[batchsize] and
@@ -993,27 +1447,28 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
   void SendClientSumCT(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
     olc::net::message<ThreshMsgTypes> msg;
-    // if the PrivateKey does not yet exist, send a Nack
-    EvalSumCT = EvaluateSumCiphertext(client);
-    if (!EvalSumCTDone) {
-      std::cout << "[SERVER] sending NackSumCT to [" << client->GetID()
-                << "]:\n";
-      msg.header.id = ThreshMsgTypes::NackSumCT;
-      client->Send(msg);
-      return;
+    // evaluate only if the inputs changed since the cached result
+    if (!EvalSumResult.IsCurrent(ctVersion, sumKeyVersion)) {
+      EvalSumCT = EvaluateSumCiphertext(client);
+      // if the inputs do not yet exist, send a Nack
+      if (!EvalSumCTDone) {
+        std::cout << "[SERVER] sending NackSumCT to [" << client->GetID()
+                  << "]:\n";
+        msg.header.id = ThreshMsgTypes::NackSumCT;
+        client->Send(msg);
+        return;
+      }
+      EvalSumResult.Store(EvalSumCT, ctVersion, sumKeyVersion);
     }
 
-    std::string s;
-    std::ostringstream os(s);
     DEBUG("[SERVER]: sending eval sum CT to [" << client->GetID() << "]:");
-    Serial::Serialize(EvalSumCT, os, SerType::BINARY);
-
     msg.header.id = ThreshMsgTypes::SendSumCT;
-    msg << os.str();  // push the string onto the message.
+    msg << EvalSumResult.bytes;  // push the cached bytes onto the message.
     DEBUG("[SERVER]: msg.size() " << msg.size());
     DEBUG("[SERVER]: msg.body.size() " << msg.body.size());
     client->Send(msg);
   }
+
   void SendClientDecryptMainMult(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
     olc::net::message<ThreshMsgTypes> msg;
@@ -1164,6 +1619,19 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     client->Send(msg);
   }
 
+  // Partial decryptions are only taken from the connection registered for
+  // their role, anybody else is sent nack and the share is dropped
+  bool FromRole(std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+                uint32_t roleID, ThreshMsgTypes nack) {
+    if (roleID != 0 && client->GetID() == roleID) return true;
+    std::cout << "[SERVER] [" << client->GetID()
+              << "] does not hold the role of its partial decryption\n";
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.id = nack;
+    client->Send(msg);
+    return false;
+  }
+
   void RecvClientPartialMainAddCT(
       std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
       olc::net::message<ThreshMsgTypes>& msg) {
@@ -1188,6 +1656,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_MainAddRecd = true;
+    fusedResults.clear();
   }
 
   void RecvClientPartialMainMultCT(
@@ -1213,6 +1682,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_MainMultRecd = true;
+    fusedResults.clear();
   }
 
   void RecvClientPartialMainSumCT(
@@ -1238,6 +1708,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_MainSumRecd = true;
+    fusedResults.clear();
   }
 
   void RecvClientPartialLeadAddCT(
@@ -1264,6 +1735,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_LeadAddRecd = true;
+    fusedResults.clear();
   }
 
   void RecvClientPartialLeadMultCT(
@@ -1289,6 +1761,7 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_LeadMultRecd = true;
+    fusedResults.clear();
   }
 
   void RecvClientPartialLeadSumCT(
@@ -1314,6 +1787,489 @@ class ThreshServer : public olc::net::server_interface<ThreshMsgTypes> {
     DEBUG("[SERVER] Done");
     assert(is.good());
     Partial_LeadSumRecd = true;
+    fusedResults.clear();
+  }
+
+  // N party ceremony
+  //
+  // Parties are numbered in the order they register. Party 0 generates the
+  // first key pair, eval mult key and eval sum keys. Every other party
+  // generates its own key pair and its shares of the mult key
+  // (MultiKeySwitchGen) and of the sum keys (MultiEvalSumKeyGen) from party
+  // 0's outputs alone, so all of them run at the same time (a star rather
+  // than a chain). The server adds the contributions of all parties into
+  // the joint public key, eval mult key and eval sum keys. Every party then
+  // multiplies the joint eval mult key by its secret (MultiMultEvalKey) and
+  // the server adds the N results into the final eval mult key.
+  //
+  // All of the additions are associative, so the server combines them as a
+  // balanced tree on a thread pool (TreeReduce), which takes log N rounds.
+  // The partial decryptions of all parties are summed the same way, so each
+  // party only has to fuse a single share.
+  //
+  // The server holds no secrets, it only relays and adds the contributions
+  // and sends each step the moment its inputs exist.
+
+  void RegisterParty(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
+    olc::net::message<ThreshMsgTypes> msg;
+    if (client->GetUserData<usint>()) {
+      return;  // already registered
+    }
+    if (parties.size() >= numParties) {
+      std::cout << "[SERVER] sending RejectParty to [" << client->GetID()
+                << "]: " << numParties << " parties expected\n";
+      msg.header.id = ThreshMsgTypes::RejectParty;
+      client->Send(msg);
+      return;
+    }
+    usint index = parties.size();
+    client->SetUserData(index);  // see PartyOf()
+    parties.push_back(client);
+    std::cout << "[SERVER] party " << index << " of " << numParties << " is ["
+              << client->GetID() << "]\n";
+
+    // popped by the client in reverse order
+    msg.header.id = ThreshMsgTypes::AssignParty;
+    msg << numParties << index;
+    client->Send(msg);
+  }
+
+  // Send every step whose inputs now exist. Called whenever a party
+  // registers or returns the output of a step.
+  void ScheduleCeremony(void) {
+    // party 0 starts as soon as it registers, everybody else as soon as
+    // party 0's keys are in and they have registered
+    while (keyGenDispatched < parties.size() &&
+           (keyGenDispatched == 0 || partyPubKeys[0])) {
+      usint index = keyGenDispatched++;
+      olc::net::message<ThreshMsgTypes> msg;
+      msg.header.id = ThreshMsgTypes::RunKeyGenStep;
+      msg.header.SubType_ID = index;
+      if (index > 0) {
+        if (leadKeysMsg.body.empty()) {
+          AppendSerial(leadKeysMsg, partyPubKeys[0]);
+          AppendSerial(leadKeysMsg, partyEvalMultKeys[0]);
+          AppendSerial(leadKeysMsg, partyEvalSumKeys[0]);
+        }
+        msg.body = leadKeysMsg.body;
+        msg.header.size = msg.size();
+      }
+      DEBUG("[SERVER]: sending RunKeyGenStep to party " << index);
+      parties[index]->Send(msg);
+    }
+
+    // once every party has contributed, add up the joint keys and ask
+    // every party for its share of the mult key
+    if (numParties > 0 && !multKeyDispatched &&
+        keyGenRecd == numParties) {
+      CombineJointKeys();
+      multKeyDispatched = true;
+      olc::net::message<ThreshMsgTypes> msg;
+      msg.header.id = ThreshMsgTypes::RunMultKeyStep;
+      AppendSerial(msg, jointPubKey);
+      AppendSerial(msg, jointEvalMultKey);
+      for (auto& party : parties) {
+        party->Send(msg);
+      }
+    }
+
+    if (!ceremonyDone && numParties > 0 && multKeySharesRecd == numParties) {
+      TimeVar t;
+      TIC(t);
+      std::string keyTag = jointPubKey->GetKeyTag();
+      EvalKey evalMultFinal = TreeReduce(
+          m_pool, multKeyShares, [&](const EvalKey& a, const EvalKey& b) {
+            return m_serverCC->MultiAddEvalMultKeys(a, b, keyTag);
+          });
+      PROFILELOG("[SERVER] combined " << numParties
+                                      << " mult key shares, elapsed time "
+                                      << TOC_MS(t) << "msec.");
+
+      // the joint keys take the place of the two party keys, so the
+      // evaluation code below is shared by both ceremonies
+      A_evalMultFinal = evalMultFinal;
+      A_evalMultFinalRecd = true;
+      B_evalSumKeysJoin = jointEvalSumKeys;
+      multKeyVersion++;
+      sumKeyVersion++;
+      ceremonyDone = true;
+
+      olc::net::message<ThreshMsgTypes> msg;
+      msg.header.id = ThreshMsgTypes::CeremonyComplete;
+      for (auto& party : parties) {
+        party->Send(msg);
+      }
+      std::cout << "[SERVER] key ceremony of " << numParties
+                << " parties complete\n";
+    }
+  }
+
+  // Add the public keys, eval mult keys and eval sum keys of all parties
+  void CombineJointKeys(void) {
+    TimeVar t;
+    TIC(t);
+    // all public keys share party 0's "a", the joint "b" is the sum of the
+    // parties' "b"
+    jointPubKey = TreeReduce(
+        m_pool, partyPubKeys, [](const PublicKey& a, const PublicKey& b) {
+          auto sum = std::make_shared<LPPublicKeyImpl<DCRTPoly>>(*a);
+          sum->SetPublicElementAtIndex(
+              0, a->GetPublicElements()[0] + b->GetPublicElements()[0]);
+          return PublicKey(sum);
+        });
+    std::string keyTag = partyPubKeys[0]->GetKeyTag() + "-joint";
+    jointPubKey->SetKeyTag(keyTag);
+
+    jointEvalMultKey = TreeReduce(
+        m_pool, partyEvalMultKeys, [&](const EvalKey& a, const EvalKey& b) {
+          return m_serverCC->MultiAddEvalKeys(a, b, keyTag);
+        });
+
+    using EvalKeyMap = std::shared_ptr<std::map<usint, EvalKey>>;
+    jointEvalSumKeys =
+        TreeReduce(m_pool, partyEvalSumKeys,
+                   [&](const EvalKeyMap& a, const EvalKeyMap& b) {
+                     return m_serverCC->MultiAddEvalSumKeys(a, b, keyTag);
+                   });
+    PROFILELOG("[SERVER] combined joint keys of " << numParties
+                                                  << " parties, elapsed time "
+                                                  << TOC_MS(t) << "msec.");
+  }
+
+  // returns the party index of the client, or numParties if it never
+  // registered
+  usint PartyOf(std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
+    auto index = client->GetUserData<usint>();
+    return index ? *index : numParties;
+  }
+
+  void RecvKeyGenStep(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      olc::net::message<ThreshMsgTypes>& msg) {
+    usint index = PartyOf(client);
+    if (index >= keyGenDispatched || partyPubKeys[index]) {
+      std::cout << "[SERVER] unexpected key generation step from ["
+                << client->GetID() << "]\n";
+      return;
+    }
+    DEBUG("[SERVER] read key generation step of " << msg.body.size()
+                                                  << " bytes");
+    SerialReader reader(msg);
+    reader.Next(partyPubKeys[index]);
+    reader.Next(partyEvalMultKeys[index]);
+    reader.Next(partyEvalSumKeys[index]);
+    keyGenRecd++;
+
+    olc::net::message<ThreshMsgTypes> ackMsg;
+    ackMsg.header.id = ThreshMsgTypes::AckKeyGenStep;
+    client->Send(ackMsg);
+  }
+
+  void RecvMultKeyStep(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      olc::net::message<ThreshMsgTypes>& msg) {
+    usint index = PartyOf(client);
+    if (index >= numParties || !multKeyDispatched || multKeyShares[index]) {
+      std::cout << "[SERVER] unexpected mult key step from ["
+                << client->GetID() << "]\n";
+      return;
+    }
+    SerialReader reader(msg);
+    reader.Next(multKeyShares[index]);
+    multKeySharesRecd++;
+
+    olc::net::message<ThreshMsgTypes> ackMsg;
+    ackMsg.header.id = ThreshMsgTypes::AckMultKeyStep;
+    client->Send(ackMsg);
+  }
+
+  void RecvPartialDecrypt(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      olc::net::message<ThreshMsgTypes>& msg) {
+    usint index = PartyOf(client);
+    unsigned int kind = msg.header.SubType_ID;
+    if (index >= numParties || (kind > PartialSum && !ResultReady(kind))) {
+      std::cout << "[SERVER] unexpected partial decryption from ["
+                << client->GetID() << "]\n";
+      return;
+    }
+    auto& partials = partialDecrypts[kind];
+    partials.resize(numParties);
+    SerialReader reader(msg);
+    reader.Next(partials[index]);
+    partialVersion++;
+
+    olc::net::message<ThreshMsgTypes> ackMsg;
+    ackMsg.header.id = ThreshMsgTypes::AckPartialDecrypt;
+    ackMsg.header.SubType_ID = kind;
+    client->Send(ackMsg);
+  }
+
+  // Sends the partial decryptions of all parties, lead first. With -C the
+  // server sends their sum instead: fusion only adds up the shares before
+  // decoding, so the sum is all a party needs. The sum is kept until a
+  // share or a ciphertext changes.
+  void SendClientPartialDecrypts(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      unsigned int kind) {
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.SubType_ID = kind;
+    auto& partials = partialDecrypts[kind];
+    bool complete = numParties > 0 && partials.size() == numParties;
+    for (auto& ct : partials) {
+      complete = complete && ct;
+    }
+    if (!complete) {
+      DEBUG("[SERVER] sending NackPartialDecrypts to [" << client->GetID()
+                                                        << "]");
+      msg.header.id = ThreshMsgTypes::NackPartialDecrypts;
+      client->Send(msg);
+      return;
+    }
+
+    msg.header.id = ThreshMsgTypes::SendPartialDecrypts;
+    if (!combinePartials) {
+      for (auto& ct : partials) {
+        AppendSerial(msg, ct);
+      }
+      DEBUG("[SERVER]: msg.body.size() " << msg.body.size());
+      client->Send(msg);
+      return;
+    }
+
+    CachedResult& combined = combinedDecrypts[kind];
+    if (!combined.IsCurrent(ctVersion, partialVersion)) {
+      TimeVar t;
+      TIC(t);
+      CT total = TreeReduce(m_pool, partials, [](const CT& a, const CT& b) {
+        CT sum = a->Clone();
+        auto elements = a->GetElements();
+        const auto& others = b->GetElements();
+        for (size_t i = 0; i < elements.size() && i < others.size(); i++) {
+          elements[i] += others[i];
+        }
+        sum->SetElements(elements);
+        return sum;
+      });
+      combined.Store(total, ctVersion, partialVersion);
+      PROFILELOG("[SERVER] combined " << numParties
+                                      << " partial decryptions, elapsed time "
+                                      << TOC_MS(t) << "msec.");
+    }
+    // the framing of AppendSerial() around the cached bytes
+    uint64_t len = combined.bytes.size();
+    msg << len;
+    msg << combined.bytes;
+    DEBUG("[SERVER]: msg.body.size() " << msg.body.size());
+    client->Send(msg);
+  }
+
+  // Server side fusion (-F)
+  //
+  // Rather than fetching each other's partial decryptions and fusing every
+  // result locally, a party can ask the server for all results at once. The
+  // server fuses the add, mult and sum results in parallel the first time an
+  // authorized party asks and returns the plaintext values. Only the parties
+  // enabled with EnableFusion() get them, the server tells everybody else to
+  // fuse locally.
+
+  void SendClientFusedResults(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client) {
+    olc::net::message<ThreshMsgTypes> msg;
+    // a party's role is known once it has sent its public key
+    bool authorized =
+        (fuseForLead && leadID != 0 && client->GetID() == leadID) ||
+        (fuseForMain && mainID != 0 && client->GetID() == mainID);
+    if (!authorized) {
+      std::cout << "[SERVER] sending DenyFusedResults to [" << client->GetID()
+                << "]:\n";
+      msg.header.id = ThreshMsgTypes::DenyFusedResults;
+      client->Send(msg);
+      return;
+    }
+    if (!(Partial_LeadAddRecd && Partial_MainAddRecd && Partial_LeadMultRecd &&
+          Partial_MainMultRecd && Partial_LeadSumRecd && Partial_MainSumRecd)) {
+      DEBUG("[SERVER] sending NackFusedResults to [" << client->GetID()
+                                                     << "]:");
+      msg.header.id = ThreshMsgTypes::NackFusedResults;
+      client->Send(msg);
+      return;
+    }
+
+    if (fusedResults.empty()) {
+      FuseResults();
+    }
+    msg.header.id = ThreshMsgTypes::SendFusedResults;
+    for (auto& values : fusedResults) {
+      AppendValues(msg, values);  // add, mult, sum
+    }
+    DEBUG("[SERVER]: msg.body.size() " << msg.body.size());
+    client->Send(msg);
+  }
+
+  // fuse the batch of results, one task per result
+  void FuseResults(void) {
+    TimeVar t;
+    TIC(t);
+    vector<vector<CT>> batch = {{Partial_LeadAdd, Partial_MainAdd},
+                                {Partial_LeadMult, Partial_MainMult},
+                                {Partial_LeadSum, Partial_MainSum}};
+    vector<std::future<vector<double>>> fused;
+    for (auto& partials : batch) {
+      fused.push_back(std::async(std::launch::async, [this, &partials] {
+        PT plaintext;
+        m_serverCC->MultipartyDecryptFusion(partials, &plaintext);
+        return plaintext->GetRealPackedValue();
+      }));
+    }
+    for (auto& result : fused) {
+      fusedResults.push_back(result.get());
+    }
+    PROFILELOG("[SERVER] fused " << batch.size() << " results, elapsed time "
+                                 << TOC_MS(t) << "msec.");
+  }
+
+  // Computation graphs
+  //
+  // A client submits a ComputeGraph over the uploaded ciphertexts (handle i
+  // is the i-th ciphertext received) and the results of earlier graphs. The
+  // server validates it, answers AckSubmitGraph or RejectGraph right away and
+  // runs it on m_pool, so the message loop is free while it computes. The
+  // outputs go to resultStore, any party can fetch them with RequestResult
+  // and decrypt them with the N party decryption using the handle as kind.
+
+  void RecvGraph(std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+                 olc::net::message<ThreshMsgTypes>& msg) {
+    ComputeGraph graph;
+    string error;
+    try {
+      graph.ReadFrom(msg);
+    } catch (const std::exception& e) {
+      error = e.what();
+    }
+
+    GraphKeys keys;
+    keys.multKey = A_evalMultFinalRecd;
+    keys.sumKeys = B_evalSumKeysJoin != nullptr;
+    if (B_evalSumKeysJoin) {
+      for (auto& entry : *B_evalSumKeysJoin) {
+        keys.rotations.insert(entry.first);
+      }
+    }
+    keys.cyclotomicOrder = m_serverCC->GetCyclotomicOrder();
+    keys.maxLevel = graphMaxLevel;
+
+    if (error.empty() &&
+        ValidateGraph(graph, [this](uint32_t h) { return LookupHandle(h); },
+                      keys, error)) {
+      std::scoped_lock lock(m_storeMutex);
+      for (auto& out : graph.outputs) {
+        if (resultStore.count(out.handle)) {
+          error = "handle " + std::to_string(out.handle) + " already in use";
+        }
+      }
+      if (error.empty()) {
+        for (auto& out : graph.outputs) {
+          resultStore[out.handle];  // pending
+        }
+      }
+    }
+
+    olc::net::message<ThreshMsgTypes> reply;
+    if (!error.empty()) {
+      std::cout << "[SERVER] rejecting graph from [" << client->GetID()
+                << "]: " << error << "\n";
+      // the output handles stay free, a later graph may still claim them
+      reply.header.id = ThreshMsgTypes::RejectGraph;
+      reply << error;
+      client->Send(reply);
+      return;
+    }
+
+    InsertMultKeyIfChanged();
+    InsertSumKeyIfChanged();
+    InsertRotationKeysIfChanged();
+
+    vector<CT> inputs(graph.nodes.size());
+    for (size_t i = 0; i < graph.nodes.size(); i++) {
+      if (graph.nodes[i].op == GraphOp::Input) {
+        inputs[i] = LookupHandle(graph.nodes[i].param);
+      }
+    }
+    auto run = std::make_shared<GraphRun>(
+        m_serverCC, std::move(graph), std::move(inputs), batchSize,
+        m_evalKeyMutex, [this](GraphRun& done) { StoreGraphResults(done); });
+    run->Start(m_pool);
+
+    reply.header.id = ThreshMsgTypes::AckSubmitGraph;
+    client->Send(reply);
+  }
+
+  // called on a pool thread when a graph has finished
+  void StoreGraphResults(GraphRun& run) {
+    TimeVar t;
+    TIC(t);
+    for (auto& out : run.Graph().outputs) {
+      const CT& ct = run.Value(out.node);
+      StoreResult(out.handle, ct, ct ? "" : run.Error());
+    }
+    PROFILELOG("[SERVER] graph of " << run.Graph().nodes.size()
+                                    << " nodes done, storing took "
+                                    << TOC_MS(t) << "msec.");
+  }
+
+  // ct is nullptr (and error set) if the result could not be computed
+  void StoreResult(uint32_t handle, const CT& ct, const string& error) {
+    std::string bytes;
+    if (ct) {
+      std::ostringstream os;
+      Serial::Serialize(ct, os, SerType::BINARY);
+      bytes = os.str();
+    }
+    std::scoped_lock lock(m_storeMutex);
+    GraphResult& result = resultStore[handle];
+    result.ct = ct;
+    result.bytes = std::move(bytes);
+    result.error = error;
+    result.ready = true;
+  }
+
+  void SendClientResult(
+      std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client,
+      uint32_t handle) {
+    olc::net::message<ThreshMsgTypes> msg;
+    msg.header.SubType_ID = handle;
+    {
+      std::scoped_lock lock(m_storeMutex);
+      auto it = resultStore.find(handle);
+      if (it == resultStore.end() || !it->second.ready) {
+        msg.header.id = ThreshMsgTypes::NackResult;
+      } else if (!it->second.ct) {
+        msg.header.id = ThreshMsgTypes::FailedResult;
+        msg << it->second.error;
+      } else {
+        msg.header.id = ThreshMsgTypes::SendResult;
+        uint64_t len = it->second.bytes.size();
+        msg << len;
+        msg << it->second.bytes;
+      }
+    }
+    client->Send(msg);
+  }
+
+  // an uploaded ciphertext or a finished graph result, nullptr if none
+  CT LookupHandle(uint32_t handle) {
+    if (handle < kFirstResultHandle) {
+      return handle < B_CipherTexts.size() ? B_CipherTexts[handle] : CT();
+    }
+    std::scoped_lock lock(m_storeMutex);
+    auto it = resultStore.find(handle);
+    return it != resultStore.end() && it->second.ready ? it->second.ct : CT();
+  }
+
+  bool ResultReady(uint32_t handle) {
+    return handle >= kFirstResultHandle && LookupHandle(handle) != nullptr;
   }
 
   void incrementNumClients(void){
@@ -1354,6 +2310,23 @@ private:
 
   // evaluation keys for vector sum
   std::shared_ptr<std::map<usint, EvalKey>> A_evalSumKeys, B_evalSumKeysJoin;
+  // entries of the eval sum keys still arriving, per connection ID and
+  // EvalSumKeySet, and the connection whose entries of a set are passed on
+  std::map<std::pair<uint32_t, unsigned int>, std::map<usint, EvalKey>>
+      streamedSumKeys;
+  std::map<unsigned int, uint32_t> sumKeySource;
+  // parties that get the entries of each EvalSumKeySet as they arrive
+  std::map<unsigned int,
+           vector<std::shared_ptr<olc::net::connection<ThreshMsgTypes>>>>
+      sumKeyWaiting;
+
+  // parties of the two party ceremony by CeremonyRole and the keys already
+  // pushed to each
+  struct CeremonyParty {
+    std::shared_ptr<olc::net::connection<ThreshMsgTypes>> client;
+    std::set<uint32_t> pushed;
+  };
+  std::map<unsigned int, CeremonyParty> ceremony;
 
   // ciphertexts from Bob and flags for receiving the ciphertexts
   vector<CT> B_CipherTexts;
@@ -1362,12 +2335,103 @@ private:
   // evaluation ciphertexts if the server does the computation
   CT EvalAddCT, EvalMultCT, EvalSumCT;
 
+  // Versions of the inputs of the evaluations, bumped whenever a ciphertext
+  // arrives or a joint key is replaced
+  uint64_t ctVersion = 0, multKeyVersion = 0, sumKeyVersion = 0;
+  // key versions last inserted into m_serverCC
+  uint64_t insertedMultKeyVersion = 0, insertedSumKeyVersion = 0,
+           insertedRotKeyVersion = 0;
+
+  // An evaluation result with its serialized bytes, reused for every request
+  // until the versions of its inputs change
+  struct CachedResult {
+    CT ct;
+    std::string bytes;
+    uint64_t ctVersion = 0, keyVersion = 0;
+    bool valid = false;
+
+    bool IsCurrent(uint64_t cts, uint64_t key) const {
+      return valid && ctVersion == cts && keyVersion == key;
+    }
+
+    void Store(const CT& result, uint64_t cts, uint64_t key) {
+      std::ostringstream os;
+      Serial::Serialize(result, os, SerType::BINARY);
+      ct = result;
+      bytes = os.str();
+      ctVersion = cts;
+      keyVersion = key;
+      valid = true;
+    }
+  };
+  CachedResult EvalAddResult, EvalMultResult, EvalSumResult;
+
   CT Partial_LeadAdd, Partial_MainAdd, Partial_LeadMult, Partial_MainMult,
       Partial_LeadSum, Partial_MainSum;
   bool EvalAddCTDone = false, EvalMultCTDone = false, EvalSumCTDone = false;
   bool Partial_LeadAddRecd = false, Partial_MainAddRecd = false,
        Partial_LeadMultRecd = false, Partial_MainMultRecd = false;
   bool Partial_LeadSumRecd = false, Partial_MainSumRecd = false;
+
+  // server side fusion, connection IDs of the lead and main party (0 until
+  // they send their round 1 / round 2 public key) and the fused add, mult,
+  // sum values, cleared whenever a partial decryption arrives
+  bool fuseForLead = false, fuseForMain = false;
+  uint32_t leadID = 0, mainID = 0;
+  vector<vector<double>> fusedResults;
+
+  // N party ceremony, all vectors are indexed by party
+  usint numParties;                   // 0 if the ceremony is disabled
+  vector<std::shared_ptr<olc::net::connection<ThreshMsgTypes>>> parties;
+  usint keyGenDispatched = 0;  // # of key generation steps sent
+  usint keyGenRecd = 0;        // # of key generation steps returned
+  // party 0's keys, serialized once for all other parties
+  olc::net::message<ThreshMsgTypes> leadKeysMsg;
+  // contribution of each party, and their sums
+  vector<PublicKey> partyPubKeys;
+  vector<EvalKey> partyEvalMultKeys;
+  vector<std::shared_ptr<std::map<usint, EvalKey>>> partyEvalSumKeys;
+  PublicKey jointPubKey;
+  EvalKey jointEvalMultKey;
+  std::shared_ptr<std::map<usint, EvalKey>> jointEvalSumKeys;
+  bool multKeyDispatched = false;
+  vector<EvalKey> multKeyShares;
+  usint multKeySharesRecd = 0;
+  bool ceremonyDone = false;
+  // partial decryptions and, with combinePartials, their sum per
+  // PartialKind; partialVersion is bumped whenever a share arrives
+  std::map<unsigned int, vector<CT>> partialDecrypts;
+  bool combinePartials = false;
+  uint64_t partialVersion = 0;
+  std::map<unsigned int, CachedResult> combinedDecrypts;
+
+  // results of computation graphs by handle, written by the pool threads
+  struct GraphResult {
+    CT ct;              // nullptr if the graph failed
+    std::string bytes;  // ct serialized once for every request
+    std::string error;
+    bool ready = false;
+  };
+  std::mutex m_storeMutex;
+  std::map<uint32_t, GraphResult> resultStore;
+  // the eval keys live in static maps of the context, graphs use them
+  // shared while the message loop inserts new ones exclusively
+  std::shared_mutex m_evalKeyMutex;
+  usint graphMaxLevel = 0;  // # of rescales the moduli allow
+
+  // streamed upload in progress, see RecvCTBatchBegin()
+  static const uint32_t kMaxBatchCTs = 1 << 16;  // per batch
+  struct CTBatch {
+    uint32_t expected = 0, recd = 0, handle = 0;
+    vector<bool> seen;  // by sequence number
+    CT sum;             // running sum of the batch so far
+    TimeVar timer;
+  };
+  std::map<uint32_t, CTBatch> batches;  // by connection ID
+
+  // runs the tree aggregation and the computation graphs
+  boost::asio::thread_pool m_pool{
+      std::max(1u, std::thread::hardware_concurrency())};
 };
 
 #endif  // THRESH_SERVER_H
@@ -0,0 +1,75 @@
+// @file thresh_tree.h - balanced tree aggregation for the threshold server
+// @author TPOC: contact@palisade-crypto.org
+//
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef THRESH_TREE_H
+#define THRESH_TREE_H
+
+#include <future>
+#include <memory>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+/**
+ * Combine items with an associative operation as a balanced binary tree.
+ * Each level of the tree is combined in parallel on the pool, so N items
+ * take ceil(log2 N) rounds instead of N-1. The order of the items is kept,
+ * the operation need not be commutative.
+ * Must not be called from a thread of the pool itself.
+ * @param pool - thread pool to run the combine steps on
+ * @param items - items to combine, returns T() if empty
+ * @param combine - T(const T&, const T&), exceptions are passed on
+ */
+template <typename T, typename Combine>
+T TreeReduce(boost::asio::thread_pool& pool, std::vector<T> items,
+             Combine combine) {
+  if (items.empty()) return T();
+
+  while (items.size() > 1) {
+    std::vector<std::future<T>> level;
+    for (size_t i = 0; i + 1 < items.size(); i += 2) {
+      auto task = std::make_shared<std::packaged_task<T()>>(
+          [&items, &combine, i] { return combine(items[i], items[i + 1]); });
+      level.push_back(task->get_future());
+      boost::asio::post(pool, [task] { (*task)(); });
+    }
+
+    // wait for the whole level before get() can throw, the tasks refer
+    // to items
+    for (auto& f : level) {
+      f.wait();
+    }
+    std::vector<T> next;
+    for (auto& f : level) {
+      next.push_back(f.get());
+    }
+    if (items.size() % 2) {
+      next.push_back(items.back());  // odd one out moves up a level
+    }
+    items = std::move(next);
+  }
+  return items[0];
+}
+
+#endif  // THRESH_TREE_H
@@ -36,6 +36,7 @@
 #include "utils/serial.h"
 #include <iostream>
 #include <fstream>
+#include <set>
 #include <olc_net.h>
 #include <boost/interprocess/streams/bufferstream.hpp>  // to convert between Serialize and msg
 
@@ -143,6 +144,49 @@ enum class ThreshMsgTypes : uint32_t {
   SendDecryptMainSum,
   SendDecryptLeadSum,
   DisconnectClient,
+  // N party ceremony (thresh2_party), see ThreshServer::ScheduleCeremony()
+  RegisterParty,
+  AssignParty,
+  RejectParty,
+  RunKeyGenStep,
+  SendKeyGenStep,
+  AckKeyGenStep,
+  RunMultKeyStep,
+  SendMultKeyStep,
+  AckMultKeyStep,
+  CeremonyComplete,
+  SendPartialDecrypt,
+  AckPartialDecrypt,
+  RequestPartialDecrypts,
+  SendPartialDecrypts,
+  NackPartialDecrypts,
+  // server side fusion (-F)
+  RequestFusedResults,
+  SendFusedResults,
+  NackFusedResults,
+  DenyFusedResults,
+  // computation graphs (thresh_graph.h)
+  SubmitGraph,
+  AckSubmitGraph,
+  RejectGraph,
+  RequestResult,
+  SendResult,
+  NackResult,
+  FailedResult,
+  // streamed upload of any number of ciphertexts
+  BeginCTBatch,
+  SendBatchCT,
+  AckCTBatch,
+  NackCTBatch,
+  // eval sum keys sent one index at a time (thresh_keys.h)
+  SendEvalSumKeyEntry,
+  EndEvalSumKeys,
+  // two party ceremony, the server pushes each key as soon as it has it
+  JoinCeremony,
+  PushKeys,
+  // the server could not read a message, header.SubType_ID is its id and
+  // the body the reason
+  NackMessage,
 };
 
 vector<string> ThreshMsgNames{
@@ -233,14 +277,86 @@ vector<string> ThreshMsgNames{
     "SendDecryptMainSum",
     "SendDecryptLeadSum",
 	"DisconnectClient",
+    "RegisterParty",
+    "AssignParty",
+    "RejectParty",
+    "RunKeyGenStep",
+    "SendKeyGenStep",
+    "AckKeyGenStep",
+    "RunMultKeyStep",
+    "SendMultKeyStep",
+    "AckMultKeyStep",
+    "CeremonyComplete",
+    "SendPartialDecrypt",
+    "AckPartialDecrypt",
+    "RequestPartialDecrypts",
+    "SendPartialDecrypts",
+    "NackPartialDecrypts",
+    "RequestFusedResults",
+    "SendFusedResults",
+    "NackFusedResults",
+    "DenyFusedResults",
+    "SubmitGraph",
+    "AckSubmitGraph",
+    "RejectGraph",
+    "RequestResult",
+    "SendResult",
+    "NackResult",
+    "FailedResult",
+    "BeginCTBatch",
+    "SendBatchCT",
+    "AckCTBatch",
+    "NackCTBatch",
+    "SendEvalSumKeyEntry",
+    "EndEvalSumKeys",
+    "JoinCeremony",
+    "PushKeys",
+    "NackMessage",
 };
 
+// Result kinds of the N party decryption, carried in header.SubType_ID of
+// the *PartialDecrypt* messages. The handle of a graph result (see
+// kFirstResultHandle in thresh_graph.h) can be used as a kind as well.
+enum PartialKind : unsigned int {
+  PartialAdd = 0,
+  PartialMult = 1,
+  PartialSum = 2,
+};
+
+// Which eval sum keys a SendEvalSumKeyEntry or EndEvalSumKeys is for,
+// carried in header.SubType_ID
+enum EvalSumKeySet : unsigned int {
+  Rnd1EvalSumKeys = 1,      // Alice's keys
+  Rnd2EvalSumKeysJoin = 2,  // joint keys made by Bob
+};
+
+// Role a client takes in the two party ceremony, carried in
+// header.SubType_ID of JoinCeremony
+enum CeremonyRole : unsigned int {
+  CeremonyLead = 0,  // Alice
+  CeremonyMain = 1,  // Bob
+};
+
+// Keys the server pushes to the parties of the two party ceremony
+enum CeremonyArtifact : uint32_t {
+  CeremonyRnd1PubKey = 0,         // Alice -> Bob
+  CeremonyRnd1EvalMultKey = 1,    // Alice -> Bob
+  CeremonyRnd2SharedKey = 2,      // Bob -> Alice
+  CeremonyRnd2EvalMultAB = 3,     // Bob -> Alice
+  CeremonyRnd2EvalMultBAB = 4,    // Bob -> Alice
+  CeremonyRnd3EvalMultFinal = 5,  // Alice -> Bob
+};
+
+// Name of a message ID, or its number if the ID is not one of ours, as
+// the header of a message from a peer can hold anything
+string ThreshMsgName(uint32_t id) {
+  return id < ThreshMsgNames.size() ? ThreshMsgNames[id] : std::to_string(id);
+}
+
 // Code to convert from enum class to underlying int for reference.
 std::ostream& operator<<(std::ostream& os, const ThreshMsgTypes& obj) {
   os << static_cast<std::underlying_type<ThreshMsgTypes>::type>(obj);
-  os << ": "
-     << ThreshMsgNames[static_cast<std::underlying_type<ThreshMsgTypes>::type>(
-            obj)];
+  os << ": " << ThreshMsgName(static_cast<uint32_t>(obj));
   return os;
 }
 
@@ -253,4 +369,190 @@ void nap(const int& ms = 500) {
   std::this_thread::sleep_for(timespan);
 }
 
+/**
+ * Append a serialized PALISADE object to a message body. Several objects can
+ * be appended to one message, each is written as a 64 bit length followed by
+ * its bytes so that SerialReader can take them off front to back.
+ * @param msg - message to append to
+ * @param obj - object to serialize
+ */
+template <typename T>
+void AppendSerial(olc::net::message<ThreshMsgTypes>& msg, const T& obj) {
+  std::ostringstream os;
+  Serial::Serialize(obj, os, SerType::BINARY);
+  uint64_t len = os.str().size();
+  msg << len;
+  msg << os.str();
+}
+
+/**
+ * Append a vector of trivially copyable values (e.g. decrypted CKKS values)
+ * to a message body in the same framing as AppendSerial, read back with
+ * SerialReader::NextRaw
+ * @param msg - message to append to
+ * @param values - values to append
+ */
+template <typename T>
+void AppendRaw(olc::net::message<ThreshMsgTypes>& msg,
+               const std::vector<T>& values) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "AppendRaw needs trivially copyable values");
+  uint64_t len = values.size() * sizeof(T);
+  msg << len;
+  size_t i = msg.body.size();
+  msg.body.resize(i + len);
+  std::memcpy(msg.body.data() + i, values.data(), len);
+  msg.header.size = msg.size();
+}
+
+void AppendValues(olc::net::message<ThreshMsgTypes>& msg,
+                  const std::vector<double>& values) {
+  AppendRaw(msg, values);
+}
+
+// Reads the objects written by AppendSerial() in the order they were written
+class SerialReader {
+ public:
+  explicit SerialReader(const olc::net::message<ThreshMsgTypes>& msg)
+      : body(msg.body) {}
+
+  // true if there is another object in the body
+  bool More(void) const { return pos + sizeof(uint64_t) <= body.size(); }
+
+  template <typename T>
+  void Next(T& obj) {
+    uint64_t len = NextLength();
+    std::istringstream is(string(body.begin() + pos, body.begin() + pos + len));
+    Serial::Deserialize(obj, is, SerType::BINARY);
+    pos += len;
+  }
+
+  template <typename T>
+  void NextRaw(std::vector<T>& values) {
+    uint64_t len = NextLength();
+    if (len % sizeof(T) != 0)
+      throw std::runtime_error("SerialReader: bad raw object size");
+    values.resize(len / sizeof(T));
+    std::memcpy(values.data(), body.data() + pos, len);
+    pos += len;
+  }
+
+  void NextValues(std::vector<double>& values) { NextRaw(values); }
+
+ private:
+  uint64_t NextLength(void) {
+    uint64_t len;
+    if (!More()) throw std::runtime_error("SerialReader: body exhausted");
+    std::memcpy(&len, body.data() + pos, sizeof(len));
+    pos += sizeof(len);
+    if (len > body.size() - pos)
+      throw std::runtime_error("SerialReader: truncated object");
+    return len;
+  }
+
+  const std::vector<uint8_t>& body;
+  size_t pos = 0;
+};
+
+// One entry of an eval sum key map, sent by itself so that the receiver can
+// use it before the rest of the map is there. The same message goes from
+// the clients to the server and from the server to the clients.
+olc::net::message<ThreshMsgTypes> EvalSumKeyEntryMsg(EvalSumKeySet set,
+                                                     usint index,
+                                                     const EvalKey& key) {
+  olc::net::message<ThreshMsgTypes> msg;
+  msg.header.id = ThreshMsgTypes::SendEvalSumKeyEntry;
+  msg.header.SubType_ID = set;
+  AppendSerial(msg, key);
+  msg << index;
+  return msg;
+}
+
+void ReadEvalSumKeyEntry(olc::net::message<ThreshMsgTypes>& msg,
+                         usint& index, EvalKey& key) {
+  if (msg.body.size() < sizeof(index)) {
+    throw std::runtime_error("malformed eval sum key entry");
+  }
+  msg >> index;
+  SerialReader reader(msg);
+  reader.Next(key);
+}
+
+// follows the last entry of a map, count is the number of entries
+olc::net::message<ThreshMsgTypes> EndEvalSumKeysMsg(EvalSumKeySet set,
+                                                    uint32_t count) {
+  olc::net::message<ThreshMsgTypes> msg;
+  msg.header.id = ThreshMsgTypes::EndEvalSumKeys;
+  msg.header.SubType_ID = set;
+  msg << count;
+  return msg;
+}
+
+// The keys of one or more PushKeys messages, have holds the artifacts
+// received so far
+struct CeremonyKeys {
+  PublicKey rnd1PubKey;
+  PublicKey rnd2SharedKey;
+  EvalKey rnd1EvalMultKey;
+  EvalKey rnd2EvalMultAB;
+  EvalKey rnd2EvalMultBAB;
+  EvalKey rnd3EvalMultFinal;
+  std::set<uint32_t> have;
+
+  bool Has(std::initializer_list<CeremonyArtifact> artifacts) const {
+    for (auto artifact : artifacts) {
+      if (!have.count(artifact)) return false;
+    }
+    return true;
+  }
+};
+
+// A PushKeys body is the list of artifact ids (AppendRaw) followed by the
+// artifacts in that order (AppendSerial). Returns the ids that were read.
+vector<uint32_t> ReadPushKeys(const olc::net::message<ThreshMsgTypes>& msg,
+                              CeremonyKeys& keys) {
+  SerialReader reader(msg);
+  vector<uint32_t> ids;
+  reader.NextRaw(ids);
+  for (auto id : ids) {
+    switch (id) {
+      case CeremonyRnd1PubKey:
+        reader.Next(keys.rnd1PubKey);
+        break;
+      case CeremonyRnd1EvalMultKey:
+        reader.Next(keys.rnd1EvalMultKey);
+        break;
+      case CeremonyRnd2SharedKey:
+        reader.Next(keys.rnd2SharedKey);
+        break;
+      case CeremonyRnd2EvalMultAB:
+        reader.Next(keys.rnd2EvalMultAB);
+        break;
+      case CeremonyRnd2EvalMultBAB:
+        reader.Next(keys.rnd2EvalMultBAB);
+        break;
+      case CeremonyRnd3EvalMultFinal:
+        reader.Next(keys.rnd3EvalMultFinal);
+        break;
+      default:
+        throw std::runtime_error("ReadPushKeys: unknown artifact " +
+                                 std::to_string(id));
+    }
+    keys.have.insert(id);
+  }
+  return ids;
+}
+
+/**
+ * Start writing trace events for this process (see olc_net/net_trace.h).
+ * The trace files of all parties are combined with bin/trace_merge.
+ * @param party - name of this party in the merged trace
+ * @param filename - trace file to write
+ * @param root - true for the server, which mints the trace ID
+ */
+void OpenTrace(const string& party, const string& filename, bool root = false) {
+  olc::net::tracer::Get().SetMessageNamer(ThreshMsgName);
+  olc::net::tracer::Get().Open(party, filename, root);
+}
+
 #endif  // THRESH_UTILS_H
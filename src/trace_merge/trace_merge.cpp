@@ -0,0 +1,527 @@
+// @file trace_merge.cpp - merges the per-process trace files written by
+//    olc::net::tracer (src/olc_net/net_trace.h) into one Chrome/Perfetto
+//    trace, and reports the critical path and idle time of every party.
+//
+// Usage:
+//    trace_merge -o ceremony.json server.trace alice.trace bob.trace
+//
+// Load the output in chrome://tracing or https://ui.perfetto.dev
+//
+// @copyright Copyright (c) 2020, Duality Technologies Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. THIS SOFTWARE IS
+// PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+// EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// one line of a trace file. All fields are kept as text, they are converted
+// on use.
+using Fields = std::map<std::string, std::string>;
+
+// A span recorded by tracer::BeginSpan()/EndSpan()
+struct Span {
+  std::string party, name;
+  uint32_t tid = 0;
+  int64_t begin = 0, end = -1;
+  uint64_t id = 0, parent = 0;
+};
+
+// A message, pieced together from the "send" event on one party and the
+// "recv" event on another
+struct Msg {
+  std::string name, fromParty, toParty;
+  uint32_t fromTid = 0, toTid = 0;
+  int64_t sendTs = -1;  // Send() called (sender clock)
+  int64_t wireTs = -1;  // header went on the wire (sender clock)
+  int64_t recvTs = -1;  // body fully read (receiver clock)
+  uint64_t parent = 0;  // span that sent it
+  uint64_t size = 0;
+};
+
+// a piece of the critical path
+struct Segment {
+  std::string kind;  // compute, wire, wait
+  std::string party, name;
+  int64_t begin, end;
+};
+
+/**
+ * parse one flat JSON object as written by olc::net::tracer
+ * @param line - the text of the object
+ * @param fields - output: key -> value text (quotes removed)
+ * @return true if the line held an object
+ */
+bool parseLine(const std::string &line, Fields &fields) {
+  fields.clear();
+  size_t i = line.find('{');
+  if (i == std::string::npos) return false;
+  i++;
+  while (i < line.size()) {
+    size_t k0 = line.find('"', i);
+    if (k0 == std::string::npos) break;
+    size_t k1 = line.find('"', k0 + 1);
+    if (k1 == std::string::npos) return false;
+    std::string key = line.substr(k0 + 1, k1 - k0 - 1);
+    size_t c = line.find(':', k1);
+    if (c == std::string::npos) return false;
+    size_t v0 = c + 1;
+    std::string value;
+    if (line[v0] == '"') {
+      size_t v1 = line.find('"', v0 + 1);
+      if (v1 == std::string::npos) return false;
+      value = line.substr(v0 + 1, v1 - v0 - 1);
+      i = v1 + 1;
+    } else {
+      size_t v1 = line.find_first_of(",}", v0);
+      if (v1 == std::string::npos) return false;
+      value = line.substr(v0, v1 - v0);
+      i = v1;
+    }
+    fields[key] = value;
+    i = line.find_first_of(",}", i);
+    if (i == std::string::npos || line[i] == '}') break;
+    i++;
+  }
+  return !fields.empty();
+}
+
+uint64_t hexField(const Fields &f, const std::string &key) {
+  auto it = f.find(key);
+  return it == f.end() ? 0 : std::stoull(it->second, nullptr, 16);
+}
+
+int64_t numField(const Fields &f, const std::string &key) {
+  auto it = f.find(key);
+  return it == f.end() ? 0 : std::stoll(it->second);
+}
+
+std::string strField(const Fields &f, const std::string &key) {
+  auto it = f.find(key);
+  return it == f.end() ? std::string() : it->second;
+}
+
+// escape a name for the JSON output
+std::string jsonString(const std::string &s) {
+  std::string out("\"");
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+/**
+ * Trace holds every event of the run, with the clocks of all parties mapped
+ * onto the clock of a single reference party
+ */
+class Trace {
+ public:
+  bool Load(const std::string &filename) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+      std::cerr << "cannot open " << filename << std::endl;
+      return false;
+    }
+    std::string line;
+    Fields f;
+    while (std::getline(in, line)) {
+      if (!parseLine(line, f)) continue;
+      std::string ev = strField(f, "ev");
+      std::string party = strField(f, "party");
+      AddParty(party);
+      m_traceIDs.insert(strField(f, "trace"));
+      int64_t ts = numField(f, "ts");
+      uint32_t tid = numField(f, "tid");
+      m_lastTs[party] = std::max(m_lastTs[party], ts);
+
+      if (ev == "B") {
+        Span &s = m_spans[hexField(f, "span")];
+        s.id = hexField(f, "span");
+        s.parent = hexField(f, "parent");
+        s.party = party;
+        s.tid = tid;
+        s.name = strField(f, "name");
+        s.begin = ts;
+      } else if (ev == "E") {
+        m_spans[hexField(f, "span")].end = ts;
+      } else if (ev == "send") {
+        Msg &m = m_msgs[hexField(f, "span")];
+        m.name = strField(f, "name");
+        m.fromParty = party;
+        m.fromTid = tid;
+        m.sendTs = ts;
+        m.parent = hexField(f, "parent");
+        m.size = numField(f, "size");
+      } else if (ev == "recv") {
+        Msg &m = m_msgs[hexField(f, "span")];
+        m.name = strField(f, "name");
+        m.toParty = party;
+        m.toTid = tid;
+        m.recvTs = ts;
+        m.wireTs = numField(f, "send_ts");
+        m.size = numField(f, "size");
+      }
+    }
+    return true;
+  }
+
+  // Line up the party clocks: for every pair of parties exchanging messages
+  // in both directions the offset is half the difference of the minimum
+  // one-way delays (as NTP does). Parties only heard from in one direction
+  // are shifted just far enough that no message arrives before it was sent.
+  void AlignClocks() {
+    // minimum (recv - wire) per ordered pair of parties
+    std::map<std::pair<std::string, std::string>, int64_t> minDelay;
+    std::map<std::string, size_t> msgCount;
+    for (auto &kv : m_msgs) {
+      const Msg &m = kv.second;
+      if (m.recvTs < 0 || m.wireTs <= 0 || m.fromParty.empty()) continue;
+      if (m.fromParty == m.toParty) continue;
+      auto key = std::make_pair(m.fromParty, m.toParty);
+      int64_t d = m.recvTs - m.wireTs;
+      auto it = minDelay.find(key);
+      if (it == minDelay.end() || d < it->second) minDelay[key] = d;
+      msgCount[m.fromParty]++;
+      msgCount[m.toParty]++;
+    }
+    if (msgCount.empty()) return;
+
+    // the party that talks the most (the server in a star) is the reference
+    std::string ref = std::max_element(msgCount.begin(), msgCount.end(),
+                                       [](const auto &a, const auto &b) {
+                                         return a.second < b.second;
+                                       })
+                          ->first;
+    std::vector<std::string> todo{ref};
+    std::set<std::string> done{ref};
+    m_offset[ref] = 0;
+    while (!todo.empty()) {
+      std::string p = todo.back();
+      todo.pop_back();
+      for (auto &q : m_parties) {
+        if (done.count(q)) continue;
+        auto pq = minDelay.find({p, q});
+        auto qp = minDelay.find({q, p});
+        if (pq == minDelay.end() && qp == minDelay.end()) continue;
+        // offset = clock(q) - clock(p)
+        int64_t offset = 0;
+        if (pq != minDelay.end() && qp != minDelay.end())
+          offset = (pq->second - qp->second) / 2;
+        else if (pq != minDelay.end())
+          offset = std::min<int64_t>(0, pq->second);
+        else
+          offset = std::max<int64_t>(0, -qp->second);
+        m_offset[q] = m_offset[p] + offset;
+        done.insert(q);
+        todo.push_back(q);
+      }
+    }
+    for (auto &p : m_parties)
+      std::cout << "clock offset " << std::setw(12) << p << ": "
+                << m_offset[p] << " usec" << std::endl;
+
+    for (auto &kv : m_spans) {
+      kv.second.begin -= m_offset[kv.second.party];
+      if (kv.second.end >= 0) kv.second.end -= m_offset[kv.second.party];
+    }
+    for (auto &kv : m_msgs) {
+      Msg &m = kv.second;
+      if (m.sendTs >= 0) m.sendTs -= m_offset[m.fromParty];
+      if (m.wireTs > 0) m.wireTs -= m_offset[m.fromParty];
+      if (m.recvTs >= 0) m.recvTs -= m_offset[m.toParty];
+    }
+    for (auto &kv : m_lastTs) kv.second -= m_offset[kv.first];
+  }
+
+  // Close spans left open by a process that exited inside them, and find the
+  // top level spans of every party: those not nested inside another span of
+  // the same party.
+  void Prepare() {
+    for (auto &kv : m_spans) {
+      Span &s = kv.second;
+      if (s.end < 0) s.end = m_lastTs[s.party];
+      auto parent = m_spans.find(s.parent);
+      if (parent == m_spans.end() || parent->second.party != s.party)
+        m_top[s.party].push_back(&s);
+    }
+    for (auto &kv : m_top)
+      std::sort(kv.second.begin(), kv.second.end(),
+                [](const Span *a, const Span *b) { return a->begin < b->begin; });
+    m_start = std::numeric_limits<int64_t>::max();
+    for (auto &kv : m_spans) m_start = std::min(m_start, kv.second.begin);
+    for (auto &kv : m_msgs)
+      if (kv.second.sendTs >= 0) m_start = std::min(m_start, kv.second.sendTs);
+    if (m_start == std::numeric_limits<int64_t>::max()) m_start = 0;
+  }
+
+  // Walk backwards from the span that finishes last. Each span was started
+  // either by a message (its parent is a message) or by the work before it
+  // on the same party. Whichever of the two became ready last is what the
+  // span was waiting for, and is the next step back along the critical path.
+  void CriticalPath() {
+    const Span *cur = nullptr;
+    for (auto &kv : m_top)
+      for (const Span *s : kv.second)
+        if (!cur || s->end > cur->end) cur = s;
+    if (!cur) return;
+    int64_t cut = cur->end;
+    std::set<uint64_t> visited;
+
+    while (cur && !visited.count(cur->id)) {
+      visited.insert(cur->id);
+      m_path.push_back({"compute", cur->party, cur->name, cur->begin, cut});
+
+      // last top level span of this party finished before cur started
+      const Span *local = nullptr;
+      for (const Span *s : m_top[cur->party])
+        if (s != cur && s->end <= cur->begin && (!local || s->end > local->end))
+          local = s;
+
+      // the message that triggered cur, if any
+      auto it = m_msgs.find(cur->parent);
+      const Msg *msg = (it != m_msgs.end() && it->second.recvTs >= 0 &&
+                        it->second.sendTs >= 0)
+                           ? &it->second
+                           : nullptr;
+
+      if (msg && (!local || msg->recvTs >= local->end)) {
+        m_path.push_back({"wait", cur->party, "handle " + msg->name,
+                          msg->recvTs, cur->begin});
+        int64_t wire = msg->wireTs > 0 ? msg->wireTs : msg->sendTs;
+        m_path.push_back({"wire", msg->fromParty + "->" + msg->toParty,
+                          msg->name, wire, msg->recvTs});
+        m_path.push_back(
+            {"wait", msg->fromParty, "queue " + msg->name, msg->sendTs, wire});
+        cut = msg->sendTs;
+        cur = TopLevelOf(msg->parent);
+      } else if (local) {
+        m_path.push_back({"wait", cur->party, "idle", local->end, cur->begin});
+        cut = local->end;
+        cur = local;
+      } else {
+        cur = nullptr;
+      }
+    }
+    std::reverse(m_path.begin(), m_path.end());
+  }
+
+  void Report(std::ostream &os) {
+    os << std::fixed << std::setprecision(3);
+    os << "trace ids:";
+    for (auto &t : m_traceIDs) os << " " << t;
+    os << std::endl << std::endl;
+
+    os << std::setw(16) << "party" << std::setw(14) << "wall (ms)"
+       << std::setw(14) << "busy (ms)" << std::setw(14) << "idle (ms)"
+       << std::setw(16) << "on path (ms)" << std::endl;
+    for (auto &p : m_parties) {
+      auto &top = m_top[p];
+      if (top.empty()) continue;
+      int64_t first = top.front()->begin, last = 0, busy = 0;
+      int64_t runEnd = std::numeric_limits<int64_t>::min();
+      for (const Span *s : top) {  // union of the top level spans
+        last = std::max(last, s->end);
+        int64_t b = std::max(s->begin, runEnd);
+        if (s->end > b) busy += s->end - b;
+        runEnd = std::max(runEnd, s->end);
+      }
+      int64_t onPath = 0;
+      for (auto &seg : m_path)
+        if (seg.kind == "compute" && seg.party == p)
+          onPath += seg.end - seg.begin;
+      os << std::setw(16) << p << std::setw(14) << (last - first) / 1000.0
+         << std::setw(14) << busy / 1000.0 << std::setw(14)
+         << (last - first - busy) / 1000.0 << std::setw(16) << onPath / 1000.0
+         << std::endl;
+    }
+
+    std::map<std::string, int64_t> byKind;
+    for (auto &seg : m_path) byKind[seg.kind] += seg.end - seg.begin;
+    int64_t total = m_path.empty() ? 0 : m_path.back().end - m_path.front().begin;
+    os << std::endl
+       << "critical path " << total / 1000.0 << " ms: compute "
+       << byKind["compute"] / 1000.0 << " ms, wire " << byKind["wire"] / 1000.0
+       << " ms, wait " << byKind["wait"] / 1000.0 << " ms" << std::endl;
+    for (auto &seg : m_path) {
+      if (seg.end <= seg.begin) continue;
+      os << "  " << std::setw(8) << seg.kind << std::setw(16) << seg.party
+         << std::setw(12) << (seg.end - seg.begin) / 1000.0 << " ms  "
+         << seg.name << std::endl;
+    }
+  }
+
+  // Chrome trace event format: one process per party (plus one for the
+  // critical path), complete ("X") events for spans and transfers, and flow
+  // arrows from each send to its receive.
+  void WriteChrome(std::ostream &os) {
+    std::vector<std::string> ev;
+    std::map<std::string, int> pid;
+    int n = 1;
+    for (auto &p : m_parties) {
+      pid[p] = n++;
+      ev.push_back("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" +
+                   std::to_string(pid[p]) + ",\"args\":{\"name\":" +
+                   jsonString(p) + "}}");
+    }
+    int pathPid = n;
+    ev.push_back("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" +
+                 std::to_string(pathPid) +
+                 ",\"args\":{\"name\":\"critical path\"}}");
+
+    auto complete = [&](int p, uint32_t tid, const std::string &name,
+                        const std::string &cat, int64_t b, int64_t e,
+                        const std::string &args) {
+      std::ostringstream o;
+      o << "{\"ph\":\"X\",\"pid\":" << p << ",\"tid\":" << tid
+        << ",\"name\":" << jsonString(name) << ",\"cat\":\"" << cat
+        << "\",\"ts\":" << b - m_start << ",\"dur\":" << std::max<int64_t>(e - b, 0)
+        << ",\"args\":{" << args << "}}";
+      ev.push_back(o.str());
+    };
+
+    for (auto &kv : m_spans) {
+      const Span &s = kv.second;
+      std::ostringstream args;
+      args << "\"span\":\"" << std::hex << s.id << "\",\"parent\":\"" << s.parent
+           << "\"";
+      complete(pid[s.party], s.tid, s.name, "span", s.begin, s.end, args.str());
+    }
+
+    for (auto &kv : m_msgs) {
+      const Msg &m = kv.second;
+      if (m.sendTs < 0 || m.recvTs < 0) continue;
+      int64_t wire = m.wireTs > 0 ? m.wireTs : m.sendTs;
+      complete(pid[m.toParty], m.toTid, "recv " + m.name, "net", wire, m.recvTs,
+               "\"bytes\":" + std::to_string(m.size) + ",\"from\":" +
+                   jsonString(m.fromParty));
+      std::ostringstream s, f;
+      s << "{\"ph\":\"s\",\"id\":\"" << std::hex << kv.first << std::dec
+        << "\",\"pid\":" << pid[m.fromParty] << ",\"tid\":" << m.fromTid
+        << ",\"ts\":" << m.sendTs - m_start << ",\"name\":" << jsonString(m.name)
+        << ",\"cat\":\"msg\"}";
+      f << "{\"ph\":\"f\",\"bp\":\"e\",\"id\":\"" << std::hex << kv.first
+        << std::dec << "\",\"pid\":" << pid[m.toParty] << ",\"tid\":" << m.toTid
+        << ",\"ts\":" << wire - m_start << ",\"name\":" << jsonString(m.name)
+        << ",\"cat\":\"msg\"}";
+      ev.push_back(s.str());
+      ev.push_back(f.str());
+    }
+
+    for (auto &seg : m_path) {
+      if (seg.end <= seg.begin) continue;
+      uint32_t track = seg.kind == "compute" ? 1 : seg.kind == "wire" ? 2 : 3;
+      complete(pathPid, track, seg.kind + ": " + seg.party + " " + seg.name,
+               seg.kind, seg.begin, seg.end, "");
+    }
+
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (size_t i = 0; i < ev.size(); i++)
+      os << ev[i] << (i + 1 < ev.size() ? ",\n" : "\n");
+    os << "]}\n";
+  }
+
+ private:
+  void AddParty(const std::string &party) {
+    if (std::find(m_parties.begin(), m_parties.end(), party) == m_parties.end())
+      m_parties.push_back(party);
+  }
+
+  const Span *TopLevelOf(uint64_t id) {
+    auto it = m_spans.find(id);
+    while (it != m_spans.end()) {
+      auto up = m_spans.find(it->second.parent);
+      if (up == m_spans.end() || up->second.party != it->second.party)
+        return &it->second;
+      it = up;
+    }
+    return nullptr;
+  }
+
+  std::vector<std::string> m_parties;
+  std::set<std::string> m_traceIDs;
+  std::map<uint64_t, Span> m_spans;
+  std::map<uint64_t, Msg> m_msgs;
+  std::map<std::string, int64_t> m_lastTs;
+  std::map<std::string, int64_t> m_offset;
+  std::map<std::string, std::vector<const Span *>> m_top;
+  std::vector<Segment> m_path;
+  int64_t m_start = 0;
+};
+
+int main(int argc, char *argv[]) {
+  int opt;
+  std::string outName("trace.json");
+  bool align = true;
+
+  while ((opt = getopt(argc, argv, "o:sh")) != -1) {
+    switch (opt) {
+      case 'o':
+        outName = optarg;
+        break;
+      case 's':
+        align = false;
+        break;
+      case 'h':
+      default: /* '?' */
+        std::cerr << "Usage: " << std::endl
+                  << "  trace_merge [-o out.json] [-s] file.trace ..."
+                  << std::endl
+                  << "arguments:" << std::endl
+                  << "  -o output Chrome/Perfetto trace (default trace.json)"
+                  << std::endl
+                  << "  -s all parties share one clock, do not align them"
+                  << std::endl
+                  << "  -h prints this message" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+  }
+  if (optind >= argc) {
+    std::cerr << "no trace files given, see -h" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  Trace trace;
+  for (int i = optind; i < argc; i++)
+    if (!trace.Load(argv[i])) std::exit(EXIT_FAILURE);
+
+  if (align) trace.AlignClocks();
+  trace.Prepare();
+  trace.CriticalPath();
+  trace.Report(std::cout);
+
+  std::ofstream out(outName);
+  if (!out.is_open()) {
+    std::cerr << "cannot write " << outName << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  trace.WriteChrome(out);
+  std::cout << std::endl << "wrote " << outName << std::endl;
+  return EXIT_SUCCESS;
+}